@@ -21,6 +21,10 @@
 #include <ctype.h>
 #include <string.h>
 
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
+
 #include "base64.h"
 
 static const gchar base64char[64] =
@@ -39,11 +43,163 @@ static const gchar base64val[128] = {
 
 #define BASE64VAL(c)	(isascii((guchar)c) ? base64val[(gint)(c)] : -1)
 
+#ifdef __SSE2__
+/* The SSE2 kernels handle 12 bytes <-> 16 characters at a time. SSE2
+   has no byte shuffle, so the 3-byte groups are spread to and packed
+   from 32-bit lanes with scalar code, and the character translation
+   and validation are done with compares. */
+
+#define SET8(x)	_mm_set1_epi8((gchar)(x))
+
+static gint base64_encode_sse2(gchar *out, const guchar *in, gint inlen)
+{
+	const guchar *inp = in;
+	__m128i v, idx, mask, res;
+	const __m128i m6 = _mm_set1_epi32(0x3f);
+
+	while (inlen >= 12) {
+		v = _mm_setr_epi32((inp[0] << 16) | (inp[1] << 8) | inp[2],
+				   (inp[3] << 16) | (inp[4] << 8) | inp[5],
+				   (inp[6] << 16) | (inp[7] << 8) | inp[8],
+				   (inp[9] << 16) | (inp[10] << 8) | inp[11]);
+
+		/* four 6-bit indices per lane, the first one in the lowest
+		   byte */
+		idx = _mm_and_si128(_mm_srli_epi32(v, 18), m6);
+		idx = _mm_or_si128(idx, _mm_slli_epi32
+				   (_mm_and_si128(_mm_srli_epi32(v, 12), m6),
+				    8));
+		idx = _mm_or_si128(idx, _mm_slli_epi32
+				   (_mm_and_si128(_mm_srli_epi32(v, 6), m6),
+				    16));
+		idx = _mm_or_si128(idx, _mm_slli_epi32
+				   (_mm_and_si128(v, m6), 24));
+
+		/* 'A' + idx, then adjust for a-z, 0-9, '+' and '/' */
+		res = _mm_add_epi8(idx, SET8('A'));
+		mask = _mm_cmpgt_epi8(idx, SET8(25));
+		res = _mm_add_epi8(res, _mm_and_si128(mask, SET8('a' - 'A' - 26)));
+		mask = _mm_cmpgt_epi8(idx, SET8(51));
+		res = _mm_add_epi8(res, _mm_and_si128(mask, SET8('0' - 'a' - 26)));
+		mask = _mm_cmpeq_epi8(idx, SET8(62));
+		res = _mm_add_epi8(res, _mm_and_si128(mask, SET8('+' - '0' - 10)));
+		mask = _mm_cmpeq_epi8(idx, SET8(63));
+		res = _mm_add_epi8(res, _mm_and_si128(mask, SET8('/' - '0' - 11)));
+
+		_mm_storeu_si128((__m128i *)out, res);
+
+		inp += 12;
+		inlen -= 12;
+		out += 16;
+	}
+
+	return inp - in;
+}
+
+#define IN_RANGE(c, lo, hi)				\
+	_mm_and_si128(_mm_cmpgt_epi8(c, SET8((lo) - 1)),	\
+		      _mm_cmplt_epi8(c, SET8((hi) + 1)))
+
+/* Decodes 16 characters. Returns FALSE without any output if they
+   include a non-base64 character or padding. */
+static gboolean base64_decode_sse2(guchar *out, const gchar *in)
+{
+	__m128i c, upper, lower, digit, plus, slash, valid, shift, v, w;
+	guint32 lane[4];
+	gint i;
+
+	c = _mm_loadu_si128((const __m128i *)in);
+
+	upper = IN_RANGE(c, 'A', 'Z');
+	lower = IN_RANGE(c, 'a', 'z');
+	digit = IN_RANGE(c, '0', '9');
+	plus = _mm_cmpeq_epi8(c, SET8('+'));
+	slash = _mm_cmpeq_epi8(c, SET8('/'));
+
+	valid = _mm_or_si128(_mm_or_si128(upper, lower),
+			     _mm_or_si128(digit, _mm_or_si128(plus, slash)));
+	if (_mm_movemask_epi8(valid) != 0xffff)
+		return FALSE;
+
+	shift = _mm_and_si128(upper, SET8(-'A'));
+	shift = _mm_or_si128(shift, _mm_and_si128(lower, SET8(26 - 'a')));
+	shift = _mm_or_si128(shift, _mm_and_si128(digit, SET8(52 - '0')));
+	shift = _mm_or_si128(shift, _mm_and_si128(plus, SET8(62 - '+')));
+	shift = _mm_or_si128(shift, _mm_and_si128(slash, SET8(63 - '/')));
+	v = _mm_add_epi8(c, shift);
+
+	/* join the four 6-bit values of each lane to 24 bits */
+	w = _mm_slli_epi32(_mm_and_si128(v, _mm_set1_epi32(0xff)), 18);
+	w = _mm_or_si128(w, _mm_slli_epi32(_mm_and_si128
+		(_mm_srli_epi32(v, 8), _mm_set1_epi32(0xff)), 12));
+	w = _mm_or_si128(w, _mm_slli_epi32(_mm_and_si128
+		(_mm_srli_epi32(v, 16), _mm_set1_epi32(0xff)), 6));
+	w = _mm_or_si128(w, _mm_srli_epi32(v, 24));
+
+	_mm_storeu_si128((__m128i *)lane, w);
+	for (i = 0; i < 4; i++) {
+		*out++ = (lane[i] >> 16) & 0xff;
+		*out++ = (lane[i] >> 8) & 0xff;
+		*out++ = lane[i] & 0xff;
+	}
+
+	return TRUE;
+}
+
+#undef IN_RANGE
+#undef SET8
+#endif /* __SSE2__ */
+
+/* Decodes as many complete quanta without padding as possible, and
+   stops before the first one containing any other character. */
+static gint base64_decode_quanta(guchar *out, const gchar *in, gint inlen,
+				 gint *consumed)
+{
+	const gchar *inp = in;
+	guchar *outp = out;
+	gint v0, v1, v2, v3;
+
+#ifdef __SSE2__
+	while (inlen >= 16 && base64_decode_sse2(outp, inp)) {
+		inp += 16;
+		inlen -= 16;
+		outp += 12;
+	}
+#endif
+
+	while (inlen >= 4) {
+		if ((v0 = BASE64VAL(inp[0])) < 0 ||
+		    (v1 = BASE64VAL(inp[1])) < 0 ||
+		    (v2 = BASE64VAL(inp[2])) < 0 ||
+		    (v3 = BASE64VAL(inp[3])) < 0)
+			break;
+		*outp++ = (v0 << 2) | (v1 >> 4);
+		*outp++ = ((v1 & 0x0f) << 4) | (v2 >> 2);
+		*outp++ = ((v2 & 0x03) << 6) | v3;
+		inp += 4;
+		inlen -= 4;
+	}
+
+	*consumed = inp - in;
+	return outp - out;
+}
+
 void base64_encode(gchar *out, const guchar *in, gint inlen)
 {
 	const guchar *inp = in;
 	gchar *outp = out;
 
+#ifdef __SSE2__
+	{
+		gint len;
+
+		len = base64_encode_sse2(outp, inp, inlen);
+		inp += len;
+		inlen -= len;
+		outp += len / 3 * 4;
+	}
+#endif
+
 	while (inlen >= 3) {
 		*outp++ = base64char[(inp[0] >> 2) & 0x3f];
 		*outp++ = base64char[((inp[0] & 0x03) << 4) |
@@ -72,14 +228,43 @@ void base64_encode(gchar *out, const guchar *in, gint inlen)
 	*outp = '\0';
 }
 
+/* Encodes in into lines of line_inlen input bytes (a multiple of 3)
+   terminated with LF, and returns the output length. out must have room
+   for ((inlen + 2) / 3 * 4) + (inlen / line_inlen) + 2 bytes. */
+gint base64_encode_lines(gchar *out, const guchar *in, gint inlen,
+			 gint line_inlen)
+{
+	gchar *outp = out;
+	gint len;
+
+	g_return_val_if_fail(line_inlen > 0 && line_inlen % 3 == 0, -1);
+
+	while (inlen > 0) {
+		len = MIN(inlen, line_inlen);
+		base64_encode(outp, in, len);
+		outp += (len + 2) / 3 * 4;
+		*outp++ = '\n';
+		in += len;
+		inlen -= len;
+	}
+
+	*outp = '\0';
+	return outp - out;
+}
+
 gint base64_decode(guchar *out, const gchar *in, gint inlen)
 {
 	const gchar *inp = in;
 	guchar *outp = out;
 	gchar buf[4];
+	gint len;
 
 	if (inlen < 0)
-		inlen = G_MAXINT;
+		inlen = strlen(in);
+
+	outp += base64_decode_quanta(outp, inp, inlen, &len);
+	inp += len;
+	inlen -= len;
 
 	while (inlen >= 4 && *inp != '\0') {
 		buf[0] = *inp++;
@@ -129,40 +314,90 @@ void base64_decoder_free(Base64Decoder *decoder)
 gint base64_decoder_decode(Base64Decoder *decoder,
 			   const gchar *in, guchar *out)
 {
+	gint len;
+
+	g_return_val_if_fail(in != NULL, -1);
+
+	if (base64_decoder_decode_len(decoder, in, strlen(in), out, &len) < 0)
+		return -1;
+
+	return len;
+}
+
+/* Decodes inlen bytes of in, which may contain line breaks and may end
+   in the middle of a quantum. The rest of a line after a padded quantum
+   is skipped. out must have room for inlen * 3 / 4 + 3 bytes. Stores the
+   number of the decoded bytes into outlen, including those decoded before
+   an invalid character, and returns 0, or -1 on error. */
+gint base64_decoder_decode_len(Base64Decoder *decoder,
+			       const gchar *in, gint inlen, guchar *out,
+			       gint *outlen)
+{
+	const gchar *end;
 	gint len, total_len = 0;
 	gint buf_len;
 	gchar buf[4];
+	gint ret = 0;
 
 	g_return_val_if_fail(decoder != NULL, -1);
 	g_return_val_if_fail(in != NULL, -1);
 	g_return_val_if_fail(out != NULL, -1);
+	g_return_val_if_fail(outlen != NULL, -1);
 
+	end = in + inlen;
 	buf_len = decoder->buf_len;
 	memcpy(buf, decoder->buf, sizeof(buf));
 
-	for (;;) {
-		while (buf_len < 4) {
-			gchar c = *in;
+	while (in < end) {
+		/* decode the complete quanta in a row at once */
+		if (buf_len == 0) {
+			len = base64_decode_quanta(out, in, end - in, &inlen);
+			in += inlen;
+			out += len;
+			total_len += len;
+		}
 
-			in++;
-			if (c == '\0') break;
-			if (c == '\r' || c == '\n') continue;
-			if (c != '=' && BASE64VAL(c) == -1)
-				return -1;
+		while (buf_len < 4 && in < end) {
+			gchar c;
+
+			c = *in++;
+			if (c == '\0') {
+				in = end;
+				break;
+			}
+			if (c == '\r' || c == '\n') {
+				if (buf_len == 0)
+					break;
+				continue;
+			}
+			if (c != '=' && BASE64VAL(c) == -1) {
+				buf_len = 0;
+				ret = -1;
+				in = end;
+				break;
+			}
 			buf[buf_len++] = c;
 		}
-		if (buf_len < 4 || buf[0] == '=' || buf[1] == '=') {
-			decoder->buf_len = buf_len;
-			memcpy(decoder->buf, buf, sizeof(buf));
-			return total_len;
-		}
-		len = base64_decode(out, buf, 4);
-		out += len;
-		total_len += len;
+		if (buf_len < 4)
+			continue;
+
 		buf_len = 0;
-		if (len < 3) {
-			decoder->buf_len = 0;
-			return total_len;
+		if (buf[0] != '=' && buf[1] != '=') {
+			len = base64_decode(out, buf, 4);
+			out += len;
+			total_len += len;
+			if (len == 3)
+				continue;
 		}
+
+		/* the data of this line ends with the padding */
+		while (in < end && *in != '\n')
+			in++;
 	}
+
+	decoder->buf_len = buf_len;
+	memcpy(decoder->buf, buf, sizeof(buf));
+	*outlen = total_len;
+
+	return ret;
 }
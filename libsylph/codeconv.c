@@ -183,6 +183,8 @@ static gchar *conv_anytodisp(const gchar *inbuf, gint *error);
 static gchar *conv_ustodisp(const gchar *inbuf, gint *error);
 static gchar *conv_noconv(const gchar *inbuf, gint *error);
 
+static gboolean conv_is_ascii_compatible(CharSet charset);
+
 static gchar *conv_jistoeuc(const gchar *inbuf, gint *error)
 {
 	gchar *outbuf;
@@ -780,82 +782,132 @@ static gchar *conv_jistoutf8(const gchar *inbuf, gint *error)
 #define S_UNLOCK(name)
 #endif
 
-static gchar *conv_sjistoutf8(const gchar *inbuf, gint *error)
+/* iconv descriptors are kept in a small MRU list keyed by the encoding
+   pair, so that header decoding does not need iconv_open() for every
+   encoded-word. An entry is removed from the list while it is in use,
+   so that a descriptor is never shared between threads. The pairs which
+   iconv does not support are cached too, with cd == (iconv_t)-1. */
+
+typedef struct _ConvIconvEntry
 {
-	static iconv_t cd = (iconv_t)-1;
-	static gboolean iconv_ok = TRUE;
-	S_LOCK_DEFINE_STATIC(cd);
-	gchar *ret;
+	gchar *src_code;
+	gchar *dest_code;
+	iconv_t cd;
+} ConvIconvEntry;
 
-	S_LOCK(cd);
+#define CONV_ICONV_CACHE_SIZE	16
 
-	if (cd == (iconv_t)-1) {
-		if (!iconv_ok) {
-			S_UNLOCK(cd);
-			if (error)
-				*error = -1;
-			return g_strdup(inbuf);
-		}
+static GSList *iconv_cache_list = NULL;
+S_LOCK_DEFINE_STATIC(iconv_cache);
 
-		cd = iconv_open(CS_UTF_8, CS_CP932);
-		if (cd == (iconv_t)-1) {
-			cd = iconv_open(CS_UTF_8, CS_SHIFT_JIS);
-			if (cd == (iconv_t)-1) {
-				g_warning("conv_sjistoutf8(): %s\n",
-					  g_strerror(errno));
-				iconv_ok = FALSE;
-				S_UNLOCK(cd);
-				if (error)
-					*error = -1;
-				return g_strdup(inbuf);
-			}
+static ConvIconvEntry *conv_iconv_get(const gchar *src_code,
+				      const gchar *dest_code)
+{
+	ConvIconvEntry *entry;
+	GSList *cur;
+
+	S_LOCK(iconv_cache);
+	for (cur = iconv_cache_list; cur != NULL; cur = cur->next) {
+		entry = (ConvIconvEntry *)cur->data;
+		if (!g_ascii_strcasecmp(entry->src_code, src_code) &&
+		    !g_ascii_strcasecmp(entry->dest_code, dest_code)) {
+			iconv_cache_list =
+				g_slist_delete_link(iconv_cache_list, cur);
+			S_UNLOCK(iconv_cache);
+			/* reset the shift state left by the previous user */
+			if (entry->cd != (iconv_t)-1)
+				iconv(entry->cd, NULL, NULL, NULL, NULL);
+			return entry;
 		}
 	}
+	S_UNLOCK(iconv_cache);
 
-	ret = conv_iconv_strdup_with_cd(inbuf, cd, error);
-	S_UNLOCK(cd);
-	return ret;
+	entry = g_new(ConvIconvEntry, 1);
+	entry->src_code = g_strdup(src_code);
+	entry->dest_code = g_strdup(dest_code);
+	entry->cd = iconv_open(dest_code, src_code);
+	if (entry->cd == (iconv_t)-1)
+		debug_print("iconv_open(%s, %s): %s\n", dest_code, src_code,
+			    g_strerror(errno));
+
+	return entry;
 }
 
-static gchar *conv_euctoutf8(const gchar *inbuf, gint *error)
+static void conv_iconv_entry_free(ConvIconvEntry *entry)
 {
-	static iconv_t cd = (iconv_t)-1;
-	static gboolean iconv_ok = TRUE;
-	S_LOCK_DEFINE_STATIC(cd);
-	gchar *ret;
+	if (entry->cd != (iconv_t)-1)
+		iconv_close(entry->cd);
+	g_free(entry->src_code);
+	g_free(entry->dest_code);
+	g_free(entry);
+}
 
-	S_LOCK(cd);
+static void conv_iconv_put(ConvIconvEntry *entry)
+{
+	ConvIconvEntry *last = NULL;
+	GSList *cur;
+
+	S_LOCK(iconv_cache);
+	iconv_cache_list = g_slist_prepend(iconv_cache_list, entry);
+	cur = g_slist_nth(iconv_cache_list, CONV_ICONV_CACHE_SIZE);
+	if (cur) {
+		last = (ConvIconvEntry *)cur->data;
+		iconv_cache_list = g_slist_delete_link(iconv_cache_list, cur);
+	}
+	S_UNLOCK(iconv_cache);
+
+	if (last)
+		conv_iconv_entry_free(last);
+}
+
+/* converts with the first encoding pair supported by iconv, and returns
+   a copy of inbuf if neither of them is supported */
+static gchar *conv_iconv_strdup_alt(const gchar *inbuf,
+				    const gchar *src_code,
+				    const gchar *dest_code,
+				    const gchar *alt_src_code,
+				    const gchar *alt_dest_code,
+				    gint *error)
+{
+	ConvIconvEntry *entry;
+	gchar *ret;
 
-	if (cd == (iconv_t)-1) {
-		if (!iconv_ok) {
-			S_UNLOCK(cd);
+	entry = conv_iconv_get(src_code, dest_code);
+	if (entry->cd == (iconv_t)-1) {
+		conv_iconv_put(entry);
+		entry = conv_iconv_get(alt_src_code, alt_dest_code);
+		if (entry->cd == (iconv_t)-1) {
+			conv_iconv_put(entry);
 			if (error)
 				*error = -1;
 			return g_strdup(inbuf);
 		}
-
-		cd = iconv_open(CS_UTF_8, CS_EUC_JP_MS);
-		if (cd == (iconv_t)-1) {
-			cd = iconv_open(CS_UTF_8, CS_EUC_JP);
-			if (cd == (iconv_t)-1) {
-				g_warning("conv_euctoutf8(): %s\n",
-					  g_strerror(errno));
-				iconv_ok = FALSE;
-				S_UNLOCK(cd);
-				if (error)
-					*error = -1;
-				return g_strdup(inbuf);
-			}
-		}
 	}
 
-	ret = conv_iconv_strdup_with_cd(inbuf, cd, error);
-	S_UNLOCK(cd);
+	ret = conv_iconv_strdup_with_cd(inbuf, entry->cd, error);
+	conv_iconv_put(entry);
+
 	return ret;
 }
 
+static gchar *conv_sjistoutf8(const gchar *inbuf, gint *error)
+{
+	return conv_iconv_strdup_alt(inbuf, CS_CP932, CS_UTF_8, CS_SHIFT_JIS, CS_UTF_8, error);
+}
+
+static gchar *conv_euctoutf8(const gchar *inbuf, gint *error)
+{
+	return conv_iconv_strdup_alt(inbuf, CS_EUC_JP_MS, CS_UTF_8, CS_EUC_JP, CS_UTF_8, error);
+}
+
 static gchar *conv_anytoutf8(const gchar *inbuf, gint *error)
 {
+	if (is_ascii_str(inbuf)) {
+		if (error)
+			*error = 0;
+		return g_strdup(inbuf);
+	}
+
 	switch (conv_guess_ja_encoding(inbuf)) {
 	case C_ISO_2022_JP:
 		return conv_jistoutf8(inbuf, error);
@@ -878,80 +930,16 @@ static gchar *conv_anytoutf8(const gchar *inbuf, gint *error)
 
 static gchar *conv_utf8tosjis(const gchar *inbuf, gint *error)
 {
-	static iconv_t cd = (iconv_t)-1;
-	static gboolean iconv_ok = TRUE;
-	S_LOCK_DEFINE_STATIC(cd);
-	gchar *ret;
-
-	S_LOCK(cd);
-
-	if (cd == (iconv_t)-1) {
-		if (!iconv_ok) {
-			S_UNLOCK(cd);
-			if (error)
-				*error = -1;
-			return g_strdup(inbuf);
-		}
-
-		cd = iconv_open(CS_CP932, CS_UTF_8);
-		if (cd == (iconv_t)-1) {
-			cd = iconv_open(CS_SHIFT_JIS, CS_UTF_8);
-			if (cd == (iconv_t)-1) {
-				g_warning("conv_utf8tosjis(): %s\n",
-					  g_strerror(errno));
-				iconv_ok = FALSE;
-				S_UNLOCK(cd);
-				if (error)
-					*error = -1;
-				return g_strdup(inbuf);
-			}
-		}
-	}
-
 	if (isutf8bom(inbuf))
 		inbuf += 3;
-	ret = conv_iconv_strdup_with_cd(inbuf, cd, error);
-	S_UNLOCK(cd);
-	return ret;
+	return conv_iconv_strdup_alt(inbuf, CS_UTF_8, CS_CP932, CS_UTF_8, CS_SHIFT_JIS, error);
 }
 
 static gchar *conv_utf8toeuc(const gchar *inbuf, gint *error)
 {
-	static iconv_t cd = (iconv_t)-1;
-	static gboolean iconv_ok = TRUE;
-	S_LOCK_DEFINE_STATIC(cd);
-	gchar *ret;
-
-	S_LOCK(cd);
-
-	if (cd == (iconv_t)-1) {
-		if (!iconv_ok) {
-			S_UNLOCK(cd);
-			if (error)
-				*error = -1;
-			return g_strdup(inbuf);
-		}
-
-		cd = iconv_open(CS_EUC_JP_MS, CS_UTF_8);
-		if (cd == (iconv_t)-1) {
-			cd = iconv_open(CS_EUC_JP, CS_UTF_8);
-			if (cd == (iconv_t)-1) {
-				g_warning("conv_utf8toeuc(): %s\n",
-					  g_strerror(errno));
-				iconv_ok = FALSE;
-				S_UNLOCK(cd);
-				if (error)
-					*error = -1;
-				return g_strdup(inbuf);
-			}
-		}
-	}
-
 	if (isutf8bom(inbuf))
 		inbuf += 3;
-	ret = conv_iconv_strdup_with_cd(inbuf, cd, error);
-	S_UNLOCK(cd);
-	return ret;
+	return conv_iconv_strdup_alt(inbuf, CS_UTF_8, CS_EUC_JP_MS, CS_UTF_8, CS_EUC_JP, error);
 }
 
 static gchar *conv_utf8tojis(const gchar *inbuf, gint *error)
@@ -1272,7 +1260,7 @@ static gchar *conv_euctodisp(const gchar *inbuf, gint *error)
 
 gchar *conv_utf8todisp(const gchar *inbuf, gint *error)
 {
-	if (g_utf8_validate(inbuf, -1, NULL) == TRUE) {
+	if (is_utf8_str(inbuf) == TRUE) {
 		if (error)
 			*error = 0;
 		if (isutf8bom(inbuf))
@@ -1287,7 +1275,7 @@ static gchar *conv_anytodisp(const gchar *inbuf, gint *error)
 	gchar *outbuf;
 
 	outbuf = conv_anytoutf8(inbuf, error);
-	if (g_utf8_validate(outbuf, -1, NULL) != TRUE) {
+	if (is_utf8_str(outbuf) != TRUE) {
 		if (error)
 			*error = -1;
 		conv_unreadable_8bit(outbuf);
@@ -1312,6 +1300,13 @@ gchar *conv_localetodisp(const gchar *inbuf, gint *error)
 {
 	gchar *str;
 
+	if (conv_is_ascii_compatible(conv_get_locale_charset()) &&
+	    is_ascii_str(inbuf)) {
+		if (error)
+			*error = 0;
+		return g_strdup(inbuf);
+	}
+
 	str = conv_iconv_strdup(inbuf, conv_get_locale_charset_str(),
 				CS_INTERNAL, error);
 	if (!str)
@@ -1320,6 +1315,23 @@ gchar *conv_localetodisp(const gchar *inbuf, gint *error)
 	return str;
 }
 
+/* returns TRUE if the printable ASCII characters, TAB, CR and LF stand
+   for themselves in the encoding, so that a string of them never needs
+   conversion */
+static gboolean conv_is_ascii_compatible(CharSet charset)
+{
+	switch (charset) {
+	case C_AUTO:
+	case C_UTF_7:
+	case C_UTF_16:
+	case C_UTF_16BE:
+	case C_UTF_16LE:
+		return FALSE;
+	default:
+		return TRUE;
+	}
+}
+
 static gchar *conv_noconv(const gchar *inbuf, gint *error)
 {
 	if (error)
@@ -1396,6 +1408,18 @@ gchar *conv_codeset_strdup_full(const gchar *inbuf,
 
 	src_encoding = conv_get_fallback_for_private_encoding(src_encoding);
 
+	if (is_ascii_str(inbuf) &&
+	    conv_is_ascii_compatible(src_encoding ?
+				     conv_get_charset_from_str(src_encoding) :
+				     conv_get_locale_charset()) &&
+	    (!dest_encoding ||
+	     conv_is_ascii_compatible
+		(conv_get_charset_from_str(dest_encoding)))) {
+		if (error)
+			*error = 0;
+		return g_strdup(inbuf);
+	}
+
 	conv_func = conv_get_code_conv_func(src_encoding, dest_encoding);
 	if (conv_func != conv_noconv)
 		return conv_func(inbuf, error);
@@ -1505,7 +1529,7 @@ gchar *conv_iconv_strdup(const gchar *inbuf,
 			 const gchar *src_code, const gchar *dest_code,
 			 gint *error)
 {
-	iconv_t cd;
+	ConvIconvEntry *entry;
 	gchar *outbuf;
 
 	if (!src_code)
@@ -1513,16 +1537,17 @@ gchar *conv_iconv_strdup(const gchar *inbuf,
 	if (!dest_code)
 		dest_code = CS_INTERNAL;
 
-	cd = iconv_open(dest_code, src_code);
-	if (cd == (iconv_t)-1) {
+	entry = conv_iconv_get(src_code, dest_code);
+	if (entry->cd == (iconv_t)-1) {
+		conv_iconv_put(entry);
 		if (error)
 			*error = -1;
 		return NULL;
 	}
 
-	outbuf = conv_iconv_strdup_with_cd(inbuf, cd, error);
+	outbuf = conv_iconv_strdup_with_cd(inbuf, entry->cd, error);
 
-	iconv_close(cd);
+	conv_iconv_put(entry);
 
 	return outbuf;
 }
@@ -2704,6 +2729,7 @@ CharSet conv_check_file_encoding(const gchar *file)
 	CharSet enc;
 	const gchar *enc_str;
 	gboolean is_locale = TRUE, is_utf8 = TRUE;
+	gboolean ascii_ok;
 	size_t size;
 
 	g_return_val_if_fail(file != NULL, C_AUTO);
@@ -2712,6 +2738,7 @@ CharSet conv_check_file_encoding(const gchar *file)
 	enc_str = conv_get_locale_charset_str();
 	if (enc == C_UTF_8)
 		is_locale = FALSE;
+	ascii_ok = conv_is_ascii_compatible(enc);
 
 	if ((fp = g_fopen(file, "rb")) == NULL) {
 		FILE_OP_ERROR(file, "fopen");
@@ -2791,6 +2818,10 @@ CharSet conv_check_file_encoding(const gchar *file)
 		gchar *str;
 		gint error = 0;
 
+		/* valid both in the locale encoding and in UTF-8 */
+		if (ascii_ok && is_ascii_str(buf))
+			continue;
+
 		if (is_locale) {
 			str = conv_codeset_strdup_full(buf, enc_str,
 						       CS_INTERNAL, &error);
@@ -2799,7 +2830,7 @@ CharSet conv_check_file_encoding(const gchar *file)
 			g_free(str);
 		}
 
-		if (is_utf8 && g_utf8_validate(buf, -1, NULL) == FALSE) {
+		if (is_utf8 && is_utf8_str(buf) == FALSE) {
 			is_utf8 = FALSE;
 		}
 
@@ -75,9 +75,16 @@
 #define FOLDER_LIST		"folderlist.xml"
 #define CACHE_FILE		".sylpheed_cache"
 #define MARK_FILE		".sylpheed_mark"
+#define JOURNAL_FILE		".sylpheed_journal"
+#define THREAD_FILE		".sylpheed_thread"
+#define INDEX_FILE		".sylpheed_index"
 #define SEARCH_CACHE		"search_cache"
-#define CACHE_VERSION		0x21
+#define CACHE_VERSION		0x30
+#define CACHE_VERSION_LEGACY	0x21
 #define MARK_VERSION		2
+#define JOURNAL_VERSION		1
+#define THREAD_VERSION		1
+#define INDEX_VERSION		1
 #define SEARCH_CACHE_VERSION	1
 
 #ifdef G_OS_WIN32
@@ -46,6 +46,7 @@
 #include "prefs_common.h"
 #include "prefs_account.h"
 #include "account.h"
+#include "codeconv.h"
 
 typedef enum
 {
@@ -54,19 +55,46 @@ typedef enum
 	FLT_O_REGEX	= 1 << 2
 } FilterOldFlag;
 
+typedef struct _FilterProgram		FilterProgram;
+typedef struct _FilterMatchResult	FilterMatchResult;
+
+/* header matches computed by a FilterProgram for one message */
+struct _FilterMatchResult
+{
+	FilterProgram *program;
+	guint8 *matched;
+};
+
 static FilterInAddressBookFunc default_addrbook_func = NULL;
 
+static gboolean filter_match_rule_with_result
+					(FilterRule	*rule,
+					 MsgInfo	*msginfo,
+					 GSList		*hlist,
+					 FilterInfo	*fltinfo,
+					 FilterMatchResult *result);
 static gboolean filter_match_cond	(FilterCond	*cond,
 					 MsgInfo	*msginfo,
 					 GSList		*hlist,
-					 FilterInfo	*fltinfo);
+					 FilterInfo	*fltinfo,
+					 FilterMatchResult *result);
 static gboolean filter_match_header_cond(FilterCond	*cond,
-					 GSList		*hlist);
+					 GSList		*hlist,
+					 FilterMatchResult *result);
+static gboolean filter_cond_match_str	(const gchar	*haystack,
+					 gpointer	 data);
 static gboolean filter_match_in_addressbook
 					(FilterCond	*cond,
 					 GSList		*hlist,
 					 FilterInfo	*fltinfo);
 
+static FilterProgram *filter_program_get	(GSList		*fltlist);
+static void filter_program_unref	(FilterProgram	*program);
+static void filter_program_run		(FilterProgram	*program,
+					 GSList		*hlist,
+					 FilterMatchResult *result);
+static void filter_invalidate_programs	(void);
+
 static void filter_cond_free		(FilterCond	*cond);
 static void filter_action_free		(FilterAction	*action);
 
@@ -103,6 +131,8 @@ gint filter_apply_msginfo(GSList *fltlist, MsgInfo *msginfo,
 	gchar *file;
 	GSList *hlist, *cur;
 	FilterRule *rule;
+	FilterProgram *program;
+	FilterMatchResult result;
 	gint ret = 0;
 
 	g_return_val_if_fail(msginfo != NULL, -1);
@@ -123,12 +153,16 @@ gint filter_apply_msginfo(GSList *fltlist, MsgInfo *msginfo,
 
 	procmsg_set_auto_decrypt_message(FALSE);
 
+	program = filter_program_get(fltlist);
+	filter_program_run(program, hlist, &result);
+
 	for (cur = fltlist; cur != NULL; cur = cur->next) {
 		gboolean matched;
 
 		rule = (FilterRule *)cur->data;
 		if (!rule->enabled) continue;
-		matched = filter_match_rule(rule, msginfo, hlist, fltinfo);
+		matched = filter_match_rule_with_result(rule, msginfo, hlist,
+							fltinfo, &result);
 		if (fltinfo->error != FLT_ERROR_OK) {
 			g_warning("filter_match_rule() returned error (code: %d)\n", fltinfo->error);
 		}
@@ -146,6 +180,9 @@ gint filter_apply_msginfo(GSList *fltlist, MsgInfo *msginfo,
 		}
 	}
 
+	g_free(result.matched);
+	filter_program_unref(program);
+
 	procmsg_set_auto_decrypt_message(TRUE);
 
 	procheader_header_list_destroy(hlist);
@@ -333,58 +370,535 @@ gint filter_action_exec(FilterRule *rule, MsgInfo *msginfo, const gchar *file,
 	return 0;
 }
 
-static gboolean strmatch_regex(const gchar *haystack, const gchar *needle)
+static gpointer filter_regex_compile(const gchar *pattern)
 {
 #ifdef USE_ONIGURUMA
-	gint ret = 0;
+	gint ret;
 	OnigRegex reg;
 	OnigErrorInfo err_info;
-	const UChar *ptn = (const UChar *)needle;
-	const UChar *str = (const UChar *)haystack;
-	size_t haystack_len;
+	const UChar *ptn = (const UChar *)pattern;
 
-	ret = onig_new(&reg, ptn, ptn + strlen(needle),
+	ret = onig_new(&reg, ptn, ptn + strlen(pattern),
 		       /* ONIG_OPTION_EXTEND requires spaces to be escaped */
 		       /* ONIG_OPTION_IGNORECASE|ONIG_OPTION_EXTEND, */
 		       ONIG_OPTION_IGNORECASE,
 		       ONIG_ENCODING_UTF8, ONIG_SYNTAX_POSIX_EXTENDED,
 		       &err_info);
 	if (ret != ONIG_NORMAL) {
-		g_warning("strmatch_regex: onig_new() failed: %d", ret);
-		return FALSE;
+		g_warning("filter_regex_compile: onig_new() failed: %d", ret);
+		return NULL;
+	}
+
+	return reg;
+#elif defined(HAVE_REGCOMP)
+	regex_t *preg;
+
+	preg = g_new(regex_t, 1);
+	if (regcomp(preg, pattern, REG_ICASE|REG_EXTENDED) != 0) {
+		g_free(preg);
+		return NULL;
 	}
 
+	return preg;
+#else
+	return NULL;
+#endif
+}
+
+static gboolean filter_regex_match(gpointer regex, const gchar *haystack)
+{
+#ifdef USE_ONIGURUMA
+	const UChar *str = (const UChar *)haystack;
+	size_t haystack_len;
+
 	haystack_len = strlen(haystack);
-	ret = onig_search(reg, str, str + haystack_len,
-			  str, str + haystack_len, NULL, 0);
-	onig_free(reg);
+	return onig_search((OnigRegex)regex, str, str + haystack_len,
+			   str, str + haystack_len, NULL, 0) >= 0;
+#elif defined(HAVE_REGCOMP)
+	return regexec((regex_t *)regex, haystack, 0, NULL, 0) == 0;
+#else
+	return FALSE;
+#endif
+}
 
-	if (ret >= 0)
-		return TRUE;
-	else
-		return FALSE;
+static void filter_regex_free(gpointer regex)
+{
+	if (!regex)
+		return;
+#ifdef USE_ONIGURUMA
+	onig_free((OnigRegex)regex);
 #elif defined(HAVE_REGCOMP)
-	gint ret = 0;
-	regex_t preg;
+	regfree((regex_t *)regex);
+	g_free(regex);
+#endif
+}
+
+static gboolean strmatch_regex(const gchar *haystack, const gchar *needle)
+{
+	gpointer regex;
+	gboolean ret;
 
-	ret = regcomp(&preg, needle, REG_ICASE|REG_EXTENDED);
-	if (ret != 0)
+	if ((regex = filter_regex_compile(needle)) == NULL)
 		return FALSE;
+	ret = filter_regex_match(regex, haystack);
+	filter_regex_free(regex);
 
-	ret = regexec(&preg, haystack, 0, NULL, 0);
-	regfree(&preg);
+	return ret;
+}
 
-	if (ret == 0)
-		return TRUE;
-	else
-		return FALSE;
+/* the regex is compiled once in filter_cond_new() */
+static gboolean filter_cond_match_str(const gchar *haystack, gpointer data)
+{
+	FilterCond *cond = (FilterCond *)data;
+
+	if (cond->match_type == FLT_REGEX)
+		return cond->regex ? filter_regex_match(cond->regex, haystack)
+			: FALSE;
+
+	return cond->match_func(haystack, cond->str_value);
+}
+
+/*
+ * Compiled header matcher.
+ *
+ * The FLT_CONTAIN header conditions of all the rules in a filter list are
+ * grouped by header name into Aho-Corasick automata, so that each header
+ * of a message is scanned once instead of once per condition.
+ * filter_match_header_cond() then looks up the precomputed result.  The
+ * programs are cached per filter list, and dropped whenever a rule or a
+ * condition is created or freed.
+ */
+
+#define FILTER_PROGRAM_CACHE_SIZE	4
+
+typedef struct _FilterMatcherNode
+{
+	guint parent;
+	guint depth;
+	guchar c;
+	guint fail;
+	guint dict;
+	GSList *conds;
+} FilterMatcherNode;
+
+typedef struct _FilterMatcher
+{
+	gchar *header_name;	/* NULL matches any header */
+	gboolean case_sens;
+	GArray *nodes;
+	GHashTable *edges;	/* (node << 8 | c) -> child + 1 */
+} FilterMatcher;
+
+struct _FilterProgram
+{
+	gint ref_count;
+	gint generation;
+	GSList *rules;
+	GHashTable *cond_table;	/* FilterCond -> index + 1 */
+	guint n_conds;
+	GSList *matchers;
+};
+
+#if USE_THREADS
+G_LOCK_DEFINE_STATIC(filter_program);
+#define S_LOCK(name)	G_LOCK(name)
+#define S_UNLOCK(name)	G_UNLOCK(name)
 #else
-	return FALSE;
+#define S_LOCK(name)
+#define S_UNLOCK(name)
 #endif
+
+static gint filter_generation = 0;
+static GSList *filter_program_cache = NULL;
+
+#define FILTER_MATCHER_NODE(m, n) \
+	(&g_array_index((m)->nodes, FilterMatcherNode, (n)))
+#define FILTER_MATCHER_FOLD(m, c) \
+	((m)->case_sens ? (guchar)(c) : (guchar)g_ascii_tolower(c))
+
+static FilterMatcher *filter_matcher_new(const gchar *header_name,
+					 gboolean case_sens)
+{
+	FilterMatcher *matcher;
+	FilterMatcherNode root = {0};
+
+	matcher = g_new0(FilterMatcher, 1);
+	matcher->header_name = g_strdup(header_name);
+	matcher->case_sens = case_sens;
+	matcher->nodes = g_array_new(FALSE, FALSE, sizeof(FilterMatcherNode));
+	matcher->edges = g_hash_table_new(NULL, g_direct_equal);
+	g_array_append_val(matcher->nodes, root);
+
+	return matcher;
+}
+
+static void filter_matcher_free(FilterMatcher *matcher)
+{
+	guint i;
+
+	for (i = 0; i < matcher->nodes->len; i++)
+		g_slist_free(FILTER_MATCHER_NODE(matcher, i)->conds);
+	g_array_free(matcher->nodes, TRUE);
+	g_hash_table_destroy(matcher->edges);
+	g_free(matcher->header_name);
+	g_free(matcher);
+}
+
+static guint filter_matcher_goto(FilterMatcher *matcher, guint node, guchar c)
+{
+	return GPOINTER_TO_UINT(g_hash_table_lookup
+		(matcher->edges, GUINT_TO_POINTER((node << 8) | c)));
+}
+
+static void filter_matcher_add(FilterMatcher *matcher, const gchar *pattern,
+			       guint index)
+{
+	FilterMatcherNode new_node = {0};
+	const guchar *p;
+	guint node = 0, child;
+	guchar c;
+
+	for (p = (const guchar *)pattern; *p != '\0'; p++) {
+		c = FILTER_MATCHER_FOLD(matcher, *p);
+		child = filter_matcher_goto(matcher, node, c);
+		if (child == 0) {
+			new_node.parent = node;
+			new_node.depth = FILTER_MATCHER_NODE(matcher, node)->depth + 1;
+			new_node.c = c;
+			g_array_append_val(matcher->nodes, new_node);
+			child = matcher->nodes->len;
+			g_hash_table_insert(matcher->edges,
+					    GUINT_TO_POINTER((node << 8) | c),
+					    GUINT_TO_POINTER(child));
+		}
+		node = child - 1;
+	}
+
+	FILTER_MATCHER_NODE(matcher, node)->conds =
+		g_slist_prepend(FILTER_MATCHER_NODE(matcher, node)->conds,
+				GUINT_TO_POINTER(index));
+}
+
+static gint filter_matcher_depth_cmp(gconstpointer a, gconstpointer b,
+				     gpointer data)
+{
+	FilterMatcher *matcher = (FilterMatcher *)data;
+
+	return FILTER_MATCHER_NODE(matcher, *(const guint *)a)->depth -
+		FILTER_MATCHER_NODE(matcher, *(const guint *)b)->depth;
+}
+
+/* set the failure links in breadth-first order */
+static void filter_matcher_build(FilterMatcher *matcher)
+{
+	GArray *order;
+	FilterMatcherNode *node, *fail;
+	guint i, v, f, child;
+
+	order = g_array_sized_new(FALSE, FALSE, sizeof(guint),
+				  matcher->nodes->len);
+	for (v = 1; v < matcher->nodes->len; v++)
+		g_array_append_val(order, v);
+	g_array_sort_with_data(order, filter_matcher_depth_cmp, matcher);
+
+	for (i = 0; i < order->len; i++) {
+		v = g_array_index(order, guint, i);
+		node = FILTER_MATCHER_NODE(matcher, v);
+		node->fail = 0;
+		if (node->depth > 1) {
+			f = FILTER_MATCHER_NODE(matcher, node->parent)->fail;
+			for (;;) {
+				child = filter_matcher_goto(matcher, f, node->c);
+				if (child != 0) {
+					node->fail = child - 1;
+					break;
+				}
+				if (f == 0)
+					break;
+				f = FILTER_MATCHER_NODE(matcher, f)->fail;
+			}
+		}
+		fail = FILTER_MATCHER_NODE(matcher, node->fail);
+		node->dict = fail->conds ? node->fail : fail->dict;
+	}
+
+	g_array_free(order, TRUE);
+}
+
+static void filter_matcher_scan(FilterMatcher *matcher, const gchar *str,
+				guint8 *matched)
+{
+	const guchar *p;
+	FilterMatcherNode *node;
+	guint cur = 0, child, n;
+	guchar c;
+	GSList *cond;
+
+	for (p = (const guchar *)str; *p != '\0'; p++) {
+		c = FILTER_MATCHER_FOLD(matcher, *p);
+		for (;;) {
+			child = filter_matcher_goto(matcher, cur, c);
+			if (child != 0) {
+				cur = child - 1;
+				break;
+			}
+			if (cur == 0)
+				break;
+			cur = FILTER_MATCHER_NODE(matcher, cur)->fail;
+		}
+
+		node = FILTER_MATCHER_NODE(matcher, cur);
+		for (n = node->conds ? cur : node->dict; n != 0;
+		     n = FILTER_MATCHER_NODE(matcher, n)->dict) {
+			for (cond = FILTER_MATCHER_NODE(matcher, n)->conds;
+			     cond != NULL; cond = cond->next)
+				matched[GPOINTER_TO_UINT(cond->data)] = TRUE;
+		}
+	}
+}
+
+static gboolean filter_cond_is_compilable(FilterCond *cond)
+{
+	const guchar *p;
+
+	if (cond->match_type != FLT_CONTAIN || !cond->str_value)
+		return FALSE;
+	if (cond->type == FLT_COND_HEADER) {
+		if (!cond->header_name)
+			return FALSE;
+	} else if (cond->type != FLT_COND_ANY_HEADER &&
+		   cond->type != FLT_COND_TO_OR_CC)
+		return FALSE;
+
+	/* strcasestr() may fold non-ASCII bytes in legacy locales */
+	if (!FLT_IS_CASE_SENS(cond->match_flag) &&
+	    conv_get_locale_charset() != C_UTF_8) {
+		for (p = (const guchar *)cond->str_value; *p != '\0'; p++) {
+			if (*p & 0x80)
+				return FALSE;
+		}
+	}
+
+	return TRUE;
+}
+
+static void filter_program_add(FilterProgram *program,
+			       const gchar *header_name, FilterCond *cond,
+			       guint index)
+{
+	FilterMatcher *matcher = NULL;
+	GSList *cur;
+	gboolean case_sens = FLT_IS_CASE_SENS(cond->match_flag);
+
+	for (cur = program->matchers; cur != NULL; cur = cur->next) {
+		FilterMatcher *m = (FilterMatcher *)cur->data;
+
+		if (m->case_sens != case_sens)
+			continue;
+		if ((!header_name && !m->header_name) ||
+		    (header_name && m->header_name &&
+		     !g_ascii_strcasecmp(header_name, m->header_name))) {
+			matcher = m;
+			break;
+		}
+	}
+
+	if (!matcher) {
+		matcher = filter_matcher_new(header_name, case_sens);
+		program->matchers = g_slist_append(program->matchers, matcher);
+	}
+
+	filter_matcher_add(matcher, cond->str_value, index);
+}
+
+static FilterProgram *filter_program_new(GSList *fltlist, gint generation)
+{
+	FilterProgram *program;
+	FilterRule *rule;
+	FilterCond *cond;
+	GSList *cur, *cur_cond;
+	guint index;
+
+	program = g_new0(FilterProgram, 1);
+	program->generation = generation;
+	program->rules = g_slist_copy(fltlist);
+	program->cond_table = g_hash_table_new(NULL, g_direct_equal);
+
+	for (cur = fltlist; cur != NULL; cur = cur->next) {
+		rule = (FilterRule *)cur->data;
+		for (cur_cond = rule->cond_list; cur_cond != NULL;
+		     cur_cond = cur_cond->next) {
+			cond = (FilterCond *)cur_cond->data;
+			if (!filter_cond_is_compilable(cond) ||
+			    g_hash_table_lookup(program->cond_table, cond))
+				continue;
+
+			index = program->n_conds++;
+			g_hash_table_insert(program->cond_table, cond,
+					    GUINT_TO_POINTER(index + 1));
+
+			if (cond->type == FLT_COND_HEADER)
+				filter_program_add(program, cond->header_name,
+						   cond, index);
+			else if (cond->type == FLT_COND_TO_OR_CC) {
+				filter_program_add(program, "To", cond, index);
+				filter_program_add(program, "Cc", cond, index);
+			} else
+				filter_program_add(program, NULL, cond, index);
+		}
+	}
+
+	for (cur = program->matchers; cur != NULL; cur = cur->next)
+		filter_matcher_build((FilterMatcher *)cur->data);
+
+	debug_print("filter_program_new: %u conditions in %u matchers\n",
+		    program->n_conds, g_slist_length(program->matchers));
+
+	return program;
+}
+
+static void filter_program_free(FilterProgram *program)
+{
+	GSList *cur;
+
+	for (cur = program->matchers; cur != NULL; cur = cur->next)
+		filter_matcher_free((FilterMatcher *)cur->data);
+	g_slist_free(program->matchers);
+	g_hash_table_destroy(program->cond_table);
+	g_slist_free(program->rules);
+	g_free(program);
+}
+
+static void filter_program_unref(FilterProgram *program)
+{
+	S_LOCK(filter_program);
+	if (--program->ref_count == 0)
+		filter_program_free(program);
+	S_UNLOCK(filter_program);
+}
+
+static gboolean filter_program_is_for(FilterProgram *program, GSList *fltlist)
+{
+	GSList *cur, *cur_rule;
+
+	for (cur = fltlist, cur_rule = program->rules;
+	     cur != NULL && cur_rule != NULL;
+	     cur = cur->next, cur_rule = cur_rule->next) {
+		if (cur->data != cur_rule->data)
+			return FALSE;
+	}
+
+	return cur == NULL && cur_rule == NULL;
+}
+
+static FilterProgram *filter_program_get(GSList *fltlist)
+{
+	FilterProgram *program = NULL;
+	GSList *cur, *next;
+	gint generation;
+
+	S_LOCK(filter_program);
+
+	generation = g_atomic_int_get(&filter_generation);
+
+	for (cur = filter_program_cache; cur != NULL; cur = next) {
+		FilterProgram *p = (FilterProgram *)cur->data;
+
+		next = cur->next;
+		if (p->generation != generation) {
+			filter_program_cache =
+				g_slist_delete_link(filter_program_cache, cur);
+			if (--p->ref_count == 0)
+				filter_program_free(p);
+		} else if (!program && filter_program_is_for(p, fltlist))
+			program = p;
+	}
+
+	if (!program) {
+		program = filter_program_new(fltlist, generation);
+		program->ref_count = 1;
+		filter_program_cache =
+			g_slist_prepend(filter_program_cache, program);
+		if (g_slist_length(filter_program_cache) >
+		    FILTER_PROGRAM_CACHE_SIZE) {
+			FilterProgram *last;
+
+			cur = g_slist_last(filter_program_cache);
+			last = (FilterProgram *)cur->data;
+			filter_program_cache =
+				g_slist_delete_link(filter_program_cache, cur);
+			if (--last->ref_count == 0)
+				filter_program_free(last);
+		}
+	}
+
+	program->ref_count++;
+
+	S_UNLOCK(filter_program);
+
+	return program;
+}
+
+static void filter_program_run(FilterProgram *program, GSList *hlist,
+			       FilterMatchResult *result)
+{
+	GSList *cur, *cur_m;
+	Header *header;
+	FilterMatcher *matcher;
+
+	result->program = program;
+	result->matched = g_new0(guint8, program->n_conds);
+
+	for (cur = hlist; cur != NULL; cur = cur->next) {
+		header = (Header *)cur->data;
+		if (!header->body)
+			continue;
+		for (cur_m = program->matchers; cur_m != NULL;
+		     cur_m = cur_m->next) {
+			matcher = (FilterMatcher *)cur_m->data;
+			if (!matcher->header_name ||
+			    !g_ascii_strcasecmp(header->name,
+						matcher->header_name))
+				filter_matcher_scan(matcher, header->body,
+						    result->matched);
+		}
+	}
+}
+
+static gboolean filter_match_result_lookup(FilterMatchResult *result,
+					   FilterCond *cond,
+					   gboolean *matched)
+{
+	guint index;
+
+	if (!result)
+		return FALSE;
+
+	index = GPOINTER_TO_UINT(g_hash_table_lookup
+		(result->program->cond_table, cond));
+	if (index == 0)
+		return FALSE;
+
+	*matched = result->matched[index - 1];
+	return TRUE;
+}
+
+static void filter_invalidate_programs(void)
+{
+	g_atomic_int_inc(&filter_generation);
 }
 
 gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			   FilterInfo *fltinfo)
+{
+	return filter_match_rule_with_result(rule, msginfo, hlist, fltinfo,
+					     NULL);
+}
+
+static gboolean filter_match_rule_with_result(FilterRule *rule,
+					      MsgInfo *msginfo, GSList *hlist,
+					      FilterInfo *fltinfo,
+					      FilterMatchResult *result)
 {
 	FilterCond *cond;
 	GSList *cur;
@@ -412,7 +926,7 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			cond = (FilterCond *)cur->data;
 			if (cond->type >= FLT_COND_SIZE_GREATER) {
 				matched = filter_match_cond
-					(cond, msginfo, hlist, fltinfo);
+					(cond, msginfo, hlist, fltinfo, result);
 				if (matched == FALSE)
 					return FALSE;
 			}
@@ -422,7 +936,7 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			cond = (FilterCond *)cur->data;
 			if (cond->type <= FLT_COND_TO_OR_CC) {
 				matched = filter_match_cond
-					(cond, msginfo, hlist, fltinfo);
+					(cond, msginfo, hlist, fltinfo, result);
 				if (matched == FALSE)
 					return FALSE;
 			}
@@ -433,7 +947,7 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			if (cond->type == FLT_COND_BODY ||
 			    cond->type == FLT_COND_CMD_TEST) {
 				matched = filter_match_cond
-					(cond, msginfo, hlist, fltinfo);
+					(cond, msginfo, hlist, fltinfo, result);
 				if (matched == FALSE)
 					return FALSE;
 			}
@@ -445,7 +959,7 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			cond = (FilterCond *)cur->data;
 			if (cond->type >= FLT_COND_SIZE_GREATER) {
 				matched = filter_match_cond
-					(cond, msginfo, hlist, fltinfo);
+					(cond, msginfo, hlist, fltinfo, result);
 				if (matched == TRUE)
 					return TRUE;
 			}
@@ -455,7 +969,7 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			cond = (FilterCond *)cur->data;
 			if (cond->type <= FLT_COND_TO_OR_CC) {
 				matched = filter_match_cond
-					(cond, msginfo, hlist, fltinfo);
+					(cond, msginfo, hlist, fltinfo, result);
 				if (matched == TRUE)
 					return TRUE;
 			}
@@ -466,7 +980,7 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 			if (cond->type == FLT_COND_BODY ||
 			    cond->type == FLT_COND_CMD_TEST) {
 				matched = filter_match_cond
-					(cond, msginfo, hlist, fltinfo);
+					(cond, msginfo, hlist, fltinfo, result);
 				if (matched == TRUE)
 					return TRUE;
 			}
@@ -479,7 +993,8 @@ gboolean filter_match_rule(FilterRule *rule, MsgInfo *msginfo, GSList *hlist,
 }
 
 static gboolean filter_match_cond(FilterCond *cond, MsgInfo *msginfo,
-				  GSList *hlist, FilterInfo *fltinfo)
+				  GSList *hlist, FilterInfo *fltinfo,
+				  FilterMatchResult *result)
 {
 	gint ret;
 	gboolean matched = FALSE;
@@ -494,17 +1009,18 @@ static gboolean filter_match_cond(FilterCond *cond, MsgInfo *msginfo,
 		if (cond->match_type == FLT_IN_ADDRESSBOOK)
 			return filter_match_in_addressbook(cond, hlist, fltinfo);
 		else
-			return filter_match_header_cond(cond, hlist);
+			return filter_match_header_cond(cond, hlist, result);
 	case FLT_COND_ANY_HEADER:
-		return filter_match_header_cond(cond, hlist);
+		return filter_match_header_cond(cond, hlist, result);
 	case FLT_COND_TO_OR_CC:
 		if (cond->match_type == FLT_IN_ADDRESSBOOK)
 			return filter_match_in_addressbook(cond, hlist, fltinfo);
 		else
-			return filter_match_header_cond(cond, hlist);
+			return filter_match_header_cond(cond, hlist, result);
 	case FLT_COND_BODY:
-		matched = procmime_find_string(msginfo, cond->str_value,
-					       cond->match_func);
+		if (cond->str_value)
+			matched = procmime_find_string_with_func
+				(msginfo, filter_cond_match_str, cond);
 		break;
 	case FLT_COND_CMD_TEST:
 		file = procmsg_get_message_file(msginfo);
@@ -594,10 +1110,9 @@ static gboolean filter_match_cond(FilterCond *cond, MsgInfo *msginfo,
 	return matched;
 }
 
-static gboolean filter_match_header_cond(FilterCond *cond, GSList *hlist)
+static gboolean filter_match_header_list(FilterCond *cond, GSList *hlist)
 {
 	gboolean matched = FALSE;
-	gboolean not_match = FALSE;
 	GSList *cur;
 	Header *header;
 
@@ -609,22 +1124,20 @@ static gboolean filter_match_header_cond(FilterCond *cond, GSList *hlist)
 			if (!g_ascii_strcasecmp
 				(header->name, cond->header_name)) {
 				if (!cond->str_value ||
-				    cond->match_func(header->body,
-						     cond->str_value))
+				    filter_cond_match_str(header->body, cond))
 					matched = TRUE;
 			}
 			break;
 		case FLT_COND_ANY_HEADER:
 			if (!cond->str_value ||
-			    cond->match_func(header->body, cond->str_value))
+			    filter_cond_match_str(header->body, cond))
 				matched = TRUE;
 			break;
 		case FLT_COND_TO_OR_CC:
 			if (!g_ascii_strcasecmp(header->name, "To") ||
 			    !g_ascii_strcasecmp(header->name, "Cc")) {
 				if (!cond->str_value ||
-				    cond->match_func(header->body,
-						     cond->str_value))
+				    filter_cond_match_str(header->body, cond))
 					matched = TRUE;
 			}
 			break;
@@ -636,6 +1149,18 @@ static gboolean filter_match_header_cond(FilterCond *cond, GSList *hlist)
 			break;
 	}
 
+	return matched;
+}
+
+static gboolean filter_match_header_cond(FilterCond *cond, GSList *hlist,
+					 FilterMatchResult *result)
+{
+	gboolean matched = FALSE;
+	gboolean not_match = FALSE;
+
+	if (!filter_match_result_lookup(result, cond, &matched))
+		matched = filter_match_header_list(cond, hlist);
+
 	if (FLT_IS_NOT_MATCH(cond->match_flag)) {
 		not_match = TRUE;
 		matched = !matched;
@@ -1459,6 +1984,8 @@ FilterRule *filter_rule_new(const gchar *name, FilterBoolOp bool_op,
 {
 	FilterRule *rule;
 
+	filter_invalidate_programs();
+
 	rule = g_new0(FilterRule, 1);
 	rule->name = g_strdup(name);
 	rule->bool_op = bool_op;
@@ -1477,6 +2004,8 @@ FilterCond *filter_cond_new(FilterCondType type,
 {
 	FilterCond *cond;
 
+	filter_invalidate_programs();
+
 	cond = g_new0(FilterCond, 1);
 	cond->type = type;
 	cond->match_type = match_type;
@@ -1495,9 +2024,11 @@ FilterCond *filter_cond_new(FilterCondType type,
 	else
 		cond->int_value = 0;
 
-	if (match_type == FLT_REGEX)
+	if (match_type == FLT_REGEX) {
 		cond->match_func = strmatch_regex;
-	else if (match_type == FLT_EQUAL) {
+		if (cond->str_value && type <= FLT_COND_BODY)
+			cond->regex = filter_regex_compile(cond->str_value);
+	} else if (match_type == FLT_EQUAL) {
 		if (FLT_IS_CASE_SENS(match_flag))
 			cond->match_func = str_find_equal;
 		else
@@ -1904,6 +2435,8 @@ void filter_rule_free(FilterRule *rule)
 {
 	if (!rule) return;
 
+	filter_invalidate_programs();
+
 	g_free(rule->name);
 	g_free(rule->target_folder);
 
@@ -1933,6 +2466,8 @@ void filter_action_list_free(GSList *action_list)
 
 static void filter_cond_free(FilterCond *cond)
 {
+	filter_invalidate_programs();
+	filter_regex_free(cond->regex);
 	g_free(cond->header_name);
 	g_free(cond->str_value);
 	g_free(cond);
@@ -126,6 +126,9 @@ struct _FilterCond
 	FilterMatchFlag match_flag;
 
 	StrFindFunc match_func;
+
+	/* compiled str_value of FLT_REGEX (NULL if it is invalid) */
+	gpointer regex;
 };
 
 struct _FilterAction
@@ -176,6 +176,8 @@ gint folder_remote_folder_destroy_all_sessions(void)
 		folder = FOLDER(list->data);
 		if (FOLDER_IS_REMOTE(folder)) {
 			rfolder = REMOTE_FOLDER(folder);
+			if (FOLDER_TYPE(folder) == F_IMAP)
+				imap_close_pooled_sessions(IMAP_FOLDER(folder));
 			if (rfolder->session &&
 			    !folder_remote_folder_is_session_active(rfolder)) {
 				session_destroy(rfolder->session);
@@ -241,6 +243,10 @@ FolderItem *folder_item_new(const gchar *name, const gchar *path)
 	item->name = g_strdup(name);
 	item->path = g_strdup(path);
 	item->mtime = 0;
+	item->modseq = 0;
+	item->scan_mtime = 0;
+	item->scan_n_msg = 0;
+	item->scan_last_num = 0;
 	item->new = 0;
 	item->unread = 0;
 	item->total = 0;
@@ -294,6 +300,7 @@ FolderItem *folder_item_copy(FolderItem *item)
 	new_item->name = g_strdup(item->name);
 	new_item->path = g_strdup(item->path);
 	new_item->mtime = item->mtime;
+	new_item->modseq = item->modseq;
 	new_item->new = item->new;
 	new_item->unread = item->unread;
 	new_item->total = item->total;
@@ -1224,6 +1231,45 @@ void folder_item_scan_foreach(GHashTable *table)
 	g_hash_table_foreach(table, folder_item_scan_foreach_func, NULL);
 }
 
+static void folder_item_scan_list_func(gpointer key, gpointer val,
+				       gpointer data)
+{
+	GSList *item_list = g_slist_reverse((GSList *)val);
+	gint *ret = (gint *)data;
+
+	if (imap_scan_folder_list(FOLDER(key), item_list) < 0)
+		*ret = -1;
+	g_slist_free(item_list);
+}
+
+/* scans the items of IMAP folders together, one batch per account */
+gint folder_item_scan_list(GSList *item_list)
+{
+	GHashTable *table;
+	GSList *cur;
+	gint ret = 0;
+
+	table = g_hash_table_new(NULL, NULL);
+
+	for (cur = item_list; cur != NULL; cur = cur->next) {
+		FolderItem *item = FOLDER_ITEM(cur->data);
+
+		if (FOLDER_TYPE(item->folder) == F_IMAP) {
+			GSList *list;
+
+			list = g_hash_table_lookup(table, item->folder);
+			g_hash_table_insert(table, item->folder,
+					    g_slist_prepend(list, item));
+		} else if (folder_item_scan(item) < 0)
+			ret = -1;
+	}
+
+	g_hash_table_foreach(table, folder_item_scan_list_func, &ret);
+	g_hash_table_destroy(table);
+
+	return ret;
+}
+
 GSList *folder_item_get_msg_list(FolderItem *item, gboolean use_cache)
 {
 	Folder *folder;
@@ -1573,6 +1619,60 @@ gchar *folder_item_get_mark_file(FolderItem *item)
 	return file;
 }
 
+gchar *folder_item_get_journal_file(FolderItem *item)
+{
+	gchar *path;
+	gchar *file;
+
+	g_return_val_if_fail(item != NULL, NULL);
+	g_return_val_if_fail(item->path != NULL, NULL);
+
+	path = folder_item_get_path(item);
+	g_return_val_if_fail(path != NULL, NULL);
+	if (!is_dir_exist(path))
+		make_dir_hier(path);
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, JOURNAL_FILE, NULL);
+	g_free(path);
+
+	return file;
+}
+
+gchar *folder_item_get_thread_file(FolderItem *item)
+{
+	gchar *path;
+	gchar *file;
+
+	g_return_val_if_fail(item != NULL, NULL);
+	g_return_val_if_fail(item->path != NULL, NULL);
+
+	path = folder_item_get_path(item);
+	g_return_val_if_fail(path != NULL, NULL);
+	if (!is_dir_exist(path))
+		make_dir_hier(path);
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, THREAD_FILE, NULL);
+	g_free(path);
+
+	return file;
+}
+
+gchar *folder_item_get_index_file(FolderItem *item)
+{
+	gchar *path;
+	gchar *file;
+
+	g_return_val_if_fail(item != NULL, NULL);
+	g_return_val_if_fail(item->path != NULL, NULL);
+
+	path = folder_item_get_path(item);
+	g_return_val_if_fail(path != NULL, NULL);
+	if (!is_dir_exist(path))
+		make_dir_hier(path);
+	file = g_strconcat(path, G_DIR_SEPARATOR_S, INDEX_FILE, NULL);
+	g_free(path);
+
+	return file;
+}
+
 static gboolean folder_build_tree(GNode *node, gpointer data)
 {
 	Folder *folder = FOLDER(data);
@@ -1590,6 +1690,9 @@ static gboolean folder_build_tree(GNode *node, gpointer data)
 	gboolean qsearch_cond_type = 0;
 	gint new = 0, unread = 0, total = 0;
 	time_t mtime = 0;
+	guint64 modseq = 0;
+	time_t scan_mtime = 0;
+	gint scan_n_msg = 0, scan_last_num = 0;
 	gboolean use_auto_to_on_reply = FALSE;
 	gchar *auto_to = NULL, *auto_cc = NULL, *auto_bcc = NULL,
 	      *auto_replyto = NULL;
@@ -1635,6 +1738,14 @@ static gboolean folder_build_tree(GNode *node, gpointer data)
 			path = attr->value;
 		} else if (!strcmp(attr->name, "mtime"))
 			mtime = strtoll(attr->value, NULL, 10);
+		else if (!strcmp(attr->name, "modseq"))
+			modseq = g_ascii_strtoull(attr->value, NULL, 10);
+		else if (!strcmp(attr->name, "scan_mtime"))
+			scan_mtime = strtoll(attr->value, NULL, 10);
+		else if (!strcmp(attr->name, "scan_msgs"))
+			scan_n_msg = atoi(attr->value);
+		else if (!strcmp(attr->name, "scan_last_num"))
+			scan_last_num = atoi(attr->value);
 		else if (!strcmp(attr->name, "new"))
 			new = atoi(attr->value);
 		else if (!strcmp(attr->name, "unread"))
@@ -1731,6 +1842,10 @@ static gboolean folder_build_tree(GNode *node, gpointer data)
 	item = folder_item_new(name, path);
 	item->stype = stype;
 	item->mtime = mtime;
+	item->modseq = modseq;
+	item->scan_mtime = scan_mtime;
+	item->scan_n_msg = scan_n_msg;
+	item->scan_last_num = scan_last_num;
 	item->new = new;
 	item->unread = unread;
 	item->total = total;
@@ -1947,6 +2062,18 @@ static void folder_write_list_recursive(GNode *node, gpointer data)
 		fprintf(fp,
 			" mtime=\"%lld\" new=\"%d\" unread=\"%d\" total=\"%d\"",
 			(gint64)item->mtime, item->new, item->unread, item->total);
+		/* the modseq is saved only when the cache and mark files
+		   hold the flags synced up to it, or a crash before they are
+		   written would make the next sync skip the changes */
+		if (item->modseq > 0 && !item->cache_dirty &&
+		    !item->mark_dirty)
+			fprintf(fp, " modseq=\"%" G_GUINT64_FORMAT "\"",
+				item->modseq);
+		if (item->scan_mtime > 0)
+			fprintf(fp, " scan_mtime=\"%lld\" scan_msgs=\"%d\""
+				" scan_last_num=\"%d\"",
+				(gint64)item->scan_mtime, item->scan_n_msg,
+				item->scan_last_num);
 
 		if (item->account)
 			fprintf(fp, " account_id=\"%d\"",
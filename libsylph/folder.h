@@ -278,6 +278,13 @@ struct _FolderItem
 	gchar *path; /* UTF-8 */
 
 	stime_t mtime;
+	guint64 modseq; /* IMAP HIGHESTMODSEQ of the last sync */
+
+	/* MH: directory mtime, number of messages and last number at the
+	   last directory scan */
+	stime_t scan_mtime;
+	gint scan_n_msg;
+	gint scan_last_num;
 
 	gint new;
 	gint unread;
@@ -424,6 +431,7 @@ gchar *folder_item_get_path		(FolderItem	*item);
 
 gint   folder_item_scan			(FolderItem	*item);
 void   folder_item_scan_foreach		(GHashTable	*table);
+gint   folder_item_scan_list		(GSList		*item_list);
 GSList *folder_item_get_msg_list	(FolderItem	*item,
 					 gboolean	 use_cache);
 GSList *folder_item_get_uncached_msg_list
@@ -469,6 +477,9 @@ gboolean folder_item_is_msg_changed	(FolderItem	*item,
 /* return value is filename encoding */
 gchar *folder_item_get_cache_file	(FolderItem	*item);
 gchar *folder_item_get_mark_file	(FolderItem	*item);
+gchar *folder_item_get_journal_file	(FolderItem	*item);
+gchar *folder_item_get_thread_file	(FolderItem	*item);
+gchar *folder_item_get_index_file	(FolderItem	*item);
 
 gint   folder_item_close		(FolderItem	*item);
 
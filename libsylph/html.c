@@ -202,8 +202,24 @@ HTMLParser *html_parser_new(FILE *fp, CodeConverter *conv)
 	g_return_val_if_fail(fp != NULL, NULL);
 	g_return_val_if_fail(conv != NULL, NULL);
 
-	parser = g_new0(HTMLParser, 1);
+	parser = html_parser_new_str("", conv);
 	parser->fp = fp;
+	parser->src = NULL;
+
+	return parser;
+}
+
+/* Parses the nul-terminated string str instead of a file */
+HTMLParser *html_parser_new_str(const gchar *str, CodeConverter *conv)
+{
+	HTMLParser *parser;
+
+	g_return_val_if_fail(str != NULL, NULL);
+	g_return_val_if_fail(conv != NULL, NULL);
+
+	parser = g_new0(HTMLParser, 1);
+	parser->fp = NULL;
+	parser->src = str;
 	parser->conv = conv;
 	parser->str = g_string_new(NULL);
 	parser->buf = g_string_new(NULL);
@@ -299,9 +315,27 @@ static HTMLState html_read_line(HTMLParser *parser)
 	gchar *conv_str;
 	gint index;
 
-	if (fgets(buf, sizeof(buf), parser->fp) == NULL) {
-		parser->state = HTML_EOF;
-		return HTML_EOF;
+	if (parser->fp) {
+		if (fgets(buf, sizeof(buf), parser->fp) == NULL) {
+			parser->state = HTML_EOF;
+			return HTML_EOF;
+		}
+	} else {
+		const gchar *p;
+		gint len;
+
+		if (*parser->src == '\0') {
+			parser->state = HTML_EOF;
+			return HTML_EOF;
+		}
+		if ((p = strchr(parser->src, '\n')) != NULL)
+			len = p - parser->src + 1;
+		else
+			len = strlen(parser->src);
+		len = MIN(len, sizeof(buf) - 1);
+		memcpy(buf, parser->src, len);
+		buf[len] = '\0';
+		parser->src += len;
 	}
 
 	conv_str = conv_convert(parser->conv, buf);
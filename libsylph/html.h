@@ -49,6 +49,7 @@ typedef struct _HTMLTag		HTMLTag;
 struct _HTMLParser
 {
 	FILE *fp;
+	const gchar *src;
 	CodeConverter *conv;
 
 	GHashTable *symbol_table;
@@ -83,6 +84,8 @@ struct _HTMLTag
 
 HTMLParser *html_parser_new	(FILE		*fp,
 				 CodeConverter	*conv);
+HTMLParser *html_parser_new_str	(const gchar	*str,
+				 CodeConverter	*conv);
 void html_parser_destroy	(HTMLParser	*parser);
 const gchar *html_parse		(HTMLParser	*parser);
 
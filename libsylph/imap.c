@@ -61,6 +61,19 @@
 #define IMAP_COPY_LIMIT	200
 #define IMAP_CMD_LIMIT	1000
 
+/* number of messages per envelope FETCH, and FETCH commands in flight */
+#define IMAP_ENVELOPE_CHUNK	500
+#define IMAP_ENVELOPE_PIPELINE	4
+
+/* STATUS commands in flight while scanning many folders */
+#define IMAP_STATUS_PIPELINE	16
+
+#define IMAP_STATUS_ITEMS	"MESSAGES RECENT UIDNEXT UIDVALIDITY UNSEEN"
+
+/* connections per account, and idle time before closing pooled ones */
+#define IMAP_SESSION_POOL_MAX		4
+#define IMAP_SESSION_POOL_TIMEOUT	(SESSION_TIMEOUT_INTERVAL * 5)
+
 #define QUOTE_IF_REQUIRED(out, str)					\
 {									\
 	if (!str || *str == '\0') {					\
@@ -110,6 +123,35 @@ typedef struct _IMAPRealSession
 #endif
 } IMAPRealSession;
 
+typedef struct _IMAPUIDRange
+{
+	guint32 first;
+	guint32 last;
+} IMAPUIDRange;
+
+typedef struct _IMAPFolderStatus
+{
+	FolderItem *item;
+	gchar *real_path;
+	gchar *quoted_path;
+	gchar *utf8_path;
+	gboolean found;
+
+	gint messages;
+	gint recent;
+	guint32 uid_next;
+	guint32 uid_validity;
+	gint unseen;
+} IMAPFolderStatus;
+
+typedef struct _IMAPStatusListData
+{
+	GPtrArray *status_array;
+	/* decoded real path -> IMAPFolderStatus */
+	GHashTable *status_table;
+	gboolean list_status;
+} IMAPStatusListData;
+
 static GList *session_list = NULL;
 
 static void imap_folder_init		(Folder		*folder,
@@ -132,6 +174,22 @@ static gint imap_search_flags		(IMAPSession	*session,
 static gint imap_fetch_flags		(IMAPSession	*session,
 					 GArray	       **uids,
 					 GHashTable    **flags_table);
+static gint imap_fetch_changed_flags	(IMAPSession	*session,
+					 guint64	 modseq,
+					 GArray	       **uids,
+					 GHashTable    **flags_table,
+					 GArray	       **vanished);
+static gboolean imap_check_changed_flags(GSList		*mlist,
+					 GArray		*uids,
+					 GArray		*vanished,
+					 gint		 exists);
+static gint imap_get_expunged_uids	(IMAPSession	*session,
+					 GSList		*mlist,
+					 GArray	       **vanished);
+static void imap_parse_uid_set		(const gchar	*str,
+					 GArray		*ranges);
+static gboolean imap_uid_in_ranges	(GArray		*ranges,
+					 guint32	 uid);
 
 static GSList *imap_get_msg_list	(Folder		*folder,
 					 FolderItem	*item,
@@ -213,6 +271,22 @@ static gint imap_remove_folder		(Folder		*folder,
 					 FolderItem	*item);
 
 static IMAPSession *imap_session_get	(Folder		*folder);
+static IMAPSession *imap_session_get_for_path
+					(Folder		*folder,
+					 const gchar	*path);
+static IMAPSession *imap_session_get_for_path_full
+					(Folder		*folder,
+					 const gchar	*path,
+					 gboolean	 parallel);
+static IMAPSession *imap_session_check	(Folder		*folder,
+					 Session	*session);
+static gboolean imap_session_is_running	(Session	*session);
+static IMAPSession *imap_session_hand_out(Session	*session,
+					  const gchar	*path);
+static void imap_session_cancel_hand_out(IMAPSession	*session);
+static void imap_session_pool_expire	(IMAPFolder	*folder);
+static gboolean imap_session_pool_keepalive_cb
+					(gpointer	 data);
 
 static gint imap_greeting		(IMAPSession	*session);
 static gint imap_auth			(IMAPSession	*session,
@@ -295,6 +369,16 @@ static gint imap_status				(IMAPSession	*session,
 						 guint32	*uid_next,
 						 guint32	*uid_validity,
 						 gint		*unseen);
+static gint imap_parse_status			(const gchar	*str,
+						 gint		*messages,
+						 gint		*recent,
+						 guint32	*uid_next,
+						 guint32	*uid_validity,
+						 gint		*unseen);
+static gint imap_get_status_list		(IMAPSession	*session,
+						 IMAPStatusListData *sdata);
+static gint imap_folder_status_set_path		(IMAPFolderStatus *status,
+						 const gchar	*real_path);
 
 static void imap_parse_namespace		(IMAPSession	*session,
 						 IMAPFolder	*folder);
@@ -334,6 +418,8 @@ static gint imap_cmd_login	(IMAPSession	*session,
 				 const gchar	*pass);
 static gint imap_cmd_logout	(IMAPSession	*session);
 static gint imap_cmd_noop	(IMAPSession	*session);
+static gint imap_cmd_enable	(IMAPSession	*session,
+				 const gchar	*capability);
 #if USE_SSL
 static gint imap_cmd_starttls	(IMAPSession	*session);
 #endif
@@ -399,6 +485,9 @@ static gint imap_cmd_ok_real	(IMAPSession	*session,
 				 GPtrArray	*argbuf);
 static gint imap_cmd_gen_send	(IMAPSession	*session,
 				 const gchar	*format, ...);
+static gint imap_cmd_gen_send_real
+				(IMAPSession	*session,
+				 const gchar	*cmd);
 static gint imap_cmd_gen_recv	(IMAPSession	*session,
 				 gchar	       **ret);
 
@@ -517,6 +606,7 @@ static void imap_folder_destroy(Folder *folder)
 		g_free(server);
 	}
 
+	imap_close_pooled_sessions(IMAP_FOLDER(folder));
 	folder_remote_folder_destroy(REMOTE_FOLDER(folder));
 }
 
@@ -527,10 +617,38 @@ static void imap_folder_init(Folder *folder, const gchar *name,
 	folder_remote_folder_init(folder, name, path);
 }
 
+/* the mailbox a session has selected or is about to select */
+#define IMAP_SESSION_MBOX(session)				\
+	(IMAP_SESSION(session)->pending_mbox ?			\
+	 IMAP_SESSION(session)->pending_mbox : IMAP_SESSION(session)->mbox)
+
 static IMAPSession *imap_session_get(Folder *folder)
+{
+	return imap_session_get_for_path(folder, NULL);
+}
+
+static IMAPSession *imap_session_get_for_path(Folder *folder,
+					      const gchar *path)
+{
+	return imap_session_get_for_path_full(folder, path, FALSE);
+}
+
+/* Returns an idle session of the account, preferring the one which has
+   path already selected. If every session is busy, a new connection is
+   added to the pool up to IMAP_SESSION_POOL_MAX. Operations on a folder
+   which is being used by a running session are not started in parallel
+   unless parallel is TRUE, in which case another connection selects the
+   folder as well (used by the independent fetch and copy requests).
+   The folder counts as used from the moment the session is handed out,
+   since its SELECT may still be on the way. */
+static IMAPSession *imap_session_get_for_path_full(Folder *folder,
+						   const gchar *path,
+						   gboolean parallel)
 {
 	RemoteFolder *rfolder = REMOTE_FOLDER(folder);
-	gint ret;
+	IMAPFolder *ifolder = IMAP_FOLDER(folder);
+	Session *session = NULL;
+	GList *cur;
 
 	g_return_val_if_fail(folder != NULL, NULL);
 	g_return_val_if_fail(FOLDER_TYPE(folder) == F_IMAP, NULL);
@@ -544,20 +662,102 @@ static IMAPSession *imap_session_get(Folder *folder)
 		if (rfolder->session)
 			imap_parse_namespace(IMAP_SESSION(rfolder->session),
 					     IMAP_FOLDER(folder));
-		return IMAP_SESSION(rfolder->session);
+		return imap_session_hand_out(rfolder->session, path);
 	}
 
-	if (imap_is_session_active(IMAP_FOLDER(folder))) {
-		g_warning("imap_session_get: session is busy.");
-		return NULL;
+	imap_session_pool_expire(ifolder);
+
+	if (path) {
+		if (strcmp2(IMAP_SESSION_MBOX(rfolder->session), path) == 0)
+			session = rfolder->session;
+		for (cur = ifolder->session_pool; !session && cur != NULL;
+		     cur = cur->next) {
+			if (strcmp2(IMAP_SESSION_MBOX(cur->data), path) == 0)
+				session = SESSION(cur->data);
+		}
+		if (session && imap_session_is_running(session)) {
+			if (!parallel) {
+				g_warning("imap_session_get: session is busy.");
+				return NULL;
+			}
+			session = NULL;
+		}
+	}
+
+	if (!session && !imap_session_is_running(rfolder->session))
+		session = rfolder->session;
+	for (cur = ifolder->session_pool; !session && cur != NULL;
+	     cur = cur->next) {
+		if (!imap_session_is_running(SESSION(cur->data)))
+			session = SESSION(cur->data);
+	}
+
+	if (!session) {
+		if (g_list_length(ifolder->session_pool) + 1 >=
+		    IMAP_SESSION_POOL_MAX) {
+			g_warning("imap_session_get: session is busy.");
+			return NULL;
+		}
+		debug_print("imap_session_get: adding a session to the pool "
+			    "(%d)\n", g_list_length(ifolder->session_pool) + 1);
+		session = imap_session_new(folder->account);
+		if (session) {
+			ifolder->session_pool =
+				g_list_append(ifolder->session_pool, session);
+			if (ifolder->session_pool_tag == 0)
+				ifolder->session_pool_tag = g_timeout_add_full
+					(G_PRIORITY_LOW,
+					 SESSION_TIMEOUT_INTERVAL * 1000,
+					 imap_session_pool_keepalive_cb,
+					 ifolder, NULL);
+		}
+		return imap_session_hand_out(session, path);
 	}
 
-	if (time(NULL) - rfolder->session->last_access_time <
+	return imap_session_hand_out
+		(SESSION(imap_session_check(folder, session)), path);
+}
+
+/* records the mailbox the session is going to select, so that another
+   request for it does not open a second connection meanwhile */
+static IMAPSession *imap_session_hand_out(Session *session, const gchar *path)
+{
+	IMAPSession *imap_session = IMAP_SESSION(session);
+
+	if (!imap_session)
+		return NULL;
+
+	g_free(imap_session->pending_mbox);
+	if (path && strcmp2(imap_session->mbox, path) != 0)
+		imap_session->pending_mbox = g_strdup(path);
+	else
+		imap_session->pending_mbox = NULL;
+
+	return imap_session;
+}
+
+/* forgets the mailbox recorded by imap_session_hand_out() when the
+   request finishes without selecting it */
+static void imap_session_cancel_hand_out(IMAPSession *session)
+{
+	g_free(session->pending_mbox);
+	session->pending_mbox = NULL;
+}
+
+/* sends NOOP to the session which has been idle for a while and
+   reconnects it if the connection has been lost */
+static IMAPSession *imap_session_check(Folder *folder, Session *session)
+{
+	RemoteFolder *rfolder = REMOTE_FOLDER(folder);
+	IMAPFolder *ifolder = IMAP_FOLDER(folder);
+	gint ret;
+
+	if (time(NULL) - session->last_access_time <
 		SESSION_TIMEOUT_INTERVAL) {
-		return IMAP_SESSION(rfolder->session);
+		return IMAP_SESSION(session);
 	}
 
-	if ((ret = imap_cmd_noop(IMAP_SESSION(rfolder->session))) != IMAP_SUCCESS) {
+	if ((ret = imap_cmd_noop(IMAP_SESSION(session))) != IMAP_SUCCESS) {
 		if (ret == IMAP_EAGAIN) {
 			g_warning("imap_session_get: session is busy.");
 			return NULL;
@@ -566,17 +766,95 @@ static IMAPSession *imap_session_get(Folder *folder)
 		log_warning(_("IMAP4 connection to %s has been"
 			      " disconnected. Reconnecting...\n"),
 			    folder->account->recv_server);
-		if (imap_session_reconnect(IMAP_SESSION(rfolder->session))
+		if (imap_session_reconnect(IMAP_SESSION(session))
 		    == IMAP_SUCCESS)
-			imap_parse_namespace(IMAP_SESSION(rfolder->session),
+			imap_parse_namespace(IMAP_SESSION(session),
 					     IMAP_FOLDER(folder));
 		else {
-			session_destroy(rfolder->session);
-			rfolder->session = NULL;
+			if (session == rfolder->session)
+				rfolder->session = NULL;
+			else
+				ifolder->session_pool = g_list_remove
+					(ifolder->session_pool, session);
+			session_destroy(session);
+			return NULL;
 		}
 	}
 
-	return IMAP_SESSION(rfolder->session);
+	return IMAP_SESSION(session);
+}
+
+static gboolean imap_session_is_running(Session *session)
+{
+#if USE_THREADS
+	return ((IMAPRealSession *)session)->is_running;
+#else
+	return FALSE;
+#endif
+}
+
+/* closes the pooled sessions which have not been used for a while */
+static void imap_session_pool_expire(IMAPFolder *folder)
+{
+	GList *cur, *next;
+	Session *session;
+
+	for (cur = folder->session_pool; cur != NULL; cur = next) {
+		next = cur->next;
+		session = SESSION(cur->data);
+
+		if (imap_session_is_running(session) ||
+		    time(NULL) - session->last_access_time <
+		    IMAP_SESSION_POOL_TIMEOUT)
+			continue;
+
+		debug_print("imap_session_pool_expire: closing idle session\n");
+		folder->session_pool = g_list_delete_link(folder->session_pool,
+							  cur);
+		/* the reply is not waited for */
+		imap_cmd_gen_send(IMAP_SESSION(session), "LOGOUT");
+		session_destroy(session);
+	}
+}
+
+/* closes the expired pooled sessions and keeps the other idle ones
+   alive with NOOP, so that they are not dropped by the server */
+static gboolean imap_session_pool_keepalive_cb(gpointer data)
+{
+	IMAPFolder *folder = IMAP_FOLDER(data);
+	GList *cur;
+	Session *session = NULL;
+
+	imap_session_pool_expire(folder);
+
+	for (cur = folder->session_pool; cur != NULL; cur = cur->next) {
+		if (!imap_session_is_running(SESSION(cur->data)) &&
+		    time(NULL) - SESSION(cur->data)->last_access_time >=
+		    SESSION_TIMEOUT_INTERVAL) {
+			session = SESSION(cur->data);
+			break;
+		}
+	}
+
+	/* one session per call, since the folder may change meanwhile */
+	if (session) {
+		debug_print("imap_session_pool_keepalive_cb: "
+			    "sending NOOP\n");
+		if (imap_cmd_noop(IMAP_SESSION(session)) != IMAP_SUCCESS &&
+		    !imap_session_is_running(session) &&
+		    g_list_find(folder->session_pool, session)) {
+			folder->session_pool =
+				g_list_remove(folder->session_pool, session);
+			session_destroy(session);
+		}
+	}
+
+	if (folder->session_pool == NULL) {
+		folder->session_pool_tag = 0;
+		return FALSE;
+	}
+
+	return TRUE;
 }
 
 static gint imap_greeting(IMAPSession *session)
@@ -679,7 +957,10 @@ static Session *imap_session_new(PrefsAccount *account)
 	session->authenticated = FALSE;
 	session->capability    = NULL;
 	session->uidplus       = FALSE;
+	session->qresync       = FALSE;
 	session->mbox          = NULL;
+	session->pending_mbox  = NULL;
+	session->highest_modseq = 0;
 	session->cmd_count     = 0;
 
 	session_list = g_list_append(session_list, session);
@@ -780,6 +1061,17 @@ static gint imap_session_connect(IMAPSession *session)
 		return IMAP_AUTHFAIL;
 	}
 
+	/* QRESYNC (RFC 7162) must be enabled explicitly to get VANISHED
+	   responses */
+	if (imap_has_capability(session, "QRESYNC") &&
+	    imap_has_capability(session, "ENABLE")) {
+		gint ok;
+
+		ok = imap_cmd_enable(session, "QRESYNC");
+		if (ok == IMAP_SOCKET || ok == IMAP_IOERR)
+			return IMAP_ERROR;
+	}
+
 	return IMAP_SUCCESS;
 }
 
@@ -791,8 +1083,12 @@ static gint imap_session_reconnect(IMAPSession *session)
 
 	imap_capability_free(session);
 	session->uidplus = FALSE;
+	session->qresync = FALSE;
 	g_free(session->mbox);
 	session->mbox = NULL;
+	g_free(session->pending_mbox);
+	session->pending_mbox = NULL;
+	session->highest_modseq = 0;
 	session->authenticated = FALSE;
 	SESSION(session)->state = SESSION_READY;
 
@@ -809,6 +1105,7 @@ static void imap_session_destroy(Session *session)
 #endif
 	imap_capability_free(IMAP_SESSION(session));
 	g_free(IMAP_SESSION(session)->mbox);
+	g_free(IMAP_SESSION(session)->pending_mbox);
 	session_list = g_list_remove(session_list, session);
 }
 
@@ -890,6 +1187,16 @@ static gint imap_search_flags(IMAPSession *session, GArray **uids,
 
 static gint imap_fetch_flags(IMAPSession *session, GArray **uids,
 			     GHashTable **flags_table)
+{
+	return imap_fetch_changed_flags(session, 0, uids, flags_table, NULL);
+}
+
+/* Fetches the flags of the messages whose MODSEQ is greater than modseq
+   (all messages if modseq is 0). If vanished is not NULL and QRESYNC is
+   enabled, the UID ranges of the expunged messages are also returned. */
+static gint imap_fetch_changed_flags(IMAPSession *session, guint64 modseq,
+				     GArray **uids, GHashTable **flags_table,
+				     GArray **vanished)
 {
 	gint ok;
 	gchar *tmp;
@@ -898,8 +1205,32 @@ static gint imap_fetch_flags(IMAPSession *session, GArray **uids,
 	guint32 uid;
 	IMAPFlags flags;
 
-	if (imap_cmd_gen_send(session, "UID FETCH 1:* (UID FLAGS)") != IMAP_SUCCESS)
-		return IMAP_ERROR;
+	if (vanished)
+		*vanished = NULL;
+
+	if (modseq == 0) {
+		if (imap_cmd_gen_send(session, "UID FETCH 1:* (UID FLAGS)")
+		    != IMAP_SUCCESS)
+			return IMAP_ERROR;
+	} else if (modseq == session->highest_modseq) {
+		debug_print("imap_fetch_changed_flags: "
+			    "mailbox not changed (MODSEQ %" G_GUINT64_FORMAT
+			    ")\n", modseq);
+		*uids = g_array_new(FALSE, FALSE, sizeof(guint32));
+		*flags_table = g_hash_table_new(NULL, g_direct_equal);
+		return IMAP_SUCCESS;
+	} else {
+		gboolean use_vanished = vanished && session->qresync;
+
+		if (imap_cmd_gen_send(session, "UID FETCH 1:* (UID FLAGS) "
+				      "(CHANGEDSINCE %" G_GUINT64_FORMAT "%s)",
+				      modseq, use_vanished ? " VANISHED" : "")
+		    != IMAP_SUCCESS)
+			return IMAP_ERROR;
+		if (use_vanished)
+			*vanished = g_array_new(FALSE, FALSE,
+						sizeof(IMAPUIDRange));
+	}
 
 	*uids = g_array_new(FALSE, FALSE, sizeof(guint32));
 	*flags_table = g_hash_table_new(NULL, g_direct_equal);
@@ -922,11 +1253,22 @@ static gint imap_fetch_flags(IMAPSession *session, GArray **uids,
 		g_free(tmp);					\
 		g_hash_table_destroy(*flags_table);		\
 		g_array_free(*uids, TRUE);			\
+		if (vanished && *vanished)			\
+			g_array_free(*vanished, TRUE);		\
 		return IMAP_ERROR;				\
 	}							\
 }
 
 		PARSE_ONE_ELEMENT(' ');
+		if (!strcmp(buf, "VANISHED")) {
+			if (vanished && *vanished) {
+				if (!strncmp(cur_pos, "(EARLIER) ", 10))
+					cur_pos += 10;
+				imap_parse_uid_set(cur_pos, *vanished);
+			}
+			g_free(tmp);
+			continue;
+		}
 		PARSE_ONE_ELEMENT(' ');
 		if (strcmp(buf, "FETCH") != 0) {
 			g_free(tmp);
@@ -956,6 +1298,14 @@ static gint imap_fetch_flags(IMAPSession *session, GArray **uids,
 				PARSE_ONE_ELEMENT(')');
 				flags = imap_parse_imap_flags(buf);
 				flags |= IMAP_FLAG_DRAFT;
+			} else if (!strncmp(cur_pos, "MODSEQ ", 7)) {
+				cur_pos += 7;
+				if (*cur_pos != '(') {
+					g_warning("*cur_pos != '('\n");
+					break;
+				}
+				cur_pos++;
+				PARSE_ONE_ELEMENT(')');
 			} else {
 				g_warning("invalid FETCH response: %s\n", cur_pos);
 				break;
@@ -976,11 +1326,159 @@ static gint imap_fetch_flags(IMAPSession *session, GArray **uids,
 	if (ok != IMAP_SUCCESS) {
 		g_hash_table_destroy(*flags_table);
 		g_array_free(*uids, TRUE);
+		if (vanished && *vanished) {
+			g_array_free(*vanished, TRUE);
+			*vanished = NULL;
+		}
 	}
 
 	return ok;
 }
 
+/* Returns TRUE if the cached messages updated with the changed UIDs and
+   the vanished ranges add up to the number of messages on the server. */
+static gboolean imap_check_changed_flags(GSList *mlist, GArray *uids,
+					 GArray *vanished, gint exists)
+{
+	GHashTable *msg_table;
+	GSList *cur;
+	gint count = 0;
+	gint i;
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+		if (!imap_uid_in_ranges(vanished, msginfo->msgnum))
+			count++;
+	}
+
+	msg_table = procmsg_msg_hash_table_create(mlist);
+	for (i = 0; i < uids->len; i++) {
+		guint32 uid;
+
+		uid = g_array_index(uids, guint32, i);
+		if (!msg_table ||
+		    !g_hash_table_lookup(msg_table, GUINT_TO_POINTER(uid)))
+			count++;
+	}
+	if (msg_table)
+		g_hash_table_destroy(msg_table);
+
+	debug_print("imap_check_changed_flags: %d (exists: %d)\n",
+		    count, exists);
+
+	return count == exists;
+}
+
+static gint imap_uid_range_compare(gconstpointer a, gconstpointer b)
+{
+	const IMAPUIDRange *ra = a, *rb = b;
+
+	if (ra->first < rb->first)
+		return -1;
+	if (ra->first > rb->first)
+		return 1;
+	return 0;
+}
+
+/* parses a sequence set like "1:3,5,7:9" and keeps it sorted */
+static void imap_parse_uid_set(const gchar *str, GArray *ranges)
+{
+	gchar *p = (gchar *)str;
+	IMAPUIDRange range;
+
+	while (g_ascii_isdigit(*p)) {
+		range.first = range.last = strtoul(p, &p, 10);
+		if (*p == ':') {
+			p++;
+			range.last = strtoul(p, &p, 10);
+			if (range.last < range.first) {
+				guint32 tmp = range.first;
+				range.first = range.last;
+				range.last = tmp;
+			}
+		}
+		g_array_append_val(ranges, range);
+		if (*p != ',')
+			break;
+		p++;
+	}
+
+	g_array_sort(ranges, imap_uid_range_compare);
+}
+
+/* Without QRESYNC, the server does not report expunged messages with
+   CHANGEDSINCE, and an expunge and a new arrival keep the message count
+   unchanged. The cached messages which are not in the complete UID list
+   are returned as vanished ranges instead. */
+static gint imap_get_expunged_uids(IMAPSession *session, GSList *mlist,
+				   GArray **vanished)
+{
+	GArray *all_uids;
+	GHashTable *uid_table;
+	GSList *cur;
+	IMAPUIDRange range;
+	gint ok;
+	gint i;
+
+	*vanished = NULL;
+
+	ok = imap_cmd_search(session, "ALL", &all_uids);
+	if (ok != IMAP_SUCCESS)
+		return ok;
+
+	uid_table = g_hash_table_new(NULL, g_direct_equal);
+	for (i = 0; i < all_uids->len; i++) {
+		guint32 uid;
+
+		uid = g_array_index(all_uids, guint32, i);
+		g_hash_table_insert(uid_table, GUINT_TO_POINTER(uid),
+				    GINT_TO_POINTER(1));
+	}
+
+	*vanished = g_array_new(FALSE, FALSE, sizeof(IMAPUIDRange));
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+
+		if (!g_hash_table_lookup(uid_table,
+					 GUINT_TO_POINTER(msginfo->msgnum))) {
+			range.first = range.last = msginfo->msgnum;
+			g_array_append_val(*vanished, range);
+		}
+	}
+	g_array_sort(*vanished, imap_uid_range_compare);
+
+	debug_print("imap_get_expunged_uids: %u of %u UIDs expunged\n",
+		    (*vanished)->len, g_slist_length(mlist));
+
+	g_hash_table_destroy(uid_table);
+	g_array_free(all_uids, TRUE);
+
+	return IMAP_SUCCESS;
+}
+
+static gboolean imap_uid_in_ranges(GArray *ranges, guint32 uid)
+{
+	gint lo, hi, mid;
+
+	if (!ranges || ranges->len == 0)
+		return FALSE;
+
+	/* find the last range which starts at or before uid */
+	lo = 0;
+	hi = ranges->len - 1;
+	while (lo < hi) {
+		mid = (lo + hi + 1) / 2;
+		if (g_array_index(ranges, IMAPUIDRange, mid).first <= uid)
+			lo = mid;
+		else
+			hi = mid - 1;
+	}
+
+	return g_array_index(ranges, IMAPUIDRange, lo).first <= uid &&
+		uid <= g_array_index(ranges, IMAPUIDRange, lo).last;
+}
+
 static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 				      gboolean use_cache,
 				      gboolean uncached_only)
@@ -999,7 +1497,7 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 
 	item->new = item->unread = item->total = 0;
 
-	session = imap_session_get(folder);
+	session = imap_session_get_for_path(folder, item->path);
 
 	if (!session) {
 		if (uncached_only)
@@ -1028,8 +1526,10 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 
 	if (use_cache) {
 		GArray *uids;
+		GArray *vanished = NULL;
 		GHashTable *msg_table;
 		GHashTable *flags_table;
+		gboolean changed_only = FALSE;
 		guint32 cache_last;
 		guint32 begin = 0;
 		GSList *cur, *next = NULL;
@@ -1042,20 +1542,71 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 		procmsg_set_flags(mlist, item);
 		cache_last = procmsg_get_last_num_in_msg_list(mlist);
 
+		/* get only the flags changed since the last sync if the
+		   mailbox supports CONDSTORE */
+		if (item->modseq > 0 && session->highest_modseq > 0) {
+			ok = imap_fetch_changed_flags(session, item->modseq,
+						      &uids, &flags_table,
+						      &vanished);
+			if (ok == IMAP_SOCKET || ok == IMAP_IOERR) THROW;
+			if (ok == IMAP_SUCCESS && !session->qresync &&
+			    item->modseq != session->highest_modseq) {
+				ok = imap_get_expunged_uids(session, mlist,
+							    &vanished);
+				if (ok != IMAP_SUCCESS) {
+					g_array_free(uids, TRUE);
+					g_hash_table_destroy(flags_table);
+					if (ok == IMAP_SOCKET ||
+					    ok == IMAP_IOERR)
+						THROW;
+				}
+			}
+			if (ok == IMAP_SUCCESS &&
+			    !imap_check_changed_flags(mlist, uids, vanished,
+						      exists)) {
+				debug_print("imap_get_msg_list: "
+					    "message count mismatch. "
+					    "fetching all flags.\n");
+				g_array_free(uids, TRUE);
+				g_hash_table_destroy(flags_table);
+				if (vanished) {
+					g_array_free(vanished, TRUE);
+					vanished = NULL;
+				}
+				ok = IMAP_ERROR;
+			}
+			changed_only = (ok == IMAP_SUCCESS);
+		}
+
 		/* get all UID list and flags */
+		if (!changed_only) {
 #if 0
-		ok = imap_search_flags(session, &uids, &flags_table);
-		if (ok != IMAP_SUCCESS) {
-			if (ok == IMAP_SOCKET || ok == IMAP_IOERR) THROW;
+			ok = imap_search_flags(session, &uids, &flags_table);
+			if (ok != IMAP_SUCCESS) {
+				if (ok == IMAP_SOCKET || ok == IMAP_IOERR)
+					THROW;
+				ok = imap_fetch_flags(session, &uids,
+						      &flags_table);
+				if (ok != IMAP_SUCCESS) THROW;
+			}
+#else
 			ok = imap_fetch_flags(session, &uids, &flags_table);
 			if (ok != IMAP_SUCCESS) THROW;
-		}
-#else
-		ok = imap_fetch_flags(session, &uids, &flags_table);
-		if (ok != IMAP_SUCCESS) THROW;
 #endif
+		}
+
+		if (changed_only) {
+			gint i;
 
-		if (uids->len > 0) {
+			last_uid = cache_last;
+			for (i = 0; i < uids->len; i++) {
+				guint32 uid;
+
+				uid = g_array_index(uids, guint32, i);
+				if (uid > last_uid)
+					last_uid = uid;
+			}
+		} else if (uids->len > 0) {
 			first_uid = g_array_index(uids, guint32, 0);
 			last_uid = g_array_index(uids, guint32, uids->len - 1);
 		} else {
@@ -1073,6 +1624,10 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 				 GUINT_TO_POINTER(msginfo->msgnum)));
 
 			if (imap_flags == 0) {
+				if (changed_only &&
+				    !imap_uid_in_ranges(vanished,
+							msginfo->msgnum))
+					continue;
 				debug_print("imap_get_msg_list: "
 					    "message %u has been deleted.\n",
 					    msginfo->msgnum);
@@ -1171,11 +1726,14 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 
 		g_array_free(uids, TRUE);
 		g_hash_table_destroy(flags_table);
+		if (vanished)
+			g_array_free(vanished, TRUE);
 
 		/* remove ununsed caches */
-		if (first_uid > 0 && last_uid > 0) {
+		if (first_uid > 0)
 			mlist = imap_delete_cached_messages
 				(mlist, item, 0, first_uid - 1);
+		if (last_uid > 0) {
 			mlist = imap_delete_cached_messages
 				(mlist, item, begin > 0 ? begin : last_uid + 1,
 				 UINT_MAX);
@@ -1213,6 +1771,10 @@ static GSList *imap_get_msg_list_full(Folder *folder, FolderItem *item,
 	debug_print("cache_dirty: %d, mark_dirty: %d\n",
 		    item->cache_dirty, item->mark_dirty);
 
+	/* the flags in mlist are in sync with the server now, and the
+	   summary writes them out when it is closed */
+	item->modseq = session->highest_modseq;
+
 	if (!item->opened) {
 		item->mtime = uid_validity;
 		if (item->cache_dirty)
@@ -1281,7 +1843,7 @@ static gchar *imap_fetch_msg(Folder *folder, FolderItem *item, gint uid)
 		return filename;
 	}
 
-	session = imap_session_get(folder);
+	session = imap_session_get_for_path_full(folder, item->path, TRUE);
 	if (!session) {
 		g_free(filename);
 		return NULL;
@@ -1318,7 +1880,7 @@ static MsgInfo *imap_get_msginfo(Folder *folder, FolderItem *item, gint uid)
 	g_return_val_if_fail(folder != NULL, NULL);
 	g_return_val_if_fail(item != NULL, NULL);
 
-	session = imap_session_get(folder);
+	session = imap_session_get_for_path(folder, item->path);
 	g_return_val_if_fail(session != NULL, NULL);
 
 	ok = imap_select(session, IMAP_FOLDER(folder), item->path,
@@ -1514,11 +2076,6 @@ static gint imap_do_copy_msgs(Folder *folder, FolderItem *dest, GSList *msglist,
 	g_return_val_if_fail(dest != NULL, -1);
 	g_return_val_if_fail(msglist != NULL, -1);
 
-	session = imap_session_get(folder);
-	if (!session) return -1;
-
-	ui_update();
-
 	msginfo = (MsgInfo *)msglist->data;
 
 	src = msginfo->folder;
@@ -1527,6 +2084,11 @@ static gint imap_do_copy_msgs(Folder *folder, FolderItem *dest, GSList *msglist,
 		return -1;
 	}
 
+	session = imap_session_get_for_path_full(folder, src->path, TRUE);
+	if (!session) return -1;
+
+	ui_update();
+
 	ok = imap_select(session, IMAP_FOLDER(folder), src->path,
 			 NULL, NULL, NULL, NULL);
 	if (ok != IMAP_SUCCESS)
@@ -1684,7 +2246,7 @@ static gint imap_remove_msgs_by_seq_set(Folder *folder, FolderItem *item,
 
 	g_return_val_if_fail(seq_list != NULL, -1);
 
-	session = imap_session_get(folder);
+	session = imap_session_get_for_path(folder, item->path);
 	if (!session) return -1;
 
 	for (cur = seq_list; cur != NULL; cur = cur->next) {
@@ -1740,7 +2302,7 @@ static gint imap_remove_msgs(Folder *folder, FolderItem *item, GSList *msglist)
 	g_return_val_if_fail(item != NULL, -1);
 	g_return_val_if_fail(msglist != NULL, -1);
 
-	session = imap_session_get(folder);
+	session = imap_session_get_for_path(folder, item->path);
 	if (!session) return -1;
 
 	ok = imap_select(session, IMAP_FOLDER(folder), item->path,
@@ -1786,7 +2348,7 @@ static gint imap_remove_all_msg(Folder *folder, FolderItem *item)
 	g_return_val_if_fail(folder != NULL, -1);
 	g_return_val_if_fail(item != NULL, -1);
 
-	session = imap_session_get(folder);
+	session = imap_session_get_for_path(folder, item->path);
 	if (!session) return -1;
 
 	ok = imap_select(session, IMAP_FOLDER(folder), item->path,
@@ -1847,22 +2409,23 @@ static gint imap_close(Folder *folder, FolderItem *item)
 	if (!REMOTE_FOLDER(folder)->session)
 		return 0;
 
-	session = imap_session_get(folder);
+	session = imap_session_get_for_path(folder, item->path);
 	if (!session) return -1;
 
-	if (session->mbox) {
-		if (strcmp2(session->mbox, item->path) != 0) return -1;
+	/* no session has the folder selected */
+	if (session->pending_mbox) {
+		imap_session_cancel_hand_out(session);
+		return 0;
+	}
 
-		ok = imap_cmd_close(session);
-		if (ok != IMAP_SUCCESS)
-			log_warning(_("can't close folder\n"));
+	ok = imap_cmd_close(session);
+	if (ok != IMAP_SUCCESS)
+		log_warning(_("can't close folder\n"));
 
-		g_free(session->mbox);
-		session->mbox = NULL;
+	g_free(session->mbox);
+	session->mbox = NULL;
 
-		return ok;
-	} else
-		return 0;
+	return ok;
 }
 
 static gint imap_scan_folder(Folder *folder, FolderItem *item)
@@ -1875,6 +2438,7 @@ static gint imap_scan_folder(Folder *folder, FolderItem *item)
 	g_return_val_if_fail(folder != NULL, -1);
 	g_return_val_if_fail(item != NULL, -1);
 
+	/* STATUS does not select the folder, so any idle session will do */
 	session = imap_session_get(folder);
 	if (!session) return -1;
 
@@ -1892,6 +2456,82 @@ static gint imap_scan_folder(Folder *folder, FolderItem *item)
 	return 0;
 }
 
+/* Refreshes the counts of many folders at once with LIST-STATUS or
+   pipelined STATUS commands instead of one round-trip per folder. */
+gint imap_scan_folder_list(Folder *folder, GSList *item_list)
+{
+	IMAPSession *session;
+	IMAPStatusListData sdata;
+	IMAPFolderStatus *status;
+	FolderItem *item;
+	GSList *cur;
+	gchar *real_path;
+	gint i;
+	gint ok;
+
+	g_return_val_if_fail(folder != NULL, -1);
+	g_return_val_if_fail(FOLDER_TYPE(folder) == F_IMAP, -1);
+
+	if (!item_list)
+		return 0;
+
+	session = imap_session_get(folder);
+	if (!session) return -1;
+
+	sdata.status_array = g_ptr_array_new();
+	sdata.status_table = g_hash_table_new(g_str_hash, g_str_equal);
+	sdata.list_status = imap_has_capability(session, "LIST-STATUS");
+
+	for (cur = item_list; cur != NULL; cur = cur->next) {
+		item = FOLDER_ITEM(cur->data);
+		if (!item->path || item->no_select)
+			continue;
+
+		status = g_new0(IMAPFolderStatus, 1);
+		status->item = item;
+		real_path = imap_get_real_path(IMAP_FOLDER(folder), item->path);
+		ok = imap_folder_status_set_path(status, real_path);
+		g_free(real_path);
+		if (ok != IMAP_SUCCESS) {
+			g_free(status);
+			continue;
+		}
+		g_ptr_array_add(sdata.status_array, status);
+		g_hash_table_insert(sdata.status_table, status->utf8_path,
+				    status);
+	}
+
+	debug_print("imap_scan_folder_list: %d folders (LIST-STATUS: %d)\n",
+		    sdata.status_array->len, sdata.list_status);
+
+	ok = imap_get_status_list(session, &sdata);
+
+	for (i = 0; i < sdata.status_array->len; i++) {
+		status = g_ptr_array_index(sdata.status_array, i);
+		item = status->item;
+
+		if (status->found) {
+			item->new = status->unseen > 0 ? status->recent : 0;
+			item->unread = status->unseen;
+			item->total = status->messages;
+			item->last_num = (status->messages > 0 &&
+					  status->uid_next > 0)
+				? status->uid_next - 1 : 0;
+			item->updated = TRUE;
+		}
+
+		g_free(status->utf8_path);
+		g_free(status->quoted_path);
+		g_free(status->real_path);
+		g_free(status);
+	}
+
+	g_hash_table_destroy(sdata.status_table);
+	g_ptr_array_free(sdata.status_array, TRUE);
+
+	return ok == IMAP_SUCCESS ? 0 : -1;
+}
+
 static gint imap_scan_tree(Folder *folder)
 {
 	FolderItem *item = NULL;
@@ -2712,6 +3352,7 @@ typedef struct _IMAPGetData
 	FolderItem *item;
 	gint exists;
 	gboolean update_count;
+	GSList *seq_list;
 	GSList *newlist;
 } IMAPGetData;
 
@@ -2734,14 +3375,20 @@ static gint imap_get_uncached_messages_func(IMAPSession *session, gpointer data)
 	GSList *llast = NULL;
 	GString *str;
 	MsgInfo *msginfo;
-	gint count = 1;
-	GTimeVal tv_prev, tv_cur;
+	gint count = 1, n_msgs = 0;
+	GTimeVal tv_start, tv_prev, tv_cur;
 	IMAPGetData *get_data = (IMAPGetData *)data;
 	FolderItem *item = get_data->item;
 	gint exists = get_data->exists;
 	gboolean update_count = get_data->update_count;
+	GSList *next_seq = get_data->seq_list;
+	gint n_cmds, n_sent = 0, n_done = 0;
+	gint cmd_num;
+	gchar cmd_status[IMAPBUFSIZE + 1];
+	gdouble elapsed;
 
-	g_get_current_time(&tv_prev);
+	g_get_current_time(&tv_start);
+	tv_prev = tv_start;
 #ifndef USE_THREADS
 	ui_update();
 #endif
@@ -2750,9 +3397,22 @@ static gint imap_get_uncached_messages_func(IMAPSession *session, gpointer data)
 	((IMAPRealSession *)session)->prog_total = exists;
 #endif
 
+	/* keep several FETCH commands in flight so that the server does not
+	   wait for us between the chunks */
+	n_cmds = g_slist_length(get_data->seq_list);
+	while (next_seq && n_sent < IMAP_ENVELOPE_PIPELINE) {
+		if (imap_cmd_envelope(session, (gchar *)next_seq->data)
+		    != IMAP_SUCCESS) {
+			log_warning(_("can't get envelope\n"));
+			return IMAP_SOCKET;
+		}
+		next_seq = next_seq->next;
+		n_sent++;
+	}
+
 	str = g_string_new(NULL);
 
-	for (;;) {
+	while (n_done < n_cmds) {
 		if (exists > 0 && count <= exists) {
 			g_get_current_time(&tv_cur);
 			if (tv_cur.tv_sec > tv_prev.tv_sec ||
@@ -2778,8 +3438,29 @@ static gint imap_get_uncached_messages_func(IMAPSession *session, gpointer data)
 		strretchomp(tmp);
 		if (tmp[0] != '*' || tmp[1] != ' ') {
 			log_print("IMAP4< %s\n", tmp);
+			if (sscanf(tmp, "%d %" Xstr(IMAPBUFSIZE) "s",
+				   &cmd_num, cmd_status) < 2) {
+				log_warning(_("error occurred while getting envelope.\n"));
+				g_free(tmp);
+				g_string_free(str, TRUE);
+				return IMAP_ERROR;
+			}
+			if (strcmp(cmd_status, "OK") != 0)
+				log_warning(_("can't get envelope\n"));
 			g_free(tmp);
-			break;
+			n_done++;
+
+			if (next_seq) {
+				if (imap_cmd_envelope
+					(session, (gchar *)next_seq->data)
+				    != IMAP_SUCCESS) {
+					g_string_free(str, TRUE);
+					return IMAP_SOCKET;
+				}
+				next_seq = next_seq->next;
+				n_sent++;
+			}
+			continue;
 		}
 		if (strstr(tmp, "FETCH") == NULL) {
 			log_print("IMAP4< %s\n", tmp);
@@ -2818,23 +3499,96 @@ static gint imap_get_uncached_messages_func(IMAPSession *session, gpointer data)
 
 		if (update_count)
 			item->total++;
+		n_msgs++;
 	}
 
 	g_string_free(str, TRUE);
 
+	g_get_current_time(&tv_cur);
+	elapsed = (tv_cur.tv_sec - tv_start.tv_sec) +
+		(tv_cur.tv_usec - tv_start.tv_usec) / (gdouble)G_USEC_PER_SEC;
+	debug_print("imap_get_uncached_messages: %d messages in %d commands, "
+		    "%.2f sec (%.1f messages/sec)\n", n_msgs, n_cmds, elapsed,
+		    elapsed > 0 ? n_msgs / elapsed : 0.0);
+
 	session_set_access_time(SESSION(session));
 
 	get_data->newlist = newlist;
 	return IMAP_SUCCESS;
 }
 
+/* split the UIDs from first_uid to last_uid into the sets of FETCH
+   commands of about IMAP_ENVELOPE_CHUNK messages each */
+static GSList *imap_get_envelope_seq_list(guint32 first_uid,
+					  guint32 last_uid, gint exists)
+{
+	GSList *seq_list = NULL;
+	guint32 uid, step, n_chunks;
+
+	if (first_uid == 0 && last_uid == 0)
+		return g_slist_append(NULL, g_strdup("1:*"));
+
+	/* UIDs may be sparse: divide the range evenly by the expected
+	   number of messages */
+	n_chunks = exists > IMAP_ENVELOPE_CHUNK
+		? (exists + IMAP_ENVELOPE_CHUNK - 1) / IMAP_ENVELOPE_CHUNK : 1;
+	step = (last_uid - first_uid) / n_chunks + 1;
+	if (step < IMAP_ENVELOPE_CHUNK)
+		step = IMAP_ENVELOPE_CHUNK;
+
+	for (uid = first_uid; ; uid += step) {
+		if (last_uid - uid < step) {
+			seq_list = g_slist_prepend
+				(seq_list,
+				 g_strdup_printf("%u:%u", uid, last_uid));
+			break;
+		}
+		seq_list = g_slist_prepend
+			(seq_list, g_strdup_printf("%u:%u", uid, uid + step - 1));
+	}
+
+	return g_slist_reverse(seq_list);
+}
+
+static gint imap_uid_compare(gconstpointer a, gconstpointer b)
+{
+	guint32 uid1 = *(const guint32 *)a;
+	guint32 uid2 = *(const guint32 *)b;
+
+	return uid1 < uid2 ? -1 : uid1 > uid2 ? 1 : 0;
+}
+
+/* split the UIDs of the whole folder into the sets of FETCH commands of
+   IMAP_ENVELOPE_CHUNK messages each */
+static GSList *imap_get_envelope_seq_list_all(IMAPSession *session)
+{
+	GSList *seq_list = NULL;
+	GArray *uids;
+	guint i, last;
+
+	if (imap_cmd_search(session, "ALL", &uids) != IMAP_SUCCESS)
+		return NULL;
+
+	g_array_sort(uids, imap_uid_compare);
+	for (i = 0; i < uids->len; i += IMAP_ENVELOPE_CHUNK) {
+		last = MIN(i + IMAP_ENVELOPE_CHUNK, uids->len) - 1;
+		seq_list = g_slist_prepend
+			(seq_list,
+			 g_strdup_printf("%u:%u", g_array_index(uids, guint32, i),
+					 g_array_index(uids, guint32, last)));
+	}
+
+	g_array_free(uids, TRUE);
+
+	return g_slist_reverse(seq_list);
+}
+
 static GSList *imap_get_uncached_messages(IMAPSession *session,
 					  FolderItem *item,
 					  guint32 first_uid, guint32 last_uid,
 					  gint exists, gboolean update_count)
 {
-	IMAPGetData get_data = {item, exists, update_count, NULL};
-	gchar seq_set[22];
+	IMAPGetData get_data = {item, exists, update_count, NULL, NULL};
 	gint ok;
 
 	g_return_val_if_fail(session != NULL, NULL);
@@ -2843,15 +3597,13 @@ static GSList *imap_get_uncached_messages(IMAPSession *session,
 	g_return_val_if_fail(FOLDER_TYPE(item->folder) == F_IMAP, NULL);
 	g_return_val_if_fail(first_uid <= last_uid, NULL);
 
-	if (first_uid == 0 && last_uid == 0)
-		strcpy(seq_set, "1:*");
-	else
-		g_snprintf(seq_set, sizeof(seq_set), "%u:%u",
-			   first_uid, last_uid);
-	if (imap_cmd_envelope(session, seq_set) != IMAP_SUCCESS) {
-		log_warning(_("can't get envelope\n"));
-		return NULL;
-	}
+	/* a large folder is fetched by the UID ranges of its messages
+	   rather than in one command */
+	if (first_uid == 0 && last_uid == 0 && exists > IMAP_ENVELOPE_CHUNK)
+		get_data.seq_list = imap_get_envelope_seq_list_all(session);
+	if (!get_data.seq_list)
+		get_data.seq_list = imap_get_envelope_seq_list
+			(first_uid, last_uid, exists);
 
 #if USE_THREADS
 	ok = imap_thread_run_progress(session, imap_get_uncached_messages_func,
@@ -2861,6 +3613,9 @@ static GSList *imap_get_uncached_messages(IMAPSession *session,
 	ok = imap_get_uncached_messages_func(session, &get_data);
 #endif
 
+	slist_free_strings(get_data.seq_list);
+	g_slist_free(get_data.seq_list);
+
 	progress_show(0, 0);
 	return get_data.newlist;
 }
@@ -3445,6 +4200,15 @@ static MsgInfo *imap_parse_envelope(IMAPSession *session, FolderItem *item,
 			cur_pos++;
 			PARSE_ONE_ELEMENT(')');
 			imap_flags = imap_parse_flags(buf);
+		} else if (!strncmp(cur_pos, "MODSEQ ", 7)) {
+			cur_pos += 7;
+			if (*cur_pos != '(') {
+				g_warning("MODSEQ: *cur_pos != '('\n");
+				procmsg_msginfo_free(msginfo);
+				return NULL;
+			}
+			cur_pos++;
+			PARSE_ONE_ELEMENT(')');
 		} else if (!strncmp(cur_pos, "RFC822.SIZE ", 12)) {
 			cur_pos += 12;
 			size = strtol(cur_pos, &cur_pos, 10);
@@ -3502,7 +4266,7 @@ static gint imap_msg_list_change_perm_flags(GSList *msglist, MsgPermFlags flags,
 	folder = msginfo->folder->folder;
 	g_return_val_if_fail(FOLDER_TYPE(folder) == F_IMAP, -1);
 
-	session = imap_session_get(folder);
+	session = imap_session_get_for_path(folder, msginfo->folder->path);
 	if (!session) return -1;
 
 	ok = imap_select(session, IMAP_FOLDER(folder), msginfo->folder->path,
@@ -3587,7 +4351,7 @@ gint imap_msg_list_set_colorlabel_flags(GSList *msglist, guint color)
 	folder = msginfo->folder->folder;
 	g_return_val_if_fail(FOLDER_TYPE(folder) == F_IMAP, -1);
 
-	session = imap_session_get(folder);
+	session = imap_session_get_for_path(folder, msginfo->folder->path);
 	if (!session) return -1;
 
 	ok = imap_select(session, IMAP_FOLDER(folder), msginfo->folder->path,
@@ -3694,6 +4458,8 @@ static gint imap_select(IMAPSession *session, IMAPFolder *folder,
 		log_warning(_("can't select folder: %s\n"), real_path);
 	else
 		session->mbox = g_strdup(path);
+	g_free(session->pending_mbox);
+	session->pending_mbox = NULL;
 	g_free(real_path);
 
 	return ok;
@@ -3735,32 +4501,8 @@ static gint imap_status(IMAPSession *session, IMAPFolder *folder,
 	str = search_array_str(argbuf, "STATUS");
 	if (!str) THROW(IMAP_ERROR);
 
-	str = strrchr_with_skip_quote(str, '"', '(');
-	if (!str) THROW(IMAP_ERROR);
-	str++;
-	while (*str != '\0' && *str != ')') {
-		while (*str == ' ') str++;
-
-		if (!strncmp(str, "MESSAGES ", 9)) {
-			str += 9;
-			*messages = strtol(str, &str, 10);
-		} else if (!strncmp(str, "RECENT ", 7)) {
-			str += 7;
-			*recent = strtol(str, &str, 10);
-		} else if (!strncmp(str, "UIDNEXT ", 8)) {
-			str += 8;
-			*uid_next = strtoul(str, &str, 10);
-		} else if (!strncmp(str, "UIDVALIDITY ", 12)) {
-			str += 12;
-			*uid_validity = strtoul(str, &str, 10);
-		} else if (!strncmp(str, "UNSEEN ", 7)) {
-			str += 7;
-			*unseen = strtol(str, &str, 10);
-		} else {
-			g_warning("invalid STATUS response: %s\n", str);
-			break;
-		}
-	}
+	ok = imap_parse_status(str, messages, recent, uid_next, uid_validity,
+			       unseen);
 
 catch:
 	g_free(real_path);
@@ -3772,6 +4514,186 @@ catch:
 	return ok;
 }
 
+static gint imap_parse_status(const gchar *str, gint *messages, gint *recent,
+			      guint32 *uid_next, guint32 *uid_validity,
+			      gint *unseen)
+{
+	gchar *p;
+
+	p = strrchr_with_skip_quote(str, '"', '(');
+	if (!p) return IMAP_ERROR;
+	p++;
+	while (*p != '\0' && *p != ')') {
+		while (*p == ' ') p++;
+
+		if (!strncmp(p, "MESSAGES ", 9)) {
+			p += 9;
+			*messages = strtol(p, &p, 10);
+		} else if (!strncmp(p, "RECENT ", 7)) {
+			p += 7;
+			*recent = strtol(p, &p, 10);
+		} else if (!strncmp(p, "UIDNEXT ", 8)) {
+			p += 8;
+			*uid_next = strtoul(p, &p, 10);
+		} else if (!strncmp(p, "UIDVALIDITY ", 12)) {
+			p += 12;
+			*uid_validity = strtoul(p, &p, 10);
+		} else if (!strncmp(p, "UNSEEN ", 7)) {
+			p += 7;
+			*unseen = strtol(p, &p, 10);
+		} else {
+			g_warning("invalid STATUS response: %s\n", p);
+			break;
+		}
+	}
+
+	return IMAP_SUCCESS;
+}
+
+/* Stores a STATUS response into the entry of the mailbox named in it.
+   Servers may answer pipelined commands in any order and may send
+   unsolicited STATUS responses, so the name is the only reliable key. */
+static void imap_parse_status_response(IMAPStatusListData *sdata,
+				       const gchar *str)
+{
+	IMAPFolderStatus *status;
+	gchar name[IMAPBUFSIZE];
+	gchar *utf8_name;
+	const gchar *p = str + 7;
+
+	if (*p == '"')
+		get_quoted(p, '"', name, sizeof(name));
+	else if (!strchr_cpy(p, ' ', name, sizeof(name)))
+		return;
+
+	utf8_name = imap_modified_utf7_to_utf8(name);
+	status = g_hash_table_lookup(sdata->status_table, utf8_name);
+	if (!status && !g_ascii_strcasecmp(utf8_name, "INBOX"))
+		status = g_hash_table_lookup(sdata->status_table, "INBOX");
+	g_free(utf8_name);
+	if (!status) {
+		debug_print("imap_parse_status_response: "
+			    "unknown mailbox: %s\n", name);
+		return;
+	}
+
+	if (imap_parse_status(str, &status->messages, &status->recent,
+			      &status->uid_next, &status->uid_validity,
+			      &status->unseen) == IMAP_SUCCESS)
+		status->found = TRUE;
+}
+
+/* reads the responses up to the next tagged one */
+static gint imap_get_status_list_recv(IMAPSession *session,
+				      IMAPStatusListData *sdata)
+{
+	gchar *tmp;
+	gint ok;
+	gint cmd_num;
+	gchar cmd_status[IMAPBUFSIZE + 1];
+
+	for (;;) {
+		if ((ok = imap_cmd_gen_recv(session, &tmp)) != IMAP_SUCCESS)
+			return ok;
+		if (tmp[0] == '*' && tmp[1] == ' ') {
+			if (!strncmp(tmp + 2, "STATUS ", 7))
+				imap_parse_status_response(sdata, tmp + 2);
+			g_free(tmp);
+			continue;
+		}
+
+		if (sscanf(tmp, "%d %" Xstr(IMAPBUFSIZE) "s",
+			   &cmd_num, cmd_status) < 2)
+			ok = IMAP_ERROR;
+		else if (strcmp(cmd_status, "OK") != 0)
+			ok = IMAP_ERROR;
+		g_free(tmp);
+		return ok;
+	}
+}
+
+static gint imap_get_status_list_func(IMAPSession *session, gpointer data)
+{
+	IMAPStatusListData *sdata = (IMAPStatusListData *)data;
+	IMAPFolderStatus *status;
+	GPtrArray *pending;
+	gchar buf[IMAPBUFSIZE];
+	gint n_sent = 0, n_done = 0;
+	gint i;
+	gint ok = IMAP_SUCCESS;
+
+	/* LIST-STATUS (RFC 5819) returns all of them with one command */
+	if (sdata->list_status) {
+		ok = imap_cmd_gen_send_real(session, "LIST \"\" \"*\" "
+					    "RETURN (STATUS ("
+					    IMAP_STATUS_ITEMS "))");
+		if (ok != IMAP_SUCCESS)
+			return ok;
+		ok = imap_get_status_list_recv(session, sdata);
+		if (ok == IMAP_SOCKET)
+			return ok;
+	}
+
+	/* pipeline STATUS for the rest. The untagged responses are
+	   matched by mailbox name, the tagged ones only count the
+	   commands in flight. */
+	pending = g_ptr_array_new();
+	for (i = 0; i < sdata->status_array->len; i++) {
+		status = g_ptr_array_index(sdata->status_array, i);
+		if (!status->found)
+			g_ptr_array_add(pending, status);
+	}
+
+	while (n_done < pending->len) {
+		if (n_sent < pending->len &&
+		    n_sent - n_done < IMAP_STATUS_PIPELINE) {
+			status = g_ptr_array_index(pending, n_sent);
+			g_snprintf(buf, sizeof(buf), "STATUS %s (%s)",
+				   status->quoted_path, IMAP_STATUS_ITEMS);
+			ok = imap_cmd_gen_send_real(session, buf);
+			if (ok != IMAP_SUCCESS)
+				break;
+			n_sent++;
+			continue;
+		}
+
+		ok = imap_get_status_list_recv(session, sdata);
+		if (ok == IMAP_SOCKET || ok == IMAP_IOERR)
+			break;
+		if (ok != IMAP_SUCCESS)
+			log_warning(_("error on imap command: STATUS\n"));
+		ok = IMAP_SUCCESS;
+		n_done++;
+	}
+
+	g_ptr_array_free(pending, TRUE);
+
+	return ok;
+}
+
+static gint imap_get_status_list(IMAPSession *session,
+				 IMAPStatusListData *sdata)
+{
+#if USE_THREADS
+	return imap_thread_run(session, imap_get_status_list_func, sdata);
+#else
+	return imap_get_status_list_func(session, sdata);
+#endif
+}
+
+static gint imap_folder_status_set_path(IMAPFolderStatus *status,
+					const gchar *real_path)
+{
+	gchar *real_path_;
+
+	QUOTE_IF_REQUIRED(real_path_, real_path);
+	status->real_path = g_strdup(real_path);
+	status->quoted_path = g_strdup(real_path_);
+	status->utf8_path = imap_modified_utf7_to_utf8(real_path);
+
+	return IMAP_SUCCESS;
+}
+
 #undef THROW
 
 static gboolean imap_has_capability(IMAPSession	*session,
@@ -3963,6 +4885,29 @@ static gint imap_cmd_noop(IMAPSession *session)
 	return imap_cmd_ok(session, NULL);
 }
 
+static gint imap_cmd_enable(IMAPSession *session, const gchar *capability)
+{
+	gint ok;
+	GPtrArray *argbuf;
+	gchar *str;
+
+	argbuf = g_ptr_array_new();
+
+	ok = imap_cmd_gen_send(session, "ENABLE %s", capability);
+	if (ok == IMAP_SUCCESS)
+		ok = imap_cmd_ok(session, argbuf);
+	if (ok == IMAP_SUCCESS) {
+		str = search_array_str(argbuf, "ENABLED");
+		if (str && strcasestr(str, "QRESYNC"))
+			session->qresync = TRUE;
+	}
+
+	ptr_array_free_strings(argbuf);
+	g_ptr_array_free(argbuf, TRUE);
+
+	return ok;
+}
+
 #if USE_SSL
 static gint imap_cmd_starttls(IMAPSession *session)
 {
@@ -4029,8 +4974,10 @@ static gint imap_cmd_do_select(IMAPSession *session, const gchar *folder,
 	gchar *select_cmd;
 	gchar *folder_;
 	guint uid_validity_;
+	gboolean condstore;
 
 	*exists = *recent = *unseen = *uid_validity = 0;
+	session->highest_modseq = 0;
 	argbuf = g_ptr_array_new();
 
 	if (examine)
@@ -4038,8 +4985,13 @@ static gint imap_cmd_do_select(IMAPSession *session, const gchar *folder,
 	else
 		select_cmd = "SELECT";
 
+	condstore = session->qresync ||
+		imap_has_capability(session, "CONDSTORE");
+
 	QUOTE_IF_REQUIRED(folder_, folder);
-	if ((ok = imap_cmd_gen_send(session, "%s %s", select_cmd, folder_)) != IMAP_SUCCESS)
+	if ((ok = imap_cmd_gen_send(session, "%s %s%s", select_cmd, folder_,
+				    condstore ? " (CONDSTORE)" : ""))
+	    != IMAP_SUCCESS)
 		THROW;
 
 	if ((ok = imap_cmd_ok(session, argbuf)) != IMAP_SUCCESS) THROW;
@@ -4078,6 +5030,12 @@ static gint imap_cmd_do_select(IMAPSession *session, const gchar *folder,
 		}
 	}
 
+	/* NOMODSEQ is returned instead if the mailbox has no modseq */
+	resp_str = search_array_contain_str(argbuf, "HIGHESTMODSEQ");
+	if (resp_str && !strncmp(resp_str, "OK [HIGHESTMODSEQ ", 18))
+		session->highest_modseq =
+			g_ascii_strtoull(resp_str + 18, NULL, 10);
+
 catch:
 	ptr_array_free_strings(argbuf);
 	g_ptr_array_free(argbuf, TRUE);
@@ -4443,11 +5401,14 @@ static gint imap_cmd_copy(IMAPSession *session, const gchar *seq_set,
 	return ok;
 }
 
-gint imap_cmd_envelope(IMAPSession *session, const gchar *seq_set)
+static gint imap_cmd_envelope(IMAPSession *session, const gchar *seq_set)
 {
-	return imap_cmd_gen_send
-		(session, "UID FETCH %s (UID FLAGS RFC822.SIZE RFC822.HEADER)",
-		 seq_set);
+	gchar buf[IMAPBUFSIZE];
+
+	g_snprintf(buf, sizeof(buf),
+		   "UID FETCH %s (UID FLAGS RFC822.SIZE RFC822.HEADER)",
+		   seq_set);
+	return imap_cmd_gen_send_real(session, buf);
 }
 
 static gint imap_cmd_store(IMAPSession *session, const gchar *seq_set,
@@ -4590,9 +5551,7 @@ static gint imap_cmd_ok(IMAPSession *session, GPtrArray *argbuf)
 static gint imap_cmd_gen_send(IMAPSession *session, const gchar *format, ...)
 {
 	IMAPRealSession *real = (IMAPRealSession *)session;
-	gchar buf[IMAPBUFSIZE];
 	gchar tmp[IMAPBUFSIZE];
-	gchar *p;
 	va_list args;
 
 	va_start(args, format);
@@ -4606,17 +5565,31 @@ static gint imap_cmd_gen_send(IMAPSession *session, const gchar *format, ...)
 	}
 #endif
 
+	return imap_cmd_gen_send_real(session, tmp);
+}
+
+/* send a command without waiting for the previous ones to complete.
+   Used by the session thread itself to pipeline commands. */
+static gint imap_cmd_gen_send_real(IMAPSession *session, const gchar *cmd)
+{
+	gchar buf[IMAPBUFSIZE];
+	gchar tmp[IMAPBUFSIZE];
+	gchar *p;
+
 	session->cmd_count++;
 
-	g_snprintf(buf, sizeof(buf), "%d %s\r\n", session->cmd_count, tmp);
-	if (!g_ascii_strncasecmp(tmp, "LOGIN ", 6) &&
-	    (p = strchr(tmp + 6, ' '))) {
-		*p = '\0';
-		log_print("IMAP4> %d %s ********\n", session->cmd_count, tmp);
+	g_snprintf(buf, sizeof(buf), "%d %s\r\n", session->cmd_count, cmd);
+	if (!g_ascii_strncasecmp(cmd, "LOGIN ", 6)) {
+		strncpy2(tmp, cmd, sizeof(tmp));
+		if ((p = strchr(tmp + 6, ' ')) != NULL)
+			*p = '\0';
+		log_print("IMAP4> %d %s%s\n", session->cmd_count, tmp,
+			  p ? " ********" : "");
 	} else
-		log_print("IMAP4> %d %s\n", session->cmd_count, tmp);
+		log_print("IMAP4> %d %s\n", session->cmd_count, cmd);
 
-	sock_write_all(SESSION(session)->sock, buf, strlen(buf));
+	if (sock_write_all(SESSION(session)->sock, buf, strlen(buf)) < 0)
+		return IMAP_SOCKET;
 
 	return IMAP_SUCCESS;
 }
@@ -5201,9 +6174,16 @@ gboolean imap_is_session_active(IMAPFolder *folder)
 {
 #if USE_THREADS
 	IMAPRealSession *real;
+	GList *cur;
 
 	g_return_val_if_fail(folder != NULL, FALSE);
 
+	for (cur = folder->session_pool; cur != NULL; cur = cur->next) {
+		real = (IMAPRealSession *)cur->data;
+		if (real->is_running)
+			return TRUE;
+	}
+
 	real = (IMAPRealSession *)(REMOTE_FOLDER(folder)->session);
 	if (!real)
 		return FALSE;
@@ -5213,3 +6193,68 @@ gboolean imap_is_session_active(IMAPFolder *folder)
 	return FALSE;
 #endif
 }
+
+/* pooled sessions which were running a command when they were closed */
+static GList *closing_session_list = NULL;
+static guint closing_session_tag = 0;
+
+static gboolean imap_close_finished_sessions_cb(gpointer data)
+{
+	GList *cur, *next;
+	Session *session;
+
+	for (cur = closing_session_list; cur != NULL; cur = next) {
+		next = cur->next;
+		session = SESSION(cur->data);
+
+		if (imap_session_is_running(session))
+			continue;
+
+		debug_print("imap_close_finished_sessions_cb: "
+			    "closing session\n");
+		closing_session_list =
+			g_list_delete_link(closing_session_list, cur);
+		session_destroy(session);
+	}
+
+	if (closing_session_list == NULL) {
+		closing_session_tag = 0;
+		return FALSE;
+	}
+
+	return TRUE;
+}
+
+void imap_close_pooled_sessions(IMAPFolder *folder)
+{
+	GList *cur, *next;
+	Session *session;
+
+	g_return_if_fail(folder != NULL);
+
+	if (folder->session_pool_tag > 0) {
+		g_source_remove(folder->session_pool_tag);
+		folder->session_pool_tag = 0;
+	}
+
+	for (cur = folder->session_pool; cur != NULL; cur = next) {
+		next = cur->next;
+		session = SESSION(cur->data);
+
+		folder->session_pool = g_list_delete_link(folder->session_pool,
+							  cur);
+
+		/* the running ones are closed when their command finishes */
+		if (imap_session_is_running(session)) {
+			closing_session_list =
+				g_list_append(closing_session_list, session);
+			if (closing_session_tag == 0)
+				closing_session_tag = g_timeout_add
+					(1000, imap_close_finished_sessions_cb,
+					 NULL);
+			continue;
+		}
+
+		session_destroy(session);
+	}
+}
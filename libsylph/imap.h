@@ -55,6 +55,10 @@ struct _IMAPFolder
 	GList *ns_personal;
 	GList *ns_others;
 	GList *ns_shared;
+
+	/* additional sessions used while the main session is busy */
+	GList *session_pool;
+	guint session_pool_tag;
 };
 
 struct _IMAPSession
@@ -65,8 +69,12 @@ struct _IMAPSession
 
 	gchar **capability;
 	gboolean uidplus;
+	gboolean qresync;
 
 	gchar *mbox;
+	/* mailbox the session has been handed out for, until it is selected */
+	gchar *pending_mbox;
+	guint64 highest_modseq;
 	guint cmd_count;
 };
 
@@ -125,6 +133,10 @@ gint imap_msg_list_unset_perm_flags	(GSList		*msglist,
 gint imap_msg_list_set_colorlabel_flags	(GSList		*msglist,
 					 guint		 color);
 
+gint imap_scan_folder_list		(Folder		*folder,
+					 GSList		*item_list);
+
 gboolean imap_is_session_active		(IMAPFolder	*folder);
+void imap_close_pooled_sessions		(IMAPFolder	*folder);
 
 #endif /* __IMAP_H__ */
@@ -21,6 +21,10 @@
 #  include "config.h"
 #endif
 
+#if HAVE_COPY_FILE_RANGE && !defined(_GNU_SOURCE)
+#  define _GNU_SOURCE
+#endif
+
 #include "defs.h"
 
 #include <glib.h>
@@ -32,11 +36,19 @@
 #include <sys/file.h>
 #include <ctype.h>
 #include <time.h>
+#include <errno.h>
+#if HAVE_SYS_SENDFILE_H
+#  include <sys/sendfile.h>
+#endif
 
 #ifdef HAVE_LOCKFILE_H
 #  include <lockfile.h>
 #endif
 
+#ifdef G_OS_WIN32
+#  include <windows.h>
+#endif
+
 #include "mbox.h"
 #include "procmsg.h"
 #include "procheader.h"
@@ -47,6 +59,19 @@
 #include "account.h"
 #include "utils.h"
 
+/* the messages of a mapped mbox are written out and their headers parsed
+   from the mapping by a pool of worker threads if there are at least MBOX_IMPORT_THREAD_MIN of them,
+   in chunks of MBOX_IMPORT_CHUNK. At most MBOX_IMPORT_WINDOW chunks per
+   thread are processed ahead of the filtering. */
+#define MBOX_IMPORT_THREAD_MIN		256
+#define MBOX_IMPORT_CHUNK		32
+#define MBOX_IMPORT_WINDOW		4
+#define MBOX_IMPORT_MAX_THREADS		8
+
+#ifndef O_BINARY
+#  define O_BINARY	0
+#endif
+
 #define FPUTS_TO_TMP_ABORT_IF_FAIL(s) \
 { \
 	if (fputs(s, tmp_fp) == EOF) { \
@@ -59,6 +84,44 @@
 	} \
 }
 
+typedef struct _MboxMsg
+{
+	const gchar *from;	/* the "From " line */
+	const gchar *body;	/* the line following it */
+	const gchar *end;
+
+	gchar *file;
+	MsgInfo *msginfo;
+} MboxMsg;
+
+typedef struct _MboxImportData
+{
+	GArray *msgs;
+	gchar *tmp_base;
+	gboolean *chunk_done;
+#if USE_THREADS
+	GMutex *mutex;
+	GCond *cond;
+#endif
+} MboxImportData;
+
+static gint proc_mbox_mapped	(FolderItem	*dest,
+				 const gchar	*mbox,
+				 GMappedFile	*map,
+				 GHashTable	*folder_table,
+				 gboolean	 apply_filter,
+				 GSList		*junk_fltlist);
+static gint proc_mbox_stream	(FolderItem	*dest,
+				 const gchar	*mbox,
+				 GHashTable	*folder_table,
+				 gboolean	 apply_filter,
+				 GSList		*junk_fltlist);
+static gint proc_mbox_add_msg	(FolderItem	*dest,
+				 MsgInfo	*msginfo,
+				 GHashTable	*folder_table,
+				 gboolean	 apply_filter,
+				 GSList		*junk_fltlist);
+
 gint proc_mbox(FolderItem *dest, const gchar *mbox, GHashTable *folder_table)
 {
 	return proc_mbox_full(dest, mbox, folder_table,
@@ -71,15 +134,11 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 		    GHashTable *folder_table, gboolean apply_filter,
 		    gboolean filter_junk)
 {
-	FILE *mbox_fp;
-	gchar buf[BUFFSIZE], from_line[BUFFSIZE];
-	gchar *tmp_file;
-	gint new_msgs = 0;
-	guint count = 0;
-	Folder *folder;
+	GMappedFile *map;
 	FilterRule *junk_rule = NULL;
 	GSList junk_fltlist = {NULL, NULL};
-	FolderItem *junk;
+	GSList *junk_list = NULL;
+	gint ret;
 
 	g_return_val_if_fail(dest != NULL, -1);
 	g_return_val_if_fail(dest->folder != NULL, -1);
@@ -87,6 +146,496 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 
 	debug_print(_("Getting messages from %s into %s...\n"), mbox, dest->path);
 
+	if (filter_junk) {
+		FolderItem *junk;
+
+		junk = folder_get_junk(dest->folder);
+		junk_rule = filter_junk_rule_create(NULL, junk, FALSE);
+		junk_fltlist.data = junk_rule;
+		if (junk_rule && prefs_common.enable_junk)
+			junk_list = &junk_fltlist;
+	}
+
+	/* read the mbox from memory if it can be mapped (it may be too
+	   large for the address space) */
+	map = g_mapped_file_new(mbox, FALSE, NULL);
+	if (map && g_mapped_file_get_length(map) > 0)
+		ret = proc_mbox_mapped(dest, mbox, map, folder_table,
+				       apply_filter, junk_list);
+	else
+		ret = proc_mbox_stream(dest, mbox, folder_table,
+				       apply_filter, junk_list);
+	if (map)
+		g_mapped_file_free(map);
+
+	if (junk_rule)
+		filter_rule_free(junk_rule);
+
+	if (ret >= 0)
+		debug_print("%d new messages found.\n", ret);
+
+	return ret;
+}
+
+/* filters msginfo and adds it to dest. msginfo is freed.
+   Returns 1 if the message is counted as new, 0 if not, or -1 on error. */
+static gint proc_mbox_add_msg(FolderItem *dest, MsgInfo *msginfo,
+			      GHashTable *folder_table, gboolean apply_filter,
+			      GSList *junk_fltlist)
+{
+	FilterInfo *fltinfo;
+	GSList *cur;
+	gboolean is_junk = FALSE;
+	gint ret = 0;
+
+	fltinfo = filter_info_new();
+	fltinfo->flags = msginfo->flags;
+
+	if (junk_fltlist && prefs_common.filter_junk_before) {
+		filter_apply_msginfo(junk_fltlist, msginfo, fltinfo);
+		if (fltinfo->drop_done)
+			is_junk = TRUE;
+	}
+
+	if (!fltinfo->drop_done && apply_filter)
+		filter_apply_msginfo(prefs_common.fltlist, msginfo, fltinfo);
+
+	if (!fltinfo->drop_done &&
+	    junk_fltlist && !prefs_common.filter_junk_before) {
+		filter_apply_msginfo(junk_fltlist, msginfo, fltinfo);
+		if (fltinfo->drop_done)
+			is_junk = TRUE;
+	}
+
+	if (fltinfo->actions[FLT_ACTION_MOVE] == FALSE &&
+	    fltinfo->actions[FLT_ACTION_DELETE] == FALSE) {
+		msginfo->flags = fltinfo->flags;
+		if (folder_item_add_msg_msginfo(dest, msginfo, FALSE) < 0) {
+			procmsg_msginfo_free(msginfo);
+			filter_info_free(fltinfo);
+			return -1;
+		}
+		fltinfo->dest_list = g_slist_append(fltinfo->dest_list, dest);
+	}
+
+	for (cur = fltinfo->dest_list; cur != NULL; cur = cur->next) {
+		FolderItem *drop_folder = (FolderItem *)cur->data;
+		gint val = 0;
+
+		if (folder_table) {
+			val = GPOINTER_TO_INT(g_hash_table_lookup
+					      (folder_table, drop_folder));
+		}
+		if (val == 0) {
+			if (folder_table) {
+				g_hash_table_insert(folder_table, drop_folder,
+						    GINT_TO_POINTER(1));
+			}
+		}
+	}
+
+	if (!is_junk &&
+	    fltinfo->actions[FLT_ACTION_DELETE] == FALSE &&
+	    fltinfo->actions[FLT_ACTION_MARK_READ] == FALSE)
+		ret = 1;
+
+	procmsg_msginfo_free(msginfo);
+	filter_info_free(fltinfo);
+
+	return ret;
+}
+
+static const gchar *mbox_next_line(const gchar *p, const gchar *endp)
+{
+	const gchar *nl;
+
+	nl = memchr(p, '\n', endp - p);
+	return nl ? nl + 1 : endp;
+}
+
+/* returns the first line beginning with "From " from p, which must be at
+   the beginning of a line */
+static const gchar *mbox_find_from(const gchar *p, const gchar *endp)
+{
+	while (endp - p >= 5) {
+		if (*p == 'F' && strncmp(p, "From ", 5) == 0)
+			return p;
+		p = memchr(p, '\n', endp - p);
+		if (!p)
+			return NULL;
+		p++;
+	}
+
+	return NULL;
+}
+
+/* the line following a "From " separator must be a header line */
+static gboolean mbox_is_header_line(const gchar *p, const gchar *endp)
+{
+	gchar buf[BUFFSIZE];
+	gsize len;
+
+	if (endp - p >= 6 && strncmp(p, ">From ", 6) == 0)
+		return TRUE;
+
+	len = MIN(mbox_next_line(p, endp) - p, sizeof(buf) - 1);
+	memcpy(buf, p, len);
+	buf[len] = '\0';
+
+	return is_header_line(buf);
+}
+
+/* splits the mbox into messages in one pass. Returns NULL if it does not
+   begin with a "From " line. */
+static GArray *mbox_split(const gchar *p, const gchar *endp)
+{
+	GArray *msgs;
+	MboxMsg msg;
+	const gchar *from, *sep, *next;
+
+	/* ignore empty lines on the head */
+	while (p < endp && (*p == '\n' || *p == '\r'))
+		p = mbox_next_line(p, endp);
+	if (endp - p < 5 || strncmp(p, "From ", 5) != 0)
+		return NULL;
+
+	msgs = g_array_new(FALSE, FALSE, sizeof(MboxMsg));
+	memset(&msg, 0, sizeof(msg));
+	msg.from = p;
+	msg.body = mbox_next_line(p, endp);
+
+	p = msg.body;
+	while ((from = mbox_find_from(p, endp)) != NULL) {
+		/* the last one of consecutive "From " lines is the
+		   separator */
+		sep = from;
+		next = mbox_next_line(sep, endp);
+		while (endp - next >= 5 && strncmp(next, "From ", 5) == 0) {
+			sep = next;
+			next = mbox_next_line(sep, endp);
+		}
+
+		if (next < endp && mbox_is_header_line(next, endp)) {
+			msg.end = from;
+			g_array_append_val(msgs, msg);
+			msg.from = sep;
+			msg.body = next;
+		} else if (next < endp)
+			g_warning(_("unescaped From found:\n%.*s"),
+				  (gint)(next - sep), sep);
+
+		p = next;
+	}
+
+	msg.end = endp;
+	g_array_append_val(msgs, msg);
+
+	return msgs;
+}
+
+/* writes a message to file, converting the "From " line into Return-Path
+   and unescaping ">From " lines */
+static gint mbox_write_msg(MboxMsg *msg, const gchar *file)
+{
+	FILE *fp;
+	const gchar *p, *q, *seg, *eol, *endp;
+	gchar *rpath;
+	gint ret = 0;
+
+	if ((fp = g_fopen(file, "wb")) == NULL) {
+		FILE_OP_ERROR(file, "fopen");
+		return -1;
+	}
+	if (change_file_mode_rw(fp, file) < 0)
+		FILE_OP_ERROR(file, "chmod");
+
+	eol = msg->body;
+	for (p = q = msg->from + 5; q < eol && *q != ' '; q++)
+		;
+	rpath = g_strndup(p, q - p);
+	g_strstrip(rpath);
+	if (fprintf(fp, "Return-Path: %s\n", rpath) < 0)
+		ret = -1;
+	g_free(rpath);
+
+	/* drop the empty line before the next "From " */
+	endp = msg->end;
+	if (endp > msg->body && endp[-1] == '\n') {
+		for (q = endp - 1; q > msg->body && q[-1] != '\n'; q--)
+			;
+		if (q > msg->body && (*q == '\n' || *q == '\r'))
+			endp = q;
+	}
+
+	seg = msg->body;
+	for (p = msg->body; p < endp && ret == 0;
+	     p = mbox_next_line(p, endp)) {
+		if (endp - p >= 6 && strncmp(p, ">From ", 6) == 0) {
+			if (fwrite(seg, p - seg, 1, fp) != 1 && p > seg)
+				ret = -1;
+			seg = p + 1;
+		}
+	}
+	if (ret == 0 && endp > seg && fwrite(seg, endp - seg, 1, fp) != 1)
+		ret = -1;
+
+	if (ret < 0)
+		FILE_OP_ERROR(file, "fwrite");
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(file, "fclose");
+		ret = -1;
+	}
+	if (ret < 0)
+		g_unlink(file);
+
+	return ret;
+}
+
+/* parses the header of a written message from the mapped mbox instead of
+   reading the file back */
+static MsgInfo *mbox_parse_msg(MboxMsg *msg, MsgFlags flags)
+{
+#if HAVE_FMEMOPEN
+	MsgInfo *msginfo;
+	GStatBuf s;
+	FILE *fp;
+
+	if (msg->end == msg->body ||
+	    (fp = fmemopen((gchar *)msg->body, msg->end - msg->body, "rb"))
+	    == NULL)
+		return procheader_parse_file(msg->file, flags, FALSE);
+
+	msginfo = procheader_parse_stream(fp, flags, FALSE);
+	fclose(fp);
+
+	if (msginfo && g_stat(msg->file, &s) == 0) {
+		msginfo->size = s.st_size;
+		msginfo->mtime = s.st_mtime;
+	}
+
+	return msginfo;
+#else
+	return procheader_parse_file(msg->file, flags, FALSE);
+#endif
+}
+
+static void mbox_import_chunk(MboxImportData *data, guint chunk)
+{
+	MsgFlags flags = {MSG_NEW|MSG_UNREAD, MSG_RECEIVED};
+	guint start, end, i;
+
+	start = chunk * MBOX_IMPORT_CHUNK;
+	end = MIN(start + MBOX_IMPORT_CHUNK, data->msgs->len);
+
+	for (i = start; i < end; i++) {
+		MboxMsg *msg;
+
+		msg = &g_array_index(data->msgs, MboxMsg, i);
+		msg->file = g_strdup_printf("%s.%u", data->tmp_base, i);
+		if (mbox_write_msg(msg, msg->file) < 0) {
+			g_free(msg->file);
+			msg->file = NULL;
+			continue;
+		}
+		msg->msginfo = mbox_parse_msg(msg, flags);
+		if (msg->msginfo)
+			msg->msginfo->file_path = g_strdup(msg->file);
+	}
+
+#if USE_THREADS
+	if (data->mutex) {
+		g_mutex_lock(data->mutex);
+		data->chunk_done[chunk] = TRUE;
+		g_cond_broadcast(data->cond);
+		g_mutex_unlock(data->mutex);
+		return;
+	}
+#endif
+	data->chunk_done[chunk] = TRUE;
+}
+
+#if USE_THREADS
+static gint mbox_get_n_import_threads(void)
+{
+	gint n = 1;
+
+#ifdef G_OS_WIN32
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	n = si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return CLAMP(n, 1, MBOX_IMPORT_MAX_THREADS);
+}
+
+static void mbox_import_worker(gpointer task, gpointer user_data)
+{
+	mbox_import_chunk((MboxImportData *)user_data,
+			  GPOINTER_TO_UINT(task) - 1);
+}
+#endif
+
+/* Imports a mapped mbox. The messages are located in one scan, written
+   out and parsed in chunks (by worker threads if there are many), and
+   filtered and added to dest in the order of the mbox on the calling
+   thread, since filter actions modify folders. */
+static gint proc_mbox_mapped(FolderItem *dest, const gchar *mbox,
+			     GMappedFile *map, GHashTable *folder_table,
+			     gboolean apply_filter, GSList *junk_fltlist)
+{
+	Folder *folder = dest->folder;
+	MboxImportData data;
+	const gchar *contents;
+	GArray *msgs;
+	guint n_chunks, chunk, i;
+	guint count = 0;
+	gint new_msgs = 0;
+	gboolean cancelled = FALSE;
+#if USE_THREADS
+	GThreadPool *pool = NULL;
+	guint n_pushed = 0;
+	gint n_threads;
+#endif
+
+	contents = g_mapped_file_get_contents(map);
+	msgs = mbox_split(contents,
+			  contents + g_mapped_file_get_length(map));
+	if (!msgs) {
+		g_warning(_("invalid mbox format: %s\n"), mbox);
+		return -1;
+	}
+
+	n_chunks = (msgs->len + MBOX_IMPORT_CHUNK - 1) / MBOX_IMPORT_CHUNK;
+
+	data.msgs = msgs;
+	data.tmp_base = get_tmp_file();
+	data.chunk_done = g_new0(gboolean, n_chunks);
+
+#if USE_THREADS
+	data.mutex = NULL;
+	data.cond = NULL;
+
+	n_threads = mbox_get_n_import_threads();
+	if (msgs->len >= MBOX_IMPORT_THREAD_MIN && n_threads > 1) {
+		data.mutex = g_mutex_new();
+		data.cond = g_cond_new();
+		pool = g_thread_pool_new(mbox_import_worker, &data,
+					 n_threads, TRUE, NULL);
+		if (pool) {
+			debug_print("Importing %d messages with %d threads...\n",
+				    msgs->len, n_threads);
+			while (n_pushed < n_chunks &&
+			       n_pushed < n_threads * MBOX_IMPORT_WINDOW) {
+				g_thread_pool_push
+					(pool, GUINT_TO_POINTER(++n_pushed),
+					 NULL);
+			}
+		}
+	}
+#endif
+
+	for (chunk = 0; chunk < n_chunks && !cancelled; chunk++) {
+		guint end;
+
+#if USE_THREADS
+		if (pool) {
+			g_mutex_lock(data.mutex);
+			while (!data.chunk_done[chunk])
+				g_cond_wait(data.cond, data.mutex);
+			g_mutex_unlock(data.mutex);
+
+			if (n_pushed < n_chunks)
+				g_thread_pool_push
+					(pool, GUINT_TO_POINTER(++n_pushed),
+					 NULL);
+		} else
+#endif
+			mbox_import_chunk(&data, chunk);
+
+		end = MIN((chunk + 1) * MBOX_IMPORT_CHUNK, msgs->len);
+		for (i = chunk * MBOX_IMPORT_CHUNK; i < end; i++) {
+			MboxMsg *msg = &g_array_index(msgs, MboxMsg, i);
+			gint val;
+
+			count++;
+			if (folder->ui_func)
+				folder->ui_func(folder, dest, folder->ui_func_data ? dest->folder->ui_func_data : GUINT_TO_POINTER(count));
+			if (folder_call_ui_func2(folder, dest, count, 0) == FALSE) {
+				debug_print("Import of mbox cancelled at %u\n", count);
+				cancelled = TRUE;
+				break;
+			}
+
+			if (!msg->file) {
+				g_warning(_("can't write to temporary file\n"));
+				new_msgs = -1;
+				break;
+			}
+			if (!msg->msginfo) {
+				g_warning("proc_mbox_mapped: can't parse the message");
+				new_msgs = -1;
+				break;
+			}
+
+			val = proc_mbox_add_msg(dest, msg->msginfo,
+						folder_table, apply_filter,
+						junk_fltlist);
+			msg->msginfo = NULL;
+			g_unlink(msg->file);
+			g_free(msg->file);
+			msg->file = NULL;
+			if (val < 0) {
+				new_msgs = -1;
+				break;
+			}
+			new_msgs += val;
+		}
+		if (new_msgs < 0)
+			break;
+	}
+
+#if USE_THREADS
+	if (pool)
+		g_thread_pool_free(pool, TRUE, TRUE);
+	if (data.mutex) {
+		g_cond_free(data.cond);
+		g_mutex_free(data.mutex);
+	}
+#endif
+
+	/* remove the messages left by cancel or error */
+	for (i = 0; i < msgs->len; i++) {
+		MboxMsg *msg = &g_array_index(msgs, MboxMsg, i);
+
+		if (msg->msginfo)
+			procmsg_msginfo_free(msg->msginfo);
+		if (msg->file) {
+			g_unlink(msg->file);
+			g_free(msg->file);
+		}
+	}
+
+	g_free(data.chunk_done);
+	g_free(data.tmp_base);
+	g_array_free(msgs, TRUE);
+
+	return new_msgs;
+}
+
+static gint proc_mbox_stream(FolderItem *dest, const gchar *mbox,
+			     GHashTable *folder_table, gboolean apply_filter,
+			     GSList *junk_fltlist)
+{
+	FILE *mbox_fp;
+	gchar buf[BUFFSIZE], from_line[BUFFSIZE];
+	gchar *tmp_file;
+	gint new_msgs = 0;
+	guint count = 0;
+	Folder *folder;
+
 	folder = dest->folder;
 
 	if ((mbox_fp = g_fopen(mbox, "rb")) == NULL) {
@@ -118,21 +667,14 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 
 	tmp_file = get_tmp_file();
 
-	if (filter_junk) {
-		junk = folder_get_junk(folder);
-		junk_rule = filter_junk_rule_create(NULL, junk, FALSE);
-		junk_fltlist.data = junk_rule;
-	}
-
 	do {
 		FILE *tmp_fp;
-		GSList *cur;
 		gchar *startp, *endp, *rpath;
 		gint empty_line;
 		gboolean is_next_msg = FALSE;
-		gboolean is_junk = FALSE;
-		FilterInfo *fltinfo;
+		MsgFlags flags = {MSG_NEW|MSG_UNREAD, MSG_RECEIVED};
 		MsgInfo *msginfo;
+		gint val;
 
 		count++;
 		if (folder->ui_func)
@@ -145,7 +687,6 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 		if ((tmp_fp = g_fopen(tmp_file, "wb")) == NULL) {
 			FILE_OP_ERROR(tmp_file, "fopen");
 			g_warning(_("can't open temporary file\n"));
-			filter_rule_free(junk_rule);
 			g_free(tmp_file);
 			fclose(mbox_fp);
 			return -1;
@@ -232,100 +773,35 @@ gint proc_mbox_full(FolderItem *dest, const gchar *mbox,
 		if (fclose(tmp_fp) == EOF) {
 			FILE_OP_ERROR(tmp_file, "fclose");
 			g_warning(_("can't write to temporary file\n"));
-			filter_rule_free(junk_rule);
 			g_unlink(tmp_file);
 			g_free(tmp_file);
 			fclose(mbox_fp);
 			return -1;
 		}
 
-		fltinfo = filter_info_new();
-		fltinfo->flags.perm_flags = MSG_NEW|MSG_UNREAD;
-		fltinfo->flags.tmp_flags = MSG_RECEIVED;
-
-		msginfo = procheader_parse_file(tmp_file, fltinfo->flags,
-						FALSE);
+		msginfo = procheader_parse_file(tmp_file, flags, FALSE);
 		if (!msginfo) {
-			g_warning("proc_mbox_full: procheader_parse_file failed");
-			filter_info_free(fltinfo);
-			filter_rule_free(junk_rule);
+			g_warning("proc_mbox_stream: procheader_parse_file failed");
 			g_unlink(tmp_file);
 			g_free(tmp_file);
 			fclose(mbox_fp);
 			return -1;
 		}
-		fltinfo->flags = msginfo->flags;
 		msginfo->file_path = g_strdup(tmp_file);
 
-		if (filter_junk && prefs_common.enable_junk &&
-		    prefs_common.filter_junk_before && junk_rule) {
-			filter_apply_msginfo(&junk_fltlist, msginfo, fltinfo);
-			if (fltinfo->drop_done)
-				is_junk = TRUE;
-		}
-
-		if (!fltinfo->drop_done && apply_filter)
-			filter_apply_msginfo(prefs_common.fltlist, msginfo,
-					     fltinfo);
-
-		if (!fltinfo->drop_done &&
-		    filter_junk && prefs_common.enable_junk &&
-		    !prefs_common.filter_junk_before && junk_rule) {
-			filter_apply_msginfo(&junk_fltlist, msginfo, fltinfo);
-			if (fltinfo->drop_done)
-				is_junk = TRUE;
-		}
-
-		if (fltinfo->actions[FLT_ACTION_MOVE] == FALSE &&
-		    fltinfo->actions[FLT_ACTION_DELETE] == FALSE) {
-			msginfo->flags = fltinfo->flags;
-			if (folder_item_add_msg_msginfo(dest, msginfo, FALSE) < 0) {
-				procmsg_msginfo_free(msginfo);
-				filter_info_free(fltinfo);
-				filter_rule_free(junk_rule);
-				g_unlink(tmp_file);
-				g_free(tmp_file);
-				fclose(mbox_fp);
-				return -1;
-			}
-			fltinfo->dest_list = g_slist_append(fltinfo->dest_list,
-							    dest);
-		}
-
-		for (cur = fltinfo->dest_list; cur != NULL; cur = cur->next) {
-			FolderItem *drop_folder = (FolderItem *)cur->data;
-			gint val = 0;
-
-			if (folder_table) {
-				val = GPOINTER_TO_INT(g_hash_table_lookup
-						      (folder_table,
-						       drop_folder));
-			}
-			if (val == 0) {
-				if (folder_table) {
-					g_hash_table_insert(folder_table,
-							    drop_folder,
-							    GINT_TO_POINTER(1));
-				}
-			}
-		}
-
-		if (!is_junk &&
-		    fltinfo->actions[FLT_ACTION_DELETE] == FALSE &&
-		    fltinfo->actions[FLT_ACTION_MARK_READ] == FALSE)
-			new_msgs++;
-
-		procmsg_msginfo_free(msginfo);
-		filter_info_free(fltinfo);
+		val = proc_mbox_add_msg(dest, msginfo, folder_table,
+					apply_filter, junk_fltlist);
 		g_unlink(tmp_file);
+		if (val < 0) {
+			g_free(tmp_file);
+			fclose(mbox_fp);
+			return -1;
+		}
+		new_msgs += val;
 	} while (from_line[0] != '\0');
 
-	if (junk_rule)
-		filter_rule_free(junk_rule);
-
 	g_free(tmp_file);
 	fclose(mbox_fp);
-	debug_print("%d new messages found.\n", new_msgs);
 
 	return new_msgs;
 }
@@ -487,6 +963,200 @@ void empty_mbox(const gchar *mbox)
 #endif
 }
 
+typedef struct _MboxExportMsg
+{
+	gchar *file;
+	gchar *from_line;
+	gboolean queued;
+} MboxExportMsg;
+
+static gchar *mbox_export_get_from_line(MsgInfo *msginfo,
+					PrefsAccount *cur_ac)
+{
+	gchar buf[BUFFSIZE];
+	time_t date_t_;
+
+	strncpy2(buf,
+		 msginfo->from ? msginfo->from :
+		 cur_ac && cur_ac->address ? cur_ac->address : "unknown",
+		 sizeof(buf));
+	extract_address(buf);
+
+	date_t_ = msginfo->date_t;
+	return g_strdup_printf("From %s %s", buf, ctime(&date_t_));
+}
+
+/* returns the message file in the same way as procmsg_open_message() */
+static gboolean mbox_export_get_msg(MsgInfo *msginfo, PrefsAccount *cur_ac,
+				    MboxExportMsg *msg)
+{
+	gchar *file;
+
+	file = procmsg_get_message_file_path(msginfo);
+	if (!file)
+		return FALSE;
+	if (!is_file_exist(file)) {
+		g_free(file);
+		file = procmsg_get_message_file(msginfo);
+		if (!file)
+			return FALSE;
+	}
+
+	msg->file = file;
+	msg->from_line = mbox_export_get_from_line(msginfo, cur_ac);
+	msg->queued = MSG_IS_QUEUED(msginfo->flags) != 0;
+
+	return TRUE;
+}
+
+static void mbox_export_msg_free(MboxExportMsg *msg)
+{
+	g_free(msg->file);
+	g_free(msg->from_line);
+}
+
+static gint mbox_write_all(gint fd, const gchar *buf, gsize len)
+{
+	gssize n;
+
+	while (len > 0) {
+		n = write(fd, buf, len);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		buf += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+/* copies len bytes of in_fd at offset, whose contents are also mapped at
+   data, to out_fd. The copy is done in the kernel if possible. */
+static gint mbox_copy_range(gint in_fd, off_t offset, const gchar *data,
+			    gsize len, gint out_fd)
+{
+#if HAVE_COPY_FILE_RANGE
+	while (len > 0) {
+#ifdef __linux__
+		loff_t off_in = offset;
+#else
+		off_t off_in = offset;
+#endif
+		gssize n;
+
+		n = copy_file_range(in_fd, &off_in, out_fd, NULL, len, 0);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		offset += n;
+		data += n;
+		len -= n;
+	}
+#endif
+#if HAVE_SYS_SENDFILE_H
+	while (len > 0) {
+		off_t off_in = offset;
+		gssize n;
+
+		n = sendfile(out_fd, in_fd, &off_in, len);
+		if (n < 0 && errno == EINTR)
+			continue;
+		if (n <= 0)
+			break;
+		offset += n;
+		data += n;
+		len -= n;
+	}
+#endif
+
+	return mbox_write_all(out_fd, data, len);
+}
+
+/* appends a message to the mbox. Messages without "From " lines are copied
+   as is, and the others are escaped line by line. */
+static gint mbox_export_msg(MboxExportMsg *msg, gint out_fd, guint64 *bytes)
+{
+	GMappedFile *map;
+	const gchar *contents, *p, *endp, *from, *seg;
+	gint in_fd;
+	gint ret = 0;
+
+	map = g_mapped_file_new(msg->file, FALSE, NULL);
+	if (!map) {
+		FILE_OP_ERROR(msg->file, "mmap");
+		return 0;
+	}
+	contents = g_mapped_file_get_contents(map);
+	endp = contents + g_mapped_file_get_length(map);
+	p = contents;
+
+	/* skip the header of queued messages */
+	if (msg->queued) {
+		while (p < endp && *p != '\r' && *p != '\n')
+			p = mbox_next_line(p, endp);
+		if (p < endp)
+			p = mbox_next_line(p, endp);
+	}
+
+	if (mbox_write_all(out_fd, msg->from_line, strlen(msg->from_line)) < 0)
+		ret = -1;
+	else if ((from = mbox_find_from(p, endp)) == NULL) {
+		if ((in_fd = g_open(msg->file, O_RDONLY | O_BINARY, 0)) < 0)
+			ret = mbox_write_all(out_fd, p, endp - p);
+		else {
+			ret = mbox_copy_range(in_fd, p - contents, p,
+					      endp - p, out_fd);
+			close(in_fd);
+		}
+	} else {
+		seg = p;
+		do {
+			if (mbox_write_all(out_fd, seg, from - seg) < 0 ||
+			    mbox_write_all(out_fd, ">", 1) < 0) {
+				ret = -1;
+				break;
+			}
+			seg = from;
+			from = mbox_find_from(mbox_next_line(from, endp),
+					      endp);
+		} while (from != NULL);
+		if (ret == 0)
+			ret = mbox_write_all(out_fd, seg, endp - seg);
+	}
+	if (ret == 0)
+		ret = mbox_write_all(out_fd, "\n", 1);
+
+	*bytes += endp - p;
+	g_mapped_file_free(map);
+
+	return ret;
+}
+
+static gint mbox_export_open(const gchar *mbox)
+{
+	gint fd;
+
+	if ((fd = g_open(mbox, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY,
+			 0666)) < 0)
+		FILE_OP_ERROR(mbox, "open");
+
+	return fd;
+}
+
+static gint mbox_export_close(const gchar *mbox, gint fd)
+{
+	if (close(fd) < 0) {
+		FILE_OP_ERROR(mbox, "close");
+		return -1;
+	}
+
+	return 0;
+}
+
 /* read all messages in SRC, and store them into one MBOX file. */
 gint export_to_mbox(FolderItem *src, const gchar *mbox)
 {
@@ -507,12 +1177,13 @@ gint export_msgs_to_mbox(FolderItem *src, GSList *mlist, const gchar *mbox)
 {
 	GSList *cur;
 	MsgInfo *msginfo;
-	FILE *msg_fp;
-	FILE *mbox_fp;
-	gchar buf[BUFFSIZE];
+	MboxExportMsg msg;
+	gint fd;
 	PrefsAccount *cur_ac;
 	guint count = 0, length;
-	time_t date_t_;
+	guint64 bytes = 0;
+	GTimeVal tv_start, tv_end;
+	gint ret = 0;
 
 	g_return_val_if_fail(src != NULL, -1);
 	g_return_val_if_fail(src->folder != NULL, -1);
@@ -522,14 +1193,13 @@ gint export_msgs_to_mbox(FolderItem *src, GSList *mlist, const gchar *mbox)
 	debug_print(_("Exporting messages from %s into %s...\n"),
 		    src->path, mbox);
 
-	if ((mbox_fp = g_fopen(mbox, "wb")) == NULL) {
-		FILE_OP_ERROR(mbox, "fopen");
+	if ((fd = mbox_export_open(mbox)) < 0)
 		return -1;
-	}
 
 	cur_ac = account_get_current_account();
 
 	length = g_slist_length(mlist);
+	g_get_current_time(&tv_start);
 
 	for (cur = mlist; cur != NULL; cur = cur->next) {
 		msginfo = (MsgInfo *)cur->data;
@@ -542,31 +1212,23 @@ gint export_msgs_to_mbox(FolderItem *src, GSList *mlist, const gchar *mbox)
 			break;
 		}
 
-		msg_fp = procmsg_open_message(msginfo);
-		if (!msg_fp)
+		if (!mbox_export_get_msg(msginfo, cur_ac, &msg))
 			continue;
-
-		strncpy2(buf,
-			 msginfo->from ? msginfo->from :
-			 cur_ac && cur_ac->address ?
-			 cur_ac->address : "unknown",
-			 sizeof(buf));
-		extract_address(buf);
-
-		date_t_ = msginfo->date_t;
-		fprintf(mbox_fp, "From %s %s", buf, ctime(&date_t_));
-
-		while (fgets(buf, sizeof(buf), msg_fp) != NULL) {
-			if (!strncmp(buf, "From ", 5))
-				fputc('>', mbox_fp);
-			fputs(buf, mbox_fp);
+		ret = mbox_export_msg(&msg, fd, &bytes);
+		mbox_export_msg_free(&msg);
+		if (ret < 0) {
+			g_warning(_("writing to %s failed.\n"), mbox);
+			break;
 		}
-		fputc('\n', mbox_fp);
-
-		fclose(msg_fp);
 	}
 
-	fclose(mbox_fp);
+	if (mbox_export_close(mbox, fd) < 0)
+		ret = -1;
 
-	return 0;
+	g_get_current_time(&tv_end);
+	debug_print("%" G_GUINT64_FORMAT " bytes exported in %ld ms\n", bytes,
+		    (tv_end.tv_sec - tv_start.tv_sec) * 1000 +
+		    (tv_end.tv_usec - tv_start.tv_usec) / 1000);
+
+	return ret;
 }
@@ -31,6 +31,9 @@
 #include <unistd.h>
 #include <string.h>
 #include <errno.h>
+#if HAVE_SYS_INOTIFY_H
+#  include <sys/inotify.h>
+#endif
 
 #ifdef G_OS_WIN32
 #  include <windows.h>
@@ -55,6 +58,18 @@ G_LOCK_DEFINE_STATIC(mh);
 #define S_UNLOCK(name)
 #endif
 
+/* uncached messages are parsed by a pool of worker threads if there are
+   at least MH_PARSE_THREAD_MIN of them, in chunks of MH_PARSE_CHUNK */
+#define MH_PARSE_THREAD_MIN	256
+#define MH_PARSE_CHUNK		64
+#define MH_PARSE_MAX_THREADS	8
+
+typedef struct _MHUncachedEntry
+{
+	gint num;
+	gchar *name;
+} MHUncachedEntry;
+
 static void	mh_folder_init		(Folder		*folder,
 					 const gchar	*name,
 					 const gchar	*path);
@@ -147,7 +162,11 @@ static GSList  *mh_get_uncached_msgs		(GHashTable	*msg_table,
 						 FolderItem	*item);
 static MsgInfo *mh_parse_msg			(const gchar	*file,
 						 FolderItem	*item);
+static void	mh_parse_uncached_msgs		(FolderItem	*item,
+						 GArray		*entries,
+						 MsgInfo       **msgs);
 static void	mh_remove_missing_folder_items	(Folder		*folder);
+static void	mh_watch_add_item		(FolderItem	*item);
 static void	mh_scan_tree_recursive		(FolderItem	*item);
 
 static gboolean mh_rename_folder_func		(GNode		*node,
@@ -421,25 +440,40 @@ static gchar *mh_get_new_msg_filename(FolderItem *dest)
 	return destfile;
 }
 
-#define SET_DEST_MSG_FLAGS(fp, dest, n, fl)				\
-{									\
-	MsgInfo newmsginfo;						\
-									\
-	newmsginfo.msgnum = n;						\
-	newmsginfo.flags = fl;						\
-	if (dest->stype == F_OUTBOX ||					\
-	    dest->stype == F_QUEUE  ||					\
-	    dest->stype == F_DRAFT) {					\
-		MSG_UNSET_PERM_FLAGS(newmsginfo.flags,			\
-				     MSG_NEW|MSG_UNREAD|MSG_DELETED);	\
-	} else if (dest->stype == F_TRASH) {				\
-		MSG_UNSET_PERM_FLAGS(newmsginfo.flags, MSG_DELETED);	\
-	}								\
-									\
-	if (fp)								\
-		procmsg_write_flags(&newmsginfo, fp);			\
-	else 								\
-		procmsg_add_mark_queue(dest, n, newmsginfo.flags);	\
+/* set the flags of the message added to dest.  they are collected in
+   flag_list if given, or queued otherwise */
+static void mh_set_dest_msg_flags(GSList **flag_list, FolderItem *dest,
+				  gint n, MsgFlags flags)
+{
+	MsgInfo *newmsginfo;
+
+	if (dest->stype == F_OUTBOX ||
+	    dest->stype == F_QUEUE  ||
+	    dest->stype == F_DRAFT) {
+		MSG_UNSET_PERM_FLAGS(flags, MSG_NEW|MSG_UNREAD|MSG_DELETED);
+	} else if (dest->stype == F_TRASH) {
+		MSG_UNSET_PERM_FLAGS(flags, MSG_DELETED);
+	}
+
+	if (flag_list) {
+		newmsginfo = g_new0(MsgInfo, 1);
+		newmsginfo->msgnum = n;
+		newmsginfo->flags = flags;
+		*flag_list = g_slist_prepend(*flag_list, newmsginfo);
+	} else
+		procmsg_add_mark_queue(dest, n, flags);
+}
+
+/* append the flags of the messages added to the closed folder to the
+   summary journal */
+static void mh_write_dest_flags(FolderItem *dest, GSList *flag_list)
+{
+	if (!flag_list)
+		return;
+
+	flag_list = g_slist_reverse(flag_list);
+	procmsg_write_journal_flags_list(dest, flag_list);
+	procmsg_msg_list_free(flag_list);
 }
 
 static gint mh_add_msg(Folder *folder, FolderItem *dest, const gchar *file,
@@ -466,7 +500,7 @@ static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 	MsgFileInfo *fileinfo;
 	MsgInfo *msginfo;
 	gint first_ = 0;
-	FILE *fp = NULL;
+	GSList *flag_list = NULL;
 
 	g_return_val_if_fail(dest != NULL, -1);
 	g_return_val_if_fail(file_list != NULL, -1);
@@ -478,11 +512,6 @@ static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 
 	S_LOCK(mh);
 
-	if (!dest->opened) {
-		if ((fp = procmsg_open_mark_file(dest, DATA_APPEND)) == NULL)
-			g_warning("mh_add_msgs: can't open mark file.");
-	}
-
 	for (cur = file_list; cur != NULL; cur = cur->next) {
 		MsgFlags flags = {MSG_NEW|MSG_UNREAD, 0};
 
@@ -491,7 +520,7 @@ static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 			flags = *fileinfo->flags;
 		msginfo = procheader_parse_file(fileinfo->file, flags, 0);
 		if (!msginfo) {
-			if (fp) fclose(fp);
+			mh_write_dest_flags(dest, flag_list);
 			S_UNLOCK(mh);
 			return -1;
 		}
@@ -509,7 +538,7 @@ static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 				g_warning(_("can't copy message %s to %s\n"),
 					  fileinfo->file, destfile);
 				g_free(destfile);
-				if (fp) fclose(fp);
+				mh_write_dest_flags(dest, flag_list);
 				S_UNLOCK(mh);
 				return -1;
 			}
@@ -532,7 +561,8 @@ static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 			dest->unmarked_num++;
 			procmsg_add_mark_queue(dest, dest->last_num, flags);
 		} else {
-			SET_DEST_MSG_FLAGS(fp, dest, dest->last_num, flags);
+			mh_set_dest_msg_flags(dest->opened ? NULL : &flag_list,
+					      dest, dest->last_num, flags);
 		}
 		procmsg_add_cache_queue(dest, dest->last_num, msginfo);
 		if (MSG_IS_NEW(flags))
@@ -541,8 +571,7 @@ static gint mh_add_msgs(Folder *folder, FolderItem *dest, GSList *file_list,
 			dest->unread++;
 	}
 
-	if (fp)
-		fclose(fp);
+	mh_write_dest_flags(dest, flag_list);
 
 	if (first)
 		*first = first_;
@@ -582,7 +611,7 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 	gchar *srcfile;
 	gchar *destfile;
 	gint first_ = 0;
-	FILE *fp = NULL;
+	GSList *flag_list = NULL;
 
 	g_return_val_if_fail(dest != NULL, -1);
 	g_return_val_if_fail(msglist != NULL, -1);
@@ -594,17 +623,12 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 
 	S_LOCK(mh);
 
-	if (!dest->opened) {
-		if ((fp = procmsg_open_mark_file(dest, DATA_APPEND)) == NULL)
-			g_warning("mh_add_msgs_msginfo: can't open mark file.");
-	}
-
 	for (cur = msglist; cur != NULL; cur = cur->next) {
 		msginfo = (MsgInfo *)cur->data;
 
 		destfile = mh_get_new_msg_filename(dest);
 		if (!destfile) {
-			if (fp) fclose(fp);
+			mh_write_dest_flags(dest, flag_list);
 			S_UNLOCK(mh);
 			return -1;
 		}
@@ -613,7 +637,7 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 
 		srcfile = procmsg_get_message_file(msginfo);
 		if (!srcfile) {
-			if (fp) fclose(fp);
+			mh_write_dest_flags(dest, flag_list);
 			g_free(destfile);
 			S_UNLOCK(mh);
 			return -1;
@@ -623,7 +647,7 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 				g_warning("mh_add_msgs_msginfo: can't copy message %s to %s", srcfile, destfile);
 				g_free(srcfile);
 				g_free(destfile);
-				if (fp) fclose(fp);
+				mh_write_dest_flags(dest, flag_list);
 				S_UNLOCK(mh);
 				return -1;
 			}
@@ -648,8 +672,9 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 			procmsg_add_mark_queue(dest, dest->last_num,
 					       msginfo->flags);
 		} else {
-			SET_DEST_MSG_FLAGS(fp, dest, dest->last_num,
-					   msginfo->flags);
+			mh_set_dest_msg_flags(dest->opened ? NULL : &flag_list,
+					      dest, dest->last_num,
+					      msginfo->flags);
 		}
 		procmsg_add_cache_queue(dest, dest->last_num, msginfo);
 		if (MSG_IS_NEW(msginfo->flags))
@@ -658,8 +683,7 @@ static gint mh_add_msgs_msginfo(Folder *folder, FolderItem *dest,
 			dest->unread++;
 	}
 
-	if (fp)
-		fclose(fp);
+	mh_write_dest_flags(dest, flag_list);
 
 	if (first)
 		*first = first_;
@@ -735,7 +759,8 @@ static gint mh_do_move_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 		dest->updated = TRUE;
 		dest->mtime = 0;
 
-		SET_DEST_MSG_FLAGS(NULL, dest, dest->last_num, msginfo->flags);
+		mh_set_dest_msg_flags(NULL, dest, dest->last_num,
+				      msginfo->flags);
 		procmsg_add_cache_queue(dest, dest->last_num, msginfo);
 
 		if (MSG_IS_NEW(msginfo->flags)) {
@@ -849,7 +874,8 @@ static gint mh_copy_msgs(Folder *folder, FolderItem *dest, GSList *msglist)
 		dest->updated = TRUE;
 		dest->mtime = 0;
 
-		SET_DEST_MSG_FLAGS(NULL, dest, dest->last_num, msginfo->flags);
+		mh_set_dest_msg_flags(NULL, dest, dest->last_num,
+				      msginfo->flags);
 		procmsg_add_cache_queue(dest, dest->last_num, msginfo);
 
 		if (MSG_IS_NEW(msginfo->flags))
@@ -1052,6 +1078,7 @@ static gint mh_scan_folder_full(Folder *folder, FolderItem *item,
 	gint max = 0;
 	gint num;
 	gint n_msg = 0;
+	time_t cur_mtime;
 
 	g_return_val_if_fail(item != NULL, -1);
 
@@ -1059,6 +1086,18 @@ static gint mh_scan_folder_full(Folder *folder, FolderItem *item,
 
 	S_LOCK(mh);
 
+	/* skip reading the directory if it has not been modified */
+	cur_mtime = mh_get_mtime(item);
+	if (cur_mtime > 0 && item->scan_mtime == cur_mtime) {
+		debug_print("mh_scan_folder(): %s is not modified\n",
+			    item->path);
+		if (folder->ui_func)
+			folder->ui_func(folder, item, folder->ui_func_data);
+		n_msg = item->scan_n_msg;
+		max = item->scan_last_num;
+		goto count;
+	}
+
 	path = folder_item_get_path(item);
 	if (!path) {
 		S_UNLOCK(mh);
@@ -1118,6 +1157,18 @@ static gint mh_scan_folder_full(Folder *folder, FolderItem *item,
 	closedir(dp);
 #endif
 
+	/* a file added later in the same second would not change the
+	   mtime, so only a past mtime is remembered */
+	if (cur_mtime > 0 && cur_mtime < time(NULL)) {
+		item->scan_mtime = cur_mtime;
+		item->scan_n_msg = n_msg;
+		item->scan_last_num = max;
+	} else
+		item->scan_mtime = 0;
+
+count:
+	mh_watch_add_item(item);
+
 	if (n_msg == 0)
 		item->new = item->unread = item->total = 0;
 	else if (count_sum) {
@@ -1473,16 +1524,26 @@ static time_t mh_get_mtime(FolderItem *item)
 	}
 }
 
+static gint mh_uncached_entry_compare(gconstpointer a, gconstpointer b)
+{
+	return ((const MHUncachedEntry *)a)->num -
+		((const MHUncachedEntry *)b)->num;
+}
+
 static GSList *mh_get_uncached_msgs(GHashTable *msg_table, FolderItem *item)
 {
 	gchar *path;
 	GDir *dp;
 	const gchar *dir_name;
 	GSList *newlist = NULL;
-	GSList *last = NULL;
 	MsgInfo *msginfo;
+	MsgInfo **msgs;
+	GArray *entries;
+	MHUncachedEntry entry;
 	gint n_newmsg = 0;
 	gint num;
+	gint count = 0;
+	gint i;
 	Folder *folder;
 
 	g_return_val_if_fail(item != NULL, NULL);
@@ -1505,72 +1566,166 @@ static GSList *mh_get_uncached_msgs(GHashTable *msg_table, FolderItem *item)
 
 	debug_print("Searching uncached messages...\n");
 
-	if (msg_table) {
-		gint count = 0;
+	/* collect the uncached files first, then parse them */
+	entries = g_array_new(FALSE, FALSE, sizeof(MHUncachedEntry));
 
-		while ((dir_name = g_dir_read_name(dp)) != NULL) {
-			if ((num = to_number(dir_name)) <= 0) continue;
+	while ((dir_name = g_dir_read_name(dp)) != NULL) {
+		if ((num = to_number(dir_name)) <= 0) continue;
 
+		if (msg_table) {
 			msginfo = g_hash_table_lookup
 				(msg_table, GUINT_TO_POINTER(num));
-
 			if (msginfo) {
 				MSG_SET_TMP_FLAGS(msginfo->flags, MSG_CACHED);
-			} else {
-				/* not found in the cache (uncached message) */
-				msginfo = mh_parse_msg(dir_name, item);
-				if (!msginfo) continue;
-
-				if (!newlist)
-					last = newlist =
-						g_slist_append(NULL, msginfo);
-				else {
-					last = g_slist_append(last, msginfo);
-					last = last->next;
-				}
-				n_newmsg++;
+				count++;
+				if (folder->ui_func)
+					folder->ui_func(folder, item, folder->ui_func_data ? folder->ui_func_data : GINT_TO_POINTER(count));
+				continue;
 			}
-
-			count++;
-			if (folder->ui_func)
-				folder->ui_func(folder, item, folder->ui_func_data ? folder->ui_func_data : GINT_TO_POINTER(count));
 		}
-	} else {
-		/* discard all previous cache */
-		while ((dir_name = g_dir_read_name(dp)) != NULL) {
-			if (to_number(dir_name) <= 0) continue;
-
-			msginfo = mh_parse_msg(dir_name, item);
-			if (!msginfo) continue;
-
-			if (!newlist)
-				last = newlist = g_slist_append(NULL, msginfo);
-			else {
-				last = g_slist_append(last, msginfo);
-				last = last->next;
-			}
+
+		/* not found in the cache (uncached message) */
+		entry.num = num;
+		entry.name = g_strdup(dir_name);
+		g_array_append_val(entries, entry);
+	}
+
+	g_dir_close(dp);
+
+	/* sort new messages in numerical order */
+	g_array_sort(entries, mh_uncached_entry_compare);
+
+	msgs = g_new0(MsgInfo *, entries->len + 1);
+	mh_parse_uncached_msgs(item, entries, msgs);
+
+	for (i = (gint)entries->len - 1; i >= 0; i--) {
+		g_free(g_array_index(entries, MHUncachedEntry, i).name);
+		if (msgs[i]) {
+			newlist = g_slist_prepend(newlist, msgs[i]);
 			n_newmsg++;
-			if (folder->ui_func)
-				folder->ui_func(folder, item, folder->ui_func_data ? folder->ui_func_data : GINT_TO_POINTER(n_newmsg));
 		}
 	}
 
-	g_dir_close(dp);
+	g_free(msgs);
+	g_array_free(entries, TRUE);
 
 	if (n_newmsg)
 		debug_print("%d uncached message(s) found.\n", n_newmsg);
 	else
 		debug_print("done.\n");
 
-	/* sort new messages in numerical order */
-	if (newlist && item->sort_key == SORT_BY_NONE) {
-		debug_print("Sorting uncached messages in numerical order...\n");
-		newlist = g_slist_sort
-			(newlist, (GCompareFunc)procmsg_cmp_msgnum_for_sort);
-		debug_print("done.\n");
+	return newlist;
+}
+
+#if USE_THREADS
+typedef struct _MHParseData
+{
+	FolderItem *item;
+	gchar *path;
+	GArray *entries;
+	MsgInfo **msgs;
+	gint n_parsed;
+} MHParseData;
+
+static gint mh_get_n_parse_threads(void)
+{
+	gint n = 1;
+
+#ifdef G_OS_WIN32
+	SYSTEM_INFO si;
+
+	GetSystemInfo(&si);
+	n = si.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+	n = sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+	return CLAMP(n, 1, MH_PARSE_MAX_THREADS);
+}
+
+/* The worker threads open the files by their full path, since the main
+   loop may run in the progress callback while they work and change the
+   current directory. */
+static void mh_parse_msg_worker(gpointer task, gpointer user_data)
+{
+	MHParseData *data = (MHParseData *)user_data;
+	guint start, end, i;
+	gchar *file;
+
+	start = (GPOINTER_TO_UINT(task) - 1) * MH_PARSE_CHUNK;
+	end = MIN(start + MH_PARSE_CHUNK, data->entries->len);
+
+	for (i = start; i < end; i++) {
+		MHUncachedEntry *entry;
+
+		entry = &g_array_index(data->entries, MHUncachedEntry, i);
+		file = g_strconcat(data->path, G_DIR_SEPARATOR_S, entry->name,
+				   NULL);
+		data->msgs[i] = mh_parse_msg(file, data->item);
+		if (data->msgs[i])
+			data->msgs[i]->msgnum = atoi(entry->name);
+		g_free(file);
+		g_atomic_int_inc(&data->n_parsed);
 	}
+}
+#endif
 
-	return newlist;
+/* parses the uncached messages into msgs, in the order of entries */
+static void mh_parse_uncached_msgs(FolderItem *item, GArray *entries,
+				   MsgInfo **msgs)
+{
+	Folder *folder = item->folder;
+	gint i;
+#if USE_THREADS
+	gint n_threads;
+
+	n_threads = mh_get_n_parse_threads();
+
+	if (entries->len >= MH_PARSE_THREAD_MIN && n_threads > 1) {
+		MHParseData data;
+		GThreadPool *pool;
+		guint n_chunks;
+		gint n_parsed;
+
+		data.item = item;
+		data.path = folder_item_get_path(item);
+		data.entries = entries;
+		data.msgs = msgs;
+		data.n_parsed = 0;
+
+		pool = g_thread_pool_new(mh_parse_msg_worker, &data,
+					 n_threads, TRUE, NULL);
+		if (pool) {
+			debug_print("Parsing %d messages with %d threads...\n",
+				    entries->len, n_threads);
+
+			n_chunks = (entries->len + MH_PARSE_CHUNK - 1) /
+				MH_PARSE_CHUNK;
+			for (i = 0; i < n_chunks; i++)
+				g_thread_pool_push(pool, GUINT_TO_POINTER(i + 1),
+						   NULL);
+
+			while ((n_parsed = g_atomic_int_get(&data.n_parsed))
+			       < entries->len) {
+				g_usleep(PROGRESS_UPDATE_INTERVAL * 1000);
+				if (folder->ui_func)
+					folder->ui_func(folder, item, folder->ui_func_data ? folder->ui_func_data : GINT_TO_POINTER(n_parsed));
+			}
+
+			g_thread_pool_free(pool, FALSE, TRUE);
+			g_free(data.path);
+			return;
+		}
+		g_free(data.path);
+	}
+#endif
+
+	for (i = 0; i < entries->len; i++) {
+		msgs[i] = mh_parse_msg
+			(g_array_index(entries, MHUncachedEntry, i).name, item);
+		if (msgs[i] && folder->ui_func)
+			folder->ui_func(folder, item, folder->ui_func_data ? folder->ui_func_data : GINT_TO_POINTER(i + 1));
+	}
 }
 
 static MsgInfo *mh_parse_msg(const gchar *file, FolderItem *item)
@@ -1896,3 +2051,277 @@ static gboolean mh_rename_folder_func(GNode *node, gpointer data)
 
 	return FALSE;
 }
+
+
+/* directory watcher */
+
+#if HAVE_SYS_INOTIFY_H
+/* delay before rescanning the modified folders */
+#define MH_WATCH_DELAY	500
+
+static gint watch_fd = -1;
+static GIOChannel *watch_channel = NULL;
+static guint watch_io_tag = 0;
+static guint watch_timeout_tag = 0;
+
+/* the folders are kept by identifier, so that removed or renamed
+   folders are simply not found any more */
+static GHashTable *watch_wd_table = NULL;	/* wd -> identifier */
+static GHashTable *watch_id_table = NULL;	/* identifier -> wd */
+static GHashTable *watch_dirty_table = NULL;	/* identifier */
+
+static MHWatchFunc watch_func = NULL;
+static gpointer watch_func_data = NULL;
+
+static void mh_watch_dirty_func(gpointer key, gpointer val, gpointer data)
+{
+	FolderItem *item;
+
+	item = folder_find_item_from_identifier((gchar *)key);
+	if (item && FOLDER_TYPE(item->folder) == F_MH) {
+		debug_print("mh_watch: rescanning %s\n", item->path);
+		folder_item_scan(item);
+	}
+}
+
+static gboolean mh_watch_remove_func(gpointer key, gpointer val,
+				     gpointer data)
+{
+	return TRUE;
+}
+
+static gboolean mh_watch_timeout_cb(gpointer data)
+{
+#if USE_THREADS
+	/* try later if the folder is being accessed */
+	if (!G_TRYLOCK(mh))
+		return TRUE;
+	G_UNLOCK(mh);
+#endif
+
+	watch_timeout_tag = 0;
+
+	g_hash_table_foreach(watch_dirty_table, mh_watch_dirty_func, NULL);
+	g_hash_table_foreach_remove(watch_dirty_table, mh_watch_remove_func,
+				    NULL);
+
+	if (watch_func)
+		watch_func(watch_func_data);
+
+	return FALSE;
+}
+
+static void mh_watch_set_dirty(const gchar *id)
+{
+	g_hash_table_insert(watch_dirty_table, g_strdup(id),
+			    GINT_TO_POINTER(1));
+	if (watch_timeout_tag == 0)
+		watch_timeout_tag = g_timeout_add
+			(MH_WATCH_DELAY, mh_watch_timeout_cb, NULL);
+}
+
+/* events have been lost: rescan all the watched folders completely */
+static void mh_watch_overflow_func(gpointer key, gpointer val, gpointer data)
+{
+	FolderItem *item;
+
+	item = folder_find_item_from_identifier((gchar *)key);
+	if (item)
+		item->scan_mtime = 0;
+	if (!g_hash_table_lookup(watch_dirty_table, key))
+		mh_watch_set_dirty((gchar *)key);
+}
+
+static void mh_watch_remove_wd(gint wd)
+{
+	gchar *id;
+
+	id = g_hash_table_lookup(watch_wd_table, GINT_TO_POINTER(wd));
+	if (id) {
+		g_hash_table_remove(watch_id_table, id);
+		g_hash_table_remove(watch_wd_table, GINT_TO_POINTER(wd));
+	}
+}
+
+static gboolean mh_watch_io_cb(GIOChannel *source, GIOCondition condition,
+			       gpointer data)
+{
+	union {
+		struct inotify_event event;
+		gchar buf[4096];
+	} ebuf;
+	const struct inotify_event *event;
+	gssize len;
+	gchar *buf = ebuf.buf;
+	gchar *p;
+	gchar *id;
+
+	len = read(watch_fd, buf, sizeof(ebuf.buf));
+	if (len <= 0) {
+		if (len < 0 && errno == EINTR)
+			return TRUE;
+		g_warning("mh_watch: read failed\n");
+		watch_io_tag = 0;
+		mh_watch_disable();
+		return FALSE;
+	}
+
+	for (p = buf; p < buf + len;
+	     p += sizeof(struct inotify_event) + event->len) {
+		event = (const struct inotify_event *)p;
+
+		if (event->mask & (IN_IGNORED | IN_DELETE_SELF |
+				   IN_MOVE_SELF)) {
+			mh_watch_remove_wd(event->wd);
+			continue;
+		}
+		if (event->mask & IN_Q_OVERFLOW) {
+			g_warning("mh_watch: event queue overflowed\n");
+			g_hash_table_foreach(watch_id_table,
+					     mh_watch_overflow_func, NULL);
+			continue;
+		}
+		if (event->len == 0 || to_number(event->name) <= 0)
+			continue;
+
+		id = g_hash_table_lookup(watch_wd_table,
+					 GINT_TO_POINTER(event->wd));
+		if (!id || g_hash_table_lookup(watch_dirty_table, id))
+			continue;
+
+		debug_print("mh_watch: %s/%s modified\n", id, event->name);
+		mh_watch_set_dirty(id);
+	}
+
+	return TRUE;
+}
+
+/* watches the directory of item if the watcher is enabled */
+static void mh_watch_add_item(FolderItem *item)
+{
+	gchar *id;
+	gchar *path;
+	gint wd;
+
+	if (watch_fd < 0 || !item->path)
+		return;
+
+	id = folder_item_get_identifier(item);
+	if (!id)
+		return;
+	if (g_hash_table_lookup(watch_id_table, id)) {
+		g_free(id);
+		return;
+	}
+
+	path = folder_item_get_path(item);
+	wd = inotify_add_watch(watch_fd, path,
+			       IN_CREATE | IN_DELETE | IN_MOVED_FROM |
+			       IN_MOVED_TO | IN_CLOSE_WRITE |
+			       IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR);
+	if (wd < 0) {
+		FILE_OP_ERROR(path, "inotify_add_watch");
+		g_free(path);
+		g_free(id);
+		return;
+	}
+	g_free(path);
+
+	/* a directory which is watched twice gets the same wd */
+	mh_watch_remove_wd(wd);
+	g_hash_table_insert(watch_wd_table, GINT_TO_POINTER(wd), id);
+	g_hash_table_insert(watch_id_table, id, GINT_TO_POINTER(wd));
+}
+
+static gboolean mh_watch_add_func(GNode *node, gpointer data)
+{
+	FolderItem *item = FOLDER_ITEM(node->data);
+
+	if (item->path)
+		mh_watch_add_item(item);
+
+	return FALSE;
+}
+
+gboolean mh_watch_enable(MHWatchFunc func, gpointer data)
+{
+	GList *list;
+	Folder *folder;
+
+	watch_func = func;
+	watch_func_data = data;
+
+	if (watch_fd >= 0)
+		return TRUE;
+
+	watch_fd = inotify_init();
+	if (watch_fd < 0) {
+		FILE_OP_ERROR("mh_watch", "inotify_init");
+		return FALSE;
+	}
+
+	watch_wd_table = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+	watch_id_table = g_hash_table_new(g_str_hash, g_str_equal);
+	watch_dirty_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+						  g_free, NULL);
+
+	watch_channel = g_io_channel_unix_new(watch_fd);
+	watch_io_tag = g_io_add_watch(watch_channel, G_IO_IN | G_IO_ERR |
+				      G_IO_HUP, mh_watch_io_cb, NULL);
+
+	/* folders which have not been scanned yet are watched too */
+	for (list = folder_get_list(); list != NULL; list = list->next) {
+		folder = FOLDER(list->data);
+		if (FOLDER_TYPE(folder) == F_MH && folder->node)
+			g_node_traverse(folder->node, G_PRE_ORDER,
+					G_TRAVERSE_ALL, -1, mh_watch_add_func,
+					NULL);
+	}
+
+	debug_print("mh_watch: enabled\n");
+
+	return TRUE;
+}
+
+void mh_watch_disable(void)
+{
+	if (watch_fd < 0)
+		return;
+
+	if (watch_timeout_tag > 0) {
+		g_source_remove(watch_timeout_tag);
+		watch_timeout_tag = 0;
+	}
+	if (watch_io_tag > 0) {
+		g_source_remove(watch_io_tag);
+		watch_io_tag = 0;
+	}
+	g_io_channel_unref(watch_channel);
+	watch_channel = NULL;
+	close(watch_fd);
+	watch_fd = -1;
+
+	g_hash_table_destroy(watch_id_table);
+	g_hash_table_destroy(watch_wd_table);
+	g_hash_table_destroy(watch_dirty_table);
+	watch_id_table = watch_wd_table = watch_dirty_table = NULL;
+
+	watch_func = NULL;
+	watch_func_data = NULL;
+
+	debug_print("mh_watch: disabled\n");
+}
+#else /* !HAVE_SYS_INOTIFY_H */
+static void mh_watch_add_item(FolderItem *item)
+{
+}
+
+gboolean mh_watch_enable(MHWatchFunc func, gpointer data)
+{
+	return FALSE;
+}
+
+void mh_watch_disable(void)
+{
+}
+#endif /* HAVE_SYS_INOTIFY_H */
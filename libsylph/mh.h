@@ -33,6 +33,14 @@ struct _MHFolder
 	LocalFolder lfolder;
 };
 
+typedef void (*MHWatchFunc)	(gpointer	 data);
+
 FolderClass *mh_get_class	(void);
 
+/* watch the MH folders for changes made by other programs and rescan
+   them. func is called after the modified folders are rescanned. */
+gboolean mh_watch_enable	(MHWatchFunc	 func,
+				 gpointer	 data);
+void mh_watch_disable		(void);
+
 #endif /* __MH_H__ */
@@ -31,6 +31,8 @@
 #include <dirent.h>
 #include <unistd.h>
 #include <time.h>
+#include <sys/stat.h>
+#include <glib/gstdio.h>
 
 #include "news.h"
 #include "nntp.h"
@@ -49,11 +51,25 @@
 #endif
 #include "socks.h"
 
+#if USE_THREADS
+G_LOCK_DEFINE_STATIC(news_cache);
+#define S_LOCK(name)	G_LOCK(name)
+#define S_UNLOCK(name)	G_UNLOCK(name)
+#else
+#define S_LOCK(name)
+#define S_UNLOCK(name)
+#endif
+
 #define NNTP_PORT	119
 #if USE_SSL
 #define NNTPS_PORT	563
 #endif
 
+/* the overview is requested in chunks of NEWS_OVER_CHUNK articles, and
+   the commands of NEWS_OVER_PIPELINE chunks are sent ahead */
+#define NEWS_OVER_CHUNK		2000
+#define NEWS_OVER_PIPELINE	4
+
 static void news_folder_init		 (Folder	*folder,
 					  const gchar	*name,
 					  const gchar	*path);
@@ -116,6 +132,10 @@ static GSList *news_get_uncached_articles(NNTPSession	*session,
 					  gint		 cache_last,
 					  gint		*rfirst,
 					  gint		*rlast);
+static GSList *news_get_overview	 (NNTPSession	*session,
+					  FolderItem	*item,
+					  gint		 begin,
+					  gint		 end);
 static MsgInfo *news_parse_xover	 (const gchar	*xover_str);
 static gchar *news_parse_xhdr		 (const gchar	*xhdr_str,
 					  MsgInfo	*msginfo);
@@ -125,6 +145,11 @@ static GSList *news_delete_old_articles	 (GSList	*alist,
 static void news_delete_all_articles	 (FolderItem	*item);
 static void news_delete_expired_caches	 (GSList	*alist,
 					  FolderItem	*item);
+static void news_cache_evict		 (const gchar	*dir);
+
+#if USE_THREADS
+static void news_prefetch_destroy	 (NewsPrefetch	*prefetch);
+#endif
 
 static FolderClass news_class =
 {
@@ -197,6 +222,13 @@ static void news_folder_destroy(Folder *folder)
 		g_free(server);
 	}
 
+#if USE_THREADS
+	if (NEWS_FOLDER(folder)->prefetch) {
+		news_prefetch_destroy(NEWS_FOLDER(folder)->prefetch);
+		NEWS_FOLDER(folder)->prefetch = NULL;
+	}
+#endif
+
 	folder_remote_folder_destroy(REMOTE_FOLDER(folder));
 }
 
@@ -299,8 +331,7 @@ static NNTPSession *news_session_get(Folder *folder)
 		return NNTP_SESSION(rfolder->session);
 	}
 
-	if (nntp_mode(NNTP_SESSION(rfolder->session), FALSE)
-	    != NN_SUCCESS) {
+	if (nntp_noop(NNTP_SESSION(rfolder->session)) != NN_SUCCESS) {
 		log_warning(_("NNTP connection to %s:%d has been"
 			      " disconnected. Reconnecting...\n"),
 			    folder->account->nntp_server,
@@ -383,6 +414,9 @@ static GSList *news_get_article_list(Folder *folder, FolderItem *item,
 			procmsg_write_flags_list(item, alist);
 	}
 
+	if (session)
+		news_prefetch_msgs(item, alist);
+
 	return alist;
 }
 
@@ -403,10 +437,19 @@ static gchar *news_fetch_msg(Folder *folder, FolderItem *item, gint num)
 			       NULL);
 	g_free(path);
 
+	/* news_cache_evict() must not remove the file between the check
+	   and the update of its access time */
+	S_LOCK(news_cache);
 	if (is_file_exist(filename) && get_file_size(filename) > 0) {
 		debug_print(_("article %d has been already cached.\n"), num);
+#if GLIB_CHECK_VERSION(2, 18, 0)
+		/* for news_cache_evict() */
+		g_utime(filename, NULL);
+#endif
+		S_UNLOCK(news_cache);
 		return filename;
 	}
+	S_UNLOCK(news_cache);
 
 	session = news_session_get(folder);
 	if (!session) {
@@ -797,10 +840,6 @@ static GSList *news_get_uncached_articles(NNTPSession *session,
 {
 	gint ok;
 	gint num = 0, first = 0, last = 0, begin = 0, end = 0;
-	gchar buf[NNTPBUFSIZE];
-	GSList *newlist = NULL;
-	GSList *llast = NULL;
-	MsgInfo *msginfo;
 	gint max_articles;
 
 	if (rfirst) *rfirst = -1;
@@ -848,22 +887,85 @@ static GSList *news_get_uncached_articles(NNTPSession *session,
 
 	log_message(_("getting xover %d - %d in %s...\n"),
 		    begin, end, item->path);
-	ok = nntp_xover(session, begin, end);
+
+	return news_get_overview(session, item, begin, end);
+}
+
+static gint news_send_overview_cmd(NNTPSession *session, gint first,
+				   gint last)
+{
+	gint ok;
+
+	ok = nntp_over_send(session, first, last);
+	if (ok == NN_SUCCESS)
+		ok = nntp_hdr_send(session, "to", first, last);
+	if (ok == NN_SUCCESS)
+		ok = nntp_hdr_send(session, "cc", first, last);
+
+	return ok;
+}
+
+static gint news_recv_xhdr(NNTPSession *session, GSList *mlist,
+			   gboolean is_to)
+{
+	gchar buf[NNTPBUFSIZE];
+	GSList *cur = mlist;
+	MsgInfo *msginfo;
+	gint ok, num;
+
+	ok = nntp_recv_response(session, NULL);
 	if (ok != NN_SUCCESS) {
-		log_warning(_("can't get xover\n"));
-		if (ok == NN_SOCKET) {
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(item->folder)->session = NULL;
-		}
-		return NULL;
+		if (ok == NN_SOCKET)
+			return ok;
+		log_warning(_("can't get xhdr\n"));
+		return NN_SUCCESS;
 	}
 
 	for (;;) {
+		if (sock_gets(SESSION(session)->sock, buf, sizeof(buf)) < 0) {
+			log_warning(_("error occurred while getting xhdr.\n"));
+			return NN_SOCKET;
+		}
+
+		if (buf[0] == '.' && buf[1] == '\r') break;
+
+		num = atoi(buf);
+		while (cur && ((MsgInfo *)cur->data)->msgnum < num)
+			cur = cur->next;
+		if (!cur)
+			continue;
+
+		msginfo = (MsgInfo *)cur->data;
+		if (is_to)
+			msginfo->to = news_parse_xhdr(buf, msginfo);
+		else
+			msginfo->cc = news_parse_xhdr(buf, msginfo);
+	}
+
+	return NN_SUCCESS;
+}
+
+/* reads the responses of news_send_overview_cmd() and appends the
+   articles to mlist */
+static gint news_recv_overview(NNTPSession *session, FolderItem *item,
+			       GSList **mlist)
+{
+	gchar buf[NNTPBUFSIZE];
+	GSList *chunk = NULL, *llast = NULL;
+	MsgInfo *msginfo;
+	gint ok;
+
+	ok = nntp_recv_response(session, NULL);
+	if (ok == NN_SOCKET)
+		return ok;
+	if (ok != NN_SUCCESS)
+		log_warning(_("can't get xover\n"));
+
+	while (ok == NN_SUCCESS) {
 		if (sock_gets(SESSION(session)->sock, buf, sizeof(buf)) < 0) {
 			log_warning(_("error occurred while getting xover.\n"));
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(item->folder)->session = NULL;
-			return newlist;
+			ok = NN_SOCKET;
+			break;
 		}
 
 		if (buf[0] == '.' && buf[1] == '\r') break;
@@ -879,78 +981,65 @@ static GSList *news_get_uncached_articles(NNTPSession *session,
 		msginfo->flags.tmp_flags = MSG_NEWS;
 		msginfo->newsgroups = g_strdup(item->path);
 
-		if (!newlist)
-			llast = newlist = g_slist_append(newlist, msginfo);
+		if (!chunk)
+			llast = chunk = g_slist_append(chunk, msginfo);
 		else {
 			llast = g_slist_append(llast, msginfo);
 			llast = llast->next;
 		}
 	}
 
-	ok = nntp_xhdr(session, "to", begin, end);
-	if (ok != NN_SUCCESS) {
-		log_warning(_("can't get xhdr\n"));
-		if (ok == NN_SOCKET) {
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(item->folder)->session = NULL;
-		}
-		return newlist;
-	}
+	if (ok != NN_SOCKET)
+		ok = news_recv_xhdr(session, chunk, TRUE);
+	if (ok != NN_SOCKET)
+		ok = news_recv_xhdr(session, chunk, FALSE);
 
-	llast = newlist;
+	*mlist = g_slist_concat(*mlist, chunk);
 
-	for (;;) {
-		if (sock_gets(SESSION(session)->sock, buf, sizeof(buf)) < 0) {
-			log_warning(_("error occurred while getting xhdr.\n"));
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(item->folder)->session = NULL;
-			return newlist;
-		}
+	return ok == NN_SOCKET ? NN_SOCKET : NN_SUCCESS;
+}
 
-		if (buf[0] == '.' && buf[1] == '\r') break;
-		if (!llast) {
-			g_warning("llast == NULL\n");
-			continue;
+/* Gets the overview of the articles from begin to end in chunks of
+   NEWS_OVER_CHUNK articles, keeping the commands of NEWS_OVER_PIPELINE
+   chunks in flight. */
+static GSList *news_get_overview(NNTPSession *session, FolderItem *item,
+				 gint begin, gint end)
+{
+	Folder *folder = item->folder;
+	GSList *newlist = NULL;
+	gint sent = begin, received = begin;
+	gint n_pending = 0;
+	gint ok = NN_SUCCESS;
+
+	while (received <= end) {
+		while (sent <= end && n_pending < NEWS_OVER_PIPELINE) {
+			ok = news_send_overview_cmd
+				(session, sent,
+				 MIN(end, sent + NEWS_OVER_CHUNK - 1));
+			if (ok != NN_SUCCESS)
+				break;
+			sent += NEWS_OVER_CHUNK;
+			n_pending++;
 		}
+		if (ok != NN_SUCCESS)
+			break;
 
-		msginfo = (MsgInfo *)llast->data;
-		msginfo->to = news_parse_xhdr(buf, msginfo);
+		ok = news_recv_overview(session, item, &newlist);
+		if (ok != NN_SUCCESS)
+			break;
+		received += NEWS_OVER_CHUNK;
+		n_pending--;
 
-		llast = llast->next;
+		if (folder->ui_func)
+			folder->ui_func(folder, item, folder->ui_func_data ? folder->ui_func_data : GINT_TO_POINTER(MIN(received, end + 1) - begin));
 	}
 
-	ok = nntp_xhdr(session, "cc", begin, end);
 	if (ok != NN_SUCCESS) {
-		log_warning(_("can't get xhdr\n"));
-		if (ok == NN_SOCKET) {
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(item->folder)->session = NULL;
-		}
+		session_destroy(SESSION(session));
+		REMOTE_FOLDER(item->folder)->session = NULL;
 		return newlist;
 	}
 
-	llast = newlist;
-
-	for (;;) {
-		if (sock_gets(SESSION(session)->sock, buf, sizeof(buf)) < 0) {
-			log_warning(_("error occurred while getting xhdr.\n"));
-			session_destroy(SESSION(session));
-			REMOTE_FOLDER(item->folder)->session = NULL;
-			return newlist;
-		}
-
-		if (buf[0] == '.' && buf[1] == '\r') break;
-		if (!llast) {
-			g_warning("llast == NULL\n");
-			continue;
-		}
-
-		msginfo = (MsgInfo *)llast->data;
-		msginfo->cc = news_parse_xhdr(buf, msginfo);
-
-		llast = llast->next;
-	}
-
 	session_set_access_time(SESSION(session));
 
 	return newlist;
@@ -1096,7 +1185,7 @@ static void news_delete_all_articles(FolderItem *item)
 
 static void news_delete_expired_caches(GSList *alist, FolderItem *item)
 {
-	gchar *dir;
+	gchar *dir, *server_dir;
 
 	g_return_if_fail(item != NULL);
 	g_return_if_fail(item->folder != NULL);
@@ -1106,5 +1195,439 @@ static void news_delete_expired_caches(GSList *alist, FolderItem *item)
 
 	dir = folder_item_get_path(item);
 	remove_expired_files(dir, 24 * 7);
+	server_dir = g_path_get_dirname(dir);
+	news_cache_evict(server_dir);
+	g_free(server_dir);
 	g_free(dir);
 }
+
+/* article prefetcher */
+
+#if USE_THREADS
+typedef struct _NewsPrefetchArticle
+{
+	gchar *group;
+	gchar *file;
+	gint num;
+} NewsPrefetchArticle;
+
+/* The prefetch thread uses its own session, which is created with the
+   parameters copied from the account on the main thread. */
+struct _NewsPrefetch
+{
+	GThread *thread;
+	GMutex *mutex;
+	GQueue *queue;
+	gboolean running;
+	gboolean cancelled;
+
+	Session *session;
+
+	gchar *server;
+	gushort port;
+	SocksInfo *socks_info;
+	gchar *userid;
+	gchar *passwd;
+#if USE_SSL
+	SSLType ssl_type;
+#endif
+	gchar *cache_dir;
+};
+
+static void news_prefetch_article_free(NewsPrefetchArticle *article)
+{
+	g_free(article->group);
+	g_free(article->file);
+	g_free(article);
+}
+
+static void news_prefetch_clear_queue(NewsPrefetch *prefetch)
+{
+	NewsPrefetchArticle *article;
+
+	while ((article = g_queue_pop_head(prefetch->queue)) != NULL)
+		news_prefetch_article_free(article);
+}
+
+static void news_prefetch_session_destroy(NewsPrefetch *prefetch)
+{
+	if (prefetch->session) {
+		session_destroy(prefetch->session);
+		prefetch->session = NULL;
+	}
+}
+
+/* same as news_session_get(), for the session of the prefetch thread */
+static NNTPSession *news_prefetch_session_get(NewsPrefetch *prefetch)
+{
+	if (prefetch->session) {
+		if (time(NULL) - prefetch->session->last_access_time <
+		    SESSION_TIMEOUT_INTERVAL)
+			return NNTP_SESSION(prefetch->session);
+
+		if (nntp_noop(NNTP_SESSION(prefetch->session)) == NN_SUCCESS) {
+			session_set_access_time(prefetch->session);
+			return NNTP_SESSION(prefetch->session);
+		}
+
+		log_warning(_("NNTP connection to %s:%d has been"
+			      " disconnected. Reconnecting...\n"),
+			    prefetch->server, prefetch->port);
+		news_prefetch_session_destroy(prefetch);
+	}
+
+#if USE_SSL
+	prefetch->session = news_session_new
+		(prefetch->server, prefetch->port, prefetch->socks_info,
+		 prefetch->userid, prefetch->passwd, prefetch->ssl_type);
+#else
+	prefetch->session = news_session_new
+		(prefetch->server, prefetch->port, prefetch->socks_info,
+		 prefetch->userid, prefetch->passwd);
+#endif
+
+	return NNTP_SESSION(prefetch->session);
+}
+
+static gint news_prefetch_article(NewsPrefetch *prefetch,
+				  NewsPrefetchArticle *article)
+{
+	NNTPSession *session;
+	gchar *msgid;
+	gchar *tmp;
+	gint ok;
+
+	if (is_file_exist(article->file) && get_file_size(article->file) > 0)
+		return NN_SUCCESS;
+
+	session = news_prefetch_session_get(prefetch);
+	if (!session)
+		return NN_SOCKET;
+
+	ok = news_select_group(session, article->group, NULL, NULL, NULL);
+	if (ok == NN_SUCCESS)
+		ok = nntp_get_article(session, "ARTICLE", article->num,
+				      &msgid);
+	if (ok != NN_SUCCESS)
+		return ok;
+	g_free(msgid);
+
+	/* the file appears complete, since news_fetch_msg() may read it
+	   at any time */
+	tmp = g_strconcat(article->file, ".tmp", NULL);
+	ok = recv_write_to_file_full(SESSION(session)->sock, tmp, NULL, NULL);
+	if (ok == 0) {
+		if (rename_force(tmp, article->file) < 0) {
+			FILE_OP_ERROR(tmp, "rename");
+			g_unlink(tmp);
+		}
+		ok = NN_SUCCESS;
+	} else
+		ok = ok == -2 ? NN_SOCKET : NN_IOERR;
+	g_free(tmp);
+
+	if (ok == NN_SUCCESS)
+		session_set_access_time(SESSION(session));
+
+	debug_print("news_prefetch_article: %s %d: %d\n", article->group,
+		    article->num, ok);
+
+	return ok;
+}
+
+static gpointer news_prefetch_thread_func(gpointer data)
+{
+	NewsPrefetch *prefetch = (NewsPrefetch *)data;
+	NewsPrefetchArticle *article;
+	gint ok;
+
+	for (;;) {
+		g_mutex_lock(prefetch->mutex);
+		article = NULL;
+		if (!prefetch->cancelled)
+			article = g_queue_pop_head(prefetch->queue);
+		if (!article) {
+			prefetch->running = FALSE;
+			g_mutex_unlock(prefetch->mutex);
+			break;
+		}
+		g_mutex_unlock(prefetch->mutex);
+
+		ok = news_prefetch_article(prefetch, article);
+		if (ok == NN_SOCKET) {
+			/* the server may have dropped an idle connection:
+			   retry once on a new one */
+			news_prefetch_session_destroy(prefetch);
+			ok = news_prefetch_article(prefetch, article);
+		}
+		news_prefetch_article_free(article);
+
+		if (ok == NN_SOCKET) {
+			news_prefetch_session_destroy(prefetch);
+			/* do not retry the rest on a broken connection */
+			g_mutex_lock(prefetch->mutex);
+			news_prefetch_clear_queue(prefetch);
+			g_mutex_unlock(prefetch->mutex);
+		}
+	}
+
+	news_cache_evict(prefetch->cache_dir);
+
+	return NULL;
+}
+
+static NewsPrefetch *news_prefetch_new(Folder *folder)
+{
+	NewsPrefetch *prefetch;
+	PrefsAccount *ac = folder->account;
+	RemoteFolder *rfolder = REMOTE_FOLDER(folder);
+	gchar *server;
+
+	prefetch = g_new0(NewsPrefetch, 1);
+	prefetch->mutex = g_mutex_new();
+	prefetch->queue = g_queue_new();
+
+	prefetch->server = g_strdup(ac->nntp_server);
+#if USE_SSL
+	prefetch->port = ac->set_nntpport ? ac->nntpport
+		: ac->ssl_nntp ? NNTPS_PORT : NNTP_PORT;
+	prefetch->ssl_type = ac->ssl_nntp;
+#else
+	prefetch->port = ac->set_nntpport ? ac->nntpport : NNTP_PORT;
+#endif
+	if (ac->use_socks && ac->use_socks_for_recv && ac->proxy_host) {
+		prefetch->socks_info = socks_info_new(ac->socks_type, ac->proxy_host, ac->proxy_port, ac->use_proxy_auth ? ac->proxy_name : NULL, ac->use_proxy_auth ? ac->proxy_pass : NULL);
+	}
+
+	/* take the password from the interactive session so that the
+	   thread never has to ask for it */
+	if (rfolder->session && NNTP_SESSION(rfolder->session)->userid) {
+		prefetch->userid =
+			g_strdup(NNTP_SESSION(rfolder->session)->userid);
+		prefetch->passwd =
+			g_strdup(NNTP_SESSION(rfolder->session)->passwd);
+	}
+
+	server = uriencode_for_filename(ac->nntp_server);
+	prefetch->cache_dir = g_strconcat(get_news_cache_dir(),
+					  G_DIR_SEPARATOR_S, server, NULL);
+	g_free(server);
+
+	return prefetch;
+}
+
+static void news_prefetch_destroy(NewsPrefetch *prefetch)
+{
+	g_mutex_lock(prefetch->mutex);
+	prefetch->cancelled = TRUE;
+	news_prefetch_clear_queue(prefetch);
+	g_mutex_unlock(prefetch->mutex);
+
+	if (prefetch->thread)
+		g_thread_join(prefetch->thread);
+	news_prefetch_session_destroy(prefetch);
+
+	g_queue_free(prefetch->queue);
+	g_mutex_free(prefetch->mutex);
+	g_free(prefetch->server);
+	if (prefetch->socks_info)
+		socks_info_free(prefetch->socks_info);
+	g_free(prefetch->userid);
+	g_free(prefetch->passwd);
+	g_free(prefetch->cache_dir);
+	g_free(prefetch);
+}
+#endif /* USE_THREADS */
+
+/**
+ * news_prefetch_msgs:
+ * @item: Newsgroup.
+ * @mlist: Articles in the order of display.
+ *
+ * Fetch the bodies of the first unread articles in @mlist which are not
+ * cached yet on a separate connection in the background, up to
+ * prefs_common.news_prefetch_articles of them. The articles queued by the
+ * previous call which have not been fetched yet are discarded.
+ **/
+void news_prefetch_msgs(FolderItem *item, GSList *mlist)
+{
+#if USE_THREADS
+	NewsFolder *folder;
+	NewsPrefetch *prefetch;
+	GQueue *queue;
+	GSList *cur;
+	gchar *path;
+	gchar nstr[16];
+	gint n = 0;
+
+	g_return_if_fail(item != NULL);
+	g_return_if_fail(item->folder != NULL);
+	g_return_if_fail(FOLDER_TYPE(item->folder) == F_NEWS);
+
+	if (prefs_common.news_prefetch_articles <= 0 ||
+	    !prefs_common.online_mode)
+		return;
+
+	folder = NEWS_FOLDER(item->folder);
+	if (!folder->prefetch)
+		folder->prefetch = news_prefetch_new(item->folder);
+	prefetch = folder->prefetch;
+
+	path = folder_item_get_path(item);
+	if (!is_dir_exist(path))
+		make_dir_hier(path);
+
+	queue = g_queue_new();
+	for (cur = mlist; cur != NULL &&
+	     n < prefs_common.news_prefetch_articles; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+		NewsPrefetchArticle *article;
+		gchar *file;
+
+		if (!MSG_IS_UNREAD(msginfo->flags))
+			continue;
+		file = g_strconcat(path, G_DIR_SEPARATOR_S,
+				   utos_buf(nstr, msginfo->msgnum), NULL);
+		if (is_file_exist(file)) {
+			g_free(file);
+			continue;
+		}
+
+		article = g_new(NewsPrefetchArticle, 1);
+		article->group = g_strdup(item->path);
+		article->file = file;
+		article->num = msginfo->msgnum;
+		g_queue_push_tail(queue, article);
+		n++;
+	}
+	g_free(path);
+
+	g_mutex_lock(prefetch->mutex);
+
+	news_prefetch_clear_queue(prefetch);
+	g_queue_free(prefetch->queue);
+	prefetch->queue = queue;
+
+	if (!prefetch->running && n > 0) {
+		if (prefetch->thread)
+			g_thread_join(prefetch->thread);
+		debug_print("news_prefetch_msgs: prefetching %d articles\n", n);
+		prefetch->running = TRUE;
+		prefetch->thread = g_thread_create(news_prefetch_thread_func,
+						   prefetch, TRUE, NULL);
+		if (!prefetch->thread) {
+			prefetch->running = FALSE;
+			news_prefetch_clear_queue(prefetch);
+		}
+	}
+
+	g_mutex_unlock(prefetch->mutex);
+#endif
+}
+
+/* cache eviction */
+
+typedef struct _NewsCacheFile
+{
+	gchar *file;
+	time_t atime;
+	goffset size;
+} NewsCacheFile;
+
+static gint news_cache_file_compare(gconstpointer a, gconstpointer b)
+{
+	const NewsCacheFile *fa = (const NewsCacheFile *)a;
+	const NewsCacheFile *fb = (const NewsCacheFile *)b;
+
+	return fa->atime < fb->atime ? -1 : fa->atime > fb->atime ? 1 : 0;
+}
+
+/* Removes the least recently used articles under the cache directory of
+   a server (one subdirectory per newsgroup) until the total size is within
+   prefs_common.news_cache_size. Cached articles are touched on access, so
+   the mtime is the last access time. The directories are read without
+   the lock, which is only held for each removal, so that news_fetch_msg()
+   is not blocked for the whole scan. */
+static void news_cache_evict(const gchar *dir)
+{
+	GArray *files;
+	GDir *dp, *group_dp;
+	const gchar *group_name, *file_name;
+	goffset total = 0, budget;
+	struct stat s;
+	guint i;
+
+	if (prefs_common.news_cache_size <= 0)
+		return;
+	budget = (goffset)prefs_common.news_cache_size * 1024 * 1024;
+
+	if ((dp = g_dir_open(dir, 0, NULL)) == NULL)
+		return;
+
+	files = g_array_new(FALSE, FALSE, sizeof(NewsCacheFile));
+
+	while ((group_name = g_dir_read_name(dp)) != NULL) {
+		gchar *group_dir;
+
+		group_dir = g_strconcat(dir, G_DIR_SEPARATOR_S, group_name,
+					NULL);
+		if ((group_dp = g_dir_open(group_dir, 0, NULL)) == NULL) {
+			g_free(group_dir);
+			continue;
+		}
+
+		while ((file_name = g_dir_read_name(group_dp)) != NULL) {
+			NewsCacheFile cfile;
+
+			if (to_unumber(file_name) == 0)
+				continue;
+
+			cfile.file = g_strconcat(group_dir, G_DIR_SEPARATOR_S,
+						 file_name, NULL);
+			if (g_stat(cfile.file, &s) < 0 ||
+			    !S_ISREG(s.st_mode)) {
+				g_free(cfile.file);
+				continue;
+			}
+			cfile.atime = MAX(s.st_mtime, s.st_atime);
+			cfile.size = s.st_size;
+			total += cfile.size;
+			g_array_append_val(files, cfile);
+		}
+
+		g_dir_close(group_dp);
+		g_free(group_dir);
+	}
+
+	g_dir_close(dp);
+
+	if (total > budget) {
+		debug_print("news_cache_evict: %s: %" G_GINT64_FORMAT
+			    " > %" G_GINT64_FORMAT " bytes\n",
+			    dir, (gint64)total, (gint64)budget);
+		g_array_sort(files, news_cache_file_compare);
+	}
+
+	for (i = 0; i < files->len; i++) {
+		NewsCacheFile *cfile = &g_array_index(files, NewsCacheFile, i);
+
+		if (total > budget) {
+			S_LOCK(news_cache);
+			/* skip the articles accessed since the scan */
+			if (g_stat(cfile->file, &s) < 0 ||
+			    MAX(s.st_mtime, s.st_atime) > cfile->atime) {
+				S_UNLOCK(news_cache);
+				g_free(cfile->file);
+				continue;
+			}
+			if (g_unlink(cfile->file) < 0) {
+				FILE_OP_ERROR(cfile->file, "unlink");
+			} else
+				total -= cfile->size;
+			S_UNLOCK(news_cache);
+		}
+		g_free(cfile->file);
+	}
+
+	g_array_free(files, TRUE);
+}
@@ -27,6 +27,7 @@
 
 typedef struct _NewsFolder	NewsFolder;
 typedef struct _NewsGroupInfo	NewsGroupInfo;
+typedef struct _NewsPrefetch	NewsPrefetch;
 
 #define NEWS_FOLDER(obj)	((NewsFolder *)obj)
 
@@ -35,6 +36,8 @@ struct _NewsFolder
 	RemoteFolder rfolder;
 
 	gboolean use_auth;
+
+	NewsPrefetch *prefetch;
 };
 
 struct _NewsGroupInfo
@@ -57,4 +60,7 @@ gint news_post				(Folder		*folder,
 gint news_post_stream			(Folder		*folder,
 					 FILE		*fp);
 
+void news_prefetch_msgs			(FolderItem	*item,
+					 GSList		*mlist);
+
 #endif /* __NEWS_H__ */
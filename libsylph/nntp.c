@@ -120,6 +120,15 @@ Session *nntp_session_new_full(const gchar *server, gushort port,
 
 	session->group = NULL;
 
+	/* switch a mode-switching server to the reader mode before the
+	   authentication and CAPABILITIES (RFC 3977 5.3, RFC 4643 2.2);
+	   errors are ignored since reader-only servers may refuse it */
+	if (nntp_gen_send(sock, "MODE READER") != NN_SUCCESS ||
+	    nntp_ok(sock, NULL) == NN_SOCKET) {
+		session_destroy(SESSION(session));
+		return NULL;
+	}
+
 	if (userid && passwd) {
 		gint ok;
 
@@ -149,6 +158,16 @@ Session *nntp_session_new_full(const gchar *server, gushort port,
 		}
 	}
 
+	if (nntp_capabilities(session) == NN_SOCKET) {
+		session_destroy(SESSION(session));
+		return NULL;
+	}
+	if ((session->capability & NNTP_CAP_COMPRESS) &&
+	    nntp_compress(session) == NN_SOCKET) {
+		session_destroy(SESSION(session));
+		return NULL;
+	}
+
 	session_set_access_time(SESSION(session));
 
 	return SESSION(session);
@@ -189,13 +208,6 @@ gint nntp_group(NNTPSession *session, const gchar *group,
 	gchar buf[NNTPBUFSIZE];
 
 	ok = nntp_gen_command(session, buf, "GROUP %s", group);
-
-	if (ok != NN_SUCCESS && ok != NN_SOCKET && ok != NN_AUTHREQ) {
-		ok = nntp_mode(session, FALSE);
-		if (ok == NN_SUCCESS)
-			ok = nntp_gen_command(session, buf, "GROUP %s", group);
-	}
-
 	if (ok != NN_SUCCESS)
 		return ok;
 
@@ -283,7 +295,9 @@ gint nntp_xover(NNTPSession *session, gint first, gint last)
 	gint ok;
 	gchar buf[NNTPBUFSIZE];
 
-	ok = nntp_gen_command(session, buf, "XOVER %d-%d", first, last);
+	ok = nntp_gen_command(session, buf, "%s %d-%d",
+			      session->capability & NNTP_CAP_OVER ?
+			      "OVER" : "XOVER", first, last);
 	if (ok != NN_SUCCESS)
 		return ok;
 
@@ -295,14 +309,40 @@ gint nntp_xhdr(NNTPSession *session, const gchar *header, gint first, gint last)
 	gint ok;
 	gchar buf[NNTPBUFSIZE];
 
-	ok = nntp_gen_command(session, buf, "XHDR %s %d-%d",
-			      header, first, last);
+	ok = nntp_gen_command(session, buf, "%s %s %d-%d",
+			      session->capability & NNTP_CAP_HDR ?
+			      "HDR" : "XHDR", header, first, last);
 	if (ok != NN_SUCCESS)
 		return ok;
 
 	return NN_SUCCESS;
 }
 
+gint nntp_over_send(NNTPSession *session, gint first, gint last)
+{
+	return nntp_gen_send(SESSION(session)->sock, "%s %d-%d",
+			     session->capability & NNTP_CAP_OVER ?
+			     "OVER" : "XOVER", first, last);
+}
+
+gint nntp_hdr_send(NNTPSession *session, const gchar *header,
+		   gint first, gint last)
+{
+	return nntp_gen_send(SESSION(session)->sock, "%s %s %d-%d",
+			     session->capability & NNTP_CAP_HDR ?
+			     "HDR" : "XHDR", header, first, last);
+}
+
+gint nntp_recv_response(NNTPSession *session, gchar *argbuf)
+{
+	gint ok;
+
+	ok = nntp_ok(SESSION(session)->sock, argbuf);
+	session_set_access_time(SESSION(session));
+
+	return ok;
+}
+
 gint nntp_list(NNTPSession *session)
 {
 	return nntp_gen_command(session, NULL, "LIST");
@@ -355,6 +395,84 @@ gint nntp_mode(NNTPSession *session, gboolean stream)
 	return ok;
 }
 
+/* checks the connection of an idle session.  MODE READER must not be
+   sent again after the authentication, so CAPABILITIES is sent instead,
+   which also updates the capabilities; servers without it only get
+   MODE READER as before */
+gint nntp_noop(NNTPSession *session)
+{
+	if (session->capability == 0)
+		return nntp_mode(session, FALSE);
+
+	return nntp_capabilities(session);
+}
+
+gint nntp_capabilities(NNTPSession *session)
+{
+	gint ok;
+	gchar buf[NNTPBUFSIZE];
+	SockInfo *sock = SESSION(session)->sock;
+	NNTPCapability capability = 0;
+
+	ok = nntp_gen_command(session, NULL, "CAPABILITIES");
+	if (ok != NN_SUCCESS) {
+		session->capability = 0;
+		return ok;
+	}
+
+	for (;;) {
+		if (nntp_gen_recv(sock, buf, sizeof(buf)) != NN_SUCCESS)
+			return NN_SOCKET;
+		if (buf[0] == '.' && buf[1] == '\0')
+			break;
+
+		if (!g_ascii_strcasecmp(buf, "READER"))
+			capability |= NNTP_CAP_READER;
+		else if (!g_ascii_strcasecmp(buf, "OVER") ||
+			 !g_ascii_strncasecmp(buf, "OVER ", 5))
+			capability |= NNTP_CAP_OVER;
+		else if (!g_ascii_strcasecmp(buf, "HDR"))
+			capability |= NNTP_CAP_HDR;
+		else if (!g_ascii_strncasecmp(buf, "COMPRESS ", 9)) {
+			gchar **methods;
+			gint i;
+
+			methods = g_strsplit(buf + 9, " ", -1);
+			for (i = 0; methods[i] != NULL; i++) {
+				if (!g_ascii_strcasecmp(methods[i],
+							"DEFLATE"))
+					capability |= NNTP_CAP_COMPRESS;
+			}
+			g_strfreev(methods);
+		}
+	}
+
+	session->capability = capability;
+
+	return NN_SUCCESS;
+}
+
+/* enables COMPRESS DEFLATE (RFC 8054) for the rest of the session */
+gint nntp_compress(NNTPSession *session)
+{
+#if HAVE_LIBZ
+	gint ok;
+
+	ok = nntp_gen_command(session, NULL, "COMPRESS DEFLATE");
+	if (ok != NN_SUCCESS)
+		return ok;
+
+	if (sock_set_compression(SESSION(session)->sock) < 0) {
+		log_warning(_("can't start compression\n"));
+		return NN_SOCKET;
+	}
+
+	return NN_SUCCESS;
+#else
+	return NN_ERROR;
+#endif
+}
+
 static gint nntp_ok(SockInfo *sock, gchar *argbuf)
 {
 	gint ok;
@@ -30,6 +30,14 @@ typedef struct _NNTPSession	NNTPSession;
 
 #define NNTP_SESSION(obj)       ((NNTPSession *)obj)
 
+typedef enum
+{
+	NNTP_CAP_READER		= 1 << 0,
+	NNTP_CAP_OVER		= 1 << 1,
+	NNTP_CAP_HDR		= 1 << 2,
+	NNTP_CAP_COMPRESS	= 1 << 3
+} NNTPCapability;
+
 struct _NNTPSession
 {
 	Session session;
@@ -39,6 +47,8 @@ struct _NNTPSession
 	gchar *userid;
 	gchar *passwd;
 	gboolean auth_failed;
+
+	NNTPCapability capability;
 };
 
 #define NN_SUCCESS	0
@@ -112,6 +122,19 @@ gint nntp_xhdr			(NNTPSession	*session,
 				 const gchar	*header,
 				 gint		 first,
 				 gint		 last);
+
+/* pipelined commands: the responses are read with nntp_recv_response()
+   in the order of the commands */
+gint nntp_over_send		(NNTPSession	*session,
+				 gint		 first,
+				 gint		 last);
+gint nntp_hdr_send		(NNTPSession	*session,
+				 const gchar	*header,
+				 gint		 first,
+				 gint		 last);
+gint nntp_recv_response		(NNTPSession	*session,
+				 gchar		*argbuf);
+
 gint nntp_list			(NNTPSession	*session);
 gint nntp_post			(NNTPSession	*session,
 				 FILE		*fp);
@@ -119,5 +142,8 @@ gint nntp_newgroups		(NNTPSession	*session);
 gint nntp_newnews		(NNTPSession	*session);
 gint nntp_mode			(NNTPSession	*session,
 				 gboolean	 stream);
+gint nntp_noop			(NNTPSession	*session);
+gint nntp_capabilities		(NNTPSession	*session);
+gint nntp_compress		(NNTPSession	*session);
 
 #endif /* __NNTP_H__ */
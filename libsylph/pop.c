@@ -49,6 +49,10 @@ gint pop3_getauth_apop_send	(Pop3Session *session);
 gint pop3_stls_send		(Pop3Session *session);
 gint pop3_stls_recv		(Pop3Session *session);
 #endif
+gint pop3_getcapa_send		(Pop3Session *session);
+gint pop3_getcapa_recv		(Pop3Session *session,
+				 const gchar *data,
+				 guint        len);
 gint pop3_getrange_stat_send	(Pop3Session *session);
 gint pop3_getrange_stat_recv	(Pop3Session *session,
 				 const gchar *msg);
@@ -80,6 +84,20 @@ gint pop3_write_msg_to_file	(const gchar	*file,
 				 FILE		*src_fp,
 				 guint		 len);
 
+typedef struct _Pop3Command
+{
+	Pop3State state;
+	gint msg;
+} Pop3Command;
+
+static void pop3_cmd_queue	(Pop3Session	*session,
+				 Pop3State	 state,
+				 gint		 msg,
+				 const gchar	*format, ...)
+				 G_GNUC_PRINTF(4, 5);
+static void pop3_cmd_done	(Pop3Session	*session);
+static gint pop3_cmd_flush	(Pop3Session	*session);
+
 static Pop3State pop3_lookup_next	(Pop3Session	*session);
 
 Pop3ErrorValue pop3_ok		(Pop3Session	*session,
@@ -186,6 +204,36 @@ gint pop3_getauth_apop_send(Pop3Session *session)
 	return PS_SUCCESS;
 }
 
+gint pop3_getcapa_send(Pop3Session *session)
+{
+	session->state = POP3_GETCAPA;
+	pop3_gen_send(session, "CAPA");
+	return PS_SUCCESS;
+}
+
+gint pop3_getcapa_recv(Pop3Session *session, const gchar *data, guint len)
+{
+	const gchar *p = data;
+	const gchar *lastp = data + len;
+	const gchar *newline;
+
+	while (p < lastp) {
+		if ((newline = memchr(p, '\r', lastp - p)) == NULL)
+			return PS_PROTOCOL;
+		if (newline - p == 10 &&
+		    !g_ascii_strncasecmp(p, "PIPELINING", 10))
+			session->pipelining = TRUE;
+
+		p = newline + 1;
+		if (p < lastp && *p == '\n') p++;
+	}
+
+	if (session->pipelining)
+		debug_print("POP3: server supports PIPELINING\n");
+
+	return PS_SUCCESS;
+}
+
 gint pop3_getrange_stat_send(Pop3Session *session)
 {
 	session->state = POP3_GETRANGE_STAT;
@@ -409,6 +457,66 @@ void pop3_gen_send(Pop3Session *session, const gchar *format, ...)
 	session_send_msg(SESSION(session), SESSION_MSG_NORMAL, buf);
 }
 
+/* Appends a RETR / DELE command to the queue. The commands are sent at
+   once by pop3_cmd_flush(). state and cur_msg of the session always
+   refer to the command at the head, whose response is read next. */
+static void pop3_cmd_queue(Pop3Session *session, Pop3State state, gint msg,
+			   const gchar *format, ...)
+{
+	Pop3Command *cmd;
+	gchar buf[POPBUFSIZE + 1];
+	va_list args;
+
+	va_start(args, format);
+	g_vsnprintf(buf, sizeof(buf) - 2, format, args);
+	va_end(args);
+
+	log_print("POP3> %s\n", buf);
+
+	if (session->cmd_buf->len > 0)
+		g_string_append(session->cmd_buf, "\r\n");
+	g_string_append(session->cmd_buf, buf);
+
+	cmd = g_new(Pop3Command, 1);
+	cmd->state = state;
+	cmd->msg = msg;
+	g_queue_push_tail(session->cmd_queue, cmd);
+
+	if (g_queue_get_length(session->cmd_queue) == 1) {
+		session->state = state;
+		session->cur_msg = msg;
+	}
+}
+
+/* Removes the command whose response has been processed. */
+static void pop3_cmd_done(Pop3Session *session)
+{
+	Pop3Command *cmd;
+
+	g_free(g_queue_pop_head(session->cmd_queue));
+
+	if ((cmd = g_queue_peek_head(session->cmd_queue)) != NULL) {
+		session->state = cmd->state;
+		session->cur_msg = cmd->msg;
+	}
+}
+
+/* Sends the queued commands, or waits for the next response if all of
+   them have already been sent. */
+static gint pop3_cmd_flush(Pop3Session *session)
+{
+	gint ret;
+
+	if (session->cmd_buf->len == 0)
+		return session_recv_msg(SESSION(session));
+
+	ret = session_send_msg(SESSION(session), SESSION_MSG_NORMAL,
+			       session->cmd_buf->str);
+	g_string_truncate(session->cmd_buf, 0);
+
+	return ret;
+}
+
 Session *pop3_session_new(PrefsAccount *account)
 {
 	Pop3Session *session;
@@ -432,6 +540,9 @@ Session *pop3_session_new(PrefsAccount *account)
 	session->state = POP3_READY;
 	session->ac_prefs = account;
 	session->uidl_table = pop3_get_uidl_table(account);
+	session->cmd_queue = g_queue_new();
+	session->cmd_buf = g_string_new(NULL);
+	session->cmd_error = PS_SUCCESS;
 	session->current_time = time(NULL);
 	session->error_val = PS_SUCCESS;
 	session->error_msg = NULL;
@@ -466,6 +577,11 @@ static void pop3_session_destroy(Session *session)
 		g_free(pop3_session->msg[n].uidl);
 	g_free(pop3_session->msg);
 
+	while (!g_queue_is_empty(pop3_session->cmd_queue))
+		g_free(g_queue_pop_head(pop3_session->cmd_queue));
+	g_queue_free(pop3_session->cmd_queue);
+	g_string_free(pop3_session->cmd_buf, TRUE);
+
 	if (pop3_session->uidl_table) {
 		hash_free_strings(pop3_session->uidl_table);
 		g_hash_table_destroy(pop3_session->uidl_table);
@@ -623,15 +739,25 @@ gint pop3_write_msg_to_file(const gchar *file, FILE *src_fp, guint len)
 	return 0;
 }
 
+/* Schedules the commands for the messages from next_msg. Without
+   PIPELINING, only one command is outstanding at a time. */
 static Pop3State pop3_lookup_next(Pop3Session *session)
 {
 	Pop3MsgInfo *msg;
 	PrefsAccount *ac = session->ac_prefs;
 	gint size;
 	gboolean size_limit_over;
+	guint window;
+	gint num;
 
-	for (;;) {
-		msg = &session->msg[session->cur_msg];
+	window = session->pipelining ? POP3_PIPELINE_MAX : 1;
+
+	while (session->cmd_error == PS_SUCCESS &&
+	       session->next_msg > 0 &&
+	       session->next_msg <= session->count &&
+	       g_queue_get_length(session->cmd_queue) < window) {
+		num = session->next_msg++;
+		msg = &session->msg[num];
 		size = msg->size;
 		size_limit_over =
 		    (ac->enable_size_limit &&
@@ -645,33 +771,42 @@ static Pop3State pop3_lookup_next(Pop3Session *session)
 		     session->current_time - msg->recv_time >=
 		     ac->msg_leave_time * 24 * 60 * 60)) {
 			log_print(_("POP3: Deleting expired message %d\n"),
-				  session->cur_msg);
+				  num);
 			session->cur_total_bytes += size;
-			pop3_delete_send(session);
-			return POP3_DELETE;
+			pop3_cmd_queue(session, POP3_DELETE, num,
+				       "DELE %d", num);
+			continue;
 		}
 
 		if (size_limit_over && !msg->received) {
 			log_print
 				(_("POP3: Skipping message %d (%d bytes)\n"),
-				  session->cur_msg, size);
+				  num, size);
 			session->skipped_num++;
 		}
 
 		if (size == 0 || msg->received || size_limit_over) {
 			session->cur_total_bytes += size;
-			if (session->cur_msg == session->count) {
-				pop3_logout_send(session);
-				return POP3_LOGOUT;
-			} else
-				session->cur_msg++;
-		} else
-			break;
+			continue;
+		}
+
+		pop3_cmd_queue(session, POP3_RETR, num, "RETR %d", num);
 	}
 
-	pop3_retr_send(session);
+	if (g_queue_is_empty(session->cmd_queue)) {
+		/* report the error which stopped the transfer */
+		if (session->cmd_error != PS_SUCCESS)
+			session->error_val = session->cmd_error;
+		pop3_logout_send(session);
+		return POP3_LOGOUT;
+	}
 
-	return POP3_RETR;
+	if (pop3_cmd_flush(session) < 0) {
+		session->state = POP3_ERROR;
+		return POP3_ERROR;
+	}
+
+	return session->state;
 }
 
 Pop3ErrorValue pop3_ok(Pop3Session *session, const gchar *msg)
@@ -706,6 +841,7 @@ Pop3ErrorValue pop3_ok(Pop3Session *session, const gchar *msg)
 				log_warning(_("error occurred on authentication\n"));
 				ok = PS_AUTHFAIL;
 				break;
+			case POP3_GETCAPA:
 			case POP3_GETRANGE_LAST:
 			case POP3_GETRANGE_UIDL:
 				log_warning(_("command not supported\n"));
@@ -745,6 +881,18 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 				pop3_session->state = POP3_ERROR;
 				return -1;
 			}
+			if (val != PS_NOTSUPPORTED &&
+			    (pop3_session->state == POP3_RETR ||
+			     pop3_session->state == POP3_DELETE)) {
+				/* read the responses to the commands already
+				   sent before logging out */
+				if (pop3_session->cmd_error == PS_SUCCESS)
+					pop3_session->cmd_error = val;
+				pop3_cmd_done(pop3_session);
+				if (pop3_lookup_next(pop3_session) == POP3_ERROR)
+					return -1;
+				return 0;
+			}
 			if (val != PS_NOTSUPPORTED) {
 				if (pop3_session->state != POP3_LOGOUT) {
 					if (pop3_logout_send(pop3_session) == PS_SUCCESS)
@@ -795,7 +943,16 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 		if (pop3_session->auth_only)
 			val = pop3_logout_send(pop3_session);
 		else
+			val = pop3_getcapa_send(pop3_session);
+		break;
+	case POP3_GETCAPA:
+		if (val == PS_NOTSUPPORTED) {
+			pop3_session->error_val = PS_SUCCESS;
 			val = pop3_getrange_stat_send(pop3_session);
+		} else {
+			pop3_session->state = POP3_GETCAPA_RECV;
+			val = session_recv_data(session, 0, ".\r\n");
+		}
 		break;
 	case POP3_GETRANGE_STAT:
 		if ((val = pop3_getrange_stat_recv(pop3_session, body)) != PS_SUCCESS)
@@ -835,13 +992,9 @@ static gint pop3_session_recv_msg(Session *session, const gchar *msg)
 		break;
 	case POP3_DELETE:
 		val = pop3_delete_recv(pop3_session);
-		if (pop3_session->cur_msg == pop3_session->count)
-			val = pop3_logout_send(pop3_session);
-		else {
-			pop3_session->cur_msg++;
-			if (pop3_lookup_next(pop3_session) == POP3_ERROR)
-				return -1;
-		}
+		pop3_cmd_done(pop3_session);
+		if (pop3_lookup_next(pop3_session) == POP3_ERROR)
+			return -1;
 		break;
 	case POP3_LOGOUT:
 		if (val == PS_SUCCESS)
@@ -868,6 +1021,13 @@ static gint pop3_session_recv_data_finished(Session *session, guchar *data,
 	Pop3ErrorValue val = PS_SUCCESS;
 
 	switch (pop3_session->state) {
+	case POP3_GETCAPA_RECV:
+		val = pop3_getcapa_recv(pop3_session, (gchar *)data, len);
+		if (val == PS_SUCCESS)
+			pop3_getrange_stat_send(pop3_session);
+		else
+			return -1;
+		break;
 	case POP3_GETRANGE_UIDL_RECV:
 		val = pop3_getrange_uidl_recv(pop3_session, (gchar *)data, len);
 		if (val == PS_SUCCESS) {
@@ -881,6 +1041,7 @@ static gint pop3_session_recv_data_finished(Session *session, guchar *data,
 	case POP3_GETSIZE_LIST_RECV:
 		val = pop3_getsize_list_recv(pop3_session, (gchar *)data, len);
 		if (val == PS_SUCCESS) {
+			pop3_session->next_msg = pop3_session->cur_msg;
 			if (pop3_lookup_next(pop3_session) == POP3_ERROR)
 				return -1;
 		} else
@@ -898,6 +1059,8 @@ static gint pop3_session_recv_data_as_file_finished(Session *session, FILE *fp,
 						    guint len)
 {
 	Pop3Session *pop3_session = POP3_SESSION(session);
+	Pop3MsgInfo *msg;
+	gint num;
 
 	g_return_val_if_fail(pop3_session->state == POP3_RETR_RECV, -1);
 
@@ -908,20 +1071,18 @@ static gint pop3_session_recv_data_as_file_finished(Session *session, FILE *fp,
 	if (!session->sock)
 		return -1;
 
-	if (pop3_session->msg[pop3_session->cur_msg].recv_time
-	    == RECV_TIME_DELETE ||
+	num = pop3_session->cur_msg;
+	msg = &pop3_session->msg[num];
+	pop3_cmd_done(pop3_session);
+
+	if (msg->recv_time == RECV_TIME_DELETE ||
 	    (pop3_session->ac_prefs->rmmail &&
 	     pop3_session->ac_prefs->msg_leave_time == 0 &&
-	     pop3_session->msg[pop3_session->cur_msg].recv_time
-	     != RECV_TIME_KEEP))
-		pop3_delete_send(pop3_session);
-	else if (pop3_session->cur_msg == pop3_session->count)
-		pop3_logout_send(pop3_session);
-	else {
-		pop3_session->cur_msg++;
-		if (pop3_lookup_next(pop3_session) == POP3_ERROR)
-			return -1;
-	}
+	     msg->recv_time != RECV_TIME_KEEP))
+		pop3_cmd_queue(pop3_session, POP3_DELETE, num, "DELE %d", num);
+
+	if (pop3_lookup_next(pop3_session) == POP3_ERROR)
+		return -1;
 
 	return 0;
 }
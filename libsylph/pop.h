@@ -43,6 +43,8 @@ typedef enum {
 	POP3_GETAUTH_USER,
 	POP3_GETAUTH_PASS,
 	POP3_GETAUTH_APOP,
+	POP3_GETCAPA,
+	POP3_GETCAPA_RECV,
 	POP3_GETRANGE_STAT,
 	POP3_GETRANGE_LAST,
 	POP3_GETRANGE_UIDL,
@@ -128,6 +130,13 @@ struct _Pop3Session
 
 	GHashTable *uidl_table;
 
+	/* RFC 2449 PIPELINING */
+	gboolean pipelining;
+	gint next_msg;		/* next message to be scheduled */
+	GQueue *cmd_queue;	/* commands waiting for the responses */
+	GString *cmd_buf;	/* commands not sent yet */
+	Pop3ErrorValue cmd_error;
+
 	gboolean auth_only;
 
 	gboolean new_msg_exist;
@@ -149,6 +158,9 @@ struct _Pop3Session
 /* #define IDLEN	128 */
 #define IDLEN		POPBUFSIZE
 
+/* maximum number of outstanding RETR / DELE commands */
+#define POP3_PIPELINE_MAX	16
+
 Session *pop3_session_new	(PrefsAccount	*account);
 
 GHashTable *pop3_get_uidl_table	(PrefsAccount	*account);
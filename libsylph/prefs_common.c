@@ -41,6 +41,7 @@ static PrefParam param[] = {
 	{"autochk_newmail", "FALSE", &prefs_common.autochk_newmail, P_BOOL},
 	{"autochk_interval", "10", &prefs_common.autochk_itv, P_INT},
 	{"check_on_startup", "FALSE", &prefs_common.chk_on_startup, P_BOOL},
+	{"inc_max_sessions", "4", &prefs_common.inc_max_sessions, P_INT},
 	{"scan_all_after_inc", "FALSE", &prefs_common.scan_all_after_inc,
 	 P_BOOL},
 	{"enable_newmsg_notify", "FALSE", &prefs_common.enable_newmsg_notify,
@@ -516,6 +517,11 @@ static PrefParam param[] = {
 	{"strict_cache_check", "FALSE", &prefs_common.strict_cache_check,
 	 P_BOOL},
 	{"io_timeout_secs", "60", &prefs_common.io_timeout_secs, P_INT},
+	{"watch_local_folders", "FALSE", &prefs_common.watch_local_folders,
+	 P_BOOL},
+	{"news_prefetch_articles", "0", &prefs_common.news_prefetch_articles,
+	 P_INT},
+	{"news_cache_size", "0", &prefs_common.news_cache_size, P_INT},
 
 	/* File selector */
 	{"filesel_prev_open_dir", NULL, &prefs_common.prev_open_dir, P_STRING},
@@ -57,6 +57,7 @@ struct _PrefsCommon
 	gboolean autochk_newmail;
 	gint autochk_itv;
 	gboolean chk_on_startup;
+	gint inc_max_sessions;
 	gboolean enable_newmsg_notify;
 	gchar *newmsg_notify_cmd;
 
@@ -297,6 +298,9 @@ struct _PrefsCommon
 	/* Advanced */
 	gboolean strict_cache_check;
 	gint io_timeout_secs;
+	gboolean watch_local_folders;
+	gint news_prefetch_articles;
+	gint news_cache_size;		/* MB */
 
 	/* Filtering */
 	GSList *fltlist;
@@ -50,6 +50,8 @@
 
 #define MAX_MIME_LEVEL	64
 
+#define B64_DECODE_BUFFSIZE	(BUFFSIZE * 4)
+
 static GHashTable *procmime_get_mime_type_table	(void);
 static GList *procmime_get_mime_type_list	(const gchar *file);
 
@@ -902,57 +904,109 @@ MimeInfo *procmime_scan_mime_header(FILE *fp)
 	return mimeinfo;
 }
 
-static gint procmime_normalize_lbreak(FILE *infp, FILE *outfp)
+typedef struct _MimeDecodeOutput
 {
-	gchar buf[BUFFSIZE];
-	gint len;
+	MimeWriteFunc write_func;
+	gpointer data;
+	gboolean normalize_lbreak;
+	gboolean cr_pending;
+	gboolean error;
+} MimeDecodeOutput;
+
+static void procmime_output_raw(MimeDecodeOutput *out, const gchar *buf,
+				gint len)
+{
+	if (len <= 0 || out->error)
+		return;
+	if (out->write_func(buf, len, out->data) < 0)
+		out->error = TRUE;
+}
 
-	g_return_val_if_fail(infp != NULL, -1);
-	g_return_val_if_fail(outfp != NULL, -1);
+/* Writes buf to the sink, converting the line breaks to the native ones
+   if requested. A CR at the end of buf is held until the next call. */
+static void procmime_output(MimeDecodeOutput *out, const gchar *buf,
+			    gint len)
+{
+	const gchar *p, *s, *end = buf + len;
 
-	while (fgets(buf, sizeof(buf), infp) != NULL) {
-		len = strlen(buf);
-		if (len == sizeof(buf) - 1 && buf[len - 1] != '\n') {
-			if (buf[len - 1] == '\r') {
-				ungetc('\r', infp);
-				buf[len - 1] = '\0';
-			}
-			fputs(buf, outfp);
-			continue;
+	if (!out->normalize_lbreak) {
+		procmime_output_raw(out, buf, len);
+		return;
+	}
+
+	s = buf;
+	if (out->cr_pending) {
+		out->cr_pending = FALSE;
+#ifdef G_OS_WIN32
+		procmime_output_raw(out, "\r", 1);
+		if (len > 0 && buf[0] == '\n') {
+			procmime_output_raw(out, "\n", 1);
+			s++;
 		}
+#else
+		if (len == 0 || buf[0] != '\n')
+			procmime_output_raw(out, "\r", 1);
+#endif
+	}
+
+	for (p = s; p < end; p++) {
+		if (*p == '\r') {
+			if (p + 1 == end) {
+				procmime_output_raw(out, s, p - s);
+				out->cr_pending = TRUE;
+				return;
+			}
 #ifdef G_OS_WIN32
-		strretchomp(buf);
-		fputs(buf, outfp);
-		fputs("\r\n", outfp);
+			if (p[1] == '\n')
+				p++;
 #else
-		strcrchomp(buf);
-		fputs(buf, outfp);
+			if (p[1] == '\n') {
+				procmime_output_raw(out, s, p - s);
+				s = p + 1;
+			}
+#endif
+		}
+#ifdef G_OS_WIN32
+		else if (*p == '\n') {
+			procmime_output_raw(out, s, p - s);
+			procmime_output_raw(out, "\r\n", 2);
+			s = p + 1;
+		}
 #endif
 	}
 
-	return 0;
+	procmime_output_raw(out, s, end - s);
 }
 
-FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
+static void procmime_output_str(MimeDecodeOutput *out, const gchar *str)
+{
+	procmime_output(out, str, strlen(str));
+}
+
+static void procmime_output_flush(MimeDecodeOutput *out)
+{
+	if (out->cr_pending) {
+		out->cr_pending = FALSE;
+		procmime_output_raw(out, "\r", 1);
+	}
+}
+
+/* Decodes the content of mimeinfo read from infp, and passes it to
+   write_func in chunks. The line breaks of text parts are converted to
+   the native ones on the fly, so no intermediate file is needed. */
+gint procmime_decode_content_full(FILE *infp, MimeInfo *mimeinfo,
+				  MimeWriteFunc write_func, gpointer data)
 {
 	gchar buf[BUFFSIZE];
 	gchar *boundary = NULL;
 	gint boundary_len = 0;
-	gboolean tmp_file = FALSE;
 	gboolean normalize_lbreak = FALSE;
 	ContentType content_type;
+	MimeDecodeOutput out;
 
-	g_return_val_if_fail(infp != NULL, NULL);
-	g_return_val_if_fail(mimeinfo != NULL, NULL);
-
-	if (!outfp) {
-		outfp = my_tmpfile();
-		if (!outfp) {
-			perror("tmpfile");
-			return NULL;
-		}
-		tmp_file = TRUE;
-	}
+	g_return_val_if_fail(infp != NULL, -1);
+	g_return_val_if_fail(mimeinfo != NULL, -1);
+	g_return_val_if_fail(write_func != NULL, -1);
 
 	if (mimeinfo->parent && mimeinfo->parent->boundary) {
 		boundary = mimeinfo->parent->boundary;
@@ -965,18 +1019,16 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 		normalize_lbreak = TRUE;
 	}
 
+	out.write_func = write_func;
+	out.data = data;
+	out.normalize_lbreak = FALSE;
+	out.cr_pending = FALSE;
+	out.error = FALSE;
+
 	if (mimeinfo->encoding_type == ENC_QUOTED_PRINTABLE) {
-		FILE *tmpfp = outfp;
 		gchar prev_empty_line[3] = "";
 
-		if (normalize_lbreak) {
-			tmpfp = my_tmpfile();
-			if (!tmpfp) {
-				perror("tmpfile");
-				if (tmp_file) fclose(outfp);
-				return NULL;
-			}
-		}
+		out.normalize_lbreak = normalize_lbreak;
 
 		while (fgets(buf, sizeof(buf), infp) != NULL &&
 		       (!boundary ||
@@ -984,7 +1036,7 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 			gint len;
 
 			if (prev_empty_line[0]) {
-				fputs(prev_empty_line, tmpfp);
+				procmime_output_str(&out, prev_empty_line);
 				prev_empty_line[0] = '\0';
 			}
 
@@ -993,63 +1045,47 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 				strcpy(prev_empty_line, buf);
 			else {
 				len = qp_decode_line(buf);
-				fwrite(buf, len, 1, tmpfp);
+				procmime_output(&out, buf, len);
 			}
 		}
 		if (!boundary && prev_empty_line[0])
-			fputs(prev_empty_line, tmpfp);
-
-		if (normalize_lbreak) {
-			if (fflush(tmpfp) == EOF) {
-				perror("fflush");
-				fclose(tmpfp);
-				if (tmp_file) fclose(outfp);
-				return NULL;
-			}
-			rewind(tmpfp);
-			procmime_normalize_lbreak(tmpfp, outfp);
-			fclose(tmpfp);
-		}
+			procmime_output_str(&out, prev_empty_line);
 	} else if (mimeinfo->encoding_type == ENC_BASE64) {
-		gchar outbuf[BUFFSIZE];
-		gint len;
+		gchar inbuf[B64_DECODE_BUFFSIZE];
+		gchar outbuf[B64_DECODE_BUFFSIZE / 4 * 3 + 3];
+		gint inlen = 0, outlen, len;
+		gboolean eod = FALSE;
+		gint ret;
 		Base64Decoder *decoder;
-		FILE *tmpfp = outfp;
-
-		if (normalize_lbreak) {
-			tmpfp = my_tmpfile();
-			if (!tmpfp) {
-				perror("tmpfile");
-				if (tmp_file) fclose(outfp);
-				return NULL;
-			}
-		}
 
+		out.normalize_lbreak = normalize_lbreak;
+
+		/* collect lines and decode them in large blocks */
 		decoder = base64_decoder_new();
-		while (fgets(buf, sizeof(buf), infp) != NULL &&
-		       (!boundary ||
-			!IS_BOUNDARY(buf, boundary, boundary_len))) {
-			len = base64_decoder_decode(decoder, buf,
-						    (guchar *)outbuf);
-			if (len < 0) {
-				g_warning("Bad BASE64 content\n");
-				break;
+		while (!eod) {
+			if (fgets(buf, sizeof(buf), infp) == NULL ||
+			    (boundary &&
+			     IS_BOUNDARY(buf, boundary, boundary_len))) {
+				eod = TRUE;
+				len = 0;
+			} else
+				len = strlen(buf);
+			if (inlen > 0 &&
+			    (eod || inlen + len > sizeof(inbuf))) {
+				ret = base64_decoder_decode_len
+					(decoder, inbuf, inlen,
+					 (guchar *)outbuf, &outlen);
+				procmime_output(&out, outbuf, outlen);
+				if (ret < 0) {
+					g_warning("Bad BASE64 content\n");
+					break;
+				}
+				inlen = 0;
 			}
-			fwrite(outbuf, sizeof(gchar), len, tmpfp);
+			memcpy(inbuf + inlen, buf, len);
+			inlen += len;
 		}
 		base64_decoder_free(decoder);
-
-		if (normalize_lbreak) {
-			if (fflush(tmpfp) == EOF) {
-				perror("fflush");
-				fclose(tmpfp);
-				if (tmp_file) fclose(outfp);
-				return NULL;
-			}
-			rewind(tmpfp);
-			procmime_normalize_lbreak(tmpfp, outfp);
-			fclose(tmpfp);
-		}
 	} else if (mimeinfo->encoding_type == ENC_X_UUENCODE) {
 		gchar outbuf[BUFFSIZE];
 		gint len;
@@ -1067,7 +1103,7 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 						g_warning("Bad UUENCODE content(%d)\n", len);
 					break;
 				}
-				fwrite(outbuf, sizeof(gchar), len, outfp);
+				procmime_output(&out, outbuf, len);
 			} else
 				flag = TRUE;
 		}
@@ -1080,7 +1116,7 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 		       (!boundary ||
 			!IS_BOUNDARY(buf, boundary, boundary_len))) {
 			if (prev_empty_line[0]) {
-				fputs(prev_empty_line, outfp);
+				procmime_output_str(&out, prev_empty_line);
 				prev_empty_line[0] = '\0';
 			}
 
@@ -1091,7 +1127,7 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 					ungetc('\r', infp);
 					buf[len - 1] = '\0';
 				}
-				fputs(buf, outfp);
+				procmime_output_str(&out, buf);
 				cont_line = TRUE;
 				continue;
 			}
@@ -1102,15 +1138,15 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 				if (!cont_line && buf[0] == '\0')
 					strcpy(prev_empty_line, "\r\n");
 				else {
-					fputs(buf, outfp);
-					fputs("\r\n", outfp);
+					procmime_output_str(&out, buf);
+					procmime_output_str(&out, "\r\n");
 				}
 #else
 				strcrchomp(buf);
 				if (!cont_line && buf[0] == '\n')
 					strcpy(prev_empty_line, "\n");
 				else
-					fputs(buf, outfp);
+					procmime_output_str(&out, buf);
 #endif
 			} else {
 				if (!cont_line &&
@@ -1118,18 +1154,52 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 				     (buf[0] == '\r' && buf[1] == '\n')))
 					strcpy(prev_empty_line, buf);
 				else
-					fputs(buf, outfp);
+					procmime_output_str(&out, buf);
 			}
 
 			cont_line = FALSE;
 		}
 		if (!boundary && prev_empty_line[0])
-			fputs(prev_empty_line, outfp);
+			procmime_output_str(&out, prev_empty_line);
 	}
 
-	if (fflush(outfp) == EOF)
-		perror("fflush");
-	if (ferror(outfp) != 0) {
+	procmime_output_flush(&out);
+
+	return out.error ? -1 : 0;
+}
+
+static gint procmime_write_file(const gchar *buf, gint len, gpointer data)
+{
+	if (fwrite(buf, len, 1, (FILE *)data) != 1)
+		return -1;
+	return 0;
+}
+
+static gint procmime_write_string(const gchar *buf, gint len, gpointer data)
+{
+	g_string_append_len((GString *)data, buf, len);
+	return 0;
+}
+
+FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
+{
+	gboolean tmp_file = FALSE;
+
+	g_return_val_if_fail(infp != NULL, NULL);
+	g_return_val_if_fail(mimeinfo != NULL, NULL);
+
+	if (!outfp) {
+		outfp = my_tmpfile();
+		if (!outfp) {
+			perror("tmpfile");
+			return NULL;
+		}
+		tmp_file = TRUE;
+	}
+
+	if (procmime_decode_content_full(infp, mimeinfo, procmime_write_file,
+					 outfp) < 0 ||
+	    fflush(outfp) == EOF || ferror(outfp) != 0) {
 		g_warning("procmime_decode_content(): Can't write to temporary file\n");
 		if (tmp_file) fclose(outfp);
 		return NULL;
@@ -1139,6 +1209,31 @@ FILE *procmime_decode_content(FILE *outfp, FILE *infp, MimeInfo *mimeinfo)
 	return outfp;
 }
 
+/* Same as procmime_decode_content(), but returns the decoded content as
+   a newly allocated nul-terminated string. */
+gchar *procmime_decode_content_str(FILE *infp, MimeInfo *mimeinfo,
+				   gint *len)
+{
+	GString *str;
+
+	g_return_val_if_fail(infp != NULL, NULL);
+	g_return_val_if_fail(mimeinfo != NULL, NULL);
+
+	str = g_string_sized_new
+		(MIN(mimeinfo->size, PROCMIME_MEM_DECODE_MAX) + 1);
+
+	if (procmime_decode_content_full(infp, mimeinfo, procmime_write_string,
+					 str) < 0) {
+		g_string_free(str, TRUE);
+		return NULL;
+	}
+
+	if (len)
+		*len = str->len;
+
+	return g_string_free(str, FALSE);
+}
+
 gint procmime_get_part(const gchar *outfile, const gchar *infile,
 		       MimeInfo *mimeinfo)
 {
@@ -1270,6 +1365,93 @@ gint procmime_get_all_parts(const gchar *dir, const gchar *infile,
 	return 0;
 }
 
+/* Decodes and converts the text part in memory, without any temporary
+   files. As with procmime_get_text_content(), each line is cut at a NUL
+   byte, so the result is a plain string without NUL bytes. */
+gchar *procmime_get_text_content_str(MimeInfo *mimeinfo, FILE *infp,
+				     const gchar *encoding)
+{
+	GString *outstr;
+	gchar *text;
+	gint len;
+	const gchar *src_encoding;
+	gboolean conv_fail = FALSE;
+	gchar buf[BUFFSIZE];
+
+	g_return_val_if_fail(mimeinfo != NULL, NULL);
+	g_return_val_if_fail(infp != NULL, NULL);
+	g_return_val_if_fail(mimeinfo->mime_type == MIME_TEXT ||
+			     mimeinfo->mime_type == MIME_TEXT_HTML, NULL);
+
+	if (fseek(infp, mimeinfo->fpos, SEEK_SET) < 0) {
+		perror("fseek");
+		return NULL;
+	}
+
+	while (fgets(buf, sizeof(buf), infp) != NULL)
+		if (buf[0] == '\r' || buf[0] == '\n') break;
+
+	text = procmime_decode_content_str(infp, mimeinfo, &len);
+	if (!text)
+		return NULL;
+
+	outstr = g_string_sized_new(len + 1);
+
+	src_encoding = prefs_common.force_charset ? prefs_common.force_charset
+		: mimeinfo->charset ? mimeinfo->charset
+		: prefs_common.default_encoding;
+
+	if (mimeinfo->mime_type == MIME_TEXT) {
+		gchar *p = text, *next;
+		gchar *end = text + len;
+		gchar c;
+
+		/* the decoded text may contain NUL bytes. Like the lines
+		   read by fgets(), each line is only cut at them. */
+		while (p < end) {
+			gchar *str;
+
+			if ((next = memchr(p, '\n', end - p)) != NULL)
+				next++;
+			else
+				next = end;
+			c = *next;
+			*next = '\0';
+
+			str = conv_codeset_strdup(p, src_encoding, encoding);
+			if (str) {
+				g_string_append(outstr, str);
+				g_free(str);
+			} else {
+				conv_fail = TRUE;
+				g_string_append(outstr, p);
+			}
+
+			*next = c;
+			p = next;
+		}
+	} else if (mimeinfo->mime_type == MIME_TEXT_HTML) {
+		HTMLParser *parser;
+		CodeConverter *conv;
+		const gchar *str;
+
+		conv = conv_code_converter_new(src_encoding, encoding);
+		parser = html_parser_new_str(text, conv);
+		while ((str = html_parse(parser)) != NULL) {
+			g_string_append(outstr, str);
+		}
+		html_parser_destroy(parser);
+		conv_code_converter_destroy(conv);
+	}
+
+	if (conv_fail)
+		g_warning(_("procmime_get_text_content(): Code conversion failed.\n"));
+
+	g_free(text);
+
+	return g_string_free(outstr, FALSE);
+}
+
 FILE *procmime_get_text_content(MimeInfo *mimeinfo, FILE *infp,
 				const gchar *encoding)
 {
@@ -1283,6 +1465,30 @@ FILE *procmime_get_text_content(MimeInfo *mimeinfo, FILE *infp,
 	g_return_val_if_fail(mimeinfo->mime_type == MIME_TEXT ||
 			     mimeinfo->mime_type == MIME_TEXT_HTML, NULL);
 
+	/* only the result needs a temporary file for small parts */
+	if (PROCMIME_USE_MEM_DECODE(mimeinfo)) {
+		gchar *str;
+
+		str = procmime_get_text_content_str(mimeinfo, infp, encoding);
+		if (!str)
+			return NULL;
+		if ((outfp = my_tmpfile()) == NULL) {
+			perror("tmpfile");
+			g_free(str);
+			return NULL;
+		}
+		fputs(str, outfp);
+		g_free(str);
+		if (fflush(outfp) == EOF) {
+			perror("fflush");
+			fclose(outfp);
+			return NULL;
+		}
+		rewind(outfp);
+
+		return outfp;
+	}
+
 	if (fseek(infp, mimeinfo->fpos, SEEK_SET) < 0) {
 		perror("fseek");
 		return NULL;
@@ -1381,24 +1587,55 @@ FILE *procmime_get_first_text_content(MsgInfo *msginfo, const gchar *encoding)
 	return outfp;
 }
 
-gboolean procmime_find_string_part(MimeInfo *mimeinfo, const gchar *filename,
-				   const gchar *str, StrFindFunc find_func)
+typedef struct _FindStringData
 {
+	const gchar *str;
+	StrFindFunc find_func;
+} FindStringData;
 
+static gboolean procmime_find_string_func(const gchar *haystack,
+					  gpointer data)
+{
+	FindStringData *fdata = (FindStringData *)data;
+
+	return fdata->find_func(haystack, fdata->str);
+}
+
+static gboolean procmime_find_part_with_func(MimeInfo *mimeinfo,
+					     const gchar *filename,
+					     MimeFindFunc find_func,
+					     gpointer data)
+{
 	FILE *infp, *outfp;
 	gchar buf[BUFFSIZE];
 
-	g_return_val_if_fail(mimeinfo != NULL, FALSE);
-	g_return_val_if_fail(mimeinfo->mime_type == MIME_TEXT ||
-			     mimeinfo->mime_type == MIME_TEXT_HTML, FALSE);
-	g_return_val_if_fail(str != NULL, FALSE);
-	g_return_val_if_fail(find_func != NULL, FALSE);
-
 	if ((infp = g_fopen(filename, "rb")) == NULL) {
 		FILE_OP_ERROR(filename, "fopen");
 		return FALSE;
 	}
 
+	if (PROCMIME_USE_MEM_DECODE(mimeinfo)) {
+		gchar *text, *p, *next;
+		gboolean found = FALSE;
+
+		text = procmime_get_text_content_str(mimeinfo, infp, NULL);
+		fclose(infp);
+		if (!text)
+			return FALSE;
+
+		for (p = text; *p != '\0' && !found; p = next) {
+			if ((next = strchr(p, '\n')) != NULL)
+				*next++ = '\0';
+			else
+				next = p + strlen(p);
+			strretchomp(p);
+			found = find_func(p, data);
+		}
+
+		g_free(text);
+		return found;
+	}
+
 	outfp = procmime_get_text_content(mimeinfo, infp, NULL);
 	fclose(infp);
 
@@ -1407,7 +1644,7 @@ gboolean procmime_find_string_part(MimeInfo *mimeinfo, const gchar *filename,
 
 	while (fgets(buf, sizeof(buf), outfp) != NULL) {
 		strretchomp(buf);
-		if (find_func(buf, str)) {
+		if (find_func(buf, data)) {
 			fclose(outfp);
 			return TRUE;
 		}
@@ -1418,8 +1655,43 @@ gboolean procmime_find_string_part(MimeInfo *mimeinfo, const gchar *filename,
 	return FALSE;
 }
 
+gboolean procmime_find_string_part(MimeInfo *mimeinfo, const gchar *filename,
+				   const gchar *str, StrFindFunc find_func)
+{
+	FindStringData fdata;
+
+	g_return_val_if_fail(mimeinfo != NULL, FALSE);
+	g_return_val_if_fail(mimeinfo->mime_type == MIME_TEXT ||
+			     mimeinfo->mime_type == MIME_TEXT_HTML, FALSE);
+	g_return_val_if_fail(str != NULL, FALSE);
+	g_return_val_if_fail(find_func != NULL, FALSE);
+
+	fdata.str = str;
+	fdata.find_func = find_func;
+
+	return procmime_find_part_with_func(mimeinfo, filename,
+					    procmime_find_string_func, &fdata);
+}
+
 gboolean procmime_find_string(MsgInfo *msginfo, const gchar *str,
 			      StrFindFunc find_func)
+{
+	FindStringData fdata;
+
+	g_return_val_if_fail(msginfo != NULL, FALSE);
+	g_return_val_if_fail(str != NULL, FALSE);
+	g_return_val_if_fail(find_func != NULL, FALSE);
+
+	fdata.str = str;
+	fdata.find_func = find_func;
+
+	return procmime_find_string_with_func(msginfo,
+					      procmime_find_string_func,
+					      &fdata);
+}
+
+gboolean procmime_find_string_with_func(MsgInfo *msginfo,
+					MimeFindFunc find_func, gpointer data)
 {
 	MimeInfo *mimeinfo;
 	MimeInfo *partinfo;
@@ -1427,7 +1699,6 @@ gboolean procmime_find_string(MsgInfo *msginfo, const gchar *str,
 	gboolean found = FALSE;
 
 	g_return_val_if_fail(msginfo != NULL, FALSE);
-	g_return_val_if_fail(str != NULL, FALSE);
 	g_return_val_if_fail(find_func != NULL, FALSE);
 
 	filename = procmsg_get_message_file(msginfo);
@@ -1438,8 +1709,8 @@ gboolean procmime_find_string(MsgInfo *msginfo, const gchar *str,
 	     partinfo = procmime_mimeinfo_next(partinfo)) {
 		if (partinfo->mime_type == MIME_TEXT ||
 		    partinfo->mime_type == MIME_TEXT_HTML) {
-			if (procmime_find_string_part
-				(partinfo, filename, str, find_func) == TRUE) {
+			if (procmime_find_part_with_func
+				(partinfo, filename, find_func, data) == TRUE) {
 				found = TRUE;
 				break;
 			}
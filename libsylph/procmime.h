@@ -34,6 +34,17 @@ typedef struct _MimeInfo	MimeInfo;
 #include "procmsg.h"
 #include "utils.h"
 
+typedef gboolean (*MimeFindFunc)	(const gchar	*haystack,
+					 gpointer	 data);
+typedef gint (*MimeWriteFunc)		(const gchar	*buf,
+					 gint		 len,
+					 gpointer	 data);
+
+/* parts up to this size are decoded in memory */
+#define PROCMIME_MEM_DECODE_MAX		(1024 * 1024)
+#define PROCMIME_USE_MEM_DECODE(mimeinfo) \
+	((mimeinfo)->size > 0 && (mimeinfo)->size <= PROCMIME_MEM_DECODE_MAX)
+
 typedef enum
 {
 	ENC_7BIT,
@@ -168,6 +179,13 @@ MimeInfo *procmime_scan_mime_header	(FILE		*fp);
 FILE *procmime_decode_content		(FILE		*outfp,
 					 FILE		*infp,
 					 MimeInfo	*mimeinfo);
+gint procmime_decode_content_full	(FILE		*infp,
+					 MimeInfo	*mimeinfo,
+					 MimeWriteFunc	 write_func,
+					 gpointer	 data);
+gchar *procmime_decode_content_str	(FILE		*infp,
+					 MimeInfo	*mimeinfo,
+					 gint		*len);
 gint procmime_get_part			(const gchar	*outfile,
 					 const gchar	*infile,
 					 MimeInfo	*mimeinfo);
@@ -183,6 +201,9 @@ gint procmime_get_all_parts		(const gchar	*dir,
 FILE *procmime_get_text_content		(MimeInfo	*mimeinfo,
 					 FILE		*infp,
 					 const gchar	*encoding);
+gchar *procmime_get_text_content_str	(MimeInfo	*mimeinfo,
+					 FILE		*infp,
+					 const gchar	*encoding);
 FILE *procmime_get_first_text_content	(MsgInfo	*msginfo,
 					 const gchar	*encoding);
 
@@ -193,6 +214,9 @@ gboolean procmime_find_string_part	(MimeInfo	*mimeinfo,
 gboolean procmime_find_string		(MsgInfo	*msginfo,
 					 const gchar	*str,
 					 StrFindFunc	 find_func);
+gboolean procmime_find_string_with_func	(MsgInfo	*msginfo,
+					 MimeFindFunc	 find_func,
+					 gpointer	 data);
 
 gchar *procmime_get_part_file_name	(MimeInfo	*mimeinfo);
 gchar *procmime_get_tmp_file_name	(MimeInfo	*mimeinfo);
@@ -39,6 +39,73 @@ typedef struct _MsgFlagInfo {
 	MsgFlags flags;
 } MsgFlagInfo;
 
+/* The summary journal (JOURNAL_FILE) records the changes made to the
+   summary cache and the mark file since they were last written as a
+   whole.  It consists of the version followed by entries of:
+
+   guint32	type
+   ...		JOURNAL_CACHE_ADD:	a record by procmsg_write_cache()
+		JOURNAL_CACHE_REMOVE:	guint32 msgnum
+		JOURNAL_MARK_SET:	guint32 msgnum, guint32 perm_flags
+		JOURNAL_MARK_REMOVE:	guint32 msgnum
+
+   The entries are applied in order on top of the cache and mark files
+   when they are read.  A full rewrite of either file drops the entries
+   belonging to it, and the journal is merged into both files once it
+   grows beyond JOURNAL_COMPACT_SIZE.  A partial entry left at the end by
+   an interrupted write is cut off before anything is appended again.
+
+   For the merge, the journal is renamed to JOURNAL_MERGE_SUFFIX, whose
+   entries are read before those of the journal until the merged files
+   replace the cache and mark files. */
+
+typedef enum
+{
+	JOURNAL_CACHE_ADD	= 1,
+	JOURNAL_CACHE_REMOVE	= 2,
+	JOURNAL_MARK_SET	= 3,
+	JOURNAL_MARK_REMOVE	= 4
+} JournalType;
+
+#define JOURNAL_MASK(type)	(1 << (type))
+#define JOURNAL_CACHE_MASK	(JOURNAL_MASK(JOURNAL_CACHE_ADD) | \
+				 JOURNAL_MASK(JOURNAL_CACHE_REMOVE))
+#define JOURNAL_MARK_MASK	(JOURNAL_MASK(JOURNAL_MARK_SET) | \
+				 JOURNAL_MASK(JOURNAL_MARK_REMOVE))
+
+#define JOURNAL_COMPACT_SIZE	(256 * 1024)
+#define JOURNAL_MERGE_SUFFIX	".merge"
+
+typedef struct _JournalEntry {
+	JournalType type;
+	guint msgnum;
+	MsgPermFlags perm_flags;
+	MsgInfo *msginfo;
+} JournalEntry;
+
+typedef struct _JournalCompactData {
+	gchar *cachefile;
+	gchar *markfile;
+	gchar *journalfile;
+} JournalCompactData;
+
+/* serializes the access to the cache, mark and journal files */
+#if USE_THREADS
+G_LOCK_DEFINE_STATIC(journal);
+#define S_LOCK(name)	G_LOCK(name)
+#define S_UNLOCK(name)	G_UNLOCK(name)
+#else
+#define S_LOCK(name)
+#define S_UNLOCK(name)
+#endif
+
+static gint journal_compacting = 0;
+/* incremented on each full rewrite of a cache or mark file */
+static guint journal_rewrite_count = 0;
+
+/* journal files which are known to end with a complete entry */
+static GHashTable *journal_checked_table = NULL;
+
 static GSList *procmsg_read_cache_queue		(FolderItem	*item,
 						 gboolean	 scan_file);
 
@@ -50,8 +117,27 @@ static GHashTable *procmsg_read_mark_file	(FolderItem	*item);
 static void procmsg_write_mark_file		(FolderItem	*item,
 						 GHashTable	*mark_table);
 
+static GHashTable *procmsg_read_mark_table	(const gchar	*markfile);
+static gint procmsg_write_mark_table		(const gchar	*markfile,
+						 GHashTable	*mark_table);
+
 static GMappedFile *procmsg_open_cache_file_mmap(FolderItem	*item,
-						 DataOpenMode	 mode);
+						 DataOpenMode	 mode,
+						 guint32	*version);
+static GMappedFile *procmsg_map_cache_file	(const gchar	*cachefile,
+						 guint32	*version);
+
+static GSList *procmsg_read_journal		(const gchar	*journalfile);
+static GSList *procmsg_read_journal_full	(const gchar	*journalfile,
+						 gboolean	*corrupted);
+static void procmsg_write_journal		(FolderItem	*item,
+						 GSList		*entries);
+static void procmsg_drop_journal		(const gchar	*journalfile,
+						 guint		 mask);
+static void procmsg_drop_journal_file		(const gchar	*journalfile,
+						 guint		 mask);
+static void procmsg_journal_free		(GSList		*entries);
+static void procmsg_compact_journal		(FolderItem	*item);
 
 static gint procmsg_cmp_by_mark			(gconstpointer	 a,
 						 gconstpointer	 b);
@@ -179,24 +265,15 @@ static gint procmsg_read_cache_data_str_mem(const gchar **p, const gchar *endp,
 
 #define READ_CACHE_DATA(data)						\
 {									\
-	if (procmsg_read_cache_data_str_mem(&p, endp, &data) < 0) {	\
-		g_warning("Cache data is corrupted\n");			\
-		procmsg_msginfo_free(msginfo);				\
-		procmsg_msg_list_free(mlist);				\
-		g_mapped_file_free(mapfile);				\
-		return NULL;						\
-	}								\
+	if (procmsg_read_cache_data_str_mem(&p, endp, &data) < 0)	\
+		goto corrupted;						\
 }
 
 #define READ_CACHE_DATA_INT(n)					\
 {								\
-	if (endp - p < sizeof(guint32)) {			\
-		g_warning("Cache data is corrupted\n");		\
-		procmsg_msginfo_free(msginfo);			\
-		procmsg_msg_list_free(mlist);			\
-		g_mapped_file_free(mapfile);			\
-		return NULL;					\
-	} else {						\
+	if (endp - p < sizeof(guint32))				\
+		goto corrupted;					\
+	else {							\
 		guint32 idata;					\
 		memcpy(&idata, p, sizeof(idata));		\
 		n = idata;					\
@@ -204,18 +281,375 @@ static gint procmsg_read_cache_data_str_mem(const gchar **p, const gchar *endp,
 	}							\
 }
 
-GSList *procmsg_read_cache(FolderItem *item, gboolean scan_file)
+/* read one variable-length record written by procmsg_write_cache() */
+static MsgInfo *procmsg_read_cache_record(const gchar **pp, const gchar *endp)
+{
+	const gchar *p = *pp;
+	MsgInfo *msginfo;
+	guint refnum;
+
+	msginfo = g_new0(MsgInfo, 1);
+
+	READ_CACHE_DATA_INT(msginfo->msgnum);
+
+	READ_CACHE_DATA_INT(msginfo->size);
+	READ_CACHE_DATA_INT(msginfo->mtime);
+	READ_CACHE_DATA_INT(msginfo->date_t);
+	READ_CACHE_DATA_INT(msginfo->flags.tmp_flags);
+
+	READ_CACHE_DATA(msginfo->fromname);
+
+	READ_CACHE_DATA(msginfo->date);
+	READ_CACHE_DATA(msginfo->from);
+	READ_CACHE_DATA(msginfo->to);
+	READ_CACHE_DATA(msginfo->newsgroups);
+	READ_CACHE_DATA(msginfo->subject);
+	READ_CACHE_DATA(msginfo->msgid);
+	READ_CACHE_DATA(msginfo->inreplyto);
+
+	READ_CACHE_DATA_INT(refnum);
+	for (; refnum != 0; refnum--) {
+		gchar *ref = NULL;
+
+		READ_CACHE_DATA(ref);
+		msginfo->references =
+			g_slist_prepend(msginfo->references, ref);
+	}
+	if (msginfo->references)
+		msginfo->references = g_slist_reverse(msginfo->references);
+
+	*pp = p;
+	return msginfo;
+
+corrupted:
+	procmsg_msginfo_free(msginfo);
+	return NULL;
+}
+
+#undef READ_CACHE_DATA
+#undef READ_CACHE_DATA_INT
+
+/* The summary cache of CACHE_VERSION consists of:
+
+   guint32	  version
+   MsgCacheHeader header
+   MsgCacheRecord records[n_records]	(header.record_size bytes each)
+   guint32	  refs[n_refs]		(string offsets of References)
+   gchar	  strtab[strtab_size]	(NUL-terminated, interned strings)
+   ...		  records appended by procmsg_write_cache()
+
+   String fields are offsets into strtab, with 0 meaning NULL.
+   procmsg_read_cache() points the MsgInfo members directly into the
+   mapped string table instead of duplicating them. */
+
+typedef struct _MsgCacheHeader
+{
+	guint32 n_records;
+	guint32 record_size;
+	guint32 n_refs;
+	guint32 strtab_size;
+} MsgCacheHeader;
+
+typedef struct _MsgCacheRecord
+{
+	guint32 msgnum;
+	guint32 size;
+	guint32 mtime;
+	guint32 date_t;
+	guint32 tmp_flags;
+
+	guint32 fromname;
+
+	guint32 date;
+	guint32 from;
+	guint32 to;
+	guint32 newsgroups;
+	guint32 subject;
+	guint32 msgid;
+	guint32 inreplyto;
+
+	guint32 refs;
+	guint32 n_refs;
+} MsgCacheRecord;
+
+struct _MsgCacheMap
 {
-	GSList *mlist = NULL;
-	GSList *last = NULL;
 	GMappedFile *mapfile;
+
+	const gchar *records;
+	guint32 n_records;
+	guint32 record_size;
+
+	const guint32 *refs;
+	guint32 n_refs;
+
+	const gchar *strtab;
+	guint32 strtab_size;
+
+	gint ref_count;
+};
+
+static MsgCacheMap *procmsg_cache_map_new(GMappedFile *mapfile,
+					  const gchar **pp, const gchar *endp)
+{
+	MsgCacheMap *map;
+	MsgCacheHeader header;
+	const gchar *p = *pp;
+	guint64 table_size;
+
+	if (endp - p < sizeof(header))
+		return NULL;
+	memcpy(&header, p, sizeof(header));
+	p += sizeof(header);
+
+	if (header.record_size < sizeof(MsgCacheRecord) ||
+	    header.record_size % sizeof(guint32) != 0)
+		return NULL;
+
+	table_size = (guint64)header.n_records * header.record_size +
+		(guint64)header.n_refs * sizeof(guint32) + header.strtab_size;
+	if (table_size > endp - p)
+		return NULL;
+	if (header.strtab_size > 0 &&
+	    p[table_size - 1] != '\0')
+		return NULL;
+
+	map = g_new0(MsgCacheMap, 1);
+	map->mapfile = mapfile;
+	map->records = p;
+	map->n_records = header.n_records;
+	map->record_size = header.record_size;
+	p += (gsize)header.n_records * header.record_size;
+	map->refs = (const guint32 *)p;
+	map->n_refs = header.n_refs;
+	p += (gsize)header.n_refs * sizeof(guint32);
+	map->strtab = p;
+	map->strtab_size = header.strtab_size;
+	p += header.strtab_size;
+	map->ref_count = 1;
+
+	*pp = p;
+	return map;
+}
+
+static MsgCacheMap *procmsg_cache_map_ref(MsgCacheMap *map)
+{
+	g_atomic_int_inc(&map->ref_count);
+	return map;
+}
+
+static void procmsg_cache_map_unref(MsgCacheMap *map)
+{
+	if (g_atomic_int_dec_and_test(&map->ref_count)) {
+		g_mapped_file_free(map->mapfile);
+		g_free(map);
+	}
+}
+
+static gboolean procmsg_msginfo_str_is_mapped(const MsgInfo *msginfo,
+					      const gchar *str)
+{
+	const MsgCacheMap *map = msginfo->cache_map;
+
+	return map != NULL && str != NULL &&
+		str >= map->strtab && str < map->strtab + map->strtab_size;
+}
+
+#define CACHE_MAP_STR(ofs)	((ofs) != 0 ? (gchar *)map->strtab + (ofs) : NULL)
+
+static MsgInfo *procmsg_cache_map_get_msginfo(MsgCacheMap *map, guint32 index)
+{
+	const MsgCacheRecord *rec;
+	MsgInfo *msginfo;
+	guint32 i;
+
+	rec = (const MsgCacheRecord *)(map->records +
+				       (gsize)index * map->record_size);
+
+	if (rec->fromname >= map->strtab_size ||
+	    rec->date >= map->strtab_size ||
+	    rec->from >= map->strtab_size ||
+	    rec->to >= map->strtab_size ||
+	    rec->newsgroups >= map->strtab_size ||
+	    rec->subject >= map->strtab_size ||
+	    rec->msgid >= map->strtab_size ||
+	    rec->inreplyto >= map->strtab_size ||
+	    rec->refs > map->n_refs || rec->n_refs > map->n_refs - rec->refs)
+		return NULL;
+	for (i = rec->refs; i < rec->refs + rec->n_refs; i++) {
+		if (map->refs[i] == 0 || map->refs[i] >= map->strtab_size)
+			return NULL;
+	}
+
+	msginfo = g_new0(MsgInfo, 1);
+
+	msginfo->msgnum = rec->msgnum;
+	msginfo->size = rec->size;
+	msginfo->mtime = rec->mtime;
+	msginfo->date_t = rec->date_t;
+	msginfo->flags.tmp_flags = rec->tmp_flags;
+
+	msginfo->fromname = CACHE_MAP_STR(rec->fromname);
+
+	msginfo->date = CACHE_MAP_STR(rec->date);
+	msginfo->from = CACHE_MAP_STR(rec->from);
+	msginfo->to = CACHE_MAP_STR(rec->to);
+	msginfo->newsgroups = CACHE_MAP_STR(rec->newsgroups);
+	msginfo->subject = CACHE_MAP_STR(rec->subject);
+	msginfo->msgid = CACHE_MAP_STR(rec->msgid);
+	msginfo->inreplyto = CACHE_MAP_STR(rec->inreplyto);
+
+	for (i = rec->refs + rec->n_refs; i > rec->refs; i--) {
+		msginfo->references = g_slist_prepend
+			(msginfo->references, CACHE_MAP_STR(map->refs[i - 1]));
+	}
+
+	msginfo->cache_map = procmsg_cache_map_ref(map);
+
+#ifdef G_OS_WIN32
+	/* mapped files cannot be replaced on Win32 while in use */
+	procmsg_msginfo_unmap(msginfo);
+#endif
+
+	return msginfo;
+}
+
+#undef CACHE_MAP_STR
+
+static gboolean procmsg_read_cache_check(FolderItem *item, MsgInfo *msginfo,
+					 MsgFlags *default_flags,
+					 gboolean scan_file)
+{
+	MSG_SET_PERM_FLAGS(msginfo->flags, default_flags->perm_flags);
+	MSG_SET_TMP_FLAGS(msginfo->flags, default_flags->tmp_flags);
+
+	/* if the message file doesn't exist or is changed,
+	   don't add the data */
+	if ((FOLDER_TYPE(item->folder) == F_MH && scan_file &&
+	     folder_item_is_msg_changed(item, msginfo)) ||
+	     msginfo->msgnum == 0) {
+		procmsg_msginfo_free(msginfo);
+		item->cache_dirty = TRUE;
+		return FALSE;
+	}
+
+	msginfo->folder = item;
+	return TRUE;
+}
+
+/* read all the records of the summary cache.  mapfile is always consumed. */
+static gint procmsg_parse_cache(GMappedFile *mapfile, guint32 version,
+				GSList **mlist)
+{
+	GSList *list = NULL;
+	MsgCacheMap *map = NULL;
 	const gchar *filep;
-	gsize file_len;
 	const gchar *p, *endp;
 	MsgInfo *msginfo;
+	guint32 i;
+
+	filep = g_mapped_file_get_contents(mapfile);
+	endp = filep + g_mapped_file_get_length(mapfile);
+	p = filep + sizeof(guint32); /* version */
+
+	if (version == CACHE_VERSION) {
+		map = procmsg_cache_map_new(mapfile, &p, endp);
+		if (!map) {
+			g_mapped_file_free(mapfile);
+			return -1;
+		}
+
+		for (i = 0; i < map->n_records; i++) {
+			msginfo = procmsg_cache_map_get_msginfo(map, i);
+			if (!msginfo)
+				goto corrupted;
+			list = g_slist_prepend(list, msginfo);
+		}
+	}
+
+	/* records appended after the table */
+	while (endp - p >= sizeof(guint32)) {
+		msginfo = procmsg_read_cache_record(&p, endp);
+		if (!msginfo)
+			goto corrupted;
+		list = g_slist_prepend(list, msginfo);
+	}
+
+	if (map)
+		procmsg_cache_map_unref(map);
+	else
+		g_mapped_file_free(mapfile);
+
+	*mlist = g_slist_reverse(list);
+	return 0;
+
+corrupted:
+	procmsg_msg_list_free(list);
+	if (map)
+		procmsg_cache_map_unref(map);
+	else
+		g_mapped_file_free(mapfile);
+	return -1;
+}
+
+/* apply the cache entries of the journal to mlist */
+static GSList *procmsg_journal_apply_to_list(GSList *mlist, GSList *entries)
+{
+	GHashTable *node_table;
+	GSList *cur, *last, *node;
+	JournalEntry *entry;
+
+	if (!entries)
+		return mlist;
+
+	node_table = g_hash_table_new(NULL, g_direct_equal);
+	for (cur = mlist, last = NULL; cur != NULL; last = cur, cur = cur->next)
+		g_hash_table_insert(node_table,
+				    GUINT_TO_POINTER(((MsgInfo *)cur->data)->msgnum),
+				    cur);
+
+	for (cur = entries; cur != NULL; cur = cur->next) {
+		entry = (JournalEntry *)cur->data;
+		node = g_hash_table_lookup(node_table,
+					   GUINT_TO_POINTER(entry->msgnum));
+
+		if (entry->type == JOURNAL_CACHE_ADD) {
+			if (node) {
+				procmsg_msginfo_free((MsgInfo *)node->data);
+				node->data = entry->msginfo;
+			} else if (!last) {
+				last = mlist = g_slist_append(NULL,
+							      entry->msginfo);
+				node = last;
+			} else {
+				last = g_slist_append(last, entry->msginfo);
+				last = node = last->next;
+			}
+			entry->msginfo = NULL;
+			g_hash_table_insert(node_table,
+					    GUINT_TO_POINTER(entry->msgnum),
+					    node);
+		} else if (entry->type == JOURNAL_CACHE_REMOVE && node) {
+			procmsg_msginfo_free((MsgInfo *)node->data);
+			node->data = NULL;
+			g_hash_table_remove(node_table,
+					    GUINT_TO_POINTER(entry->msgnum));
+		}
+	}
+
+	g_hash_table_destroy(node_table);
+
+	return g_slist_remove_all(mlist, NULL);
+}
+
+GSList *procmsg_read_cache(FolderItem *item, gboolean scan_file)
+{
+	GSList *mlist = NULL;
+	GSList *entries = NULL;
+	GSList *cur;
+	GMappedFile *mapfile;
+	guint32 version;
 	MsgFlags default_flags;
-	guint32 num;
-	guint refnum;
 	FolderType type;
 
 	g_return_val_if_fail(item != NULL, NULL);
@@ -248,7 +682,17 @@ GSList *procmsg_read_cache(FolderItem *item, gboolean scan_file)
 		g_free(path);
 	}
 
-	mapfile = procmsg_open_cache_file_mmap(item, DATA_READ);
+	S_LOCK(journal);
+	mapfile = procmsg_open_cache_file_mmap(item, DATA_READ, &version);
+	if (mapfile) {
+		gchar *journalfile;
+
+		journalfile = folder_item_get_journal_file(item);
+		entries = procmsg_read_journal(journalfile);
+		g_free(journalfile);
+	}
+	S_UNLOCK(journal);
+
 	if (!mapfile) {
 		item->cache_dirty = TRUE;
 		return NULL;
@@ -256,66 +700,29 @@ GSList *procmsg_read_cache(FolderItem *item, gboolean scan_file)
 
 	debug_print("Reading summary cache...\n");
 
-	filep = g_mapped_file_get_contents(mapfile);
-	file_len = g_mapped_file_get_length(mapfile);
-	endp = filep + file_len;
-	p = filep + sizeof(guint32); /* version */
-
-	while (endp - p >= sizeof(num)) {
-		msginfo = g_new0(MsgInfo, 1);
-
-		READ_CACHE_DATA_INT(msginfo->msgnum);
-
-		READ_CACHE_DATA_INT(msginfo->size);
-		READ_CACHE_DATA_INT(msginfo->mtime);
-		READ_CACHE_DATA_INT(msginfo->date_t);
-		READ_CACHE_DATA_INT(msginfo->flags.tmp_flags);
-
-		READ_CACHE_DATA(msginfo->fromname);
-
-		READ_CACHE_DATA(msginfo->date);
-		READ_CACHE_DATA(msginfo->from);
-		READ_CACHE_DATA(msginfo->to);
-		READ_CACHE_DATA(msginfo->newsgroups);
-		READ_CACHE_DATA(msginfo->subject);
-		READ_CACHE_DATA(msginfo->msgid);
-		READ_CACHE_DATA(msginfo->inreplyto);
-
-		READ_CACHE_DATA_INT(refnum);
-		for (; refnum != 0; refnum--) {
-			gchar *ref;
-
-			READ_CACHE_DATA(ref);
-			msginfo->references =
-				g_slist_prepend(msginfo->references, ref);
-		}
-		if (msginfo->references)
-			msginfo->references =
-				g_slist_reverse(msginfo->references);
+	if (version != CACHE_VERSION) {
+		/* convert to the current format on the next write */
+		debug_print("Converting summary cache from version %u\n",
+			    version);
+		item->cache_dirty = TRUE;
+	}
 
-		MSG_SET_PERM_FLAGS(msginfo->flags, default_flags.perm_flags);
-		MSG_SET_TMP_FLAGS(msginfo->flags, default_flags.tmp_flags);
+	if (procmsg_parse_cache(mapfile, version, &mlist) < 0) {
+		g_warning("Cache data is corrupted\n");
+		procmsg_journal_free(entries);
+		item->cache_dirty = TRUE;
+		return NULL;
+	}
 
-		/* if the message file doesn't exist or is changed,
-		   don't add the data */
-		if ((type == F_MH && scan_file &&
-		     folder_item_is_msg_changed(item, msginfo)) ||
-		     msginfo->msgnum == 0) {
-			procmsg_msginfo_free(msginfo);
-			item->cache_dirty = TRUE;
-		} else {
-			msginfo->folder = item;
+	mlist = procmsg_journal_apply_to_list(mlist, entries);
+	procmsg_journal_free(entries);
 
-			if (!mlist)
-				last = mlist = g_slist_append(NULL, msginfo);
-			else {
-				last = g_slist_append(last, msginfo);
-				last = last->next;
-			}
-		}
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		if (!procmsg_read_cache_check(item, (MsgInfo *)cur->data,
+					      &default_flags, scan_file))
+			cur->data = NULL;
 	}
-
-	g_mapped_file_free(mapfile);
+	mlist = g_slist_remove_all(mlist, NULL);
 
 	if (item->cache_queue) {
 		GSList *qlist;
@@ -328,9 +735,6 @@ GSList *procmsg_read_cache(FolderItem *item, gboolean scan_file)
 	return mlist;
 }
 
-#undef READ_CACHE_DATA
-#undef READ_CACHE_DATA_INT
-
 static GSList *procmsg_read_cache_queue(FolderItem *item, gboolean scan_file)
 {
 	FolderType type;
@@ -604,28 +1008,172 @@ void procmsg_write_flags(MsgInfo *msginfo, FILE *fp)
 	WRITE_CACHE_DATA_INT(flags, fp);
 }
 
-void procmsg_write_cache_list(FolderItem *item, GSList *mlist)
+static guint32 procmsg_cache_intern_str(GString *strtab, GHashTable *table,
+					const gchar *str)
+{
+	gpointer ofs;
+
+	if (str == NULL || *str == '\0')
+		return 0;
+
+	ofs = g_hash_table_lookup(table, str);
+	if (ofs)
+		return GPOINTER_TO_UINT(ofs);
+
+	ofs = GUINT_TO_POINTER(strtab->len);
+	g_string_append_len(strtab, str, strlen(str) + 1);
+	g_hash_table_insert(table, (gchar *)str, ofs);
+
+	return GPOINTER_TO_UINT(ofs);
+}
+
+static void procmsg_cache_add_record(GArray *records, GArray *refs,
+				     GString *strtab, GHashTable *table,
+				     MsgInfo *msginfo)
+{
+	MsgCacheRecord rec;
+	GSList *cur;
+
+#define INTERN(str)	procmsg_cache_intern_str(strtab, table, str)
+
+	rec.msgnum = msginfo->msgnum;
+	rec.size = msginfo->size;
+	rec.mtime = msginfo->mtime;
+	rec.date_t = msginfo->date_t;
+	rec.tmp_flags = msginfo->flags.tmp_flags & MSG_CACHED_FLAG_MASK;
+
+	rec.fromname = INTERN(msginfo->fromname);
+
+	rec.date = INTERN(msginfo->date);
+	rec.from = INTERN(msginfo->from);
+	rec.to = INTERN(msginfo->to);
+	rec.newsgroups = INTERN(msginfo->newsgroups);
+	rec.subject = INTERN(msginfo->subject);
+	rec.msgid = INTERN(msginfo->msgid);
+	rec.inreplyto = INTERN(msginfo->inreplyto);
+
+	rec.refs = refs->len;
+	rec.n_refs = 0;
+	for (cur = msginfo->references; cur != NULL; cur = cur->next) {
+		guint32 ofs;
+
+		ofs = INTERN((gchar *)cur->data);
+		if (ofs == 0)
+			continue;
+		g_array_append_val(refs, ofs);
+		rec.n_refs++;
+	}
+
+#undef INTERN
+
+	g_array_append_val(records, rec);
+}
+
+static gint procmsg_write_cache_table(const gchar *cachefile, GSList *mlist,
+				      GSList *qlist)
 {
+	gchar *tmpfile;
 	FILE *fp;
+	MsgCacheHeader header;
+	GArray *records, *refs;
+	GString *strtab;
+	GHashTable *table;
 	GSList *cur;
+	gint ret = 0;
+
+	records = g_array_new(FALSE, FALSE, sizeof(MsgCacheRecord));
+	refs = g_array_new(FALSE, FALSE, sizeof(guint32));
+	strtab = g_string_sized_new(BUFFSIZE);
+	table = g_hash_table_new(g_str_hash, g_str_equal);
+
+	/* offset 0 stands for NULL */
+	g_string_append_c(strtab, '\0');
+
+	for (cur = mlist; cur != NULL; cur = cur->next)
+		procmsg_cache_add_record(records, refs, strtab, table,
+					 (MsgInfo *)cur->data);
+	for (cur = qlist; cur != NULL; cur = cur->next)
+		procmsg_cache_add_record(records, refs, strtab, table,
+					 (MsgInfo *)cur->data);
+
+	g_hash_table_destroy(table);
+
+	header.n_records = records->len;
+	header.record_size = sizeof(MsgCacheRecord);
+	header.n_refs = refs->len;
+	header.strtab_size = strtab->len;
+
+	/* write to a new file and rename it, since the current one may
+	   still be mapped by the MsgInfo's returned by procmsg_read_cache() */
+	tmpfile = g_strconcat(cachefile, ".tmp", NULL);
+	if ((fp = procmsg_open_data_file(tmpfile, CACHE_VERSION, DATA_WRITE,
+					 NULL, 0)) == NULL) {
+		ret = -1;
+		goto finish;
+	}
+
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+	    (records->len > 0 &&
+	     fwrite(records->data, sizeof(MsgCacheRecord), records->len, fp)
+	     != records->len) ||
+	    (refs->len > 0 &&
+	     fwrite(refs->data, sizeof(guint32), refs->len, fp) != refs->len) ||
+	    fwrite(strtab->str, strtab->len, 1, fp) != 1) {
+		FILE_OP_ERROR(tmpfile, "fwrite");
+		fclose(fp);
+		ret = -1;
+	} else if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(tmpfile, "fclose");
+		ret = -1;
+	} else if (rename_force(tmpfile, cachefile) < 0) {
+		FILE_OP_ERROR(tmpfile, "rename");
+		ret = -1;
+	}
+
+	if (ret < 0)
+		g_unlink(tmpfile);
+
+finish:
+	g_free(tmpfile);
+	g_array_free(records, TRUE);
+	g_array_free(refs, TRUE);
+	g_string_free(strtab, TRUE);
+
+	return ret;
+}
+
+void procmsg_write_cache_list(FolderItem *item, GSList *mlist)
+{
+	gchar *cachefile, *journalfile;
+	GSList *qlist;
+	gint ret;
 
 	g_return_if_fail(item != NULL);
 
 	debug_print("Writing summary cache (%s)\n", item->path);
 
-	fp = procmsg_open_cache_file(item, DATA_WRITE);
-	if (fp == NULL)
-		return;
+	cachefile = folder_item_get_cache_file(item);
+	g_return_if_fail(cachefile != NULL);
+	journalfile = folder_item_get_journal_file(item);
 
-	for (cur = mlist; cur != NULL; cur = cur->next) {
-		MsgInfo *msginfo = (MsgInfo *)cur->data;
-		procmsg_write_cache(msginfo, fp);
-	}
+	qlist = g_slist_reverse(item->cache_queue);
+	item->cache_queue = NULL;
 
-	if (item->cache_queue)
-		procmsg_flush_cache_queue(item, fp);
+	S_LOCK(journal);
+	ret = procmsg_write_cache_table(cachefile, mlist, qlist);
+	if (ret == 0)
+		procmsg_drop_journal(journalfile, JOURNAL_CACHE_MASK);
+	S_UNLOCK(journal);
 
-	fclose(fp);
+	g_free(journalfile);
+	g_free(cachefile);
+
+	if (ret < 0) {
+		item->cache_queue = g_slist_reverse(qlist);
+		return;
+	}
+
+	procmsg_msg_list_free(qlist);
 	item->cache_dirty = FALSE;
 }
 
@@ -633,14 +1181,19 @@ void procmsg_write_flags_list(FolderItem *item, GSList *mlist)
 {
 	FILE *fp;
 	GSList *cur;
+	gchar *journalfile;
 
 	g_return_if_fail(item != NULL);
 
 	debug_print("Writing summary flags (%s)\n", item->path);
 
+	S_LOCK(journal);
+
 	fp = procmsg_open_mark_file(item, DATA_WRITE);
-	if (fp == NULL)
+	if (fp == NULL) {
+		S_UNLOCK(journal);
 		return;
+	}
 
 	for (cur = mlist; cur != NULL; cur = cur->next) {
 		MsgInfo *msginfo = (MsgInfo *)cur->data;
@@ -651,6 +1204,13 @@ void procmsg_write_flags_list(FolderItem *item, GSList *mlist)
 		procmsg_flush_mark_queue(item, fp);
 
 	fclose(fp);
+
+	journalfile = folder_item_get_journal_file(item);
+	procmsg_drop_journal(journalfile, JOURNAL_MARK_MASK);
+	g_free(journalfile);
+
+	S_UNLOCK(journal);
+
 	item->mark_dirty = FALSE;
 }
 
@@ -665,11 +1225,26 @@ static gint cmp_by_item(gconstpointer a, gconstpointer b)
 	return msginfo1->folder - msginfo2->folder;
 }
 
+static JournalEntry *procmsg_journal_entry_new(JournalType type, guint msgnum,
+					       MsgPermFlags perm_flags,
+					       MsgInfo *msginfo)
+{
+	JournalEntry *entry;
+
+	entry = g_new(JournalEntry, 1);
+	entry->type = type;
+	entry->msgnum = msgnum;
+	entry->perm_flags = perm_flags;
+	entry->msginfo = msginfo;
+
+	return entry;
+}
+
 void procmsg_write_flags_for_multiple_folders(GSList *mlist)
 {
 	GSList *tmp_list, *cur;
+	GSList *entries = NULL;
 	FolderItem *prev_item = NULL;
-	FILE *fp = NULL;
 
 	if (!mlist)
 		return;
@@ -682,21 +1257,28 @@ void procmsg_write_flags_for_multiple_folders(GSList *mlist)
 		FolderItem *item = msginfo->folder;
 
 		if (prev_item != item) {
-			if (fp)
-				fclose(fp);
-			fp = procmsg_open_mark_file(item, DATA_APPEND);
-			if (!fp) {
-				g_warning("can't open mark file\n");
-				break;
+			if (entries) {
+				entries = g_slist_reverse(entries);
+				procmsg_write_journal(prev_item, entries);
+				slist_free_strings(entries);
+				g_slist_free(entries);
+				entries = NULL;
 			}
 			item->updated = TRUE;
 		}
-		procmsg_write_flags(msginfo, fp);
+		entries = g_slist_prepend
+			(entries, procmsg_journal_entry_new
+				(JOURNAL_MARK_SET, msginfo->msgnum,
+				 msginfo->flags.perm_flags, NULL));
 		prev_item = item;
 	}
 
-	if (fp)
-		fclose(fp);
+	if (entries) {
+		entries = g_slist_reverse(entries);
+		procmsg_write_journal(prev_item, entries);
+		slist_free_strings(entries);
+		g_slist_free(entries);
+	}
 	g_slist_free(tmp_list);
 }
 
@@ -704,8 +1286,8 @@ void procmsg_flush_mark_queue(FolderItem *item, FILE *fp)
 {
 	MsgFlagInfo *flaginfo;
 	MsgInfo msginfo = {0};
-	gboolean append = FALSE;
 	GSList *qlist, *cur;
+	GSList *entries = NULL;
 
 	g_return_if_fail(item != NULL);
 
@@ -714,28 +1296,33 @@ void procmsg_flush_mark_queue(FolderItem *item, FILE *fp)
 
 	debug_print("flushing mark_queue: %s ...\n", item->path);
 
-	if (!fp) {
-		append =  TRUE;
-		fp = procmsg_open_mark_file(item, DATA_APPEND);
-		g_return_if_fail(fp != NULL);
-	}
-
 	qlist = g_slist_reverse(item->mark_queue);
 	item->mark_queue = NULL;
 
 	for (cur = qlist; cur != NULL; cur = cur->next) {
 		flaginfo = (MsgFlagInfo *)cur->data;
 
-		msginfo.msgnum = flaginfo->msgnum;
-		msginfo.flags = flaginfo->flags;
-		procmsg_write_flags(&msginfo, fp);
+		if (fp) {
+			msginfo.msgnum = flaginfo->msgnum;
+			msginfo.flags = flaginfo->flags;
+			procmsg_write_flags(&msginfo, fp);
+		} else
+			entries = g_slist_prepend
+				(entries, procmsg_journal_entry_new
+					(JOURNAL_MARK_SET, flaginfo->msgnum,
+					 flaginfo->flags.perm_flags, NULL));
 		g_free(flaginfo);
 	}
 
 	g_slist_free(qlist);
 
-	if (append)
-		fclose(fp);
+	/* append to the journal instead of the mark file */
+	if (entries) {
+		entries = g_slist_reverse(entries);
+		procmsg_write_journal(item, entries);
+		slist_free_strings(entries);
+		g_slist_free(entries);
+	}
 }
 
 void procmsg_add_mark_queue(FolderItem *item, gint num, MsgFlags flags)
@@ -763,8 +1350,8 @@ void procmsg_flaginfo_list_free(GSList *flaglist)
 void procmsg_flush_cache_queue(FolderItem *item, FILE *fp)
 {
 	MsgInfo *msginfo;
-	gboolean append = FALSE;
 	GSList *qlist, *cur;
+	GSList *entries = NULL;
 
 	g_return_if_fail(item != NULL);
 
@@ -773,12 +1360,6 @@ void procmsg_flush_cache_queue(FolderItem *item, FILE *fp)
 
 	debug_print("flushing cache_queue: %s ...\n", item->path);
 
-	if (!fp) {
-		append =  TRUE;
-		fp = procmsg_open_cache_file(item, DATA_APPEND);
-		g_return_if_fail(fp != NULL);
-	}
-
 	qlist = g_slist_reverse(item->cache_queue);
 	item->cache_queue = NULL;
 
@@ -787,14 +1368,24 @@ void procmsg_flush_cache_queue(FolderItem *item, FILE *fp)
 
 		debug_print("flush cache queue: %s/%d\n",
 			    item->path, msginfo->msgnum);
-		procmsg_write_cache(msginfo, fp);
-		procmsg_msginfo_free(msginfo);
+		if (fp)
+			procmsg_write_cache(msginfo, fp);
+		else
+			entries = g_slist_prepend
+				(entries, procmsg_journal_entry_new
+					(JOURNAL_CACHE_ADD, msginfo->msgnum,
+					 0, msginfo));
 	}
 
-	g_slist_free(qlist);
+	/* append to the journal instead of the cache file */
+	if (entries) {
+		entries = g_slist_reverse(entries);
+		procmsg_write_journal(item, entries);
+		slist_free_strings(entries);
+		g_slist_free(entries);
+	}
 
-	if (append)
-		fclose(fp);
+	procmsg_msg_list_free(qlist);
 }
 
 void procmsg_add_cache_queue(FolderItem *item, gint num, MsgInfo *msginfo)
@@ -863,8 +1454,8 @@ void procmsg_flush_folder_foreach(GHashTable *folder_table)
 
 void procmsg_add_flags(FolderItem *item, gint num, MsgFlags flags)
 {
-	FILE *fp;
-	MsgInfo msginfo;
+	JournalEntry entry;
+	GSList entries;
 
 	g_return_if_fail(item != NULL);
 
@@ -873,16 +1464,14 @@ void procmsg_add_flags(FolderItem *item, gint num, MsgFlags flags)
 		return;
 	}
 
-	if ((fp = procmsg_open_mark_file(item, DATA_APPEND)) == NULL) {
-		g_warning(_("can't open mark file\n"));
-		return;
-	}
-
-	msginfo.msgnum = num;
-	msginfo.flags = flags;
+	entry.type = JOURNAL_MARK_SET;
+	entry.msgnum = num;
+	entry.perm_flags = flags.perm_flags;
+	entry.msginfo = NULL;
+	entries.data = &entry;
+	entries.next = NULL;
 
-	procmsg_write_flags(&msginfo, fp);
-	fclose(fp);
+	procmsg_write_journal(item, &entries);
 }
 
 struct MarkSum {
@@ -935,7 +1524,7 @@ void procmsg_get_mark_sum(FolderItem *item,
 	}
 }
 
-static GHashTable *procmsg_read_mark_file(FolderItem *item)
+static GHashTable *procmsg_read_mark_table(const gchar *markfile)
 {
 	FILE *fp;
 	GHashTable *mark_table = NULL;
@@ -943,9 +1532,9 @@ static GHashTable *procmsg_read_mark_file(FolderItem *item)
 	guint num;
 	MsgFlags *flags;
 	MsgPermFlags perm_flags;
-	GSList *cur;
 
-	if ((fp = procmsg_open_mark_file(item, DATA_READ)) == NULL)
+	if ((fp = procmsg_open_data_file(markfile, MARK_VERSION, DATA_READ,
+					 NULL, 0)) == NULL)
 		return NULL;
 
 	mark_table = g_hash_table_new(NULL, g_direct_equal);
@@ -955,68 +1544,659 @@ static GHashTable *procmsg_read_mark_file(FolderItem *item)
 		if (fread(&idata, sizeof(idata), 1, fp) != 1) break;
 		perm_flags = idata;
 
-		flags = g_hash_table_lookup(mark_table, GUINT_TO_POINTER(num));
-		if (flags != NULL)
-			g_free(flags);
+		flags = g_hash_table_lookup(mark_table, GUINT_TO_POINTER(num));
+		if (flags != NULL)
+			g_free(flags);
+
+		flags = g_new0(MsgFlags, 1);
+		flags->perm_flags = perm_flags;
+
+		g_hash_table_insert(mark_table, GUINT_TO_POINTER(num), flags);
+	}
+
+	fclose(fp);
+
+	return mark_table;
+}
+
+/* apply the mark entries of the journal to mark_table */
+static void procmsg_journal_apply_to_mark_table(GHashTable *mark_table,
+						GSList *entries)
+{
+	GSList *cur;
+	JournalEntry *entry;
+	MsgFlags *flags;
+
+	for (cur = entries; cur != NULL; cur = cur->next) {
+		entry = (JournalEntry *)cur->data;
+		if (entry->type != JOURNAL_MARK_SET &&
+		    entry->type != JOURNAL_MARK_REMOVE)
+			continue;
+
+		flags = g_hash_table_lookup(mark_table,
+					    GUINT_TO_POINTER(entry->msgnum));
+		if (flags != NULL) {
+			g_hash_table_remove(mark_table,
+					    GUINT_TO_POINTER(entry->msgnum));
+			g_free(flags);
+		}
+
+		if (entry->type == JOURNAL_MARK_SET) {
+			flags = g_new0(MsgFlags, 1);
+			flags->perm_flags = entry->perm_flags;
+			g_hash_table_insert(mark_table,
+					    GUINT_TO_POINTER(entry->msgnum),
+					    flags);
+		}
+	}
+}
+
+static GHashTable *procmsg_read_mark_file(FolderItem *item)
+{
+	GHashTable *mark_table = NULL;
+	MsgFlags *flags;
+	GSList *cur;
+	GSList *entries;
+	gchar *markfile, *journalfile;
+
+	markfile = folder_item_get_mark_file(item);
+	journalfile = folder_item_get_journal_file(item);
+
+	S_LOCK(journal);
+
+	mark_table = procmsg_read_mark_table(markfile);
+	if (!mark_table)
+		goto finish;
+
+	entries = procmsg_read_journal(journalfile);
+	procmsg_journal_apply_to_mark_table(mark_table, entries);
+	procmsg_journal_free(entries);
+
+	if (item->mark_queue) {
+		g_hash_table_foreach(mark_table, mark_unset_new_func, NULL);
+		item->mark_dirty = TRUE;
+	}
+
+	for (cur = item->mark_queue; cur != NULL; cur = cur->next) {
+		MsgFlagInfo *flaginfo = (MsgFlagInfo *)cur->data;
+
+		flags = g_hash_table_lookup(mark_table,
+					    GUINT_TO_POINTER(flaginfo->msgnum));
+		if (flags != NULL)
+			g_free(flags);
+
+		flags = g_new0(MsgFlags, 1);
+		flags->perm_flags = flaginfo->flags.perm_flags;
+
+		g_hash_table_insert(mark_table,
+				    GUINT_TO_POINTER(flaginfo->msgnum), flags);
+				    
+	}
+
+	if (item->mark_queue && !item->opened) {
+		if (procmsg_write_mark_table(markfile, mark_table) == 0)
+			procmsg_drop_journal(journalfile, JOURNAL_MARK_MASK);
+		procmsg_flaginfo_list_free(item->mark_queue);
+		item->mark_queue = NULL;
+		item->mark_dirty = FALSE;
+	}
+
+finish:
+	S_UNLOCK(journal);
+	g_free(journalfile);
+	g_free(markfile);
+
+	return mark_table;
+}
+
+static void write_mark_func(gpointer key, gpointer value, gpointer data)
+{
+	MsgInfo msginfo;
+
+	msginfo.msgnum = GPOINTER_TO_UINT(key);
+	msginfo.flags.perm_flags = ((MsgFlags *)value)->perm_flags;
+	procmsg_write_flags(&msginfo, (FILE *)data);
+}
+
+static gint procmsg_write_mark_table(const gchar *markfile,
+				     GHashTable *mark_table)
+{
+	FILE *fp;
+
+	if ((fp = procmsg_open_data_file(markfile, MARK_VERSION, DATA_WRITE,
+					 NULL, 0)) == NULL) {
+		g_warning("procmsg_write_mark_file: cannot open mark file.");
+		return -1;
+	}
+	g_hash_table_foreach(mark_table, write_mark_func, fp);
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(markfile, "fclose");
+		return -1;
+	}
+
+	return 0;
+}
+
+static void procmsg_write_mark_file(FolderItem *item, GHashTable *mark_table)
+{
+	gchar *markfile, *journalfile;
+
+	markfile = folder_item_get_mark_file(item);
+	journalfile = folder_item_get_journal_file(item);
+
+	S_LOCK(journal);
+	if (procmsg_write_mark_table(markfile, mark_table) == 0)
+		procmsg_drop_journal(journalfile, JOURNAL_MARK_MASK);
+	S_UNLOCK(journal);
+
+	g_free(journalfile);
+	g_free(markfile);
+}
+
+#define READ_JOURNAL_DATA_INT(n)				\
+{								\
+	if (endp - p < sizeof(guint32))				\
+		goto corrupted;					\
+	else {							\
+		guint32 idata;					\
+		memcpy(&idata, p, sizeof(idata));		\
+		n = idata;					\
+		p += sizeof(guint32);				\
+	}							\
+}
+
+/* read the entries being merged, followed by those of the journal */
+static GSList *procmsg_read_journal(const gchar *journalfile)
+{
+	GSList *entries;
+	gchar *mergefile;
+
+	mergefile = g_strconcat(journalfile, JOURNAL_MERGE_SUFFIX, NULL);
+	entries = procmsg_read_journal_full(mergefile, NULL);
+	g_free(mergefile);
+
+	return g_slist_concat(entries,
+			      procmsg_read_journal_full(journalfile, NULL));
+}
+
+/* corrupted is set to TRUE if the journal has a partial or broken entry,
+   after which nothing can be read */
+static GSList *procmsg_read_journal_full(const gchar *journalfile,
+					 gboolean *corrupted)
+{
+	gchar *contents;
+	gsize len;
+	const gchar *p, *endp;
+	guint32 data_ver;
+	JournalEntry *entry = NULL;
+	GSList *entries = NULL;
+	GError *error = NULL;
+
+	if (corrupted)
+		*corrupted = FALSE;
+
+	if (!is_file_exist(journalfile))
+		return NULL;
+
+	if (!g_file_get_contents(journalfile, &contents, &len, &error)) {
+		g_warning("%s: cannot read journal: %s", journalfile,
+			  error->message);
+		g_error_free(error);
+		return NULL;
+	}
+
+	p = contents;
+	endp = contents + len;
+
+	READ_JOURNAL_DATA_INT(data_ver);
+	if (data_ver != JOURNAL_VERSION) {
+		g_message("%s: Journal version is different (%u != %u). Discarding it.\n",
+			  journalfile, data_ver, JOURNAL_VERSION);
+		g_free(contents);
+		return NULL;
+	}
+
+	while (endp - p >= sizeof(guint32)) {
+		entry = g_new0(JournalEntry, 1);
+
+		READ_JOURNAL_DATA_INT(entry->type);
+		switch (entry->type) {
+		case JOURNAL_CACHE_ADD:
+			entry->msginfo = procmsg_read_cache_record(&p, endp);
+			if (!entry->msginfo)
+				goto corrupted;
+			entry->msgnum = entry->msginfo->msgnum;
+			break;
+		case JOURNAL_MARK_SET:
+			READ_JOURNAL_DATA_INT(entry->msgnum);
+			READ_JOURNAL_DATA_INT(entry->perm_flags);
+			break;
+		case JOURNAL_CACHE_REMOVE:
+		case JOURNAL_MARK_REMOVE:
+			READ_JOURNAL_DATA_INT(entry->msgnum);
+			break;
+		default:
+			goto corrupted;
+		}
+
+		entries = g_slist_prepend(entries, entry);
+		entry = NULL;
+	}
+
+	if (p != endp)
+		goto corrupted;
+
+	g_free(contents);
+
+	return g_slist_reverse(entries);
+
+corrupted:
+	/* an interrupted write leaves a partial entry at the end */
+	g_warning("%s: journal is truncated or corrupted\n", journalfile);
+	if (corrupted)
+		*corrupted = TRUE;
+	g_free(entry);
+	g_free(contents);
+	return g_slist_reverse(entries);
+}
+
+#undef READ_JOURNAL_DATA_INT
+
+static void procmsg_write_journal_entry(JournalEntry *entry, FILE *fp)
+{
+	WRITE_CACHE_DATA_INT(entry->type, fp);
+
+	switch (entry->type) {
+	case JOURNAL_CACHE_ADD:
+		procmsg_write_cache(entry->msginfo, fp);
+		break;
+	case JOURNAL_MARK_SET:
+		WRITE_CACHE_DATA_INT(entry->msgnum, fp);
+		WRITE_CACHE_DATA_INT(entry->perm_flags, fp);
+		break;
+	default:
+		WRITE_CACHE_DATA_INT(entry->msgnum, fp);
+		break;
+	}
+}
+
+/* Entries appended after a partial one (left by a crash in the middle
+   of a write) could never be read, so the journal is cut back to its last
+   complete entry before the first append to it.  Must be called with the
+   journal lock held. */
+static void procmsg_check_journal(const gchar *journalfile)
+{
+	GSList *entries;
+	gboolean corrupted = FALSE;
+
+	if (!journal_checked_table)
+		journal_checked_table =
+			g_hash_table_new_full(g_str_hash, g_str_equal,
+					      g_free, NULL);
+	else if (g_hash_table_lookup(journal_checked_table, journalfile))
+		return;
+
+	if (is_file_exist(journalfile)) {
+		entries = procmsg_read_journal_full(journalfile, &corrupted);
+		procmsg_journal_free(entries);
+		if (corrupted) {
+			debug_print("procmsg_check_journal: truncating %s\n",
+				    journalfile);
+			/* rewrite with the readable entries only */
+			procmsg_drop_journal_file(journalfile, 0);
+		}
+	}
+
+	g_hash_table_insert(journal_checked_table, g_strdup(journalfile),
+			    GINT_TO_POINTER(1));
+}
+
+static void procmsg_uncheck_journal(const gchar *journalfile)
+{
+	if (journal_checked_table)
+		g_hash_table_remove(journal_checked_table, journalfile);
+}
+
+static void procmsg_write_journal(FolderItem *item, GSList *entries)
+{
+	gchar *journalfile;
+	FILE *fp;
+	GSList *cur;
+	glong size;
+
+	g_return_if_fail(item != NULL);
+
+	if (!entries)
+		return;
+
+	journalfile = folder_item_get_journal_file(item);
+	g_return_if_fail(journalfile != NULL);
+
+	S_LOCK(journal);
+
+	procmsg_check_journal(journalfile);
+
+	fp = procmsg_open_data_file(journalfile, JOURNAL_VERSION, DATA_APPEND,
+				    NULL, 0);
+	if (!fp) {
+		S_UNLOCK(journal);
+		g_warning("can't open journal file %s\n", journalfile);
+		g_free(journalfile);
+		return;
+	}
+
+	for (cur = entries; cur != NULL; cur = cur->next)
+		procmsg_write_journal_entry((JournalEntry *)cur->data, fp);
+
+	size = ftell(fp);
+	if (ferror(fp)) {
+		FILE_OP_ERROR(journalfile, "fwrite");
+		procmsg_uncheck_journal(journalfile);
+	}
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(journalfile, "fclose");
+		procmsg_uncheck_journal(journalfile);
+	}
+
+	S_UNLOCK(journal);
+
+	g_free(journalfile);
+
+	if (size > JOURNAL_COMPACT_SIZE)
+		procmsg_compact_journal(item);
+}
+
+/* drop the entries of the types in mask from the journal and from the
+   entries being merged, after a full rewrite of the files they belong to */
+static void procmsg_drop_journal(const gchar *journalfile, guint mask)
+{
+	gchar *mergefile;
+
+	mergefile = g_strconcat(journalfile, JOURNAL_MERGE_SUFFIX, NULL);
+	procmsg_drop_journal_file(mergefile, mask);
+	g_free(mergefile);
+	procmsg_drop_journal_file(journalfile, mask);
+
+	journal_rewrite_count++;
+}
+
+/* rewrite a journal file without the entries of the types in mask */
+static void procmsg_drop_journal_file(const gchar *journalfile, guint mask)
+{
+	GSList *entries, *cur;
+	JournalEntry *entry;
+	gboolean keep = FALSE;
+	gchar *tmpfile;
+	FILE *fp;
+
+	if (!is_file_exist(journalfile))
+		return;
+
+	entries = procmsg_read_journal_full(journalfile, NULL);
+	for (cur = entries; cur != NULL; cur = cur->next) {
+		entry = (JournalEntry *)cur->data;
+		if ((JOURNAL_MASK(entry->type) & mask) == 0) {
+			keep = TRUE;
+			break;
+		}
+	}
+
+	if (!keep) {
+		if (g_unlink(journalfile) < 0)
+			FILE_OP_ERROR(journalfile, "unlink");
+		procmsg_journal_free(entries);
+		return;
+	}
+
+	tmpfile = g_strconcat(journalfile, ".tmp", NULL);
+	fp = procmsg_open_data_file(tmpfile, JOURNAL_VERSION, DATA_WRITE,
+				    NULL, 0);
+	if (fp) {
+		for (cur = entries; cur != NULL; cur = cur->next) {
+			entry = (JournalEntry *)cur->data;
+			if ((JOURNAL_MASK(entry->type) & mask) == 0)
+				procmsg_write_journal_entry(entry, fp);
+		}
+		if (fclose(fp) == EOF) {
+			FILE_OP_ERROR(tmpfile, "fclose");
+			g_unlink(tmpfile);
+		} else if (rename_force(tmpfile, journalfile) < 0) {
+			FILE_OP_ERROR(tmpfile, "rename");
+			g_unlink(tmpfile);
+		}
+	}
+
+	g_free(tmpfile);
+	procmsg_journal_free(entries);
+}
+
+static void procmsg_journal_free(GSList *entries)
+{
+	GSList *cur;
+	JournalEntry *entry;
+
+	for (cur = entries; cur != NULL; cur = cur->next) {
+		entry = (JournalEntry *)cur->data;
+		if (entry->msginfo)
+			procmsg_msginfo_free(entry->msginfo);
+		g_free(entry);
+	}
+	g_slist_free(entries);
+}
+
+/* merge the journal into the cache and mark files.  Only the renaming
+   of the journal and the replacing of the files are done with the lock
+   held; if either file is rewritten in the meantime, the merged files
+   are discarded and the renamed journal is merged the next time. */
+static void procmsg_compact_journal_files(const gchar *cachefile,
+					  const gchar *markfile,
+					  const gchar *journalfile)
+{
+	GSList *entries;
+	GSList *mlist = NULL;
+	GMappedFile *mapfile;
+	GHashTable *mark_table;
+	gchar *mergefile, *new_cachefile, *new_markfile;
+	guint32 version;
+	guint rewrite_count;
+	gboolean merged = FALSE;
+
+	mergefile = g_strconcat(journalfile, JOURNAL_MERGE_SUFFIX, NULL);
+
+	S_LOCK(journal);
+	/* entries left by an interrupted merge are merged first */
+	if (!is_file_exist(mergefile) && is_file_exist(journalfile) &&
+	    rename_force(journalfile, mergefile) < 0)
+		FILE_OP_ERROR(journalfile, "rename");
+	rewrite_count = journal_rewrite_count;
+	S_UNLOCK(journal);
+
+	entries = procmsg_read_journal_full(mergefile, NULL);
+	if (!entries) {
+		g_free(mergefile);
+		return;
+	}
+
+	/* leave the entries alone if there is nothing to merge into; the
+	   next full rewrite will drop them */
+	mapfile = procmsg_map_cache_file(cachefile, &version);
+	if (!mapfile) {
+		procmsg_journal_free(entries);
+		g_free(mergefile);
+		return;
+	}
+	if (procmsg_parse_cache(mapfile, version, &mlist) < 0) {
+		g_warning("%s: Cache data is corrupted\n", cachefile);
+		procmsg_journal_free(entries);
+		g_free(mergefile);
+		return;
+	}
+	mlist = procmsg_journal_apply_to_list(mlist, entries);
+
+	mark_table = procmsg_read_mark_table(markfile);
+	if (!mark_table)
+		mark_table = g_hash_table_new(NULL, g_direct_equal);
+	procmsg_journal_apply_to_mark_table(mark_table, entries);
+
+	new_cachefile = g_strconcat(cachefile, JOURNAL_MERGE_SUFFIX, NULL);
+	new_markfile = g_strconcat(markfile, JOURNAL_MERGE_SUFFIX, NULL);
+
+	if (procmsg_write_cache_table(new_cachefile, mlist, NULL) == 0 &&
+	    procmsg_write_mark_table(new_markfile, mark_table) == 0)
+		merged = TRUE;
+
+	hash_free_value_mem(mark_table);
+	g_hash_table_destroy(mark_table);
+	procmsg_msg_list_free(mlist);
+	procmsg_journal_free(entries);
+
+	S_LOCK(journal);
+	if (merged && rewrite_count == journal_rewrite_count) {
+		/* the entries are applied again if the mark file could not
+		   be replaced, which gives the same result */
+		if (rename_force(new_cachefile, cachefile) < 0) {
+			FILE_OP_ERROR(new_cachefile, "rename");
+		} else if (rename_force(new_markfile, markfile) < 0) {
+			FILE_OP_ERROR(new_markfile, "rename");
+		} else if (g_unlink(mergefile) < 0) {
+			FILE_OP_ERROR(mergefile, "unlink");
+		}
+	} else
+		debug_print("journal %s was not merged\n", journalfile);
+	S_UNLOCK(journal);
+
+	if (is_file_exist(new_cachefile))
+		g_unlink(new_cachefile);
+	if (is_file_exist(new_markfile))
+		g_unlink(new_markfile);
+
+	g_free(new_markfile);
+	g_free(new_cachefile);
+	g_free(mergefile);
+}
+
+static gpointer procmsg_compact_journal_func(gpointer data)
+{
+	JournalCompactData *cdata = (JournalCompactData *)data;
+
+	debug_print("compacting journal %s ...\n", cdata->journalfile);
+
+	procmsg_compact_journal_files(cdata->cachefile, cdata->markfile,
+				      cdata->journalfile);
+
+	debug_print("compacting journal %s done\n", cdata->journalfile);
+
+	g_free(cdata->journalfile);
+	g_free(cdata->markfile);
+	g_free(cdata->cachefile);
+	g_free(cdata);
 
-		flags = g_new0(MsgFlags, 1);
-		flags->perm_flags = perm_flags;
+	g_atomic_int_compare_and_exchange(&journal_compacting, 1, 0);
 
-		g_hash_table_insert(mark_table, GUINT_TO_POINTER(num), flags);
-	}
+	return NULL;
+}
 
-	fclose(fp);
+static void procmsg_compact_journal(FolderItem *item)
+{
+	JournalCompactData *cdata;
 
-	if (item->mark_queue) {
-		g_hash_table_foreach(mark_table, mark_unset_new_func, NULL);
-		item->mark_dirty = TRUE;
-	}
+	/* only one compaction at a time */
+	if (!g_atomic_int_compare_and_exchange(&journal_compacting, 0, 1))
+		return;
 
-	for (cur = item->mark_queue; cur != NULL; cur = cur->next) {
-		MsgFlagInfo *flaginfo = (MsgFlagInfo *)cur->data;
+	cdata = g_new(JournalCompactData, 1);
+	cdata->cachefile = folder_item_get_cache_file(item);
+	cdata->markfile = folder_item_get_mark_file(item);
+	cdata->journalfile = folder_item_get_journal_file(item);
 
-		flags = g_hash_table_lookup(mark_table,
-					    GUINT_TO_POINTER(flaginfo->msgnum));
-		if (flags != NULL)
-			g_free(flags);
+#if USE_THREADS
+	if (g_thread_create(procmsg_compact_journal_func, cdata, FALSE, NULL)
+	    != NULL)
+		return;
+	g_warning("procmsg_compact_journal: can't create thread\n");
+#endif
+	procmsg_compact_journal_func(cdata);
+}
 
-		flags = g_new0(MsgFlags, 1);
-		flags->perm_flags = flaginfo->flags.perm_flags;
+void procmsg_write_journal_remove_list(FolderItem *item, GSList *numlist)
+{
+	GSList *entries = NULL;
+	GSList *cur;
+	guint num;
 
-		g_hash_table_insert(mark_table,
-				    GUINT_TO_POINTER(flaginfo->msgnum), flags);
-				    
-	}
+	g_return_if_fail(item != NULL);
 
-	if (item->mark_queue && !item->opened) {
-		procmsg_write_mark_file(item, mark_table);
-		procmsg_flaginfo_list_free(item->mark_queue);
-		item->mark_queue = NULL;
-		item->mark_dirty = FALSE;
+	if (!numlist)
+		return;
+
+	for (cur = numlist; cur != NULL; cur = cur->next) {
+		num = GPOINTER_TO_UINT(cur->data);
+		entries = g_slist_prepend
+			(entries, procmsg_journal_entry_new
+				(JOURNAL_CACHE_REMOVE, num, 0, NULL));
+		entries = g_slist_prepend
+			(entries, procmsg_journal_entry_new
+				(JOURNAL_MARK_REMOVE, num, 0, NULL));
 	}
 
-	return mark_table;
+	entries = g_slist_reverse(entries);
+	procmsg_write_journal(item, entries);
+	slist_free_strings(entries);
+	g_slist_free(entries);
 }
 
-static void write_mark_func(gpointer key, gpointer value, gpointer data)
+void procmsg_write_journal_add_list(FolderItem *item, GSList *mlist)
 {
-	MsgInfo msginfo;
+	GSList *entries = NULL;
+	GSList *cur;
+	MsgInfo *msginfo;
 
-	msginfo.msgnum = GPOINTER_TO_UINT(key);
-	msginfo.flags.perm_flags = ((MsgFlags *)value)->perm_flags;
-	procmsg_write_flags(&msginfo, (FILE *)data);
+	g_return_if_fail(item != NULL);
+
+	if (!mlist)
+		return;
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		entries = g_slist_prepend
+			(entries, procmsg_journal_entry_new
+				(JOURNAL_CACHE_ADD, msginfo->msgnum, 0,
+				 msginfo));
+		entries = g_slist_prepend
+			(entries, procmsg_journal_entry_new
+				(JOURNAL_MARK_SET, msginfo->msgnum,
+				 msginfo->flags.perm_flags, NULL));
+	}
+
+	entries = g_slist_reverse(entries);
+	procmsg_write_journal(item, entries);
+	slist_free_strings(entries);
+	g_slist_free(entries);
 }
 
-static void procmsg_write_mark_file(FolderItem *item, GHashTable *mark_table)
+void procmsg_write_journal_flags_list(FolderItem *item, GSList *mlist)
 {
-	FILE *fp;
+	GSList *entries = NULL;
+	GSList *cur;
+	MsgInfo *msginfo;
 
-	if ((fp = procmsg_open_mark_file(item, DATA_WRITE)) == NULL) {
-		g_warning("procmsg_write_mark_file: cannot open mark file.");
+	g_return_if_fail(item != NULL);
+
+	if (!mlist)
 		return;
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		entries = g_slist_prepend
+			(entries, procmsg_journal_entry_new
+				(JOURNAL_MARK_SET, msginfo->msgnum,
+				 msginfo->flags.perm_flags, NULL));
 	}
-	g_hash_table_foreach(mark_table, write_mark_func, fp);
-	fclose(fp);
+
+	entries = g_slist_reverse(entries);
+	procmsg_write_journal(item, entries);
+	slist_free_strings(entries);
+	g_slist_free(entries);
 }
 
 FILE *procmsg_open_data_file(const gchar *file, guint version,
@@ -1101,62 +2281,129 @@ FILE *procmsg_open_data_file(const gchar *file, guint version,
 }
 
 static GMappedFile *procmsg_open_cache_file_mmap(FolderItem *item,
-						 DataOpenMode mode)
+						 DataOpenMode mode,
+						 guint32 *version)
 {
 	gchar *cachefile;
 	GMappedFile *map = NULL;
-	GError *error = NULL;
-	gsize size;
-	guint32 data_ver = 0;
-	gchar *p;
 
 	if (mode != DATA_READ)
 		return NULL;
 
 	cachefile = folder_item_get_cache_file(item);
 	if (cachefile) {
-		map = g_mapped_file_new(cachefile, FALSE, &error);
-		if (!map) {
-			if (error && error->code == G_FILE_ERROR_NOENT)
-				debug_print("%s: mark/cache file not found\n", cachefile);
-			else if (error)
-				g_warning("%s: cannot open mark/cache file: %s", cachefile, error->message);
-			else
-				g_warning("%s: cannot open mark/cache file", cachefile);
-			if (error)
-				g_error_free(error);
-			g_free(cachefile);
-			return NULL;
-		}
-		size = g_mapped_file_get_length(map);
-		if (size < sizeof(data_ver)) {
-			g_warning("%s: cannot read mark/cache file (truncated?)", cachefile);
-			g_mapped_file_free(map);
-			g_free(cachefile);
-			return NULL;
-		}
-		p = g_mapped_file_get_contents(map);
-		data_ver = *(guint32 *)p;
-		if (CACHE_VERSION != data_ver) {
-			g_message("%s: Mark/Cache version is different (%u != %u). Discarding it.\n",
-				  cachefile, data_ver, CACHE_VERSION);
-			g_mapped_file_free(map);
-			g_free(cachefile);
-			return NULL;
-		}
+		map = procmsg_map_cache_file(cachefile, version);
 		g_free(cachefile);
 	}
 
 	return map;
 }
 
+static GMappedFile *procmsg_map_cache_file(const gchar *cachefile,
+					   guint32 *version)
+{
+	GMappedFile *map;
+	GError *error = NULL;
+	gsize size;
+	guint32 data_ver = 0;
+	gchar *p;
+
+	map = g_mapped_file_new(cachefile, FALSE, &error);
+	if (!map) {
+		if (error && error->code == G_FILE_ERROR_NOENT)
+			debug_print("%s: mark/cache file not found\n", cachefile);
+		else if (error)
+			g_warning("%s: cannot open mark/cache file: %s", cachefile, error->message);
+		else
+			g_warning("%s: cannot open mark/cache file", cachefile);
+		if (error)
+			g_error_free(error);
+		return NULL;
+	}
+	size = g_mapped_file_get_length(map);
+	if (size < sizeof(data_ver)) {
+		g_warning("%s: cannot read mark/cache file (truncated?)", cachefile);
+		g_mapped_file_free(map);
+		return NULL;
+	}
+	p = g_mapped_file_get_contents(map);
+	data_ver = *(guint32 *)p;
+	if (CACHE_VERSION != data_ver &&
+	    CACHE_VERSION_LEGACY != data_ver) {
+		g_message("%s: Mark/Cache version is different (%u != %u). Discarding it.\n",
+			  cachefile, data_ver, CACHE_VERSION);
+		g_mapped_file_free(map);
+		return NULL;
+	}
+	*version = data_ver;
+
+	return map;
+}
+
+static gint procmsg_get_cache_file_version(const gchar *file,
+					   guint32 *version)
+{
+	FILE *fp;
+	guint32 data_ver;
+	gint ret = 0;
+
+	if ((fp = g_fopen(file, "rb")) == NULL)
+		return -1;
+	if (fread(&data_ver, sizeof(data_ver), 1, fp) != 1)
+		ret = -1;
+	else
+		*version = data_ver;
+	fclose(fp);
+
+	return ret;
+}
+
 FILE *procmsg_open_cache_file(FolderItem *item, DataOpenMode mode)
 {
 	gchar *cachefile;
-	FILE *fp;
+	FILE *fp = NULL;
+	guint32 version = 0;
 
 	cachefile = folder_item_get_cache_file(item);
-	fp = procmsg_open_data_file(cachefile, CACHE_VERSION, mode, NULL, 0);
+
+	if (mode != DATA_WRITE &&
+	    procmsg_get_cache_file_version(cachefile, &version) == 0 &&
+	    (version == CACHE_VERSION || version == CACHE_VERSION_LEGACY)) {
+		/* both formats end with a list of records written by
+		   procmsg_write_cache(), so they can be appended as is */
+		fp = procmsg_open_data_file(cachefile, version, mode, NULL, 0);
+		if (fp && mode == DATA_READ && version == CACHE_VERSION) {
+			MsgCacheHeader header;
+
+			/* skip to the appended records */
+			if (fread(&header, sizeof(header), 1, fp) != 1 ||
+			    fseek(fp, (glong)header.n_records *
+				  header.record_size +
+				  (glong)header.n_refs * sizeof(guint32) +
+				  header.strtab_size, SEEK_CUR) < 0) {
+				g_warning("%s: cannot read cache file (truncated?)\n",
+					  cachefile);
+				fclose(fp);
+				fp = NULL;
+			}
+		}
+	} else if (mode != DATA_READ) {
+		MsgCacheHeader header = {0, sizeof(MsgCacheRecord), 0, 0};
+
+		/* don't truncate the file in place, since it may still be
+		   mapped by procmsg_read_cache() */
+		if (is_file_exist(cachefile) && g_unlink(cachefile) < 0)
+			FILE_OP_ERROR(cachefile, "unlink");
+		fp = procmsg_open_data_file(cachefile, CACHE_VERSION,
+					    DATA_WRITE, NULL, 0);
+		if (fp && fwrite(&header, sizeof(header), 1, fp) != 1) {
+			FILE_OP_ERROR(cachefile, "fwrite");
+			fclose(fp);
+			fp = NULL;
+		}
+	} else
+		debug_print("Cache file '%s' not found\n", cachefile);
+
 	g_free(cachefile);
 
 	return fp;
@@ -1177,19 +2424,37 @@ FILE *procmsg_open_mark_file(FolderItem *item, DataOpenMode mode)
 void procmsg_clear_cache(FolderItem *item)
 {
 	FILE *fp;
+	gchar *journalfile;
 
+	journalfile = folder_item_get_journal_file(item);
+
+	S_LOCK(journal);
 	fp = procmsg_open_cache_file(item, DATA_WRITE);
-	if (fp)
+	if (fp) {
 		fclose(fp);
+		procmsg_drop_journal(journalfile, JOURNAL_CACHE_MASK);
+	}
+	S_UNLOCK(journal);
+
+	g_free(journalfile);
 }
 
 void procmsg_clear_mark(FolderItem *item)
 {
 	FILE *fp;
+	gchar *journalfile;
 
+	journalfile = folder_item_get_journal_file(item);
+
+	S_LOCK(journal);
 	fp = procmsg_open_mark_file(item, DATA_WRITE);
-	if (fp)
+	if (fp) {
 		fclose(fp);
+		procmsg_drop_journal(journalfile, JOURNAL_MARK_MASK);
+	}
+	S_UNLOCK(journal);
+
+	g_free(journalfile);
 }
 
 /* return the reversed thread tree */
@@ -1257,6 +2522,249 @@ GNode *procmsg_get_thread_tree(GSList *mlist)
 	return root;
 }
 
+/* The thread index (THREAD_FILE) keeps the parent of each message, so
+   that procmsg_get_thread_tree_for_item() only has to look up the
+   message-ids of the messages added since it was written.  It consists
+   of the version followed by MsgThreadEntry's.  The parent is 0 for the
+   top-level messages, and the hash detects the reused message numbers. */
+
+typedef struct _MsgThreadEntry {
+	guint32 msgnum;
+	guint32 parent;
+	guint32 id_hash;
+} MsgThreadEntry;
+
+static guint32 procmsg_thread_id_hash(MsgInfo *msginfo)
+{
+	guint32 hash;
+
+	hash = msginfo->msgid ? g_str_hash(msginfo->msgid) : 0;
+	hash = hash * 33 + (guint32)msginfo->date_t;
+	hash = hash * 33 + (guint32)msginfo->size;
+
+	return hash;
+}
+
+static GHashTable *procmsg_read_thread_index(const gchar *file,
+					     gchar **contents)
+{
+	GHashTable *table;
+	gsize len, i, n;
+	guint32 data_ver;
+	MsgThreadEntry *entries;
+
+	*contents = NULL;
+
+	if (!is_file_exist(file))
+		return NULL;
+	if (!g_file_get_contents(file, contents, &len, NULL))
+		return NULL;
+
+	if (len >= sizeof(data_ver))
+		memcpy(&data_ver, *contents, sizeof(data_ver));
+	if (len < sizeof(data_ver) || data_ver != THREAD_VERSION ||
+	    (len - sizeof(data_ver)) % sizeof(MsgThreadEntry) != 0) {
+		debug_print("%s: discarding the thread index\n", file);
+		g_free(*contents);
+		*contents = NULL;
+		return NULL;
+	}
+
+	entries = (MsgThreadEntry *)(*contents + sizeof(data_ver));
+	n = (len - sizeof(data_ver)) / sizeof(MsgThreadEntry);
+
+	table = g_hash_table_new(NULL, g_direct_equal);
+	for (i = 0; i < n; i++)
+		g_hash_table_insert(table, GUINT_TO_POINTER(entries[i].msgnum),
+				    &entries[i]);
+
+	return table;
+}
+
+static void procmsg_write_thread_index(const gchar *file, GNode *root,
+				       GSList *mlist, GHashTable *node_table)
+{
+	FILE *fp;
+	GSList *cur;
+	MsgInfo *msginfo;
+	GNode *node;
+	MsgThreadEntry entry;
+
+	if ((fp = procmsg_open_data_file(file, THREAD_VERSION, DATA_WRITE,
+					 NULL, 0)) == NULL)
+		return;
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		node = g_hash_table_lookup(node_table,
+					   GUINT_TO_POINTER(msginfo->msgnum));
+		entry.msgnum = msginfo->msgnum;
+		entry.parent = node->parent == root ? 0 :
+			((MsgInfo *)node->parent->data)->msgnum;
+		entry.id_hash = procmsg_thread_id_hash(msginfo);
+		if (fwrite(&entry, sizeof(entry), 1, fp) != 1) {
+			FILE_OP_ERROR(file, "fwrite");
+			break;
+		}
+	}
+
+	if (fclose(fp) == EOF)
+		FILE_OP_ERROR(file, "fclose");
+}
+
+static GNode *procmsg_thread_find_parent(GHashTable *table, MsgInfo *msginfo)
+{
+	GNode *parent = NULL;
+	GSList *reflist;
+
+	if (msginfo->inreplyto)
+		parent = g_hash_table_lookup(table, msginfo->inreplyto);
+
+	/* try looking for the indirect parent */
+	if (!parent && msginfo->references) {
+		for (reflist = msginfo->references;
+		     reflist != NULL; reflist = reflist->next)
+			if ((parent = g_hash_table_lookup
+				(table, reflist->data)) != NULL)
+				break;
+	}
+
+	return parent;
+}
+
+/* same as procmsg_get_thread_tree(), but reuses and updates the thread
+   index of item.  mlist must contain all the messages in item. */
+GNode *procmsg_get_thread_tree_for_item(FolderItem *item, GSList *mlist)
+{
+	GNode *root, *parent, *node, *next;
+	GHashTable *index, *node_table, *table;
+	gchar *file, *contents;
+	GSList *cur, *delta = NULL;
+	MsgInfo *msginfo;
+	MsgThreadEntry *entry, *pentry;
+	const gchar *msgid;
+	guint n_msgs = 0;
+
+	g_return_val_if_fail(item != NULL, NULL);
+
+	/* message numbers are not unique in virtual folders */
+	if (item->stype == F_VIRTUAL || !item->path)
+		return procmsg_get_thread_tree(mlist);
+
+	file = folder_item_get_thread_file(item);
+	index = procmsg_read_thread_index(file, &contents);
+
+	root = g_node_new(NULL);
+	node_table = g_hash_table_new(NULL, g_direct_equal);
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		g_hash_table_insert(node_table,
+				    GUINT_TO_POINTER(msginfo->msgnum),
+				    g_node_new(msginfo));
+		n_msgs++;
+	}
+
+	/* restore the known threads */
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		node = g_hash_table_lookup(node_table,
+					   GUINT_TO_POINTER(msginfo->msgnum));
+
+		entry = index ? g_hash_table_lookup
+			(index, GUINT_TO_POINTER(msginfo->msgnum)) : NULL;
+		if (entry && entry->id_hash == procmsg_thread_id_hash(msginfo)) {
+			if (entry->parent == 0) {
+				g_node_prepend(root, node);
+				continue;
+			}
+			parent = g_hash_table_lookup
+				(node_table, GUINT_TO_POINTER(entry->parent));
+			pentry = g_hash_table_lookup
+				(index, GUINT_TO_POINTER(entry->parent));
+			if (parent && pentry && parent != node &&
+			    pentry->id_hash ==
+			    procmsg_thread_id_hash((MsgInfo *)parent->data) &&
+			    !g_node_is_ancestor(node, parent)) {
+				g_node_append(parent, node);
+				continue;
+			}
+		}
+
+		delta = g_slist_prepend(delta, node);
+	}
+
+	delta = g_slist_reverse(delta);
+
+	debug_print("procmsg_get_thread_tree_for_item: %s: %u messages, "
+		    "%u not in the thread index\n", item->path, n_msgs,
+		    g_slist_length(delta));
+
+	if (delta) {
+		table = g_hash_table_new(g_str_hash, g_str_equal);
+		for (cur = mlist; cur != NULL; cur = cur->next) {
+			msginfo = (MsgInfo *)cur->data;
+			if ((msgid = msginfo->msgid) &&
+			    g_hash_table_lookup(table, msgid) == NULL)
+				g_hash_table_insert
+					(table, (gchar *)msgid,
+					 g_hash_table_lookup
+						(node_table,
+						 GUINT_TO_POINTER(msginfo->msgnum)));
+		}
+
+		/* thread the new messages */
+		for (cur = delta; cur != NULL; cur = cur->next) {
+			node = (GNode *)cur->data;
+			parent = procmsg_thread_find_parent
+				(table, (MsgInfo *)node->data);
+			if (parent && parent != node &&
+			    !g_node_is_ancestor(node, parent))
+				g_node_append(parent, node);
+			else
+				g_node_prepend(root, node);
+		}
+
+		g_hash_table_destroy(table);
+
+		/* the new messages may complete the unfinished threads */
+		table = g_hash_table_new(g_str_hash, g_str_equal);
+		for (cur = delta; cur != NULL; cur = cur->next) {
+			node = (GNode *)cur->data;
+			if ((msgid = ((MsgInfo *)node->data)->msgid) &&
+			    g_hash_table_lookup(table, msgid) == NULL)
+				g_hash_table_insert(table, (gchar *)msgid, node);
+		}
+
+		for (node = root->children; node != NULL; ) {
+			next = node->next;
+			parent = procmsg_thread_find_parent
+				(table, (MsgInfo *)node->data);
+			if (parent && parent != node &&
+			    !g_node_is_ancestor(node, parent)) {
+				g_node_unlink(node);
+				g_node_insert_before
+					(parent, parent->children, node);
+			}
+			node = next;
+		}
+
+		g_hash_table_destroy(table);
+	}
+
+	if (delta || !index || g_hash_table_size(index) != n_msgs)
+		procmsg_write_thread_index(file, root, mlist, node_table);
+
+	g_slist_free(delta);
+	g_hash_table_destroy(node_table);
+	if (index)
+		g_hash_table_destroy(index);
+	g_free(contents);
+	g_free(file);
+
+	return root;
+}
+
 static gboolean procmsg_thread_date_func(GNode *node, gpointer data)
 {
 	guint *tdate = (guint *)data;
@@ -2139,10 +3647,16 @@ static gboolean procmsg_get_flags(FolderItem *item, gint num,
 	gint read_num;
 	MsgPermFlags perm_flags;
 	gboolean found = FALSE;
+	gchar *journalfile;
+	GSList *entries;
 	GSList *cur;
 
-	if ((fp = procmsg_open_mark_file(item, DATA_READ)) == NULL)
+	S_LOCK(journal);
+
+	if ((fp = procmsg_open_mark_file(item, DATA_READ)) == NULL) {
+		S_UNLOCK(journal);
 		return FALSE;
+	}
 
 	while (fread(&idata, sizeof(idata), 1, fp) == 1) {
 		read_num = idata;
@@ -2157,6 +3671,26 @@ static gboolean procmsg_get_flags(FolderItem *item, gint num,
 	}
 
 	fclose(fp);
+
+	journalfile = folder_item_get_journal_file(item);
+	entries = procmsg_read_journal(journalfile);
+	g_free(journalfile);
+
+	S_UNLOCK(journal);
+
+	for (cur = entries; cur != NULL; cur = cur->next) {
+		JournalEntry *entry = (JournalEntry *)cur->data;
+
+		if (entry->msgnum != num)
+			continue;
+		if (entry->type == JOURNAL_MARK_SET) {
+			*flags = entry->perm_flags;
+			found = TRUE;
+		} else if (entry->type == JOURNAL_MARK_REMOVE)
+			found = FALSE;
+	}
+	procmsg_journal_free(entries);
+
 	if (found)
 		return TRUE;
 
@@ -2218,6 +3752,9 @@ MsgInfo *procmsg_msginfo_copy(MsgInfo *msginfo)
 #define MEMBCOPY(mmb)	newmsginfo->mmb = msginfo->mmb
 #define MEMBDUP(mmb)	newmsginfo->mmb = msginfo->mmb ? \
 			g_strdup(msginfo->mmb) : NULL
+#define MEMBSHARE(mmb)	newmsginfo->mmb = \
+			procmsg_msginfo_str_is_mapped(msginfo, msginfo->mmb) ? \
+			msginfo->mmb : g_strdup(msginfo->mmb)
 
 	MEMBCOPY(msgnum);
 	MEMBCOPY(size);
@@ -2226,16 +3763,16 @@ MsgInfo *procmsg_msginfo_copy(MsgInfo *msginfo)
 
 	MEMBCOPY(flags);
 
-	MEMBDUP(fromname);
+	MEMBSHARE(fromname);
 
-	MEMBDUP(date);
-	MEMBDUP(from);
-	MEMBDUP(to);
+	MEMBSHARE(date);
+	MEMBSHARE(from);
+	MEMBSHARE(to);
 	MEMBDUP(cc);
-	MEMBDUP(newsgroups);
-	MEMBDUP(subject);
-	MEMBDUP(msgid);
-	MEMBDUP(inreplyto);
+	MEMBSHARE(newsgroups);
+	MEMBSHARE(subject);
+	MEMBSHARE(msgid);
+	MEMBSHARE(inreplyto);
 
 	MEMBCOPY(folder);
 	MEMBCOPY(to_folder);
@@ -2252,9 +3789,48 @@ MsgInfo *procmsg_msginfo_copy(MsgInfo *msginfo)
 		MEMBCOPY(encinfo->decryption_failed);
 	}
 
+	if (msginfo->cache_map)
+		newmsginfo->cache_map =
+			procmsg_cache_map_ref(msginfo->cache_map);
+
+#undef MEMBSHARE
+
 	return newmsginfo;
 }
 
+/* Duplicate the strings which point into the summary cache.
+   This must be called before modifying them in place. */
+void procmsg_msginfo_unmap(MsgInfo *msginfo)
+{
+	GSList *cur;
+
+	if (msginfo == NULL || msginfo->cache_map == NULL) return;
+
+#define MEMBUNMAP(mmb)							\
+	if (procmsg_msginfo_str_is_mapped(msginfo, msginfo->mmb))	\
+		msginfo->mmb = g_strdup(msginfo->mmb)
+
+	MEMBUNMAP(fromname);
+
+	MEMBUNMAP(date);
+	MEMBUNMAP(from);
+	MEMBUNMAP(to);
+	MEMBUNMAP(newsgroups);
+	MEMBUNMAP(subject);
+	MEMBUNMAP(msgid);
+	MEMBUNMAP(inreplyto);
+
+	for (cur = msginfo->references; cur != NULL; cur = cur->next) {
+		if (procmsg_msginfo_str_is_mapped(msginfo, cur->data))
+			cur->data = g_strdup((gchar *)cur->data);
+	}
+
+#undef MEMBUNMAP
+
+	procmsg_cache_map_unref(msginfo->cache_map);
+	msginfo->cache_map = NULL;
+}
+
 MsgInfo *procmsg_msginfo_get_full_info(MsgInfo *msginfo)
 {
 	MsgInfo *full_msginfo;
@@ -2314,24 +3890,35 @@ gboolean procmsg_msginfo_equal(MsgInfo *msginfo_a, MsgInfo *msginfo_b)
 
 void procmsg_msginfo_free(MsgInfo *msginfo)
 {
+	GSList *cur;
+
 	if (msginfo == NULL) return;
 
 	g_free(msginfo->xface);
 
-	g_free(msginfo->fromname);
+#define MEMBFREE(mmb)							\
+	if (!procmsg_msginfo_str_is_mapped(msginfo, msginfo->mmb))	\
+		g_free(msginfo->mmb)
+
+	MEMBFREE(fromname);
 
-	g_free(msginfo->date);
-	g_free(msginfo->from);
-	g_free(msginfo->to);
+	MEMBFREE(date);
+	MEMBFREE(from);
+	MEMBFREE(to);
 	g_free(msginfo->cc);
-	g_free(msginfo->newsgroups);
-	g_free(msginfo->subject);
-	g_free(msginfo->msgid);
-	g_free(msginfo->inreplyto);
+	MEMBFREE(newsgroups);
+	MEMBFREE(subject);
+	MEMBFREE(msgid);
+	MEMBFREE(inreplyto);
 
-	slist_free_strings(msginfo->references);
+	for (cur = msginfo->references; cur != NULL; cur = cur->next) {
+		if (!procmsg_msginfo_str_is_mapped(msginfo, cur->data))
+			g_free(cur->data);
+	}
 	g_slist_free(msginfo->references);
 
+#undef MEMBFREE
+
 	g_free(msginfo->file_path);
 
 	if (msginfo->encinfo) {
@@ -2341,6 +3928,9 @@ void procmsg_msginfo_free(MsgInfo *msginfo)
 		g_free(msginfo->encinfo);
 	}
 
+	if (msginfo->cache_map)
+		procmsg_cache_map_unref(msginfo->cache_map);
+
 	g_free(msginfo);
 }
 
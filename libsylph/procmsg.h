@@ -34,6 +34,7 @@ typedef struct _MsgInfo		MsgInfo;
 typedef struct _MsgFlags	MsgFlags;
 typedef struct _MsgFileInfo	MsgFileInfo;
 typedef struct _MsgEncryptInfo	MsgEncryptInfo;
+typedef struct _MsgCacheMap	MsgCacheMap;
 
 #include "folder.h"
 #include "procmime.h"
@@ -201,6 +202,10 @@ struct _MsgInfo
 
 	/* used only for encrypted (and signed) messages */
 	MsgEncryptInfo *encinfo;
+
+	/* summary cache which the header strings point into
+	   (NULL if they are allocated) */
+	MsgCacheMap *cache_map;
 };
 
 struct _MsgFileInfo
@@ -250,6 +255,14 @@ void	procmsg_write_flags_list	(FolderItem	*item,
 void	procmsg_write_flags_for_multiple_folders
 					(GSList		*mlist);
 
+void	procmsg_write_journal_add_list	(FolderItem	*item,
+					 GSList		*mlist);
+void	procmsg_write_journal_remove_list
+					(FolderItem	*item,
+					 GSList		*numlist);
+void	procmsg_write_journal_flags_list(FolderItem	*item,
+					 GSList		*mlist);
+
 void	procmsg_flaginfo_list_free	(GSList		*flaglist);
 
 void	procmsg_flush_mark_queue	(FolderItem	*item,
@@ -293,6 +306,8 @@ void	procmsg_clear_cache		(FolderItem	*item);
 void	procmsg_clear_mark		(FolderItem	*item);
 
 GNode  *procmsg_get_thread_tree		(GSList		*mlist);
+GNode  *procmsg_get_thread_tree_for_item	(FolderItem	*item,
+					 GSList		*mlist);
 guint	procmsg_get_thread_date		(GNode		*node);
 
 gint	procmsg_move_messages		(GSList		*mlist);
@@ -344,6 +359,7 @@ MsgInfo *procmsg_get_msginfo		(FolderItem	*item,
 					 gint		 num);
 
 MsgInfo *procmsg_msginfo_copy		(MsgInfo	*msginfo);
+void	 procmsg_msginfo_unmap		(MsgInfo	*msginfo);
 MsgInfo *procmsg_msginfo_get_full_info	(MsgInfo	*msginfo);
 gboolean procmsg_msginfo_equal		(MsgInfo	*msginfo_a,
 					 MsgInfo	*msginfo_b);
@@ -19,6 +19,7 @@
 
 #include <glib.h>
 #include <ctype.h>
+#include <string.h>
 
 static gboolean get_hex_value(guchar *out, gchar c1, gchar c2);
 static void get_hex_str(gchar *out, guchar ch);
@@ -87,22 +88,42 @@ void qp_encode_line(gchar *out, const guchar *in)
 
 gint qp_decode_line(gchar *str)
 {
-	gchar *inp = str, *outp = str;
+	return qp_decode(str, str, -1);
+}
 
-	while (*inp != '\0') {
-		if (*inp == '=') {
-			if (inp[1] && inp[2] &&
-			    get_hex_value((guchar *)outp, inp[1], inp[2])
-			    == TRUE) {
-				inp += 3;
-			} else if (inp[1] == '\0' || g_ascii_isspace(inp[1])) {
-				/* soft line break */
-				break;
-			} else {
-				/* broken QP string */
-				*outp = *inp++;
-			}
+/* Decodes inlen bytes of in (or up to the nul if inlen < 0) into out,
+   which may be the same as in. Stops at a soft line break. The runs of
+   literal characters are located with memchr() and copied at once. */
+gint qp_decode(gchar *out, const gchar *in, gint inlen)
+{
+	const gchar *inp = in, *end, *eq;
+	gchar *outp = out;
+	gint len;
+
+	if (inlen < 0)
+		inlen = strlen(in);
+	end = in + inlen;
+
+	while (inp < end) {
+		eq = memchr(inp, '=', end - inp);
+		len = (eq ? eq : end) - inp;
+		if (len > 0) {
+			if (outp != inp)
+				memmove(outp, inp, len);
+			outp += len;
+			inp += len;
+		}
+		if (!eq)
+			break;
+
+		if (end - inp >= 3 &&
+		    get_hex_value((guchar *)outp, inp[1], inp[2]) == TRUE) {
+			inp += 3;
+		} else if (inp + 1 == end || g_ascii_isspace(inp[1])) {
+			/* soft line break */
+			break;
 		} else {
+			/* broken QP string */
 			*outp = *inp++;
 		}
 		outp++;
@@ -110,7 +131,7 @@ gint qp_decode_line(gchar *str)
 
 	*outp = '\0';
 
-	return outp - str;
+	return outp - out;
 }
 
 gint qp_decode_q_encoding(guchar *out, const gchar *in, gint inlen)
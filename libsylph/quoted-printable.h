@@ -25,6 +25,9 @@
 void qp_encode_line		(gchar		*out,
 				 const guchar	*in);
 gint qp_decode_line		(gchar		*str);
+gint qp_decode			(gchar		*out,
+				 const gchar	*in,
+				 gint		 inlen);
 
 gint qp_decode_q_encoding	(guchar		*out,
 				 const gchar	*in,
@@ -36,6 +36,11 @@
 static RecvUIFunc	recv_ui_func;
 static gpointer		recv_ui_func_data;
 
+static gint recv_write_real	(SockInfo	*sock,
+				 FILE		*fp,
+				 RecvUIFunc	 ui_func,
+				 gpointer	 ui_func_data);
+
 
 gchar *recv_bytes(SockInfo *sock, glong size)
 {
@@ -65,6 +70,14 @@ gchar *recv_bytes(SockInfo *sock, glong size)
 }
 
 gint recv_write_to_file(SockInfo *sock, const gchar *filename)
+{
+	return recv_write_to_file_full(sock, filename, recv_ui_func,
+				       recv_ui_func_data);
+}
+
+/* ui_func can be NULL when receiving on a thread other than the main one */
+gint recv_write_to_file_full(SockInfo *sock, const gchar *filename,
+			     RecvUIFunc ui_func, gpointer ui_func_data)
 {
 	FILE *fp;
 	gint ret;
@@ -73,14 +86,14 @@ gint recv_write_to_file(SockInfo *sock, const gchar *filename)
 
 	if ((fp = g_fopen(filename, "wb")) == NULL) {
 		FILE_OP_ERROR(filename, "fopen");
-		recv_write(sock, NULL);
+		recv_write_real(sock, NULL, ui_func, ui_func_data);
 		return -1;
 	}
 
 	if (change_file_mode_rw(fp, filename) < 0)
 		FILE_OP_ERROR(filename, "chmod");
 
-	if ((ret = recv_write(sock, fp)) < 0) {
+	if ((ret = recv_write_real(sock, fp, ui_func, ui_func_data)) < 0) {
 		fclose(fp);
 		g_unlink(filename);
 		return ret;
@@ -126,6 +139,12 @@ gint recv_bytes_write_to_file(SockInfo *sock, glong size, const gchar *filename)
 }
 
 gint recv_write(SockInfo *sock, FILE *fp)
+{
+	return recv_write_real(sock, fp, recv_ui_func, recv_ui_func_data);
+}
+
+static gint recv_write_real(SockInfo *sock, FILE *fp, RecvUIFunc ui_func,
+			    gpointer ui_func_data)
 {
 	gchar buf[BUFFSIZE];
 	gint len;
@@ -144,23 +163,21 @@ gint recv_write(SockInfo *sock, FILE *fp)
 
 		len = strlen(buf);
 		if (len > 1 && buf[0] == '.' && buf[1] == '\r') {
-			if (recv_ui_func)
-				recv_ui_func(sock, count, bytes,
-					     recv_ui_func_data);
+			if (ui_func)
+				ui_func(sock, count, bytes, ui_func_data);
 			break;
 		}
 		count++;
 		bytes += len;
 
-		if (recv_ui_func) {
+		if (ui_func) {
 			g_get_current_time(&tv_cur);
 			/* if elapsed time from previous update is greater
 			   than 50msec, update UI */
 			if (tv_cur.tv_sec - tv_prev.tv_sec > 0 ||
 			    tv_cur.tv_usec - tv_prev.tv_usec > UI_REFRESH_INTERVAL) {
 				gboolean ret;
-				ret = recv_ui_func(sock, count, bytes,
-						   recv_ui_func_data);
+				ret = ui_func(sock, count, bytes, ui_func_data);
 				if (ret == FALSE) return -1;
 				g_get_current_time(&tv_prev);
 			}
@@ -34,6 +34,10 @@ gchar *recv_bytes		(SockInfo	*sock,
 
 gint recv_write_to_file		(SockInfo	*sock,
 				 const gchar	*filename);
+gint recv_write_to_file_full	(SockInfo	*sock,
+				 const gchar	*filename,
+				 RecvUIFunc	 ui_func,
+				 gpointer	 ui_func_data);
 gint recv_bytes_write_to_file	(SockInfo	*sock,
 				 glong		 size,
 				 const gchar	*filename);
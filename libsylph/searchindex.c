@@ -0,0 +1,1092 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2017 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifdef HAVE_CONFIG_H
+#  include "config.h"
+#endif
+
+#include "defs.h"
+
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "searchindex.h"
+#include "folder.h"
+#include "procmsg.h"
+#include "procheader.h"
+#include "procmime.h"
+#include "filter.h"
+#include "codeconv.h"
+#include "utils.h"
+
+/*
+ * The search index of a folder is a sequence of segments appended to
+ * INDEX_FILE. A segment holds the messages indexed together, the sorted
+ * table of the trigrams found in their headers and text bodies, and for
+ * each trigram the delta-encoded list of the messages containing it.
+ * A message indexed again overrides its entry in the earlier segments,
+ * and the segments are merged into one when they pile up.
+ *
+ * Since FLT_CONTAIN and FLT_EQUAL conditions match only strings which
+ * contain every trigram of the pattern, the index yields a superset of
+ * the matching messages, which are then checked by filter_match_rule().
+ */
+
+#define INDEX_FIELD_HEADER	0
+#define INDEX_FIELD_BODY	1
+
+#define INDEX_SEGMENT_MSGS	256
+#define INDEX_MAX_SEGMENTS	8
+
+#define INDEX_PAD(len)		(((len) + 3) & ~3U)
+
+/* the text body could not be indexed and may match anything */
+#define INDEX_BODY_UNKNOWN	(1U << 0)
+
+#if USE_THREADS
+G_LOCK_DEFINE_STATIC(search_index);
+#define S_LOCK(name)	G_LOCK(name)
+#define S_UNLOCK(name)	G_UNLOCK(name)
+#else
+#define S_LOCK(name)
+#define S_UNLOCK(name)
+#endif
+
+typedef struct _SearchIndexSegHeader {
+	guint32 n_msgs;
+	guint32 n_grams;
+	guint32 postings_len;
+} SearchIndexSegHeader;
+
+typedef struct _SearchIndexMsg {
+	guint32 msgnum;
+	guint32 size;
+	guint32 mtime;
+	guint32 flags;
+} SearchIndexMsg;
+
+typedef struct _SearchIndexGram {
+	guint32 gram;
+	guint32 offset;
+} SearchIndexGram;
+
+typedef struct _SearchIndexSegment {
+	SearchIndexSegHeader hdr;
+	const SearchIndexMsg *msgs;
+	const SearchIndexGram *grams;
+	const guchar *postings;
+
+	/* non-zero for the current entries of the messages in the list */
+	guint8 *live;
+} SearchIndexSegment;
+
+typedef struct _SearchIndex {
+	gchar *file;
+	GMappedFile *map;
+	GArray *segments;
+
+	GSList *mlist;
+	GHashTable *msg_table;
+	GHashTable *live_table;
+	guint n_live;
+	guint n_dead;
+} SearchIndex;
+
+typedef struct _SearchIndexBuilder {
+	GArray *msgs;
+	GHashTable *postings;
+	guint32 cur_idx;
+} SearchIndexBuilder;
+
+
+static guint32 search_index_gram(guint32 field, const guchar *p)
+{
+	return (field << 24) | (g_ascii_tolower(p[0]) << 16) |
+		(g_ascii_tolower(p[1]) << 8) | g_ascii_tolower(p[2]);
+}
+
+static void search_index_add_grams(GHashTable *grams, guint32 field,
+				   const gchar *str)
+{
+	const guchar *p = (const guchar *)str;
+	guint32 gram;
+
+	if (!p || p[0] == '\0' || p[1] == '\0')
+		return;
+
+	for (; p[2] != '\0'; p++) {
+		gram = search_index_gram(field, p);
+		g_hash_table_insert(grams, GUINT_TO_POINTER(gram),
+				    GINT_TO_POINTER(1));
+	}
+}
+
+static void search_index_add_header_grams(GHashTable *grams, GSList *hlist)
+{
+	GSList *cur;
+	Header *header;
+
+	for (cur = hlist; cur != NULL; cur = cur->next) {
+		header = (Header *)cur->data;
+		search_index_add_grams(grams, INDEX_FIELD_HEADER,
+				       header->body);
+	}
+}
+
+/* collect the trigrams the same way as filter_match_header_cond() and
+   procmime_find_string() see the message */
+static guint32 search_index_scan_msg(MsgInfo *msginfo, GHashTable *grams)
+{
+	GSList *hlist;
+	gchar *file;
+	MimeInfo *mimeinfo, *partinfo;
+	FILE *fp, *outfp;
+	gchar buf[BUFFSIZE];
+	guint32 flags = 0;
+
+	hlist = procheader_get_header_list_from_msginfo(msginfo);
+	search_index_add_header_grams(grams, hlist);
+	procheader_header_list_destroy(hlist);
+
+	file = procmsg_get_message_file(msginfo);
+	if (!file)
+		return INDEX_BODY_UNKNOWN;
+
+	hlist = procheader_get_header_list_from_file(file);
+	search_index_add_header_grams(grams, hlist);
+	procheader_header_list_destroy(hlist);
+
+	mimeinfo = procmime_scan_message(msginfo);
+	if (!mimeinfo || MSG_IS_ENCRYPTED(msginfo->flags)) {
+		procmime_mimeinfo_free_all(mimeinfo);
+		g_free(file);
+		return INDEX_BODY_UNKNOWN;
+	}
+
+	for (partinfo = mimeinfo; partinfo != NULL;
+	     partinfo = procmime_mimeinfo_next(partinfo)) {
+		/* the decrypted text depends on the auto decryption */
+		if (partinfo->content_type &&
+		    !g_ascii_strcasecmp(partinfo->content_type,
+					"multipart/encrypted")) {
+			flags |= INDEX_BODY_UNKNOWN;
+			break;
+		}
+		if (partinfo->mime_type != MIME_TEXT &&
+		    partinfo->mime_type != MIME_TEXT_HTML)
+			continue;
+
+		if ((fp = g_fopen(file, "rb")) == NULL) {
+			FILE_OP_ERROR(file, "fopen");
+			flags |= INDEX_BODY_UNKNOWN;
+			break;
+		}
+
+		if (PROCMIME_USE_MEM_DECODE(partinfo)) {
+			gchar *text, *p, *next;
+
+			text = procmime_get_text_content_str(partinfo, fp, NULL);
+			fclose(fp);
+			if (!text) {
+				flags |= INDEX_BODY_UNKNOWN;
+				continue;
+			}
+			for (p = text; *p != '\0'; p = next) {
+				if ((next = strchr(p, '\n')) != NULL)
+					*next++ = '\0';
+				else
+					next = p + strlen(p);
+				strretchomp(p);
+				search_index_add_grams(grams, INDEX_FIELD_BODY,
+						       p);
+			}
+			g_free(text);
+			continue;
+		}
+
+		outfp = procmime_get_text_content(partinfo, fp, NULL);
+		fclose(fp);
+		if (!outfp) {
+			flags |= INDEX_BODY_UNKNOWN;
+			continue;
+		}
+
+		while (fgets(buf, sizeof(buf), outfp) != NULL) {
+			strretchomp(buf);
+			search_index_add_grams(grams, INDEX_FIELD_BODY, buf);
+		}
+
+		fclose(outfp);
+	}
+
+	procmime_mimeinfo_free_all(mimeinfo);
+	g_free(file);
+
+	return flags;
+}
+
+static gint search_index_gram_cmp(gconstpointer a, gconstpointer b)
+{
+	guint32 ga = *(const guint32 *)a;
+	guint32 gb = *(const guint32 *)b;
+
+	return ga < gb ? -1 : ga > gb ? 1 : 0;
+}
+
+static void search_index_sort_uniq(GArray *array)
+{
+	guint i, n = 0;
+
+	g_array_sort(array, search_index_gram_cmp);
+	for (i = 0; i < array->len; i++) {
+		if (n > 0 && g_array_index(array, guint32, n - 1) ==
+		    g_array_index(array, guint32, i))
+			continue;
+		g_array_index(array, guint32, n++) =
+			g_array_index(array, guint32, i);
+	}
+	g_array_set_size(array, n);
+}
+
+static void search_index_encode_uint(GByteArray *buf, guint32 val)
+{
+	guint8 c;
+
+	while (val >= 0x80) {
+		c = (val & 0x7f) | 0x80;
+		g_byte_array_append(buf, &c, 1);
+		val >>= 7;
+	}
+	c = val;
+	g_byte_array_append(buf, &c, 1);
+}
+
+static const guchar *search_index_decode_uint(const guchar *p,
+					      const guchar *end, guint32 *val)
+{
+	guint32 v = 0;
+	gint shift = 0;
+
+	while (p < end && shift < 32) {
+		v |= (guint32)(*p & 0x7f) << shift;
+		if ((*p++ & 0x80) == 0) {
+			*val = v;
+			return p;
+		}
+		shift += 7;
+	}
+
+	return NULL;
+}
+
+/* Segment access */
+
+static gboolean search_index_segment_postings(const SearchIndexSegment *seg,
+					      guint n, const guchar **start,
+					      const guchar **end)
+{
+	guint32 s, e;
+
+	s = seg->grams[n].offset;
+	e = n + 1 < seg->hdr.n_grams ? seg->grams[n + 1].offset
+		: seg->hdr.postings_len;
+	if (s > e || e > seg->hdr.postings_len)
+		return FALSE;
+
+	*start = seg->postings + s;
+	*end = seg->postings + e;
+	return TRUE;
+}
+
+static gboolean search_index_segment_lookup(const SearchIndexSegment *seg,
+					    guint32 gram, const guchar **start,
+					    const guchar **end)
+{
+	guint lo = 0, hi = seg->hdr.n_grams, mid;
+
+	while (lo < hi) {
+		mid = (lo + hi) / 2;
+		if (seg->grams[mid].gram < gram)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if (lo >= seg->hdr.n_grams || seg->grams[lo].gram != gram)
+		return FALSE;
+
+	return search_index_segment_postings(seg, lo, start, end);
+}
+
+static void search_index_decode_postings(const SearchIndexSegment *seg,
+					 const guchar *p, const guchar *end,
+					 GArray *out)
+{
+	guint32 val, idx = 0;
+	gboolean first = TRUE;
+
+	while (p < end && (p = search_index_decode_uint(p, end, &val))) {
+		idx = first ? val : idx + val;
+		first = FALSE;
+		if (idx >= seg->hdr.n_msgs)
+			break;
+		g_array_append_val(out, idx);
+	}
+}
+
+/* returns the entries in the segment which contain all the trigrams */
+static GArray *search_index_segment_match(const SearchIndexSegment *seg,
+					  GArray *grams)
+{
+	GArray *result, *docs;
+	const guchar *start, *end;
+	guint i, j, k, n;
+
+	result = g_array_new(FALSE, FALSE, sizeof(guint32));
+	docs = g_array_new(FALSE, FALSE, sizeof(guint32));
+
+	for (i = 0; i < grams->len; i++) {
+		if (!search_index_segment_lookup
+			(seg, g_array_index(grams, guint32, i), &start, &end)) {
+			g_array_set_size(result, 0);
+			break;
+		}
+
+		if (i == 0) {
+			search_index_decode_postings(seg, start, end, result);
+		} else {
+			g_array_set_size(docs, 0);
+			search_index_decode_postings(seg, start, end, docs);
+			for (j = 0, k = 0, n = 0;
+			     j < result->len && k < docs->len; ) {
+				guint32 a = g_array_index(result, guint32, j);
+				guint32 b = g_array_index(docs, guint32, k);
+
+				if (a < b)
+					j++;
+				else if (a > b)
+					k++;
+				else {
+					g_array_index(result, guint32, n++) = a;
+					j++;
+					k++;
+				}
+			}
+			g_array_set_size(result, n);
+		}
+
+		if (result->len == 0)
+			break;
+	}
+
+	g_array_free(docs, TRUE);
+
+	return result;
+}
+
+/* Loading */
+
+static void search_index_clear(SearchIndex *index)
+{
+	guint i;
+
+	for (i = 0; i < index->segments->len; i++)
+		g_free(g_array_index(index->segments, SearchIndexSegment,
+				     i).live);
+	g_array_set_size(index->segments, 0);
+
+	if (index->map) {
+		g_mapped_file_free(index->map);
+		index->map = NULL;
+	}
+	if (index->live_table) {
+		g_hash_table_destroy(index->live_table);
+		index->live_table = NULL;
+	}
+	index->n_live = index->n_dead = 0;
+}
+
+static void search_index_load(SearchIndex *index)
+{
+	GError *error = NULL;
+	const gchar *p, *endp;
+	guint32 data_ver;
+	gsize left;
+	SearchIndexSegment seg;
+
+	if (!is_file_exist(index->file))
+		return;
+
+	index->map = g_mapped_file_new(index->file, FALSE, &error);
+	if (!index->map) {
+		if (error) {
+			g_warning("%s: cannot open the search index: %s",
+				  index->file, error->message);
+			g_error_free(error);
+		}
+		return;
+	}
+
+	p = g_mapped_file_get_contents(index->map);
+	endp = p + g_mapped_file_get_length(index->map);
+
+	if ((gsize)(endp - p) < sizeof(data_ver))
+		goto corrupt;
+	memcpy(&data_ver, p, sizeof(data_ver));
+	if (data_ver != INDEX_VERSION)
+		goto corrupt;
+	p += sizeof(data_ver);
+
+	while (p < endp) {
+		left = endp - p;
+		if (left < sizeof(seg.hdr))
+			goto corrupt;
+		memcpy(&seg.hdr, p, sizeof(seg.hdr));
+		p += sizeof(seg.hdr);
+		left -= sizeof(seg.hdr);
+
+		if (seg.hdr.n_msgs > left / sizeof(SearchIndexMsg))
+			goto corrupt;
+		seg.msgs = (const SearchIndexMsg *)p;
+		p += seg.hdr.n_msgs * sizeof(SearchIndexMsg);
+		left -= seg.hdr.n_msgs * sizeof(SearchIndexMsg);
+
+		if (seg.hdr.n_grams > left / sizeof(SearchIndexGram))
+			goto corrupt;
+		seg.grams = (const SearchIndexGram *)p;
+		p += seg.hdr.n_grams * sizeof(SearchIndexGram);
+		left -= seg.hdr.n_grams * sizeof(SearchIndexGram);
+
+		if (INDEX_PAD(seg.hdr.postings_len) > left)
+			goto corrupt;
+		seg.postings = (const guchar *)p;
+		p += INDEX_PAD(seg.hdr.postings_len);
+
+		seg.live = NULL;
+		g_array_append_val(index->segments, seg);
+	}
+
+	return;
+
+corrupt:
+	g_message("%s: the search index is broken. Discarding it.\n",
+		  index->file);
+	search_index_clear(index);
+	g_unlink(index->file);
+}
+
+/* find the entries which are up to date with the message list */
+static void search_index_mark_live(SearchIndex *index)
+{
+	SearchIndexSegment *seg;
+	const SearchIndexMsg *entry;
+	MsgInfo *msginfo;
+	gpointer key;
+	gint s;
+	guint i;
+
+	index->live_table = g_hash_table_new(NULL, g_direct_equal);
+	index->n_live = index->n_dead = 0;
+
+	for (s = index->segments->len - 1; s >= 0; s--) {
+		seg = &g_array_index(index->segments, SearchIndexSegment, s);
+		seg->live = g_new0(guint8, seg->hdr.n_msgs + 1);
+
+		for (i = 0; i < seg->hdr.n_msgs; i++) {
+			entry = &seg->msgs[i];
+			key = GUINT_TO_POINTER(entry->msgnum);
+			msginfo = g_hash_table_lookup(index->msg_table, key);
+			if (msginfo &&
+			    !g_hash_table_lookup(index->live_table, key) &&
+			    (guint32)msginfo->size == entry->size &&
+			    (guint32)msginfo->mtime == entry->mtime) {
+				g_hash_table_insert(index->live_table, key,
+						    GINT_TO_POINTER(1));
+				seg->live[i] = 1;
+				index->n_live++;
+			} else
+				index->n_dead++;
+		}
+	}
+}
+
+/* Updating */
+
+static gboolean search_index_write_segment_header(FILE *fp,
+						  SearchIndexSegHeader *hdr,
+						  GArray *msgs)
+{
+	if (fwrite(hdr, sizeof(*hdr), 1, fp) != 1)
+		return FALSE;
+	if (msgs->len > 0 &&
+	    fwrite(msgs->data, sizeof(SearchIndexMsg), msgs->len, fp) !=
+	    msgs->len)
+		return FALSE;
+
+	return TRUE;
+}
+
+static gboolean search_index_write_padding(FILE *fp, guint32 len)
+{
+	static const guchar pad[4];
+
+	if (INDEX_PAD(len) > len &&
+	    fwrite(pad, INDEX_PAD(len) - len, 1, fp) != 1)
+		return FALSE;
+
+	return TRUE;
+}
+
+static void search_index_builder_add_posting(gpointer key, gpointer value,
+					     gpointer data)
+{
+	SearchIndexBuilder *builder = (SearchIndexBuilder *)data;
+	GArray *docs;
+
+	docs = g_hash_table_lookup(builder->postings, key);
+	if (!docs) {
+		docs = g_array_new(FALSE, FALSE, sizeof(guint32));
+		g_hash_table_insert(builder->postings, key, docs);
+	}
+	g_array_append_val(docs, builder->cur_idx);
+}
+
+static void search_index_builder_add_key(gpointer key, gpointer value,
+					 gpointer data)
+{
+	guint32 gram = GPOINTER_TO_UINT(key);
+
+	g_array_append_val((GArray *)data, gram);
+}
+
+static void search_index_builder_free_docs(gpointer key, gpointer value,
+					   gpointer data)
+{
+	g_array_free((GArray *)value, TRUE);
+}
+
+static gboolean search_index_write_builder(FILE *fp,
+					   SearchIndexBuilder *builder)
+{
+	SearchIndexSegHeader hdr;
+	GArray *keys, *table, *docs;
+	GByteArray *postings;
+	SearchIndexGram entry;
+	guint i, j;
+	guint32 prev;
+	gboolean ret;
+
+	keys = g_array_new(FALSE, FALSE, sizeof(guint32));
+	g_hash_table_foreach(builder->postings, search_index_builder_add_key,
+			     keys);
+	g_array_sort(keys, search_index_gram_cmp);
+
+	table = g_array_sized_new(FALSE, FALSE, sizeof(SearchIndexGram),
+				  keys->len);
+	postings = g_byte_array_new();
+
+	for (i = 0; i < keys->len; i++) {
+		entry.gram = g_array_index(keys, guint32, i);
+		entry.offset = postings->len;
+		g_array_append_val(table, entry);
+
+		docs = g_hash_table_lookup(builder->postings,
+					   GUINT_TO_POINTER(entry.gram));
+		for (j = 0, prev = 0; j < docs->len; j++) {
+			search_index_encode_uint
+				(postings, g_array_index(docs, guint32, j) - prev);
+			prev = g_array_index(docs, guint32, j);
+		}
+	}
+
+	hdr.n_msgs = builder->msgs->len;
+	hdr.n_grams = table->len;
+	hdr.postings_len = postings->len;
+
+	ret = search_index_write_segment_header(fp, &hdr, builder->msgs) &&
+		(table->len == 0 ||
+		 fwrite(table->data, sizeof(SearchIndexGram), table->len, fp)
+		 == table->len) &&
+		(postings->len == 0 ||
+		 fwrite(postings->data, postings->len, 1, fp) == 1) &&
+		search_index_write_padding(fp, postings->len);
+
+	g_byte_array_free(postings, TRUE);
+	g_array_free(table, TRUE);
+	g_array_free(keys, TRUE);
+
+	return ret;
+}
+
+static void search_index_builder_reset(SearchIndexBuilder *builder)
+{
+	g_hash_table_foreach(builder->postings,
+			     search_index_builder_free_docs, NULL);
+	g_hash_table_destroy(builder->postings);
+	builder->postings = g_hash_table_new(NULL, g_direct_equal);
+	g_array_set_size(builder->msgs, 0);
+	builder->cur_idx = 0;
+}
+
+/* index the messages and append them to the index file in segments */
+static void search_index_append(SearchIndex *index, GSList *mlist)
+{
+	SearchIndexBuilder builder;
+	SearchIndexMsg entry;
+	GHashTable *grams;
+	GSList *cur;
+	MsgInfo *msginfo;
+	FILE *fp;
+	gint count = 0;
+
+	if ((fp = procmsg_open_data_file(index->file, INDEX_VERSION,
+					 DATA_APPEND, NULL, 0)) == NULL)
+		return;
+
+	builder.msgs = g_array_new(FALSE, FALSE, sizeof(SearchIndexMsg));
+	builder.postings = g_hash_table_new(NULL, g_direct_equal);
+	builder.cur_idx = 0;
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+
+		grams = g_hash_table_new(NULL, g_direct_equal);
+		entry.msgnum = msginfo->msgnum;
+		entry.size = (guint32)msginfo->size;
+		entry.mtime = (guint32)msginfo->mtime;
+		entry.flags = search_index_scan_msg(msginfo, grams);
+		g_hash_table_foreach(grams, search_index_builder_add_posting,
+				     &builder);
+		g_hash_table_destroy(grams);
+		g_array_append_val(builder.msgs, entry);
+		builder.cur_idx++;
+		count++;
+
+		if (builder.msgs->len >= INDEX_SEGMENT_MSGS ||
+		    cur->next == NULL) {
+			if (!search_index_write_builder(fp, &builder)) {
+				FILE_OP_ERROR(index->file, "fwrite");
+				break;
+			}
+			search_index_builder_reset(&builder);
+		}
+	}
+
+	search_index_builder_reset(&builder);
+	g_hash_table_destroy(builder.postings);
+	g_array_free(builder.msgs, TRUE);
+
+	if (fclose(fp) == EOF)
+		FILE_OP_ERROR(index->file, "fclose");
+
+	debug_print("search index: %d messages indexed\n", count);
+}
+
+/* rewrite the live entries of all segments into one segment */
+static gboolean search_index_merge(SearchIndex *index, const gchar *file)
+{
+	SearchIndexSegment *seg;
+	SearchIndexSegHeader hdr;
+	SearchIndexGram *table = NULL;
+	GArray *msgs, *all, *docs;
+	GByteArray *buf;
+	guint32 **remap;
+	guint *cursor;
+	const guchar *start, *end;
+	guint32 gram, prev, idx;
+	glong hdr_pos = 0, table_pos = 0;
+	guint s, i, j, nseg;
+	FILE *fp;
+	gboolean ret = FALSE;
+
+	if ((fp = procmsg_open_data_file(file, INDEX_VERSION, DATA_WRITE,
+					 NULL, 0)) == NULL)
+		return FALSE;
+
+	nseg = index->segments->len;
+	msgs = g_array_new(FALSE, FALSE, sizeof(SearchIndexMsg));
+	all = g_array_new(FALSE, FALSE, sizeof(guint32));
+	docs = g_array_new(FALSE, FALSE, sizeof(guint32));
+	buf = g_byte_array_new();
+	remap = g_new(guint32 *, nseg);
+	cursor = g_new0(guint, nseg);
+
+	/* renumber the live entries in the order of the segments */
+	for (s = 0; s < nseg; s++) {
+		seg = &g_array_index(index->segments, SearchIndexSegment, s);
+		remap[s] = g_new(guint32, seg->hdr.n_msgs + 1);
+		for (i = 0; i < seg->hdr.n_msgs; i++) {
+			if (seg->live[i]) {
+				remap[s][i] = msgs->len;
+				g_array_append_val(msgs, seg->msgs[i]);
+			} else
+				remap[s][i] = G_MAXUINT32;
+		}
+		for (i = 0; i < seg->hdr.n_grams; i++)
+			g_array_append_val(all, seg->grams[i].gram);
+	}
+	search_index_sort_uniq(all);
+
+	hdr.n_msgs = msgs->len;
+	hdr.n_grams = all->len;
+	hdr.postings_len = 0;
+	table = g_new0(SearchIndexGram, all->len + 1);
+
+	if ((hdr_pos = ftell(fp)) < 0 ||
+	    !search_index_write_segment_header(fp, &hdr, msgs) ||
+	    (table_pos = ftell(fp)) < 0 ||
+	    (all->len > 0 &&
+	     fwrite(table, sizeof(SearchIndexGram), all->len, fp) != all->len))
+		goto finish;
+
+	for (j = 0; j < all->len; j++) {
+		gram = g_array_index(all, guint32, j);
+		table[j].gram = gram;
+		table[j].offset = hdr.postings_len;
+		g_byte_array_set_size(buf, 0);
+		prev = 0;
+
+		for (s = 0; s < nseg; s++) {
+			seg = &g_array_index(index->segments,
+					     SearchIndexSegment, s);
+			while (cursor[s] < seg->hdr.n_grams &&
+			       seg->grams[cursor[s]].gram < gram)
+				cursor[s]++;
+			if (cursor[s] >= seg->hdr.n_grams ||
+			    seg->grams[cursor[s]].gram != gram ||
+			    !search_index_segment_postings(seg, cursor[s],
+							   &start, &end))
+				continue;
+
+			g_array_set_size(docs, 0);
+			search_index_decode_postings(seg, start, end, docs);
+			for (i = 0; i < docs->len; i++) {
+				idx = remap[s][g_array_index(docs, guint32, i)];
+				if (idx == G_MAXUINT32)
+					continue;
+				search_index_encode_uint(buf, idx - prev);
+				prev = idx;
+			}
+		}
+
+		if (buf->len > 0 && fwrite(buf->data, buf->len, 1, fp) != 1)
+			goto finish;
+		hdr.postings_len += buf->len;
+	}
+
+	if (!search_index_write_padding(fp, hdr.postings_len) ||
+	    fseek(fp, table_pos, SEEK_SET) < 0 ||
+	    (all->len > 0 &&
+	     fwrite(table, sizeof(SearchIndexGram), all->len, fp) != all->len) ||
+	    fseek(fp, hdr_pos, SEEK_SET) < 0 ||
+	    fwrite(&hdr, sizeof(hdr), 1, fp) != 1)
+		goto finish;
+
+	ret = TRUE;
+
+finish:
+	if (!ret)
+		FILE_OP_ERROR(file, "fwrite");
+	if (fclose(fp) == EOF) {
+		FILE_OP_ERROR(file, "fclose");
+		ret = FALSE;
+	}
+
+	debug_print("search index: merged %u segments (%u entries, %u dropped)\n",
+		    nseg, msgs->len, index->n_dead);
+
+	for (s = 0; s < nseg; s++)
+		g_free(remap[s]);
+	g_free(remap);
+	g_free(cursor);
+	g_free(table);
+	g_byte_array_free(buf, TRUE);
+	g_array_free(docs, TRUE);
+	g_array_free(all, TRUE);
+	g_array_free(msgs, TRUE);
+
+	return ret;
+}
+
+static void search_index_reload(SearchIndex *index)
+{
+	search_index_clear(index);
+	search_index_load(index);
+	search_index_mark_live(index);
+}
+
+static SearchIndex *search_index_open(FolderItem *item, GSList *mlist)
+{
+	SearchIndex *index;
+	GSList *cur, *unindexed = NULL;
+	MsgInfo *msginfo;
+	gchar *tmp;
+
+	index = g_new0(SearchIndex, 1);
+	index->file = folder_item_get_index_file(item);
+	index->segments = g_array_new(FALSE, FALSE,
+				      sizeof(SearchIndexSegment));
+	index->mlist = mlist;
+	index->msg_table = g_hash_table_new(NULL, g_direct_equal);
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		g_hash_table_insert(index->msg_table,
+				    GUINT_TO_POINTER(msginfo->msgnum), msginfo);
+	}
+
+	search_index_load(index);
+	search_index_mark_live(index);
+
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		if (!g_hash_table_lookup(index->live_table,
+					 GUINT_TO_POINTER(msginfo->msgnum)))
+			unindexed = g_slist_prepend(unindexed, msginfo);
+	}
+	if (unindexed) {
+		unindexed = g_slist_reverse(unindexed);
+		search_index_clear(index);
+		search_index_append(index, unindexed);
+		g_slist_free(unindexed);
+		search_index_reload(index);
+	}
+
+	if (index->segments->len > INDEX_MAX_SEGMENTS ||
+	    index->n_dead > index->n_live) {
+		tmp = g_strconcat(index->file, ".tmp", NULL);
+		if (search_index_merge(index, tmp)) {
+			search_index_clear(index);
+			if (rename_force(tmp, index->file) < 0)
+				FILE_OP_ERROR(tmp, "rename");
+			search_index_reload(index);
+		} else
+			g_unlink(tmp);
+		g_free(tmp);
+	}
+
+	return index;
+}
+
+static void search_index_close(SearchIndex *index)
+{
+	search_index_clear(index);
+	g_array_free(index->segments, TRUE);
+	g_hash_table_destroy(index->msg_table);
+	g_free(index->file);
+	g_free(index);
+}
+
+/* Searching */
+
+/* returns the trigrams which every string matched by the condition
+   contains, or NULL if the condition cannot be answered by the index */
+static GArray *search_index_get_cond_grams(FilterCond *cond)
+{
+	GArray *grams;
+	const guchar *p;
+	guint32 field, gram;
+	gboolean use_non_ascii;
+
+	switch (cond->type) {
+	case FLT_COND_HEADER:
+	case FLT_COND_ANY_HEADER:
+	case FLT_COND_TO_OR_CC:
+		field = INDEX_FIELD_HEADER;
+		break;
+	case FLT_COND_BODY:
+		field = INDEX_FIELD_BODY;
+		break;
+	default:
+		return NULL;
+	}
+
+	if (cond->match_type != FLT_CONTAIN && cond->match_type != FLT_EQUAL)
+		return NULL;
+	if (FLT_IS_NOT_MATCH(cond->match_flag) || !cond->str_value)
+		return NULL;
+
+	/* strcasestr() may fold non-ASCII bytes in legacy locales */
+	use_non_ascii = cond->match_type == FLT_EQUAL ||
+		FLT_IS_CASE_SENS(cond->match_flag) ||
+		conv_get_locale_charset() == C_UTF_8;
+
+	grams = g_array_new(FALSE, FALSE, sizeof(guint32));
+	for (p = (const guchar *)cond->str_value;
+	     p[0] != '\0' && p[1] != '\0' && p[2] != '\0'; p++) {
+		if (!use_non_ascii && ((p[0] | p[1] | p[2]) & 0x80))
+			continue;
+		gram = search_index_gram(field, p);
+		g_array_append_val(grams, gram);
+	}
+
+	if (grams->len == 0) {
+		g_array_free(grams, TRUE);
+		return NULL;
+	}
+
+	search_index_sort_uniq(grams);
+
+	return grams;
+}
+
+static gboolean search_index_rule_is_indexable(FilterRule *rule)
+{
+	GSList *cur;
+	FilterCond *cond;
+	GArray *grams;
+	gboolean has_body = FALSE;
+	gint n_indexable = 0;
+
+	for (cur = rule->cond_list; cur != NULL; cur = cur->next) {
+		cond = (FilterCond *)cur->data;
+		if (cond->type == FLT_COND_BODY)
+			has_body = TRUE;
+		if ((grams = search_index_get_cond_grams(cond)) != NULL) {
+			g_array_free(grams, TRUE);
+			n_indexable++;
+		} else if (rule->bool_op == FLT_OR)
+			return FALSE;
+	}
+
+	if (n_indexable == 0)
+		return FALSE;
+
+	/* the headers in the summary cache are searched fast enough */
+	return has_body || filter_rule_requires_full_headers(rule);
+}
+
+static void search_index_match_cond(SearchIndex *index, FilterCond *cond,
+				    GArray *grams, GHashTable *table)
+{
+	SearchIndexSegment *seg;
+	GArray *docs;
+	GSList *cur;
+	MsgInfo *msginfo;
+	guint s, i, idx;
+
+	for (s = 0; s < index->segments->len; s++) {
+		seg = &g_array_index(index->segments, SearchIndexSegment, s);
+
+		docs = search_index_segment_match(seg, grams);
+		for (i = 0; i < docs->len; i++) {
+			idx = g_array_index(docs, guint32, i);
+			if (seg->live[idx])
+				g_hash_table_insert
+					(table,
+					 GUINT_TO_POINTER(seg->msgs[idx].msgnum),
+					 GINT_TO_POINTER(1));
+		}
+		g_array_free(docs, TRUE);
+
+		if (cond->type != FLT_COND_BODY)
+			continue;
+		for (i = 0; i < seg->hdr.n_msgs; i++) {
+			if (seg->live[i] &&
+			    (seg->msgs[i].flags & INDEX_BODY_UNKNOWN))
+				g_hash_table_insert
+					(table,
+					 GUINT_TO_POINTER(seg->msgs[i].msgnum),
+					 GINT_TO_POINTER(1));
+		}
+	}
+
+	/* the messages which could not be indexed */
+	for (cur = index->mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		if (!g_hash_table_lookup(index->live_table,
+					 GUINT_TO_POINTER(msginfo->msgnum)))
+			g_hash_table_insert(table,
+					    GUINT_TO_POINTER(msginfo->msgnum),
+					    GINT_TO_POINTER(1));
+	}
+}
+
+static gboolean search_index_remove_unmatched(gpointer key, gpointer value,
+					      gpointer data)
+{
+	return g_hash_table_lookup((GHashTable *)data, key) == NULL;
+}
+
+static GHashTable *search_index_match_rule(SearchIndex *index,
+					   FilterRule *rule)
+{
+	GHashTable *result = NULL, *table;
+	GSList *cur;
+	FilterCond *cond;
+	GArray *grams;
+
+	for (cur = rule->cond_list; cur != NULL; cur = cur->next) {
+		cond = (FilterCond *)cur->data;
+		if ((grams = search_index_get_cond_grams(cond)) == NULL)
+			continue;
+
+		if (rule->bool_op == FLT_OR) {
+			if (!result)
+				result = g_hash_table_new(NULL, g_direct_equal);
+			search_index_match_cond(index, cond, grams, result);
+		} else {
+			table = g_hash_table_new(NULL, g_direct_equal);
+			search_index_match_cond(index, cond, grams, table);
+			if (result) {
+				g_hash_table_foreach_remove
+					(result, search_index_remove_unmatched,
+					 table);
+				g_hash_table_destroy(table);
+			} else
+				result = table;
+		}
+
+		g_array_free(grams, TRUE);
+	}
+
+	return result;
+}
+
+GHashTable *search_index_get_candidates(FolderItem *item, GSList *mlist,
+					FilterRule *rule)
+{
+	SearchIndex *index;
+	GHashTable *table;
+
+	g_return_val_if_fail(item != NULL, NULL);
+	g_return_val_if_fail(rule != NULL, NULL);
+
+	/* reading the messages of remote folders may download them */
+	if (!item->path || !item->folder ||
+	    FOLDER_TYPE(item->folder) != F_MH)
+		return NULL;
+	if (!mlist || !search_index_rule_is_indexable(rule))
+		return NULL;
+
+	S_LOCK(search_index);
+
+	index = search_index_open(item, mlist);
+	table = search_index_match_rule(index, rule);
+	search_index_close(index);
+
+	S_UNLOCK(search_index);
+
+	if (table)
+		debug_print("search index: %u candidates in %u messages\n",
+			    g_hash_table_size(table), g_slist_length(mlist));
+
+	return table;
+}
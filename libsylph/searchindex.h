@@ -0,0 +1,36 @@
+/*
+ * LibSylph -- E-Mail client library
+ * Copyright (C) 1999-2017 Hiroyuki Yamamoto
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin St, Fifth Floor, Boston, MA  02110-1301  USA
+ */
+
+#ifndef __SEARCHINDEX_H__
+#define __SEARCHINDEX_H__
+
+#include <glib.h>
+
+#include "folder.h"
+#include "filter.h"
+
+/* Returns the set of message numbers in mlist which may match the rule,
+   updating the index of the folder first. Messages which are not in the
+   set never match. Returns NULL if the index cannot answer the rule and
+   every message has to be checked. */
+GHashTable *search_index_get_candidates	(FolderItem	*item,
+					 GSList		*mlist,
+					 FilterRule	*rule);
+
+#endif /* __SEARCHINDEX_H__ */
@@ -586,16 +586,31 @@ static gboolean session_recv_msg_idle_cb(gpointer data)
 }
 
 gint session_send_data(Session *session, FILE *data_fp, guint size)
+{
+	return session_send_data_full(session, NULL, data_fp, size);
+}
+
+/* Sends the command line msg (if not NULL) immediately followed by size
+   bytes of data_fp, without waiting for a response in between. */
+gint session_send_data_full(Session *session, const gchar *msg,
+			    FILE *data_fp, guint size)
 {
 	gboolean ret;
 
 	g_return_val_if_fail(session->sock != NULL, -1);
+	g_return_val_if_fail(session->write_buf == NULL, -1);
 	g_return_val_if_fail(session->write_data_fp == NULL, -1);
 	g_return_val_if_fail(data_fp != NULL, -1);
 	g_return_val_if_fail(size != 0, -1);
 
 	session->state = SESSION_SEND;
 
+	if (msg) {
+		session->write_buf = g_strconcat(msg, "\r\n", NULL);
+		session->write_buf_p = session->write_buf;
+		session->write_buf_len = strlen(msg) + 2;
+	}
+
 	session->write_data_fp = data_fp;
 	session->write_data_pos = 0;
 	session->write_data_len = size;
@@ -927,6 +942,35 @@ static gboolean session_read_data_cb(SockInfo *source, GIOCondition condition,
 	 session->read_buf_len)
 #define PREREAD_SIZE	8
 
+/* Returns the position of the terminator which begins a line in data,
+   looking at the positions from 'from'. The response to a pipelined
+   command may follow the terminator. */
+static const gchar *session_find_terminator(const gchar *data, gint len,
+					    gint from, const gchar *terminator,
+					    gboolean at_line_start)
+{
+	gint terminator_len;
+	const gchar *p, *last;
+
+	terminator_len = strlen(terminator);
+	if (len < terminator_len)
+		return NULL;
+
+	if (at_line_start && memcmp(data, terminator, terminator_len) == 0)
+		return data;
+
+	last = data + len - terminator_len;
+	for (p = data + MAX(from, 2); p <= last; p++) {
+		if ((p = memchr(p, terminator[0], last - p + 1)) == NULL)
+			break;
+		if (*(p - 2) == '\r' && *(p - 1) == '\n' &&
+		    memcmp(p, terminator, terminator_len) == 0)
+			return p;
+	}
+
+	return NULL;
+}
+
 static gboolean session_read_data_as_file_cb(SockInfo *source,
 					     GIOCondition condition,
 					     gpointer data)
@@ -936,7 +980,8 @@ static gboolean session_read_data_as_file_cb(SockInfo *source,
 	gint terminator_len;
 	gchar *data_begin_p;
 	gint buf_data_len;
-	gboolean complete = FALSE;
+	const gchar *terminator_p;
+	gint rest_len;
 	gint read_len;
 	gint write_len;
 	gint ret;
@@ -986,24 +1031,16 @@ static gboolean session_read_data_as_file_cb(SockInfo *source,
 	data_begin_p = session->read_buf_p - session->preread_len;
 	buf_data_len = session->preread_len + session->read_buf_len;
 
-	/* check if data is terminated */
-	if (buf_data_len >= terminator_len) {
-		if (session->read_data_pos == 0 &&
-		    buf_data_len == terminator_len &&
-		    memcmp(data_begin_p, session->read_data_terminator,
-			   terminator_len) == 0)
-			complete = TRUE;
-		else if (buf_data_len >= terminator_len + 2 &&
-			 memcmp(data_begin_p + buf_data_len -
-				(terminator_len + 2), "\r\n", 2) == 0 &&
-			 memcmp(data_begin_p + buf_data_len -
-				terminator_len, session->read_data_terminator,
-				terminator_len) == 0)
-			complete = TRUE;
-	}
+	/* check if data is terminated (the preread part except its tail
+	   has already been checked) */
+	terminator_p = session_find_terminator
+		(data_begin_p, buf_data_len,
+		 session->preread_len - terminator_len + 1,
+		 session->read_data_terminator,
+		 session->read_data_pos == 0);
 
 	/* incomplete read */
-	if (!complete) {
+	if (!terminator_p) {
 		GTimeVal tv_cur;
 
 		if (buf_data_len <= PREREAD_SIZE) {
@@ -1065,7 +1102,7 @@ static gboolean session_read_data_as_file_cb(SockInfo *source,
 		session->io_tag = 0;
 	}
 
-	write_len = buf_data_len - terminator_len;
+	write_len = terminator_p - data_begin_p;
 	if (write_len > 0 && fwrite(data_begin_p, write_len, 1,
 				    session->read_data_fp) < 1) {
 		g_warning("session_read_data_as_file_cb: "
@@ -1088,8 +1125,13 @@ static gboolean session_read_data_as_file_cb(SockInfo *source,
 	}
 	rewind(session->read_data_fp);
 
+	/* keep the data following the terminator for the next read */
+	rest_len = buf_data_len - write_len - terminator_len;
+	if (rest_len > 0)
+		g_memmove(session->read_buf, terminator_p + terminator_len,
+			  rest_len);
 	session->preread_len = 0;
-	session->read_buf_len = 0;
+	session->read_buf_len = rest_len;
 	session->read_buf_p = session->read_buf;
 
 	/* callback */
@@ -1274,6 +1316,19 @@ static gboolean session_write_data_cb(SockInfo *source,
 
 	write_data_len = session->write_data_len;
 
+	/* command line preceding the data */
+	if (session->write_buf) {
+		ret = session_write_buf(session);
+		if (ret < 0) {
+			session->state = SESSION_ERROR;
+			priv = session_get_priv(session);
+			if (priv->error_val == SESSION_ERROR_OK)
+				priv->error_val = SESSION_ERROR_IO;
+			return FALSE;
+		} else if (ret > 0)
+			return TRUE;
+	}
+
 	ret = session_write_data(session, &write_len);
 
 	if (ret < 0) {
@@ -237,6 +237,10 @@ gint session_recv_msg	(Session	*session);
 gint session_send_data	(Session	*session,
 			 FILE		*data_fp,
 			 guint		 size);
+gint session_send_data_full	(Session	*session,
+				 const gchar	*msg,
+				 FILE		*data_fp,
+				 guint		 size);
 gint session_recv_data	(Session	*session,
 			 guint		 size,
 			 const gchar	*terminator);
@@ -34,6 +34,8 @@
 static void smtp_session_destroy(Session *session);
 
 static gint smtp_from(SMTPSession *session);
+static gint smtp_pipeline(SMTPSession *session);
+static gint smtp_pipeline_recv(SMTPSession *session, const gchar *msg);
 
 static gint smtp_auth(SMTPSession *session);
 static gint smtp_starttls(SMTPSession *session);
@@ -48,7 +50,8 @@ static gint smtp_helo(SMTPSession *session);
 static gint smtp_rcpt(SMTPSession *session);
 static gint smtp_data(SMTPSession *session);
 static gint smtp_send_data(SMTPSession *session);
-/* static gint smtp_rset(SMTPSession *session); */
+static gint smtp_bdat(SMTPSession *session);
+static gint smtp_rset(SMTPSession *session);
 static gint smtp_quit(SMTPSession *session);
 static gint smtp_eom(SMTPSession *session);
 
@@ -90,6 +93,10 @@ Session *smtp_session_new(void)
 	session->send_data_fp              = NULL;
 	session->send_data_len             = 0;
 
+	session->esmtp_flags               = 0;
+	session->pipelining                = FALSE;
+	session->keep_alive                = FALSE;
+
 	session->avail_auth_type           = 0;
 	session->forced_auth_type          = 0;
 	session->auth_type                 = 0;
@@ -100,6 +107,30 @@ Session *smtp_session_new(void)
 	return SESSION(session);
 }
 
+/* Starts the next transaction on a session left in SMTP_IDLE. from,
+   to_list, cur_to and send_data_fp must already be set for the new
+   message. */
+gint smtp_session_send_next(Session *session)
+{
+	SMTPSession *smtp_session = SMTP_SESSION(session);
+
+	g_return_val_if_fail(smtp_session->state == SMTP_IDLE, -1);
+
+	smtp_session->error_val = SM_OK;
+	g_free(smtp_session->error_msg);
+	smtp_session->error_msg = NULL;
+	smtp_session->pipelining = FALSE;
+
+	return smtp_rset(smtp_session) == SM_OK ? 0 : -1;
+}
+
+gint smtp_session_quit(Session *session)
+{
+	g_return_val_if_fail(SMTP_SESSION(session)->state == SMTP_IDLE, -1);
+
+	return smtp_quit(SMTP_SESSION(session)) == SM_OK ? 0 : -1;
+}
+
 static void smtp_session_destroy(Session *session)
 {
 	SMTPSession *smtp_session = SMTP_SESSION(session);
@@ -121,6 +152,9 @@ static gint smtp_from(SMTPSession *session)
 
 	g_return_val_if_fail(session->from != NULL, SM_ERROR);
 
+	if (session->esmtp_flags & ESMTP_PIPELINING)
+		return smtp_pipeline(session);
+
 	session->state = SMTP_FROM;
 
 	if (strchr(session->from, '<'))
@@ -134,6 +168,116 @@ static gint smtp_from(SMTPSession *session)
 	return SM_OK;
 }
 
+/* Sends MAIL, all RCPTs and DATA at once (RFC 2920). The responses are
+   read in order afterwards. With CHUNKING, BDAT is sent only after all
+   the recipients have been accepted, since the message could not be
+   withdrawn any more. */
+static gint smtp_pipeline(SMTPSession *session)
+{
+	GString *buf;
+	GSList *cur;
+	gchar *to;
+
+	g_return_val_if_fail(session->to_list != NULL, SM_ERROR);
+
+	session->pipelining = TRUE;
+	session->cur_to = session->to_list;
+
+	buf = g_string_new(NULL);
+
+	if (strchr(session->from, '<'))
+		g_string_append_printf(buf, "MAIL FROM:%s", session->from);
+	else
+		g_string_append_printf(buf, "MAIL FROM:<%s>", session->from);
+	log_print("SMTP> %s\n", buf->str);
+
+	for (cur = session->to_list; cur != NULL; cur = cur->next) {
+		to = (gchar *)cur->data;
+		g_string_append(buf, "\r\n");
+		if (strchr(to, '<'))
+			g_string_append_printf(buf, "RCPT TO:%s", to);
+		else
+			g_string_append_printf(buf, "RCPT TO:<%s>", to);
+		log_print("SMTP> %s\n", strrchr(buf->str, '\n') + 1);
+	}
+
+	if ((session->esmtp_flags & ESMTP_CHUNKING) == 0) {
+		g_string_append(buf, "\r\nDATA");
+		log_print("SMTP> DATA\n");
+	}
+
+	session->state = SMTP_FROM;
+	session_send_msg(SESSION(session), SESSION_MSG_NORMAL, buf->str);
+
+	g_string_free(buf, TRUE);
+
+	return SM_OK;
+}
+
+/* Reads the responses to the pipelined MAIL, RCPT and DATA commands.
+   All of them are read before deciding, and like in the lock-step
+   dialog the message is sent only if every recipient was accepted. */
+static gint smtp_pipeline_recv(SMTPSession *session, const gchar *msg)
+{
+	gboolean ok;
+
+	if (msg[3] == '-')
+		return session_recv_msg(SESSION(session));
+	if (msg[3] != ' ' && msg[3] != '\0') {
+		log_warning(_("bad SMTP response\n"));
+		session->state = SMTP_ERROR;
+		session->error_val = SM_UNRECOVERABLE;
+		return -1;
+	}
+
+	ok = msg[0] == '2' || (session->state == SMTP_DATA && msg[0] == '3');
+	if (!ok && session->error_val == SM_OK) {
+		/* report the first rejected command */
+		log_warning(_("error occurred on SMTP session\n"));
+		session->error_val = SM_ERROR;
+		g_free(session->error_msg);
+		session->error_msg = g_strdup(msg);
+	}
+
+	switch (session->state) {
+	case SMTP_FROM:
+		session->state = SMTP_RCPT;
+		return session_recv_msg(SESSION(session));
+	case SMTP_RCPT:
+		session->cur_to = session->cur_to->next;
+		if (session->cur_to)
+			return session_recv_msg(SESSION(session));
+		if ((session->esmtp_flags & ESMTP_CHUNKING) == 0) {
+			session->state = SMTP_DATA;
+			return session_recv_msg(SESSION(session));
+		}
+		if (session->error_val != SM_OK) {
+			session->state = SMTP_ERROR;
+			return -1;
+		}
+		smtp_bdat(session);
+		return 0;
+	case SMTP_DATA:
+		/* the server waits for the message after 354 even if some
+		   recipients were rejected. Drop the connection instead of
+		   terminating the message, so that it is not delivered. */
+		if (session->error_val != SM_OK) {
+			session->state = SMTP_ERROR;
+			return -1;
+		}
+		if (smtp_send_data(session) != SM_OK) {
+			session->state = SMTP_ERROR;
+			session->error_val = SM_ERROR;
+			return -1;
+		}
+		return 0;
+	default:
+		break;
+	}
+
+	return 0;
+}
+
 static gint smtp_auth(SMTPSession *session)
 {
 
@@ -253,6 +397,17 @@ static gint smtp_auth_login_user_recv(SMTPSession *session, const gchar *msg)
 	return SM_OK;
 }
 
+/* EHLO is mandatory for SMTP AUTH and STARTTLS */
+static gboolean smtp_need_ehlo(SMTPSession *session)
+{
+#if USE_SSL
+	return session->user != NULL ||
+		SESSION(session)->ssl_type != SSL_NONE;
+#else
+	return session->user != NULL;
+#endif
+}
+
 static gint smtp_ehlo(SMTPSession *session)
 {
 	gchar buf[SMTPBUFSIZE];
@@ -260,6 +415,7 @@ static gint smtp_ehlo(SMTPSession *session)
 	session->state = SMTP_EHLO;
 
 	session->avail_auth_type = 0;
+	session->esmtp_flags = 0;
 
 	g_snprintf(buf, sizeof(buf), "EHLO %s",
 		   session->hostname ? session->hostname : get_domain_name());
@@ -285,7 +441,12 @@ static gint smtp_ehlo_recv(SMTPSession *session, const gchar *msg)
 				session->avail_auth_type |= SMTPAUTH_CRAM_MD5;
 			if (strcasestr(p, "DIGEST-MD5"))
 				session->avail_auth_type |= SMTPAUTH_DIGEST_MD5;
-		}
+		} else if (g_ascii_strncasecmp(p, "PIPELINING", 10) == 0 &&
+			   (p[10] == '\0' || p[10] == ' '))
+			session->esmtp_flags |= ESMTP_PIPELINING;
+		else if (g_ascii_strncasecmp(p, "CHUNKING", 8) == 0 &&
+			 (p[8] == '\0' || p[8] == ' '))
+			session->esmtp_flags |= ESMTP_CHUNKING;
 		return SM_OK;
 	} else if ((msg[0] == '1' || msg[0] == '2' || msg[0] == '3') &&
 	    (msg[3] == ' ' || msg[3] == '\0'))
@@ -415,8 +576,71 @@ static gint smtp_data(SMTPSession *session)
 	return SM_OK;
 }
 
+static FILE *smtp_get_dot_stuffed_file(FILE *fp)
+{
+	gchar buf[SMTPBUFSIZE];
+	FILE *outfp;
+	gboolean line_head = TRUE;
+	size_t len;
+
+	outfp = my_tmpfile();
+	if (!outfp) {
+		FILE_OP_ERROR("smtp_get_dot_stuffed_file", "my_tmpfile");
+		return NULL;
+	}
+
+	rewind(fp);
+
+	while (fgets(buf, sizeof(buf), fp) != NULL) {
+		len = strlen(buf);
+		if (len == 0)
+			continue;
+		if (line_head && buf[0] == '.') {
+			if (fputc('.', outfp) == EOF)
+				goto file_error;
+		}
+		if (fwrite(buf, len, 1, outfp) != 1)
+			goto file_error;
+		line_head = (buf[len - 1] == '\n');
+	}
+
+	if (ferror(fp)) {
+		FILE_OP_ERROR("smtp_get_dot_stuffed_file", "fgets");
+		fclose(outfp);
+		return NULL;
+	}
+	if (fflush(outfp) == EOF) {
+		FILE_OP_ERROR("smtp_get_dot_stuffed_file", "fflush");
+		goto file_error;
+	}
+
+	rewind(outfp);
+	return outfp;
+
+file_error:
+	g_warning("smtp_get_dot_stuffed_file(): writing to temporary file failed.\n");
+	fclose(outfp);
+	return NULL;
+}
+
 static gint smtp_send_data(SMTPSession *session)
 {
+	FILE *fp;
+	gint len;
+
+	/* DATA requires the message to be dot-stuffed */
+	fp = smtp_get_dot_stuffed_file(session->send_data_fp);
+	if (!fp)
+		return SM_ERROR;
+	len = get_left_file_size(fp);
+	if (len <= 0) {
+		fclose(fp);
+		return SM_ERROR;
+	}
+	fclose(session->send_data_fp);
+	session->send_data_fp = fp;
+	session->send_data_len = len;
+
 	session->state = SMTP_SEND_DATA;
 
 	session_send_data(SESSION(session), session->send_data_fp,
@@ -425,7 +649,22 @@ static gint smtp_send_data(SMTPSession *session)
 	return SM_OK;
 }
 
-#if 0
+/* Sends the whole message as a single chunk (RFC 3030) */
+static gint smtp_bdat(SMTPSession *session)
+{
+	gchar buf[SMTPBUFSIZE];
+
+	session->state = SMTP_BDAT;
+
+	g_snprintf(buf, sizeof(buf), "BDAT %d LAST", session->send_data_len);
+	log_print("SMTP> %s\n", buf);
+
+	session_send_data_full(SESSION(session), buf, session->send_data_fp,
+			       session->send_data_len);
+
+	return SM_OK;
+}
+
 static gint smtp_rset(SMTPSession *session)
 {
 	session->state = SMTP_RSET;
@@ -435,7 +674,6 @@ static gint smtp_rset(SMTPSession *session)
 
 	return SM_OK;
 }
-#endif
 
 static gint smtp_quit(SMTPSession *session)
 {
@@ -482,6 +720,19 @@ static gint smtp_session_recv_msg(Session *session, const gchar *msg)
 		break;
 	}
 
+	/* fall back to HELO if the server does not understand EHLO */
+	if (smtp_session->state == SMTP_EHLO && msg[0] == '5' &&
+	    !smtp_need_ehlo(smtp_session)) {
+		smtp_helo(smtp_session);
+		return 0;
+	}
+
+	if (smtp_session->pipelining &&
+	    (smtp_session->state == SMTP_FROM ||
+	     smtp_session->state == SMTP_RCPT ||
+	     smtp_session->state == SMTP_DATA))
+		return smtp_pipeline_recv(smtp_session, msg);
+
 	if (msg[0] == '5' && msg[1] == '0' &&
 	    (msg[2] == '4' || msg[2] == '3' || msg[2] == '1')) {
 		log_warning(_("error occurred on SMTP session\n"));
@@ -526,14 +777,7 @@ static gint smtp_session_recv_msg(Session *session, const gchar *msg)
 	switch (smtp_session->state) {
 	case SMTP_READY:
 	case SMTP_CONNECTED:
-#if USE_SSL
-		if (smtp_session->user || session->ssl_type != SSL_NONE)
-#else
-		if (smtp_session->user)
-#endif
-			smtp_ehlo(smtp_session);
-		else
-			smtp_helo(smtp_session);
+		smtp_ehlo(smtp_session);
 		break;
 	case SMTP_HELO:
 		smtp_from(smtp_session);
@@ -585,14 +829,27 @@ static gint smtp_session_recv_msg(Session *session, const gchar *msg)
 	case SMTP_RCPT:
 		if (smtp_session->cur_to)
 			smtp_rcpt(smtp_session);
+		else if (smtp_session->esmtp_flags & ESMTP_CHUNKING)
+			smtp_bdat(smtp_session);
 		else
 			smtp_data(smtp_session);
 		break;
 	case SMTP_DATA:
-		smtp_send_data(smtp_session);
+		if (smtp_send_data(smtp_session) != SM_OK) {
+			smtp_session->state = SMTP_ERROR;
+			smtp_session->error_val = SM_ERROR;
+			return -1;
+		}
 		break;
 	case SMTP_EOM:
-		smtp_quit(smtp_session);
+	case SMTP_BDAT:
+		if (smtp_session->keep_alive)
+			smtp_session->state = SMTP_IDLE;
+		else
+			smtp_quit(smtp_session);
+		break;
+	case SMTP_RSET:
+		smtp_from(smtp_session);
 		break;
 	case SMTP_QUIT:
 		session_disconnect(session);
@@ -612,6 +869,12 @@ static gint smtp_session_recv_msg(Session *session, const gchar *msg)
 
 static gint smtp_session_send_data_finished(Session *session, guint len)
 {
-	smtp_eom(SMTP_SESSION(session));
+	SMTPSession *smtp_session = SMTP_SESSION(session);
+
+	if (smtp_session->state == SMTP_BDAT)
+		session_recv_msg(session);
+	else
+		smtp_eom(smtp_session);
+
 	return 0;
 }
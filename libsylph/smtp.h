@@ -47,7 +47,9 @@ typedef enum
 {
 	ESMTP_8BITMIME	= 1 << 0,
 	ESMTP_SIZE	= 1 << 1,
-	ESMTP_ETRN	= 1 << 2
+	ESMTP_ETRN	= 1 << 2,
+	ESMTP_PIPELINING	= 1 << 3,
+	ESMTP_CHUNKING	= 1 << 4
 } ESMTPFlag;
 
 typedef enum
@@ -75,7 +77,9 @@ typedef enum
 	SMTP_DATA,
 	SMTP_SEND_DATA,
 	SMTP_EOM,
+	SMTP_BDAT,
 	SMTP_RSET,
+	SMTP_IDLE,
 	SMTP_QUIT,
 	SMTP_ERROR,
 	SMTP_DISCONNECTED,
@@ -100,9 +104,16 @@ struct _SMTPSession
 	GSList *to_list;
 	GSList *cur_to;
 
+	/* CRLF-canonicalized message without dot-stuffing */
 	FILE *send_data_fp;
 	gint send_data_len;
 
+	ESMTPFlag esmtp_flags;
+	gboolean pipelining;
+
+	/* stay connected in SMTP_IDLE after the message was accepted */
+	gboolean keep_alive;
+
 	SMTPAuthType avail_auth_type;
 	SMTPAuthType forced_auth_type;
 	SMTPAuthType auth_type;
@@ -113,4 +124,7 @@ struct _SMTPSession
 
 Session *smtp_session_new	(void);
 
+gint smtp_session_send_next	(Session	*session);
+gint smtp_session_quit		(Session	*session);
+
 #endif /* __SMTP_H__ */
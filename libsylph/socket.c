@@ -50,6 +50,9 @@
 #if HAVE_SYS_SELECT_H
 #  include <sys/select.h>
 #endif
+#if HAVE_LIBZ
+#  include <zlib.h>
+#endif
 
 #include "socket.h"
 #if USE_SSL
@@ -191,6 +194,24 @@ static SockLookupData *sock_get_address_info_async
 static gint sock_get_address_info_async_cancel	(SockLookupData	*lookup_data);
 #endif /* G_OS_UNIX */
 
+#if HAVE_LIBZ
+static gint zsock_read		(SockInfo	*sock,
+				 gchar		*buf,
+				 gint		 len);
+static gint zsock_peek		(SockInfo	*sock,
+				 gchar		*buf,
+				 gint		 len);
+static gint zsock_write_all	(SockInfo	*sock,
+				 const gchar	*buf,
+				 gint		 len);
+static gint zsock_gets		(SockInfo	*sock,
+				 gchar		*buf,
+				 gint		 len);
+static gint zsock_getline	(SockInfo	*sock,
+				 gchar	       **line);
+static void zsock_free		(SockZStream	*zs);
+#endif
+
 
 gint sock_init(void)
 {
@@ -504,6 +525,10 @@ gboolean sock_has_read_data(SockInfo *sock)
 #ifdef G_OS_WIN32
 	gulong val;
 
+#if HAVE_LIBZ
+	if (sock->zstream)
+		return TRUE;
+#endif
 #if USE_SSL
 	if (sock->ssl)
 		return TRUE;
@@ -1787,6 +1812,10 @@ gint sock_read(SockInfo *sock, gchar *buf, gint len)
 {
 	g_return_val_if_fail(sock != NULL, -1);
 
+#if HAVE_LIBZ
+	if (sock->zstream)
+		return zsock_read(sock, buf, len);
+#endif
 #if USE_SSL
 	if (sock->ssl)
 		return ssl_read(sock->ssl, buf, len);
@@ -1845,6 +1874,10 @@ gint sock_write(SockInfo *sock, const gchar *buf, gint len)
 {
 	g_return_val_if_fail(sock != NULL, -1);
 
+#if HAVE_LIBZ
+	if (sock->zstream)
+		return zsock_write_all(sock, buf, len);
+#endif
 #if USE_SSL
 	if (sock->ssl)
 		return ssl_write(sock->ssl, buf, len);
@@ -1900,6 +1933,10 @@ gint sock_write_all(SockInfo *sock, const gchar *buf, gint len)
 {
 	g_return_val_if_fail(sock != NULL, -1);
 
+#if HAVE_LIBZ
+	if (sock->zstream)
+		return zsock_write_all(sock, buf, len);
+#endif
 #if USE_SSL
 	if (sock->ssl)
 		return ssl_write_all(sock->ssl, buf, len);
@@ -2015,6 +2052,10 @@ gint sock_gets(SockInfo *sock, gchar *buf, gint len)
 {
 	g_return_val_if_fail(sock != NULL, -1);
 
+#if HAVE_LIBZ
+	if (sock->zstream)
+		return zsock_gets(sock, buf, len);
+#endif
 #if USE_SSL
 	if (sock->ssl)
 		return ssl_gets(sock->ssl, buf, len);
@@ -2079,6 +2120,10 @@ gint sock_getline(SockInfo *sock, gchar **line)
 	g_return_val_if_fail(sock != NULL, -1);
 	g_return_val_if_fail(line != NULL, -1);
 
+#if HAVE_LIBZ
+	if (sock->zstream)
+		return zsock_getline(sock, line);
+#endif
 #if USE_SSL
 	if (sock->ssl)
 		return ssl_getline(sock->ssl, line);
@@ -2130,6 +2175,10 @@ gint sock_peek(SockInfo *sock, gchar *buf, gint len)
 {
 	g_return_val_if_fail(sock != NULL, -1);
 
+#if HAVE_LIBZ
+	if (sock->zstream)
+		return zsock_peek(sock, buf, len);
+#endif
 #if USE_SSL
 	if (sock->ssl)
 		return ssl_peek(sock->ssl, buf, len);
@@ -2137,6 +2186,222 @@ gint sock_peek(SockInfo *sock, gchar *buf, gint len)
 	return fd_recv(sock->sock, buf, len, MSG_PEEK);
 }
 
+/* Stream compression (raw DEFLATE, as used by RFC 4978 and RFC 8054) */
+
+#if HAVE_LIBZ
+#define SOCK_ZBUFSIZE	16384
+
+struct _SockZStream
+{
+	z_stream in;
+	z_stream out;
+
+	gchar rbuf[SOCK_ZBUFSIZE];	/* compressed input */
+	gchar buf[SOCK_ZBUFSIZE];	/* decompressed input */
+	gint buf_pos;
+	gint buf_len;
+};
+
+static gint sock_raw_read(SockInfo *sock, gchar *buf, gint len)
+{
+#if USE_SSL
+	if (sock->ssl)
+		return ssl_read(sock->ssl, buf, len);
+#endif
+	return fd_read(sock->sock, buf, len);
+}
+
+static gint sock_raw_write_all(SockInfo *sock, const gchar *buf, gint len)
+{
+#if USE_SSL
+	if (sock->ssl)
+		return ssl_write_all(sock->ssl, buf, len);
+#endif
+	return fd_write_all(sock->sock, buf, len);
+}
+
+/* fills the decompressed buffer if it is empty, and returns the number of
+   bytes in it */
+static gint zsock_fill(SockInfo *sock)
+{
+	SockZStream *zs = sock->zstream;
+	gint n, ret;
+
+	if (zs->buf_pos < zs->buf_len)
+		return zs->buf_len - zs->buf_pos;
+
+	zs->buf_pos = zs->buf_len = 0;
+
+	for (;;) {
+		if (zs->in.avail_in == 0) {
+			if ((n = sock_raw_read(sock, zs->rbuf,
+					       sizeof(zs->rbuf))) <= 0)
+				return n;
+			zs->in.next_in = (Bytef *)zs->rbuf;
+			zs->in.avail_in = n;
+		}
+
+		zs->in.next_out = (Bytef *)zs->buf;
+		zs->in.avail_out = sizeof(zs->buf);
+		ret = inflate(&zs->in, Z_SYNC_FLUSH);
+		if (ret == Z_STREAM_END)
+			return 0;
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			g_warning("zsock_fill: inflate() failed: %d\n", ret);
+			return -1;
+		}
+
+		zs->buf_len = sizeof(zs->buf) - zs->in.avail_out;
+		if (zs->buf_len > 0)
+			return zs->buf_len;
+	}
+}
+
+static gint zsock_read(SockInfo *sock, gchar *buf, gint len)
+{
+	SockZStream *zs = sock->zstream;
+	gint n;
+
+	if ((n = zsock_fill(sock)) <= 0)
+		return n;
+
+	n = MIN(n, len);
+	memcpy(buf, zs->buf + zs->buf_pos, n);
+	zs->buf_pos += n;
+
+	return n;
+}
+
+static gint zsock_peek(SockInfo *sock, gchar *buf, gint len)
+{
+	SockZStream *zs = sock->zstream;
+	gint n;
+
+	if ((n = zsock_fill(sock)) <= 0)
+		return n;
+
+	n = MIN(n, len);
+	memcpy(buf, zs->buf + zs->buf_pos, n);
+
+	return n;
+}
+
+static gint zsock_write_all(SockInfo *sock, const gchar *buf, gint len)
+{
+	SockZStream *zs = sock->zstream;
+	gchar out[SOCK_ZBUFSIZE];
+	gint ret;
+
+	zs->out.next_in = (Bytef *)buf;
+	zs->out.avail_in = len;
+
+	/* each write is flushed, since the peer waits for a response */
+	do {
+		zs->out.next_out = (Bytef *)out;
+		zs->out.avail_out = sizeof(out);
+		ret = deflate(&zs->out, Z_SYNC_FLUSH);
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			g_warning("zsock_write_all: deflate() failed: %d\n",
+				  ret);
+			return -1;
+		}
+		if (sock_raw_write_all(sock, out,
+				       sizeof(out) - zs->out.avail_out) < 0)
+			return -1;
+	} while (zs->out.avail_out == 0);
+
+	return len;
+}
+
+static gint zsock_gets(SockInfo *sock, gchar *buf, gint len)
+{
+	gchar *newline, *bp = buf;
+	gint n;
+
+	if (--len < 1)
+		return -1;
+	do {
+		if ((n = zsock_peek(sock, bp, len)) <= 0)
+			return -1;
+		if ((newline = memchr(bp, '\n', n)) != NULL)
+			n = newline - bp + 1;
+		if ((n = zsock_read(sock, bp, n)) < 0)
+			return -1;
+		bp += n;
+		len -= n;
+	} while (!newline && len);
+
+	*bp = '\0';
+	return bp - buf;
+}
+
+static gint zsock_getline(SockInfo *sock, gchar **line)
+{
+	gchar buf[BUFFSIZE];
+	gchar *str = NULL;
+	gint len;
+	gulong size = 0;
+	gulong cur_offset = 0;
+
+	while ((len = zsock_gets(sock, buf, sizeof(buf))) > 0) {
+		size += len;
+		str = g_realloc(str, size + 1);
+		memcpy(str + cur_offset, buf, len + 1);
+		cur_offset += len;
+		if (buf[len - 1] == '\n')
+			break;
+	}
+
+	*line = str;
+
+	if (!str)
+		return -1;
+	else
+		return (gint)size;
+}
+
+static void zsock_free(SockZStream *zs)
+{
+	inflateEnd(&zs->in);
+	deflateEnd(&zs->out);
+	g_free(zs);
+}
+#endif /* HAVE_LIBZ */
+
+/* compresses all the data sent and received after this call.
+   Returns -1 if compression is not available. */
+gint sock_set_compression(SockInfo *sock)
+{
+#if HAVE_LIBZ
+	SockZStream *zs;
+
+	g_return_val_if_fail(sock != NULL, -1);
+
+	if (sock->zstream)
+		return 0;
+
+	zs = g_new0(SockZStream, 1);
+	if (inflateInit2(&zs->in, -MAX_WBITS) != Z_OK) {
+		g_free(zs);
+		return -1;
+	}
+	if (deflateInit2(&zs->out, Z_DEFAULT_COMPRESSION, Z_DEFLATED,
+			 -MAX_WBITS, 8, Z_DEFAULT_STRATEGY) != Z_OK) {
+		inflateEnd(&zs->in);
+		g_free(zs);
+		return -1;
+	}
+
+	sock->zstream = zs;
+	debug_print("sock_set_compression: %s:%u\n",
+		    sock->hostname ? sock->hostname : "(none)", sock->port);
+
+	return 0;
+#else
+	return -1;
+#endif
+}
+
 gint sock_close(SockInfo *sock)
 {
 	GList *cur;
@@ -2146,6 +2411,10 @@ gint sock_close(SockInfo *sock)
 
 	debug_print("sock_close: %s:%u (%p)\n", sock->hostname ? sock->hostname : "(none)", sock->port, sock);
 
+#if HAVE_LIBZ
+	if (sock->zstream)
+		zsock_free(sock->zstream);
+#endif
 #if USE_SSL
 	if (sock->ssl)
 		ssl_done_socket(sock);
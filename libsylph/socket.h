@@ -33,6 +33,7 @@
 #endif
 
 typedef struct _SockInfo	SockInfo;
+typedef struct _SockZStream	SockZStream;
 
 #if USE_SSL
 #  include "ssl.h"
@@ -82,6 +83,8 @@ struct _SockInfo
 
 	SockFunc callback;
 	GIOCondition condition;
+
+	SockZStream *zstream;
 };
 
 gint sock_init				(void);
@@ -136,6 +139,8 @@ gint sock_puts		(SockInfo *sock, const gchar *buf);
 gint sock_peek		(SockInfo *sock, gchar *buf, gint len);
 gint sock_close		(SockInfo *sock);
 
+gint sock_set_compression	(SockInfo *sock);
+
 /* Functions to directly work on FD.  They are needed for pipes */
 gint fd_connect_inet	(gushort port);
 gint fd_open_inet	(gushort port);
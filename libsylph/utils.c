@@ -40,6 +40,9 @@
 #endif
 #include <dirent.h>
 #include <time.h>
+#ifdef __SSE2__
+#  include <emmintrin.h>
+#endif
 
 #ifdef G_OS_WIN32
 #ifndef WINVER
@@ -1353,19 +1356,109 @@ gboolean is_header_line(const gchar *str)
 	return FALSE;
 }
 
-gboolean is_ascii_str(const gchar *str)
+/* The ASCII scanners below check a block at a time, and look at the
+   bytes of a block one by one only if it may contain a byte which stops
+   the scan. The blocks end before the terminating NUL, and the rest is
+   checked byte by byte, so nothing past the string is read. */
+
+#ifdef __SSE2__
+#define ASCII_BLOCK_SIZE	16
+
+static gboolean ascii_block_is_7bit(const guchar *p)
+{
+	__m128i v;
+
+	v = _mm_loadu_si128((const __m128i *)p);
+	return _mm_movemask_epi8(v) == 0;
+}
+
+static gboolean ascii_block_is_printable(const guchar *p)
+{
+	__m128i v, bad;
+
+	/* the bytes >= 0x80 are negative, and so less than 0x20 */
+	v = _mm_loadu_si128((const __m128i *)p);
+	bad = _mm_or_si128(_mm_cmplt_epi8(v, _mm_set1_epi8(0x20)),
+			   _mm_cmpeq_epi8(v, _mm_set1_epi8(0x7f)));
+	return _mm_movemask_epi8(bad) == 0;
+}
+#else /* !__SSE2__ */
+#define ASCII_BLOCK_SIZE	sizeof(gulong)
+
+#define WORD_ONES	(~0UL / 0xff)
+#define WORD_HIGHS	(WORD_ONES * 0x80)
+/* non-zero if a byte of w is less than n (n <= 0x80) or >= 0x80 */
+#define WORD_HAS_LESS(w, n)	((((w) - WORD_ONES * (n)) | (w)) & WORD_HIGHS)
+
+static gboolean ascii_block_is_7bit(const guchar *p)
+{
+	gulong w;
+
+	memcpy(&w, p, sizeof(w));
+	return (w & WORD_HIGHS) == 0;
+}
+
+static gboolean ascii_block_is_printable(const guchar *p)
+{
+	gulong w;
+
+	memcpy(&w, p, sizeof(w));
+
+	return WORD_HAS_LESS(w, 0x20) == 0 &&
+		WORD_HAS_LESS(w ^ (WORD_ONES * 0x7f), 1) == 0;
+}
+#endif /* !__SSE2__ */
+
+#define IS_ASCII_CHAR(c, printable)					\
+	((printable) ?							\
+	 (((c) >= 32 && (c) < 127) ||					\
+	  (c) == '\t' || (c) == '\r' || (c) == '\n') :			\
+	 ((c) != '\0' && (c) < 128))
+
+/* returns the first byte which is not an ASCII character (a printable
+   one, TAB, CR or LF if printable is TRUE), or the terminating NUL */
+static const gchar *ascii_str_skip(const gchar *str, gboolean printable)
 {
 	const guchar *p = (const guchar *)str;
+	const guchar *end = p + strlen(str);
+	const guchar *block_end;
+
+	while (p < end) {
+		if (printable) {
+			while (end - p >= ASCII_BLOCK_SIZE &&
+			       ascii_block_is_printable(p))
+				p += ASCII_BLOCK_SIZE;
+		} else {
+			while (end - p >= ASCII_BLOCK_SIZE &&
+			       ascii_block_is_7bit(p))
+				p += ASCII_BLOCK_SIZE;
+		}
 
-	while (*p != '\0') {
-		if (*p != '\t' && *p != ' ' &&
-		    *p != '\r' && *p != '\n' &&
-		    (*p < 32 || *p >= 127))
-			return FALSE;
-		p++;
+		/* TAB, CR and LF need a closer look, and so does the tail */
+		block_end = MIN(p + ASCII_BLOCK_SIZE, end);
+		for (; p < block_end; p++) {
+			if (!IS_ASCII_CHAR(*p, printable))
+				return (const gchar *)p;
+		}
 	}
 
-	return TRUE;
+	return (const gchar *)p;
+}
+
+gboolean is_ascii_str(const gchar *str)
+{
+	return *ascii_str_skip(str, TRUE) == '\0';
+}
+
+gboolean is_utf8_str(const gchar *str)
+{
+	const gchar *p;
+
+	p = ascii_str_skip(str, FALSE);
+	if (*p == '\0')
+		return TRUE;
+
+	return g_utf8_validate(p, -1, NULL);
 }
 
 gint get_quote_level(const gchar *str)
@@ -3558,6 +3651,11 @@ gchar *strchomp_all(const gchar *str)
 }
 
 FILE *get_outgoing_rfc2822_file(FILE *fp)
+{
+	return get_outgoing_rfc2822_file_full(fp, TRUE);
+}
+
+FILE *get_outgoing_rfc2822_file_full(FILE *fp, gboolean dot_stuffing)
 {
 	gchar buf[BUFFSIZE];
 	FILE *outfp;
@@ -3598,7 +3696,7 @@ FILE *get_outgoing_rfc2822_file(FILE *fp)
 	/* output body part */
 	while (fgets(buf, sizeof(buf), fp) != NULL) {
 		strretchomp(buf);
-		if (buf[0] == '.') {
+		if (dot_stuffing && buf[0] == '.') {
 			if (fputc('.', outfp) == EOF)
 				goto file_error;
 		}
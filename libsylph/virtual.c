@@ -40,6 +40,7 @@
 #include "procmsg.h"
 #include "procheader.h"
 #include "filter.h"
+#include "searchindex.h"
 #include "utils.h"
 
 typedef struct _VirtualSearchInfo	VirtualSearchInfo;
@@ -330,7 +331,8 @@ static GSList *virtual_search_folder(VirtualSearchInfo *info, FolderItem *item)
 	GSList *mlist;
 	GSList *cur;
 	FilterInfo fltinfo;
-	gint count = 1, total, ncachehit = 0;
+	GHashTable *candidates;
+	gint count = 1, total, ncachehit = 0, nskipped = 0;
 	GTimeVal tv_prev, tv_cur;
 
 	g_return_val_if_fail(info != NULL, NULL);
@@ -352,6 +354,8 @@ static GSList *virtual_search_folder(VirtualSearchInfo *info, FolderItem *item)
 
 	debug_print("start query search: %s\n", item->path);
 
+	candidates = search_index_get_candidates(item, mlist, info->rule);
+
 	virtual_write_search_cache(info->fp, item, NULL, 0);
 
 	for (cur = mlist; cur != NULL; cur = cur->next) {
@@ -396,6 +400,15 @@ static GSList *virtual_search_folder(VirtualSearchInfo *info, FolderItem *item)
 			}
 		}
 
+		if (candidates &&
+		    !g_hash_table_lookup(candidates,
+					 GUINT_TO_POINTER(msginfo->msgnum))) {
+			virtual_write_search_cache(info->fp, NULL, msginfo,
+						   SCACHE_NOT_MATCHED);
+			++nskipped;
+			continue;
+		}
+
 		fltinfo.flags = msginfo->flags;
 		if (info->requires_full_headers) {
 			gchar *file;
@@ -422,7 +435,11 @@ static GSList *virtual_search_folder(VirtualSearchInfo *info, FolderItem *item)
 		procheader_header_list_destroy(hlist);
 	}
 
-	debug_print("%d cache hits (%d total)\n", ncachehit, total);
+	debug_print("%d cache hits, %d skipped by index (%d total)\n",
+		    ncachehit, nskipped, total);
+
+	if (candidates)
+		g_hash_table_destroy(candidates);
 
 	virtual_write_search_cache(info->fp, NULL, NULL, 0);
 	procmsg_msg_list_free(mlist);
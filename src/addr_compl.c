@@ -41,12 +41,12 @@
 
 /* How it works:
  *
- * The address book is read into memory. We set up an address list
+ * The address book is read into memory. We set up an address table
  * containing all address book entries. Next we make the completion
- * list, which contains all the completable strings, and store a
- * reference to the address entry it belongs to.
- * After calling the g_completion_complete(), we get a reference
- * to a valid email address.  
+ * index, which contains all the completable strings in lower case,
+ * sorted, with a reference to the address entry each belongs to.
+ * A prefix lookup is a binary search in the index, which gives a range
+ * of entries referring to valid email addresses.
  *
  * Completion is very simplified. We never complete on another prefix,
  * i.e. we neglect the next smallest possible prefix for the current
@@ -54,6 +54,9 @@
  * addresses a little more (e.g. break up alfons@proteus.demon.nl into
  * something like alfons, proteus, demon, nl; and then completing on
  * any of those words).
+ * A string with several words matches the addresses which have a
+ * completable string beginning with each of the words. The matches are
+ * ranked by the number of times they were chosen in this session.
  */ 
 	
 /* address_entry - structure which refers to the original address entry in the
@@ -61,8 +64,10 @@
  */
 typedef struct
 {
-	gchar *name;
-	gchar *address;
+	gchar  *name;
+	gchar  *address;
+	guint   seq;	/* order in the address book */
+	GSList *keys;	/* lower case strings of the completion entries */
 } address_entry;
 
 /* completion_entry - structure used to complete addresses, with a reference
@@ -70,27 +75,34 @@ typedef struct
  */
 typedef struct
 {
-	gchar		*string; /* string to complete */
+	const gchar	*string; /* string to complete (points into ref->keys) */
 	address_entry	*ref;	 /* address the string belongs to  */
 } completion_entry;
 
+/* max number of addresses offered for one completion */
+#define COMPLETION_MAX_ADDRESSES	100
+/* max number of addresses whose usage is remembered */
+#define COMPLETION_MAX_USAGE		1024
+
 /*******************************************************************************/
 
 static gint	    ref_count;		/* list ref count */
-static GList 	   *completion_list;	/* list of strings to be checked */
-static GList 	   *address_list;	/* address storage */
-static GCompletion *completion;		/* completion object */
+static GArray	   *completion_index;	/* sorted completion entries */
+static GHashTable  *address_table;	/* address storage */
+static guint	    address_count;	/* number of addresses stored */
+static GHashTable  *usage_table;	/* address -> times chosen (survives
+					 * reloading of the address book) */
 
 /* To allow for continuing completion we have to keep track of the state
  * using the following variables. No need to create a context object. */
 
 static gint	    completion_count;		/* nr of addresses incl. the prefix */
 static gint	    completion_next;		/* next prev address */
-static GSList	   *completion_addresses;	/* unique addresses found in the
+static GPtrArray   *completion_addresses;	/* unique addresses found in the
 						   completion cache. */
 static gchar	   *completion_prefix;		/* last prefix. (this is cached here
-						 * because the prefix passed to g_completion
-						 * is g_strdown()'ed */
+						 * because the prefix looked up in the
+						 * index is g_utf8_strdown()'ed */
 
 /*******************************************************************************/
 
@@ -99,82 +111,93 @@ static void address_completion_entry_changed		(GtkEditable *editable,
 							 gpointer     data);
 
 
-/* completion_func() - used by GTK to find the string data to be used for 
- * completion 
- */
-static gchar *completion_func(gpointer data)
+static guint address_entry_hash(gconstpointer key)
 {
-	g_return_val_if_fail(data != NULL, NULL);
+	const address_entry *ae = key;
 
-	return ((completion_entry *)data)->string;
-} 
+	return g_str_hash(ae->name) * 31 + g_str_hash(ae->address);
+}
 
-static void init_all(void)
+static gboolean address_entry_equal(gconstpointer a, gconstpointer b)
 {
-	completion = g_completion_new(completion_func);
-	g_return_if_fail(completion != NULL);
+	const address_entry *ae1 = a;
+	const address_entry *ae2 = b;
+
+	return strcmp(ae1->name, ae2->name) == 0 &&
+		strcmp(ae1->address, ae2->address) == 0;
 }
 
-static void free_all(void)
+static void address_entry_free(gpointer data)
 {
-	GList *walk;
-
-	walk = g_list_first(completion_list);
-	for (; walk != NULL; walk = g_list_next(walk)) {
-		completion_entry *ce = (completion_entry *) walk->data;
-		g_free(ce->string);
-		g_free(ce);
-	}
-	g_list_free(completion_list);
-	completion_list = NULL;
-
-	walk = address_list;
-	for (; walk != NULL; walk = g_list_next(walk)) {
-		address_entry *ae = (address_entry *) walk->data;
-		g_free(ae->name);
-		g_free(ae->address);
-		g_free(ae);
-	}
-	g_list_free(address_list);
-	address_list = NULL;
+	address_entry *ae = (address_entry *)data;
 
-	g_completion_free(completion);
-	completion = NULL;
+	slist_free_strings(ae->keys);
+	g_slist_free(ae->keys);
+	g_free(ae->name);
+	g_free(ae->address);
+	g_free(ae);
 }
 
-static gint address_entry_find_func(gconstpointer a, gconstpointer b)
+static gint completion_entry_compare(gconstpointer a, gconstpointer b)
 {
-	const address_entry *ae1 = a;
-	const address_entry *ae2 = b;
+	const completion_entry *ce1 = a;
+	const completion_entry *ce2 = b;
 	gint val;
 
-	if (!a || !b)
-		return -1;
-
-	val = strcmp(ae1->name, ae2->name);
-	if (val != 0)
-		return val;
-	val = strcmp(ae1->address, ae2->address);
+	val = strcmp(ce1->string, ce2->string);
 	if (val != 0)
 		return val;
 
-	return 0;
+	return ce1->ref->seq - ce2->ref->seq;
+}
+
+static void init_all(void)
+{
+	completion_index = g_array_new(FALSE, FALSE, sizeof(completion_entry));
+	address_table = g_hash_table_new_full(address_entry_hash,
+					      address_entry_equal,
+					      address_entry_free, NULL);
+	address_count = 0;
+	if (!usage_table)
+		usage_table = g_hash_table_new_full(g_str_hash, g_str_equal,
+						    g_free, NULL);
+}
+
+static void free_all(void)
+{
+	g_array_free(completion_index, TRUE);
+	completion_index = NULL;
+
+	g_hash_table_destroy(address_table);
+	address_table = NULL;
 }
 
 static void add_completion_entry(const gchar *str, address_entry *ae)
 {
-	completion_entry *ce;
+	completion_entry ce;
 
 	if (!str || *str == '\0')
 		return;
 	if (!ae)
 		return;
 
-	ce = g_new0(completion_entry, 1);
-	/* GCompletion list is case sensitive */
-	ce->string = g_utf8_strdown(str, -1);
-	ce->ref = ae;
-	completion_list = g_list_append(completion_list, ce);
+	ce.string = str;
+	ce.ref = ae;
+	g_array_append_val(completion_index, ce);
+}
+
+static const gchar *add_completion_key(const gchar *str, address_entry *ae)
+{
+	gchar *key;
+
+	if (!str || *str == '\0')
+		return NULL;
+
+	/* the index is case insensitive */
+	key = g_utf8_strdown(str, -1);
+	ae->keys = g_slist_prepend(ae->keys, key);
+
+	return key;
 }
 
 /* add_address() - adds address to the completion list. this function looks
@@ -183,28 +206,29 @@ static void add_completion_entry(const gchar *str, address_entry *ae)
 static gint add_address(const gchar *name, const gchar *firstname, const gchar *lastname, const gchar *nickname, const gchar *address)
 {
 	address_entry *ae;
-	GList         *found;
+	address_entry  key;
+	const gchar   *p;
 
 	if (!address || *address == '\0')
 		return -1;
 
 	/* debugg_print("add_address: [%s] [%s] [%s] [%s] [%s]\n", name, firstname, lastname, nickname, address); */
 
-	ae = g_new0(address_entry, 1);
-	ae->name    = g_strdup(name ? name : "");
-	ae->address = g_strdup(address);		
-	if ((found = g_list_find_custom(address_list, ae,
-					address_entry_find_func))) {
-		g_free(ae->name);
-		g_free(ae->address);
-		g_free(ae);
-		ae = (address_entry *)found->data;
-	} else
-		address_list = g_list_append(address_list, ae);
+	key.name    = (gchar *)(name ? name : "");
+	key.address = (gchar *)address;
+	ae = g_hash_table_lookup(address_table, &key);
+	if (!ae) {
+		ae = g_new0(address_entry, 1);
+		ae->name    = g_strdup(key.name);
+		ae->address = g_strdup(address);
+		ae->seq     = address_count++;
+		g_hash_table_insert(address_table, ae, ae);
+	}
  
-	if (name) {
-		const gchar *p = name;
-
+	/* every word of the name completes, and points into the lower
+	   case copy of the whole name */
+	p = add_completion_key(name, ae);
+	if (p) {
 		while (*p != '\0') {
 			add_completion_entry(p, ae);
 			while (*p && *p != '-' && *p != '.' && !g_ascii_isspace(*p))
@@ -213,10 +237,10 @@ static gint add_address(const gchar *name, const gchar *firstname, const gchar *
 				p++;
 		}
 	}
-	add_completion_entry(firstname, ae);
-	add_completion_entry(lastname, ae);
-	add_completion_entry(nickname, ae);
-	add_completion_entry(address, ae);
+	add_completion_entry(add_completion_key(firstname, ae), ae);
+	add_completion_entry(add_completion_key(lastname, ae), ae);
+	add_completion_entry(add_completion_key(nickname, ae), ae);
+	add_completion_entry(add_completion_key(address, ae), ae);
 
 	return 0;
 }
@@ -225,6 +249,9 @@ static gint add_address(const gchar *name, const gchar *firstname, const gchar *
  */ 
 static void read_address_book(void) {	
 	addressbook_load_completion_full( add_address );
+	g_array_sort(completion_index, completion_entry_compare);
+	debug_print("read_address_book: %u addresses, %u completion entries\n",
+		    address_count, completion_index->len);
 }
 
 /* start_address_completion() - returns the number of addresses 
@@ -237,14 +264,11 @@ gint start_address_completion(void)
 		init_all();
 		/* open the address book */
 		read_address_book();
-		/* merge the completion entry list into g_completion */
-		if (completion_list)
-			g_completion_add_items(completion, completion_list);
 	}
 	ref_count++;
 	debug_print("start_address_completion ref count %d\n", ref_count);
 
-	return g_list_length(completion_list);
+	return completion_index->len;
 }
 
 /* get_address_from_edit() - returns a possible address (or a part)
@@ -328,35 +352,121 @@ void replace_address_in_edit(GtkEntry *entry, const gchar *newtext,
 		(entry, address_completion_entry_changed, NULL);
 }
 
-#if 0
-static gint insert_address_func(gconstpointer a, gconstpointer b)
+/* completion_index_lookup() - returns the range [*first, *last) of the
+ * index entries beginning with prefix */
+static void completion_index_lookup(const gchar *prefix,
+				    guint *first, guint *last)
 {
-	const address_entry *ae1 = a;
-	const address_entry *ae2 = b;
-	gchar *s1, *s2;
-	gint val;
+	size_t len = strlen(prefix);
+	guint lo, hi, mid;
+	const completion_entry *ce;
+
+	lo = 0;
+	hi = completion_index->len;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		ce = &g_array_index(completion_index, completion_entry, mid);
+		if (strcmp(ce->string, prefix) < 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*first = lo;
+
+	hi = completion_index->len;
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		ce = &g_array_index(completion_index, completion_entry, mid);
+		if (strncmp(ce->string, prefix, len) == 0)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	*last = lo;
+}
 
-	if (!a || !b)
-		return -1;
+/* completion_collect() - adds the addresses which have a string beginning
+ * with prefix to found. if filter is not NULL, only the addresses in
+ * filter are added. */
+static void completion_collect(const gchar *prefix, GHashTable *found,
+			       GHashTable *filter)
+{
+	guint i, first, last;
+	address_entry *ae;
 
-	s1 = g_utf8_casefold(ae1->address, -1);
-	s2 = g_utf8_casefold(ae2->address, -1);
-	val = g_utf8_collate(s1, s2);
-	g_free(s2);
-	g_free(s1);
-	if (val != 0)
-		return val;
-	s1 = g_utf8_casefold(ae1->name, -1);
-	s2 = g_utf8_casefold(ae2->name, -1);
-	val = g_utf8_collate(s1, s2);
-	g_free(s2);
-	g_free(s1);
-	if (val != 0)
-		return val;
+	completion_index_lookup(prefix, &first, &last);
 
-	return 0;
+	for (i = first; i < last; i++) {
+		ae = g_array_index(completion_index, completion_entry, i).ref;
+		if (!filter || g_hash_table_lookup(filter, ae))
+			g_hash_table_insert(found, ae, ae);
+	}
+}
+
+static void completion_add_found_func(gpointer key, gpointer value,
+				      gpointer data)
+{
+	g_ptr_array_add((GPtrArray *)data, value);
+}
+
+static guint get_address_usage(const address_entry *ae)
+{
+	return GPOINTER_TO_UINT(g_hash_table_lookup(usage_table, ae->address));
+}
+
+static gint completion_rank_compare(gconstpointer a, gconstpointer b)
+{
+	const address_entry *ae1 = *(const address_entry **)a;
+	const address_entry *ae2 = *(const address_entry **)b;
+	guint use1, use2;
+
+	use1 = get_address_usage(ae1);
+	use2 = get_address_usage(ae2);
+	if (use1 != use2)
+		return use1 > use2 ? -1 : 1;
+
+	return ae1->seq - ae2->seq;
+}
+
+static gboolean usage_age_func(gpointer key, gpointer value, gpointer data)
+{
+	guint count = GPOINTER_TO_UINT(value) / 2;
+
+	if (count > 0)
+		g_hash_table_insert((GHashTable *)data, key,
+				    GUINT_TO_POINTER(count));
+	else
+		g_free(key);
+
+	return TRUE;
+}
+
+/* address_entry_used() - records that an address was chosen. when the
+ * usage table is full, the counts are halved and the addresses which
+ * were chosen only once are forgotten. */
+static void address_entry_used(const address_entry *ae)
+{
+	gpointer orig_key, value;
+	guint count = 0;
+
+	if (g_hash_table_lookup_extended(usage_table, ae->address,
+					 &orig_key, &value)) {
+		count = GPOINTER_TO_UINT(value);
+		g_hash_table_steal(usage_table, orig_key);
+		g_free(orig_key);
+	} else if (g_hash_table_size(usage_table) >= COMPLETION_MAX_USAGE) {
+		GHashTable *aged;
+
+		aged = g_hash_table_new_full(g_str_hash, g_str_equal,
+					     g_free, NULL);
+		g_hash_table_foreach_steal(usage_table, usage_age_func, aged);
+		g_hash_table_destroy(usage_table);
+		usage_table = aged;
+	}
+
+	g_hash_table_insert(usage_table, g_strdup(ae->address),
+			    GUINT_TO_POINTER(count + 1));
 }
-#endif
 
 /* complete_address() - tries to complete an addres, and returns the
  * number of addresses found. use get_complete_address() to get one.
@@ -365,46 +475,51 @@ static gint insert_address_func(gconstpointer a, gconstpointer b)
  */
 guint complete_address(const gchar *str)
 {
-	GList *result;
+	GHashTable *found, *prev;
 	gchar *d;
-	guint  count, cpl;
-	completion_entry *ce;
+	gchar **words;
+	guint  count, i;
 
 	g_return_val_if_fail(str != NULL, 0);
 
 	clear_completion_cache();
 	completion_prefix = g_strdup(str);
 
-	/* g_completion is case sensitive */
+	/* the index is case insensitive */
 	d = g_utf8_strdown(str, -1);
-	result = g_completion_complete(completion, d, NULL);
 
-	count = g_list_length(result);
+	found = g_hash_table_new(NULL, NULL);
+	words = g_strsplit_set(d, " \t", -1);
+	for (i = 0, prev = NULL; words[i] != NULL; i++) {
+		if (words[i][0] == '\0')
+			continue;
+		if (prev) {
+			found = g_hash_table_new(NULL, NULL);
+			completion_collect(words[i], found, prev);
+			g_hash_table_destroy(prev);
+		} else
+			completion_collect(words[i], found, NULL);
+		prev = found;
+	}
+	g_strfreev(words);
+
+	count = g_hash_table_size(found);
 	if (count) {
 		/* create list with unique addresses  */
-		for (cpl = 0, result = g_list_first(result);
-		     result != NULL;
-		     result = g_list_next(result)) {
-			ce = (completion_entry *)(result->data);
-			if (NULL == g_slist_find(completion_addresses,
-						 ce->ref)) {
-				cpl++;
-				completion_addresses =
-					g_slist_append(completion_addresses,
-						       ce->ref);
-#if 0
-					g_slist_insert_sorted
-						(completion_addresses, ce->ref,
-						 insert_address_func);
-#endif
-			}
-		}
-		count = cpl + 1;	/* index 0 is the original prefix */
+		completion_addresses = g_ptr_array_sized_new(count);
+		g_hash_table_foreach(found, completion_add_found_func,
+				     completion_addresses);
+		g_ptr_array_sort(completion_addresses, completion_rank_compare);
+		if (completion_addresses->len > COMPLETION_MAX_ADDRESSES)
+			g_ptr_array_set_size(completion_addresses,
+					     COMPLETION_MAX_ADDRESSES);
+		count = completion_addresses->len + 1;	/* index 0 is the original prefix */
 		completion_next = 1;	/* we start at the first completed one */
 	} else {
 		g_free(completion_prefix);
 		completion_prefix = NULL;
 	}
+	g_hash_table_destroy(found);
 
 	completion_count = count;
 
@@ -426,8 +541,7 @@ gchar *get_complete_address(gint index)
 			address = g_strdup(completion_prefix);
 		else {
 			/* get something from the unique addresses */
-			p = (address_entry *)g_slist_nth_data
-				(completion_addresses, index - 1);
+			p = g_ptr_array_index(completion_addresses, index - 1);
 			if (p != NULL) {
 				if (!p->name || p->name[0] == '\0')
 					address = g_strdup(p->address);
@@ -493,7 +607,7 @@ void clear_completion_cache(void)
 			g_free(completion_prefix);
 
 		if (completion_addresses) {
-			g_slist_free(completion_addresses);
+			g_ptr_array_free(completion_addresses, TRUE);
 			completion_addresses = NULL;
 		}
 
@@ -516,15 +630,13 @@ gint invalidate_address_completion(void)
 	if (ref_count) {
 		/* simply the same as start_address_completion() */
 		debug_print("Invalidation request for address completion\n");
+		clear_completion_cache();
 		free_all();
 		init_all();
 		read_address_book();
-		if (completion_list)
-			g_completion_add_items(completion, completion_list);
-		clear_completion_cache();
 	}
 
-	return g_list_length(completion_list);
+	return completion_index ? completion_index->len : 0;
 }
 
 gint end_address_completion(void)
@@ -665,7 +777,10 @@ static void completion_window_apply_selection_address_only(GtkCList *clist, GtkE
 
 	row = GPOINTER_TO_INT(clist->selection->data);
 
-	ae = (address_entry *)g_slist_nth_data(completion_addresses, row - 1);
+	if (row < 1 || !completion_addresses ||
+	    row > completion_addresses->len)
+		return;
+	ae = g_ptr_array_index(completion_addresses, row - 1);
 	if (ae && ae->address) {
 		address = get_address_from_edit(entry, &cursor_pos);
 		g_free(address);
@@ -673,6 +788,22 @@ static void completion_window_apply_selection_address_only(GtkCList *clist, GtkE
 	}
 }
 
+/* completion_window_record_selection() - remembers that the address
+ * selected in the clist was chosen, for ranking the later completions */
+static void completion_window_record_selection(GtkCList *clist)
+{
+	gint row;
+
+	if (!clist->selection || !completion_addresses)
+		return;
+
+	row = GPOINTER_TO_INT(clist->selection->data);
+	if (row < 1 || row > completion_addresses->len)
+		return;
+
+	address_entry_used(g_ptr_array_index(completion_addresses, row - 1));
+}
+
 /* should be called when creating the main window containing address
  * completion entries */
 void address_completion_start(GtkWidget *mainwindow)
@@ -982,6 +1113,7 @@ static void completion_window_select_row(GtkCList *clist, gint row, gint col,
 	if (!event || event->type != GDK_BUTTON_RELEASE)
 		return;
 
+	completion_window_record_selection(clist);
 	clear_completion_cache();
 	gtk_widget_destroy(*window);
 	*window = NULL;
@@ -1087,6 +1219,7 @@ static gboolean completion_window_key_press(GtkWidget *widget,
 			completion_window_apply_selection_address_only
 				(GTK_CLIST(clist), GTK_ENTRY(entry));
 		}
+		completion_window_record_selection(GTK_CLIST(clist));
 		clear_completion_cache();
 		gtk_widget_destroy(*window);
 		*window = NULL;
@@ -172,6 +172,7 @@ typedef enum
 
 #define B64_LINE_SIZE		57
 #define B64_BUFFSIZE		77
+#define B64_BLOCK_LINES		256
 
 #define MAX_REFERENCES_LEN	999
 
@@ -4681,7 +4682,8 @@ static gint compose_write_attach(Compose *compose, FILE *fp,
 		}
 
 		if (encoding == ENC_BASE64) {
-			gchar inbuf[B64_LINE_SIZE], outbuf[B64_BUFFSIZE];
+			gchar inbuf[B64_LINE_SIZE * B64_BLOCK_LINES];
+			gchar outbuf[B64_BUFFSIZE * B64_BLOCK_LINES + 1];
 			gchar *canon_file = NULL;
 
 			if (content_type == MIME_TEXT ||
@@ -4716,18 +4718,15 @@ static gint compose_write_attach(Compose *compose, FILE *fp,
 				src_fp = attach_fp;
 			}
 
+			/* encode B64_BLOCK_LINES lines at a time */
 			while ((len = fread(inbuf, sizeof(gchar),
-					    B64_LINE_SIZE, src_fp))
-			       == B64_LINE_SIZE) {
-				base64_encode(outbuf, (guchar *)inbuf,
-					      B64_LINE_SIZE);
-				fputs(outbuf, fp);
-				fputc('\n', fp);
-			}
-			if (len > 0 && feof(src_fp)) {
-				base64_encode(outbuf, (guchar *)inbuf, len);
-				fputs(outbuf, fp);
-				fputc('\n', fp);
+					    sizeof(inbuf), src_fp)) > 0) {
+				if (len < sizeof(inbuf) && !feof(src_fp))
+					break;
+				len = base64_encode_lines
+					(outbuf, (guchar *)inbuf, len,
+					 B64_LINE_SIZE);
+				fwrite(outbuf, sizeof(gchar), len, fp);
 			}
 
 			if (tmp_fp) {
@@ -1001,6 +1001,17 @@ static void folderview_rescan_tree(FolderView *folderview, Folder *folder)
 	inc_unlock();
 }
 
+static gboolean folderview_check_new_filter(Folder *folder, FolderItem *item)
+{
+	if (!item || !item->path || !item->folder) return FALSE;
+	if (item->stype == F_VIRTUAL) return FALSE;
+	if (item->no_select) return FALSE;
+	if (folder && folder != item->folder) return FALSE;
+	if (!folder && FOLDER_IS_REMOTE(item->folder)) return FALSE;
+
+	return TRUE;
+}
+
 gint folderview_check_new(Folder *folder)
 {
 	FolderItem *item;
@@ -1008,7 +1019,9 @@ gint folderview_check_new(Folder *folder)
 	GtkTreeModel *model;
 	GtkTreeIter iter;
 	gboolean valid;
-	gint prev_new, prev_unread, n_updated = 0;
+	GSList *item_list = NULL, *cur;
+	gint *prev_new, *prev_unread;
+	gint i, n_items, n_updated = 0;
 
 	folderview = (FolderView *)folderview_list->data;
 	model = GTK_TREE_MODEL(folderview->store);
@@ -1028,29 +1041,61 @@ gint folderview_check_new(Folder *folder)
 		item = NULL;
 		gtk_tree_model_get(model, &iter,
 				   COL_FOLDER_ITEM, &item, -1);
-		if (!item || !item->path || !item->folder) continue;
-		if (item->stype == F_VIRTUAL) continue;
-		if (item->no_select) continue;
-		if (folder && folder != item->folder) continue;
-		if (!folder && FOLDER_IS_REMOTE(item->folder)) continue;
-
-		prev_new = item->new;
-		prev_unread = item->unread;
-		folderview_scan_tree_func(item->folder, item, NULL);
-		if (folder_item_scan(item) < 0) {
-			if (folder && FOLDER_IS_REMOTE(folder) &&
-			    REMOTE_FOLDER(folder)->session == NULL)
-				break;
+		if (folderview_check_new_filter(folder, item))
+			item_list = g_slist_prepend(item_list, item);
+	}
+	item_list = g_slist_reverse(item_list);
+
+	n_items = g_slist_length(item_list);
+	prev_new = g_new(gint, n_items + 1);
+	prev_unread = g_new(gint, n_items + 1);
+	for (cur = item_list, i = 0; cur != NULL; cur = cur->next, i++) {
+		item = FOLDER_ITEM(cur->data);
+		prev_new[i] = item->new;
+		prev_unread[i] = item->unread;
+	}
+
+	/* IMAP folders are scanned in one batch */
+	if (folder && FOLDER_TYPE(folder) == F_IMAP) {
+		folderview_scan_tree_func
+			(folder, FOLDER_ITEM(folder->node->data), NULL);
+		folder_item_scan_list(item_list);
+	} else {
+		for (cur = item_list; cur != NULL; cur = cur->next) {
+			item = FOLDER_ITEM(cur->data);
+			folderview_scan_tree_func(item->folder, item, NULL);
+			if (folder_item_scan(item) < 0) {
+				if (folder && FOLDER_IS_REMOTE(folder) &&
+				    REMOTE_FOLDER(folder)->session == NULL)
+					break;
+			}
 		}
+	}
+
+	/* update the rows after all counts are refreshed */
+	i = 0;
+	for (valid = gtk_tree_model_get_iter_first(model, &iter);
+	     valid && i < n_items;
+	     valid = gtkut_tree_model_next(model, &iter)) {
+		item = NULL;
+		gtk_tree_model_get(model, &iter,
+				   COL_FOLDER_ITEM, &item, -1);
+		if (!folderview_check_new_filter(folder, item)) continue;
+
 		folderview_update_row(folderview, &iter);
 		if (item->stype != F_TRASH && item->stype != F_JUNK) {
-			if (prev_unread < item->unread)
-				n_updated += item->unread - prev_unread;
-			else if (prev_new < item->new)
-				n_updated += item->new - prev_new;
+			if (prev_unread[i] < item->unread)
+				n_updated += item->unread - prev_unread[i];
+			else if (prev_new[i] < item->new)
+				n_updated += item->new - prev_new[i];
 		}
+		i++;
 	}
 
+	g_free(prev_unread);
+	g_free(prev_new);
+	g_slist_free(item_list);
+
 	gtk_widget_set_sensitive(folderview->treeview, TRUE);
 	main_window_unlock(folderview->mainwin);
 	inc_unlock();
@@ -118,7 +118,8 @@ static void inc_progress_dialog_destroy	(IncProgressDialog	*inc_dialog);
 static IncSession *inc_session_new	(PrefsAccount		*account);
 static void inc_session_destroy		(IncSession		*session);
 static gint inc_start			(IncProgressDialog	*inc_dialog);
-static IncState inc_pop3_session_do	(IncSession		*session);
+static IncState inc_pop3_session_connect(IncSession		*session);
+static IncState inc_pop3_session_finish	(IncSession		*session);
 
 static void inc_progress_dialog_update	(IncProgressDialog	*inc_dialog,
 					 IncSession		*inc_session);
@@ -126,6 +127,11 @@ static void inc_progress_dialog_update	(IncProgressDialog	*inc_dialog,
 static void inc_progress_dialog_set_label
 					(IncProgressDialog	*inc_dialog,
 					 IncSession		*inc_session);
+static gboolean inc_session_get_progress	(IncSession		*inc_session,
+						 gint			*cur_num,
+						 gint			*total_num,
+						 gint64			*cur_total,
+						 gint64			*total);
 static void inc_progress_dialog_set_progress
 					(IncProgressDialog	*inc_dialog,
 					 IncSession		*inc_session);
@@ -157,6 +163,8 @@ static void inc_put_error		(IncSession	*session,
 					 IncState	 istate,
 					 const gchar	*pop3_msg);
 
+static void inc_cancel			(IncProgressDialog	*dialog,
+					 gboolean	 cancel_all);
 static void inc_cancel_cb		(GtkWidget	*widget,
 					 gpointer	 data);
 static void inc_cancel_all_cb		(GtkWidget	*widget,
@@ -721,10 +729,9 @@ static IncProgressDialog *inc_progress_dialog_create(gboolean autocheck)
 	}
 
 	dialog->dialog = progress;
-	g_get_current_time(&dialog->progress_tv);
-	g_get_current_time(&dialog->folder_tv);
+	dialog->done_num = 0;
+	dialog->done_bytes = 0;
 	dialog->queue_list = NULL;
-	dialog->cur_row = 0;
 
 	inc_dialog_list = g_list_append(inc_dialog_list, dialog);
 
@@ -734,12 +741,14 @@ static IncProgressDialog *inc_progress_dialog_create(gboolean autocheck)
 static void inc_progress_dialog_set_list(IncProgressDialog *inc_dialog)
 {
 	GList *list;
+	gint row = 0;
 
 	for (list = inc_dialog->queue_list; list != NULL; list = list->next) {
 		IncSession *session = list->data;
 		Pop3Session *pop3_session = POP3_SESSION(session->session);
 
 		session->data = inc_dialog;
+		session->row = row++;
 		progress_dialog_append(inc_dialog->dialog, NULL,
 				       pop3_session->ac_prefs->account_name,
 				       _("Standby"), "", NULL);
@@ -748,6 +757,8 @@ static void inc_progress_dialog_set_list(IncProgressDialog *inc_dialog)
 
 static void inc_progress_dialog_clear(IncProgressDialog *inc_dialog)
 {
+	inc_dialog->done_num = 0;
+	inc_dialog->done_bytes = 0;
 	progress_dialog_set_value(inc_dialog->dialog, 0.0);
 	progress_dialog_set_label(inc_dialog->dialog, "");
 	main_window_progress_off(inc_dialog->mainwin);
@@ -811,6 +822,9 @@ static IncSession *inc_session_new(PrefsAccount *account)
 
 	session->retr_count = 0;
 
+	session->row = 0;
+	session->running = FALSE;
+
 	return session;
 }
 
@@ -832,6 +846,104 @@ static void inc_update_folder_foreach(GHashTable *table)
 	folderview_update_item_foreach(table, TRUE);
 }
 
+static gint inc_count_running_sessions(IncProgressDialog *inc_dialog,
+				       const gchar *server)
+{
+	GList *cur;
+	gint count = 0;
+
+	for (cur = inc_dialog->queue_list; cur != NULL; cur = cur->next) {
+		IncSession *session = cur->data;
+
+		if (!session->running)
+			continue;
+		if (server && g_ascii_strcasecmp(session->session->server,
+						 server) != 0)
+			continue;
+		count++;
+	}
+
+	return count;
+}
+
+static gboolean inc_is_session_finished(IncSession *session)
+{
+	return session->inc_state == INC_CANCEL ||
+		!session_is_connected(session->session);
+}
+
+#define SET_PIXMAP_AND_TEXT(row, pixbuf, status, progress)		\
+{									\
+	progress_dialog_set_row_pixbuf(inc_dialog->dialog, row, pixbuf);\
+	progress_dialog_set_row_status(inc_dialog->dialog, row, status);\
+	if (progress)							\
+		progress_dialog_set_row_progress(inc_dialog->dialog,	\
+						 row, progress);	\
+}
+
+/* Starts the queued sessions while the number of the running sessions is
+   within the limits. */
+static void inc_start_sessions(IncProgressDialog *inc_dialog)
+{
+	IncSession *session;
+	Pop3Session *pop3_session;
+	GList *qlist;
+	gint max_sessions;
+
+	max_sessions = CLAMP(prefs_common.inc_max_sessions, 1,
+			     INC_MAX_SESSIONS);
+
+	qlist = inc_dialog->queue_list;
+	while (qlist != NULL) {
+		GList *next = qlist->next;
+
+		session = qlist->data;
+		pop3_session = POP3_SESSION(session->session);
+
+		if (session->running) {
+			qlist = next;
+			continue;
+		}
+
+		if (session->inc_state == INC_CANCEL ||
+		    pop3_session->pass == NULL) {
+			SET_PIXMAP_AND_TEXT(session->row, ok_pixbuf,
+					    _("Cancelled"), NULL);
+			inc_session_destroy(session);
+			inc_dialog->queue_list =
+				g_list_remove(inc_dialog->queue_list, session);
+			qlist = next;
+			continue;
+		}
+
+		if (inc_count_running_sessions(inc_dialog, NULL) >=
+		    max_sessions)
+			break;
+		if (inc_count_running_sessions
+			(inc_dialog, session->session->server) >=
+		    INC_MAX_SESSIONS_PER_SERVER) {
+			qlist = next;
+			continue;
+		}
+
+		if (inc_count_running_sessions(inc_dialog, NULL) == 0)
+			inc_progress_dialog_clear(inc_dialog);
+		progress_dialog_scroll_to_row(inc_dialog->dialog,
+					      session->row);
+
+		SET_PIXMAP_AND_TEXT(session->row, current_pixbuf,
+				    _("Retrieving"), NULL);
+
+		/* begin POP3 session */
+		session->running = TRUE;
+		g_get_current_time(&session->progress_tv);
+		g_get_current_time(&session->folder_tv);
+		inc_pop3_session_connect(session);
+
+		qlist = next;
+	}
+}
+
 static gint inc_start(IncProgressDialog *inc_dialog)
 {
 	IncSession *session;
@@ -840,6 +952,8 @@ static gint inc_start(IncProgressDialog *inc_dialog)
 	IncState inc_state;
 	gint error_num = 0;
 	gint new_msgs = 0;
+	gint cur_num;
+	gint64 cur_total;
 	gchar *msg;
 	gchar *fin_msg;
 
@@ -881,120 +995,141 @@ static gint inc_start(IncProgressDialog *inc_dialog)
 		qlist = next;
 	}
 
-#define SET_PIXMAP_AND_TEXT(pixbuf, status, progress)			\
-{									\
-	progress_dialog_set_row_pixbuf(inc_dialog->dialog,		\
-				       inc_dialog->cur_row, pixbuf);	\
-	progress_dialog_set_row_status(inc_dialog->dialog,		\
-				       inc_dialog->cur_row, status);	\
-	if (progress)							\
-		progress_dialog_set_row_progress(inc_dialog->dialog,	\
-						 inc_dialog->cur_row,	\
-						 progress);		\
-}
+	/* The sessions run in the main loop. Received messages are dropped
+	   from the callbacks of the main loop, so the writes to the folders
+	   and the filtering are serialized. */
+	while (inc_dialog->queue_list != NULL) {
+		gboolean waiting = FALSE;
 
-	for (; inc_dialog->queue_list != NULL; inc_dialog->cur_row++) {
-		session = inc_dialog->queue_list->data;
-		pop3_session = POP3_SESSION(session->session);
+		inc_start_sessions(inc_dialog);
 
-		if (session->inc_state == INC_CANCEL ||
-		    pop3_session->pass == NULL) {
-			SET_PIXMAP_AND_TEXT(ok_pixbuf, _("Cancelled"), NULL);
-			inc_session_destroy(session);
-			inc_dialog->queue_list =
-				g_list_remove(inc_dialog->queue_list, session);
-			continue;
+		for (qlist = inc_dialog->queue_list; qlist != NULL;
+		     qlist = qlist->next) {
+			session = qlist->data;
+			if (session->running &&
+			    !inc_is_session_finished(session)) {
+				waiting = TRUE;
+				break;
+			}
 		}
+		if (waiting)
+			gtk_main_iteration();
+
+		qlist = inc_dialog->queue_list;
+		while (qlist != NULL) {
+			GList *next = qlist->next;
+
+			session = qlist->data;
+			if (!session->running ||
+			    !inc_is_session_finished(session)) {
+				qlist = next;
+				continue;
+			}
 
-		inc_progress_dialog_clear(inc_dialog);
-		progress_dialog_scroll_to_row(inc_dialog->dialog,
-					      inc_dialog->cur_row);
+			pop3_session = POP3_SESSION(session->session);
+			inc_state = inc_pop3_session_finish(session);
 
-		SET_PIXMAP_AND_TEXT(current_pixbuf, _("Retrieving"), NULL);
+			if (inc_session_get_progress(session, &cur_num, NULL,
+						     &cur_total, NULL)) {
+				inc_dialog->done_num += cur_num;
+				inc_dialog->done_bytes += cur_total;
+			}
 
-		/* begin POP3 session */
-		inc_state = inc_pop3_session_do(session);
-
-		switch (inc_state) {
-		case INC_SUCCESS:
-			if (pop3_session->cur_total_num > 0)
-				msg = g_strdup_printf
-					(_("%d message(s) (%s) received"),
-					 pop3_session->cur_total_num,
-					 to_human_readable(pop3_session->cur_total_recv_bytes));
-			else
-				msg = g_strdup_printf(_("no new messages"));
-			SET_PIXMAP_AND_TEXT(ok_pixbuf, _("Done"), msg);
-			g_free(msg);
-			break;
-		case INC_LOOKUP_ERROR:
-			SET_PIXMAP_AND_TEXT(error_pixbuf,
-					    _("Server not found"), NULL);
-			break;
-		case INC_CONNECT_ERROR:
-			SET_PIXMAP_AND_TEXT(error_pixbuf,
-					    _("Connection failed"), NULL);
-			break;
-		case INC_AUTH_FAILED:
-			SET_PIXMAP_AND_TEXT(error_pixbuf, _("Auth failed"),
-					    NULL);
-			break;
-		case INC_LOCKED:
-			SET_PIXMAP_AND_TEXT(error_pixbuf, _("Locked"), NULL);
-			break;
-		case INC_ERROR:
-		case INC_NO_SPACE:
-		case INC_IO_ERROR:
-		case INC_SOCKET_ERROR:
-		case INC_EOF:
-			SET_PIXMAP_AND_TEXT(error_pixbuf, _("Error"), NULL);
-			break;
-		case INC_TIMEOUT:
-			SET_PIXMAP_AND_TEXT(error_pixbuf, _("Timeout"), NULL);
-			break;
-		case INC_CANCEL:
-			SET_PIXMAP_AND_TEXT(ok_pixbuf, _("Cancelled"), NULL);
-			break;
-		default:
-			break;
-		}
+			switch (inc_state) {
+			case INC_SUCCESS:
+				if (pop3_session->cur_total_num > 0)
+					msg = g_strdup_printf
+						(_("%d message(s) (%s) received"),
+						 pop3_session->cur_total_num,
+						 to_human_readable(pop3_session->cur_total_recv_bytes));
+				else
+					msg = g_strdup_printf(_("no new messages"));
+				SET_PIXMAP_AND_TEXT(session->row, ok_pixbuf,
+						    _("Done"), msg);
+				g_free(msg);
+				break;
+			case INC_LOOKUP_ERROR:
+				SET_PIXMAP_AND_TEXT(session->row, error_pixbuf,
+						    _("Server not found"),
+						    NULL);
+				break;
+			case INC_CONNECT_ERROR:
+				SET_PIXMAP_AND_TEXT(session->row, error_pixbuf,
+						    _("Connection failed"),
+						    NULL);
+				break;
+			case INC_AUTH_FAILED:
+				SET_PIXMAP_AND_TEXT(session->row, error_pixbuf,
+						    _("Auth failed"), NULL);
+				break;
+			case INC_LOCKED:
+				SET_PIXMAP_AND_TEXT(session->row, error_pixbuf,
+						    _("Locked"), NULL);
+				break;
+			case INC_ERROR:
+			case INC_NO_SPACE:
+			case INC_IO_ERROR:
+			case INC_SOCKET_ERROR:
+			case INC_EOF:
+				SET_PIXMAP_AND_TEXT(session->row, error_pixbuf,
+						    _("Error"), NULL);
+				break;
+			case INC_TIMEOUT:
+				SET_PIXMAP_AND_TEXT(session->row, error_pixbuf,
+						    _("Timeout"), NULL);
+				break;
+			case INC_CANCEL:
+				SET_PIXMAP_AND_TEXT(session->row, ok_pixbuf,
+						    _("Cancelled"), NULL);
+				break;
+			default:
+				break;
+			}
 
-		if (inc_dialog->result)
-			inc_dialog->result->count_list = inc_add_message_count(inc_dialog->result->count_list, pop3_session->ac_prefs, session->new_msgs);
-		new_msgs += session->new_msgs;
+			if (inc_dialog->result)
+				inc_dialog->result->count_list = inc_add_message_count(inc_dialog->result->count_list, pop3_session->ac_prefs, session->new_msgs);
+			new_msgs += session->new_msgs;
 
-		if (!prefs_common.scan_all_after_inc) {
-			inc_update_folder_foreach(session->folder_table);
-		}
+			if (!prefs_common.scan_all_after_inc) {
+				inc_update_folder_foreach(session->folder_table);
+			}
 
-		if (pop3_session->error_val == PS_AUTHFAIL &&
-		    pop3_session->ac_prefs->tmp_pass) {
-			g_free(pop3_session->ac_prefs->tmp_pass);
-			pop3_session->ac_prefs->tmp_pass = NULL;
-		}
+			if (pop3_session->error_val == PS_AUTHFAIL &&
+			    pop3_session->ac_prefs->tmp_pass) {
+				g_free(pop3_session->ac_prefs->tmp_pass);
+				pop3_session->ac_prefs->tmp_pass = NULL;
+			}
 
-		pop3_write_uidl_list(pop3_session);
+			pop3_write_uidl_list(pop3_session);
+
+			if (inc_state != INC_SUCCESS &&
+			    inc_state != INC_CANCEL) {
+				error_num++;
+				if (inc_dialog->show_dialog)
+					manage_window_focus_in
+						(inc_dialog->dialog->window,
+						 NULL, NULL);
+				inc_put_error(session, inc_state,
+					      pop3_session->error_msg);
+				if (inc_dialog->show_dialog)
+					manage_window_focus_out
+						(inc_dialog->dialog->window,
+						 NULL, NULL);
+				/* stop the other sessions too */
+				if (inc_state == INC_NO_SPACE ||
+				    inc_state == INC_IO_ERROR)
+					inc_cancel(inc_dialog, TRUE);
+			}
 
-		if (inc_state != INC_SUCCESS && inc_state != INC_CANCEL) {
-			error_num++;
-			if (inc_dialog->show_dialog)
-				manage_window_focus_in
-					(inc_dialog->dialog->window,
-					 NULL, NULL);
-			inc_put_error(session, inc_state,
-				      pop3_session->error_msg);
-			if (inc_dialog->show_dialog)
-				manage_window_focus_out
-					(inc_dialog->dialog->window,
-					 NULL, NULL);
-			if (inc_state == INC_NO_SPACE ||
-			    inc_state == INC_IO_ERROR)
-				break;
-		}
+			session->running = FALSE;
+			inc_session_destroy(session);
+			inc_dialog->queue_list =
+				g_list_remove(inc_dialog->queue_list, session);
 
-		inc_session_destroy(session);
-		inc_dialog->queue_list =
-			g_list_remove(inc_dialog->queue_list, session);
+			/* other sessions may have finished while the error
+			   panel was shown */
+			qlist = inc_dialog->queue_list;
+		}
 	}
 
 #undef SET_PIXMAP_AND_TEXT
@@ -1019,13 +1154,6 @@ static gint inc_start(IncProgressDialog *inc_dialog)
 	}
 #endif
 
-	while (inc_dialog->queue_list != NULL) {
-		session = inc_dialog->queue_list->data;
-		inc_session_destroy(session);
-		inc_dialog->queue_list =
-			g_list_remove(inc_dialog->queue_list, session);
-	}
-
 	if (prefs_common.close_recv_dialog || !inc_dialog->show_dialog)
 		inc_progress_dialog_destroy(inc_dialog);
 	else {
@@ -1040,7 +1168,7 @@ static gint inc_start(IncProgressDialog *inc_dialog)
 	return new_msgs;
 }
 
-static IncState inc_pop3_session_do(IncSession *session)
+static IncState inc_pop3_session_connect(IncSession *session)
 {
 	Pop3Session *pop3_session = POP3_SESSION(session->session);
 	IncProgressDialog *inc_dialog = (IncProgressDialog *)session->data;
@@ -1088,10 +1216,13 @@ static IncState inc_pop3_session_do(IncSession *session)
 		return session->inc_state;
 	}
 
-	while (session_is_connected(SESSION(pop3_session)) &&
-	       session->inc_state != INC_CANCEL) {
-		gtk_main_iteration();
-	}
+	return session->inc_state;
+}
+
+static IncState inc_pop3_session_finish(IncSession *session)
+{
+	Pop3Session *pop3_session = POP3_SESSION(session->session);
+
 	log_window_flush();
 
 	debug_print("inc_state: %d\n", session->inc_state);
@@ -1155,41 +1286,40 @@ static void inc_progress_dialog_update(IncProgressDialog *inc_dialog,
 static void inc_progress_dialog_set_label(IncProgressDialog *inc_dialog,
 					  IncSession *inc_session)
 {
-	ProgressDialog *dialog = inc_dialog->dialog;
 	Pop3Session *session;
+	const gchar *label = NULL;
 
 	g_return_if_fail(inc_session != NULL);
 
 	session = POP3_SESSION(inc_session->session);
 
+	/* shown in the row of the session, since several sessions may run
+	   at once */
 	switch (session->state) {
 	case POP3_GREETING:
 		break;
 	case POP3_GETAUTH_USER:
 	case POP3_GETAUTH_PASS:
 	case POP3_GETAUTH_APOP:
-		progress_dialog_set_label(dialog, _("Authenticating..."));
+		label = _("Authenticating...");
 		statusbar_print_all(_("Retrieving messages from %s..."),
 				    SESSION(session)->server);
 		break;
 	case POP3_GETRANGE_STAT:
-		progress_dialog_set_label
-			(dialog, _("Getting the number of new messages (STAT)..."));
+		label = _("Getting the number of new messages (STAT)...");
 		break;
 	case POP3_GETRANGE_LAST:
-		progress_dialog_set_label
-			(dialog, _("Getting the number of new messages (LAST)..."));
+		label = _("Getting the number of new messages (LAST)...");
 		break;
 	case POP3_GETRANGE_UIDL:
-		progress_dialog_set_label
-			(dialog, _("Getting the number of new messages (UIDL)..."));
+		label = _("Getting the number of new messages (UIDL)...");
 		break;
 	case POP3_GETSIZE_LIST:
-		progress_dialog_set_label
-			(dialog, _("Getting the size of messages (LIST)..."));
+		label = _("Getting the size of messages (LIST)...");
 		break;
 	case POP3_RETR:
 	case POP3_RETR_RECV:
+		label = _("Retrieving");
 		break;
 	case POP3_DELETE:
 #if 0
@@ -1203,38 +1333,82 @@ static void inc_progress_dialog_set_label(IncProgressDialog *inc_dialog,
 #endif
 		break;
 	case POP3_LOGOUT:
-		progress_dialog_set_label(dialog, _("Quitting"));
+		label = _("Quitting");
 		break;
 	default:
 		break;
 	}
+
+	if (label)
+		progress_dialog_set_row_status(inc_dialog->dialog,
+					       inc_session->row, label);
+}
+
+/* gets the number and the size of the messages received and to be
+   received in this run of the session */
+static gboolean inc_session_get_progress(IncSession *inc_session,
+					 gint *cur_num, gint *total_num,
+					 gint64 *cur_total, gint64 *total)
+{
+	Pop3Session *pop3_session = POP3_SESSION(inc_session->session);
+
+	if (!pop3_session->new_msg_exist || inc_session->retr_count == 0)
+		return FALSE;
+
+	if (cur_num)
+		*cur_num = pop3_session->cur_msg - inc_session->start_num + 1;
+	if (total_num)
+		*total_num = pop3_session->count - inc_session->start_num + 1;
+	if (cur_total)
+		*cur_total = inc_session->cur_total_bytes -
+			inc_session->start_recv_bytes;
+	if (total)
+		*total = pop3_session->total_bytes -
+			inc_session->start_recv_bytes;
+
+	return TRUE;
 }
 
+/* The label and the progressbars show the totals of all the sessions of
+   the dialog, and the row of inc_session its own count. */
 static void inc_progress_dialog_set_progress(IncProgressDialog *inc_dialog,
 					     IncSession *inc_session)
 {
 	gchar buf[BUFFSIZE];
 	Pop3Session *pop3_session = POP3_SESSION(inc_session->session);
-	gint64 cur_total;
-	gint64 total;
-	gint cur_num;
-	gint total_num_to_recv;
+	GList *cur;
+	gint64 cur_total, total;
+	gint cur_num, total_num_to_recv;
+	gboolean retrieving = FALSE;
 
 	if (!pop3_session->new_msg_exist) return;
 
-	if (inc_session->retr_count == 0) {
-		cur_num = total_num_to_recv = 0;
-		cur_total = total = 0;
-	} else {
-		cur_num = pop3_session->cur_msg - inc_session->start_num + 1;
-		total_num_to_recv = pop3_session->count - inc_session->start_num + 1;
-		cur_total = inc_session->cur_total_bytes - inc_session->start_recv_bytes;
-		total = pop3_session->total_bytes - inc_session->start_recv_bytes;
+	cur_num = total_num_to_recv = inc_dialog->done_num;
+	cur_total = total = inc_dialog->done_bytes;
+
+	for (cur = inc_dialog->queue_list; cur != NULL; cur = cur->next) {
+		IncSession *session = (IncSession *)cur->data;
+		Pop3Session *pop3 = POP3_SESSION(session->session);
+		gint n, total_n;
+		gint64 size, total_size;
+
+		if (!session->running ||
+		    !inc_session_get_progress(session, &n, &total_n,
+					      &size, &total_size))
+			continue;
+
+		cur_num += n;
+		total_num_to_recv += total_n;
+		cur_total += size;
+		total += total_size;
+
+		if (pop3->state == POP3_RETR ||
+		    pop3->state == POP3_RETR_RECV ||
+		    pop3->state == POP3_DELETE)
+			retrieving = TRUE;
 	}
 
-	if ((pop3_session->state == POP3_RETR ||
-	     pop3_session->state == POP3_RETR_RECV ||
-	     pop3_session->state == POP3_DELETE) && total_num_to_recv > 0) {
+	if (retrieving && total_num_to_recv > 0) {
 		gchar total_size_str[16];
 
 		to_human_readable_buf(total_size_str, sizeof(total_size_str),
@@ -1269,7 +1443,7 @@ static void inc_progress_dialog_set_progress(IncProgressDialog *inc_dialog,
 			   pop3_session->cur_total_num,
 			   to_human_readable(pop3_session->cur_total_recv_bytes));
 		progress_dialog_set_row_progress(inc_dialog->dialog,
-						 inc_dialog->cur_row, buf);
+						 inc_session->row, buf);
 	}
 }
 
@@ -1303,8 +1477,8 @@ static void inc_progress_dialog_update_periodic(IncProgressDialog *inc_dialog,
 
 	g_get_current_time(&tv_cur);
 
-	tv_result.tv_sec = tv_cur.tv_sec - inc_dialog->progress_tv.tv_sec;
-	tv_result.tv_usec = tv_cur.tv_usec - inc_dialog->progress_tv.tv_usec;
+	tv_result.tv_sec = tv_cur.tv_sec - inc_session->progress_tv.tv_sec;
+	tv_result.tv_usec = tv_cur.tv_usec - inc_session->progress_tv.tv_usec;
 	if (tv_result.tv_usec < 0) {
 		tv_result.tv_sec--;
 		tv_result.tv_usec += G_USEC_PER_SEC;
@@ -1313,8 +1487,8 @@ static void inc_progress_dialog_update_periodic(IncProgressDialog *inc_dialog,
 	msec = tv_result.tv_sec * 1000 + tv_result.tv_usec / 1000;
 	if (msec > PROGRESS_UPDATE_INTERVAL) {
 		inc_progress_dialog_update(inc_dialog, inc_session);
-		inc_dialog->progress_tv.tv_sec = tv_cur.tv_sec;
-		inc_dialog->progress_tv.tv_usec = tv_cur.tv_usec;
+		inc_session->progress_tv.tv_sec = tv_cur.tv_sec;
+		inc_session->progress_tv.tv_usec = tv_cur.tv_usec;
 	}
 }
 
@@ -1327,8 +1501,8 @@ static void inc_update_folderview_periodic(IncProgressDialog *inc_dialog,
 
 	g_get_current_time(&tv_cur);
 
-	tv_result.tv_sec = tv_cur.tv_sec - inc_dialog->folder_tv.tv_sec;
-	tv_result.tv_usec = tv_cur.tv_usec - inc_dialog->folder_tv.tv_usec;
+	tv_result.tv_sec = tv_cur.tv_sec - inc_session->folder_tv.tv_sec;
+	tv_result.tv_usec = tv_cur.tv_usec - inc_session->folder_tv.tv_usec;
 	if (tv_result.tv_usec < 0) {
 		tv_result.tv_sec--;
 		tv_result.tv_usec += G_USEC_PER_SEC;
@@ -1337,8 +1511,8 @@ static void inc_update_folderview_periodic(IncProgressDialog *inc_dialog,
 	msec = tv_result.tv_sec * 1000 + tv_result.tv_usec / 1000;
 	if (msec > FOLDER_UPDATE_INTERVAL) {
 		inc_update_folderview(inc_dialog, inc_session);
-		inc_dialog->folder_tv.tv_sec = tv_cur.tv_sec;
-		inc_dialog->folder_tv.tv_usec = tv_cur.tv_usec;
+		inc_session->folder_tv.tv_sec = tv_cur.tv_sec;
+		inc_session->folder_tv.tv_usec = tv_cur.tv_usec;
 	}
 }
 
@@ -1450,18 +1624,7 @@ static gint inc_recv_message(Session *session, const gchar *msg, gpointer data)
 	return 0;
 }
 
-/**
- * inc_drop_message:
- * @session: Current Pop3Session.
- * @file: Received message file.
- * 
- * Callback function to drop received message into local mailbox.
- *
- * Return value: DROP_OK if succeeded. DROP_ERROR if error occurred.
- *   DROP_DONT_RECEIVE if the message should be skipped.
- *   DROP_DELETE if the message should be deleted.
- **/
-static gint inc_drop_message(Pop3Session *session, const gchar *file)
+static gint inc_drop_message_real(Pop3Session *session, const gchar *file)
 {
 	FolderItem *inbox;
 	GSList *cur;
@@ -1613,6 +1776,105 @@ static gint inc_drop_message(Pop3Session *session, const gchar *file)
 	return val;
 }
 
+/* The filter commands and the error panels of inc_drop_message_real() run
+   nested main loops, in which the other sessions keep receiving. Their
+   messages are dropped after the running drop has finished. */
+typedef struct _IncDeferredDrop
+{
+	Pop3Session *session;
+	gint num;
+	gchar *file;
+} IncDeferredDrop;
+
+static gboolean inc_dropping = FALSE;
+static GSList *inc_deferred_drop_list = NULL;
+
+static gint inc_defer_drop(Pop3Session *session, const gchar *file)
+{
+	IncDeferredDrop *drop;
+	gchar *tmp;
+
+	/* the caller removes file when this returns */
+	tmp = get_tmp_file();
+	if (copy_file(file, tmp, FALSE) < 0) {
+		g_free(tmp);
+		return DROP_ERROR;
+	}
+
+	debug_print("inc_defer_drop: message %d deferred\n", session->cur_msg);
+
+	drop = g_new(IncDeferredDrop, 1);
+	drop->session = session;
+	drop->num = session->cur_msg;
+	drop->file = tmp;
+	inc_deferred_drop_list = g_slist_append(inc_deferred_drop_list, drop);
+
+	/* keep it on the server until the drop has really been done */
+	return DROP_DONT_RECEIVE;
+}
+
+static void inc_drop_deferred(void)
+{
+	IncDeferredDrop *drop;
+	Pop3MsgInfo *msg;
+	gint val;
+
+	while (inc_deferred_drop_list != NULL) {
+		drop = (IncDeferredDrop *)inc_deferred_drop_list->data;
+		inc_deferred_drop_list = g_slist_remove
+			(inc_deferred_drop_list, drop);
+
+		val = inc_drop_message_real(drop->session, drop->file);
+
+		/* replace the verdict given to pop3_retr_recv(); the UIDL
+		   list is written after the session has finished */
+		msg = &drop->session->msg[drop->num];
+		if (val < 0) {
+			IncSession *inc_session =
+				(IncSession *)(SESSION(drop->session)->data);
+			msg->received = FALSE;
+			msg->recv_time = RECV_TIME_NONE;
+			inc_session->inc_state = INC_ERROR;
+		} else
+			msg->recv_time =
+				val == DROP_DONT_RECEIVE ? RECV_TIME_KEEP
+				: val == DROP_DELETE ? RECV_TIME_DELETE
+				: drop->session->current_time;
+
+		g_unlink(drop->file);
+		g_free(drop->file);
+		g_free(drop);
+	}
+}
+
+/**
+ * inc_drop_message:
+ * @session: Current Pop3Session.
+ * @file: Received message file.
+ * 
+ * Callback function to drop received message into local mailbox.
+ * A message received while another one is being dropped is dropped
+ * after it, and is kept on the server in the meantime.
+ *
+ * Return value: DROP_OK if succeeded. DROP_ERROR if error occurred.
+ *   DROP_DONT_RECEIVE if the message should be skipped.
+ *   DROP_DELETE if the message should be deleted.
+ **/
+static gint inc_drop_message(Pop3Session *session, const gchar *file)
+{
+	gint val;
+
+	if (inc_dropping)
+		return inc_defer_drop(session, file);
+
+	inc_dropping = TRUE;
+	val = inc_drop_message_real(session, file);
+	inc_drop_deferred();
+	inc_dropping = FALSE;
+
+	return val;
+}
+
 static void inc_put_error(IncSession *session, IncState istate, const gchar *pop3_msg)
 {
 	gchar *log_msg = NULL;
@@ -1722,12 +1984,13 @@ static void inc_cancel(IncProgressDialog *dialog, gboolean cancel_all)
 		return;
 	}
 
+	/* Cancel stops the running sessions */
 	for (list = dialog->queue_list; list != NULL; list = list->next) {
 		session = list->data;
+		if (!cancel_all && !session->running)
+			continue;
 		session->inc_state = INC_CANCEL;
 		session_disconnect(session->session);
-		if (!cancel_all)
-			break;
 	}
 
 	log_message(_("Incorporation cancelled\n"));
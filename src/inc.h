@@ -60,11 +60,11 @@ struct _IncProgressDialog
 
 	gboolean show_dialog;
 
-	GTimeVal progress_tv;
-	GTimeVal folder_tv;
+	/* messages of the finished sessions, added to the totals */
+	gint done_num;
+	gint64 done_bytes;
 
 	GList *queue_list;	/* list of IncSession */
-	gint cur_row;
 
 	IncResult *result;
 };
@@ -87,11 +87,21 @@ struct _IncSession
 
 	gint retr_count;
 
+	gint row;		/* row in the progress dialog */
+	gboolean running;
+
+	GTimeVal progress_tv;
+	GTimeVal folder_tv;
+
 	gpointer data;
 };
 
 #define TIMEOUT_ITV	200
 
+/* limits of the POP3 sessions running at once */
+#define INC_MAX_SESSIONS		16
+#define INC_MAX_SESSIONS_PER_SERVER	2
+
 void inc_mail			(MainWindow	*mainwin);
 gint inc_account_mail		(MainWindow	*mainwin,
 				 PrefsAccount	*account);
@@ -74,6 +74,7 @@
 #include "compose.h"
 #include "logwindow.h"
 #include "folder.h"
+#include "mh.h"
 #include "setup.h"
 #include "sylmain.h"
 #include "utils.h"
@@ -170,6 +171,8 @@ static void set_log_handlers		(gboolean	 enable);
 static void register_system_events	(void);
 static void plugin_init			(void);
 
+static void mh_watch_updated		(gpointer	 data);
+
 static gchar *get_socket_name		(void);
 static gint prohibit_duplicate_launch	(void);
 static gint lock_socket_remove		(void);
@@ -370,6 +373,9 @@ int main(int argc, char *argv[])
 
 	inc_autocheck_timer_init(mainwin);
 
+	if (prefs_common.watch_local_folders)
+		mh_watch_enable(mh_watch_updated, NULL);
+
 	plugin_init();
 
 	g_signal_emit_by_name(syl_app, "init-done");
@@ -964,6 +970,7 @@ void app_will_exit(gboolean force)
 	g_signal_emit_by_name(syl_app_get(), "app-exit");
 
 	inc_autocheck_timer_remove();
+	mh_watch_disable();
 
 	if (prefs_common.clean_on_exit)
 		main_window_empty_trash(mainwin,
@@ -1323,6 +1330,11 @@ static void register_system_events(void)
 }
 #endif
 
+static void mh_watch_updated(gpointer data)
+{
+	folderview_update_all_updated(FALSE);
+}
+
 #define ADD_SYM(sym)	syl_plugin_add_symbol(#sym, sym)
 
 static void plugin_init(void)
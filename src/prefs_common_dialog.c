@@ -69,6 +69,9 @@ static struct Receive {
 	GtkWidget *checkbtn_chkonstartup;
 	GtkWidget *checkbtn_scan_after_inc;
 
+	GtkWidget *spinbtn_inc_sessions;
+	GtkObject *spinbtn_inc_sessions_adj;
+
 	GtkWidget *checkbtn_newmsg_notify_window;
 	GtkWidget *spinbtn_notifywin;
 	GtkObject *spinbtn_notifywin_adj;
@@ -281,6 +284,13 @@ static struct Advanced {
 
 	GtkWidget *spinbtn_iotimeout;
 	GtkObject *spinbtn_iotimeout_adj;
+
+	GtkWidget *checkbtn_watch_local_folders;
+
+	GtkWidget *spinbtn_news_prefetch;
+	GtkObject *spinbtn_news_prefetch_adj;
+	GtkWidget *spinbtn_news_cache;
+	GtkObject *spinbtn_news_cache_adj;
 } advanced;
 
 static struct MessageColorButtons {
@@ -324,6 +334,8 @@ static PrefsUIData ui_data[] = {
 	 prefs_set_data_from_toggle, prefs_set_toggle},
 	{"scan_all_after_inc", &receive.checkbtn_scan_after_inc,
 	 prefs_set_data_from_toggle, prefs_set_toggle},
+	{"inc_max_sessions", &receive.spinbtn_inc_sessions,
+	 prefs_set_data_from_spinbtn, prefs_set_spinbtn},
 	{"enable_newmsg_notify", &receive.checkbtn_newmsg_notify,
 	 prefs_set_data_from_toggle, prefs_set_toggle},
 	{"newmsg_notify_command", &receive.entry_newmsg_notify,
@@ -657,6 +669,12 @@ static PrefsUIData ui_data[] = {
 	 prefs_set_data_from_toggle, prefs_set_toggle},
 	{"io_timeout_secs", &advanced.spinbtn_iotimeout,
 	 prefs_set_data_from_spinbtn, prefs_set_spinbtn},
+	{"watch_local_folders", &advanced.checkbtn_watch_local_folders,
+	 prefs_set_data_from_toggle, prefs_set_toggle},
+	{"news_prefetch_articles", &advanced.spinbtn_news_prefetch,
+	 prefs_set_data_from_spinbtn, prefs_set_spinbtn},
+	{"news_cache_size", &advanced.spinbtn_news_cache,
+	 prefs_set_data_from_spinbtn, prefs_set_spinbtn},
 
 	{NULL, NULL, NULL, NULL}
 };
@@ -865,6 +883,11 @@ static void prefs_receive_create(void)
 	GtkWidget *checkbtn_chkonstartup;
 	GtkWidget *checkbtn_scan_after_inc;
 
+	GtkWidget *hbox_inc_sessions;
+	GtkWidget *label_inc_sessions;
+	GtkObject *spinbtn_inc_sessions_adj;
+	GtkWidget *spinbtn_inc_sessions;
+
 	GtkWidget *frame_notify;
 	GtkWidget *checkbtn_newmsg_notify_window;
 	GtkWidget *hbox_notifywin;
@@ -933,6 +956,31 @@ static void prefs_receive_create(void)
 	PACK_CHECK_BUTTON (vbox2, checkbtn_scan_after_inc,
 			   _("Update all local folders after incorporation"));
 
+	hbox_inc_sessions = gtk_hbox_new (FALSE, 8);
+	gtk_widget_show (hbox_inc_sessions);
+	gtk_box_pack_start (GTK_BOX (vbox2), hbox_inc_sessions, FALSE, FALSE, 0);
+
+	label_inc_sessions = gtk_label_new
+		(_("Receive from POP3 accounts at once up to"));
+	gtk_widget_show (label_inc_sessions);
+	gtk_box_pack_start (GTK_BOX (hbox_inc_sessions), label_inc_sessions,
+			    FALSE, FALSE, 0);
+
+	spinbtn_inc_sessions_adj = gtk_adjustment_new (4, 1, 16, 1, 4, 0);
+	spinbtn_inc_sessions = gtk_spin_button_new
+		(GTK_ADJUSTMENT (spinbtn_inc_sessions_adj), 1, 0);
+	gtk_widget_show (spinbtn_inc_sessions);
+	gtk_box_pack_start (GTK_BOX (hbox_inc_sessions), spinbtn_inc_sessions,
+			    FALSE, FALSE, 0);
+	gtk_widget_set_size_request (spinbtn_inc_sessions, 64, -1);
+	gtk_spin_button_set_numeric
+		(GTK_SPIN_BUTTON (spinbtn_inc_sessions), TRUE);
+
+	label_inc_sessions = gtk_label_new (_("account(s)"));
+	gtk_widget_show (label_inc_sessions);
+	gtk_box_pack_start (GTK_BOX (hbox_inc_sessions), label_inc_sessions,
+			    FALSE, FALSE, 0);
+
 	/* New message notify */
 	PACK_FRAME(vbox1, frame_notify, _("New message notification"));
 
@@ -1083,6 +1131,9 @@ static void prefs_receive_create(void)
 	receive.checkbtn_chkonstartup   = checkbtn_chkonstartup;
 	receive.checkbtn_scan_after_inc = checkbtn_scan_after_inc;
 
+	receive.spinbtn_inc_sessions     = spinbtn_inc_sessions;
+	receive.spinbtn_inc_sessions_adj = spinbtn_inc_sessions_adj;
+
 	receive.checkbtn_newmsg_notify_window = checkbtn_newmsg_notify_window;
 	receive.spinbtn_notifywin       = spinbtn_notifywin;
 	receive.spinbtn_notifywin_adj   = spinbtn_notifywin_adj;
@@ -3205,6 +3256,14 @@ static GtkWidget *prefs_advanced_create(void)
 	GtkWidget *spinbtn_iotimeout;
 	GtkObject *spinbtn_iotimeout_adj;
 
+	GtkWidget *checkbtn_watch_local_folders;
+
+	GtkWidget *label_news;
+	GtkWidget *spinbtn_news_prefetch;
+	GtkObject *spinbtn_news_prefetch_adj;
+	GtkWidget *spinbtn_news_cache;
+	GtkObject *spinbtn_news_cache_adj;
+
 	vbox1 = gtk_vbox_new (FALSE, VSPACING);
 	gtk_widget_show (vbox1);
 
@@ -3244,11 +3303,69 @@ static GtkWidget *prefs_advanced_create(void)
 	gtk_widget_show (vbox2);
 	gtk_box_pack_start (GTK_BOX (vbox1), vbox2, FALSE, FALSE, 0);
 
+	PACK_CHECK_BUTTON (vbox2, checkbtn_watch_local_folders,
+			   _("Watch local folders for changes by other applications"));
+	PACK_SMALL_LABEL
+		(vbox2, label,
+		 _("The number of messages is updated when other applications deliver mail to the folders.\n"
+		   "This option takes effect after restarting Sylpheed."));
+
+	hbox1 = gtk_hbox_new (FALSE, 8);
+	gtk_widget_show (hbox1);
+	gtk_box_pack_start (GTK_BOX (vbox1), hbox1, FALSE, FALSE, 0);
+
+	label_news = gtk_label_new (_("Prefetch unread news articles:"));
+	gtk_widget_show (label_news);
+	gtk_box_pack_start (GTK_BOX (hbox1), label_news, FALSE, FALSE, 0);
+
+	spinbtn_news_prefetch_adj = gtk_adjustment_new (20, 0, 1000, 1, 10, 0);
+	spinbtn_news_prefetch = gtk_spin_button_new
+		(GTK_ADJUSTMENT (spinbtn_news_prefetch_adj), 1, 0);
+	gtk_widget_show (spinbtn_news_prefetch);
+	gtk_box_pack_start (GTK_BOX (hbox1), spinbtn_news_prefetch,
+			    FALSE, FALSE, 0);
+	gtk_widget_set_size_request (spinbtn_news_prefetch, 64, -1);
+	gtk_spin_button_set_numeric
+		(GTK_SPIN_BUTTON (spinbtn_news_prefetch), TRUE);
+
+	label_news = gtk_label_new (_("article(s) (0: disable)"));
+	gtk_widget_show (label_news);
+	gtk_box_pack_start (GTK_BOX (hbox1), label_news, FALSE, FALSE, 0);
+
+	hbox1 = gtk_hbox_new (FALSE, 8);
+	gtk_widget_show (hbox1);
+	gtk_box_pack_start (GTK_BOX (vbox1), hbox1, FALSE, FALSE, 0);
+
+	label_news = gtk_label_new (_("Limit the news cache of each server to"));
+	gtk_widget_show (label_news);
+	gtk_box_pack_start (GTK_BOX (hbox1), label_news, FALSE, FALSE, 0);
+
+	spinbtn_news_cache_adj = gtk_adjustment_new (100, 0, 100000, 1, 10, 0);
+	spinbtn_news_cache = gtk_spin_button_new
+		(GTK_ADJUSTMENT (spinbtn_news_cache_adj), 1, 0);
+	gtk_widget_show (spinbtn_news_cache);
+	gtk_box_pack_start (GTK_BOX (hbox1), spinbtn_news_cache,
+			    FALSE, FALSE, 0);
+	gtk_widget_set_size_request (spinbtn_news_cache, 64, -1);
+	gtk_spin_button_set_numeric
+		(GTK_SPIN_BUTTON (spinbtn_news_cache), TRUE);
+
+	label_news = gtk_label_new (_("MB (0: unlimited)"));
+	gtk_widget_show (label_news);
+	gtk_box_pack_start (GTK_BOX (hbox1), label_news, FALSE, FALSE, 0);
+
 	advanced.checkbtn_strict_cache_check = checkbtn_strict_cache_check;
 
 	advanced.spinbtn_iotimeout     = spinbtn_iotimeout;
 	advanced.spinbtn_iotimeout_adj = spinbtn_iotimeout_adj;
 
+	advanced.checkbtn_watch_local_folders = checkbtn_watch_local_folders;
+
+	advanced.spinbtn_news_prefetch     = spinbtn_news_prefetch;
+	advanced.spinbtn_news_prefetch_adj = spinbtn_news_prefetch_adj;
+	advanced.spinbtn_news_cache        = spinbtn_news_cache;
+	advanced.spinbtn_news_cache_adj    = spinbtn_news_cache_adj;
+
 	return vbox1;
 }
 
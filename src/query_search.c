@@ -65,6 +65,7 @@
 #include "procheader.h"
 #include "folder.h"
 #include "filter.h"
+#include "searchindex.h"
 #include "prefs_common.h"
 #include "prefs_filter.h"
 #include "prefs_filter_edit.h"
@@ -729,6 +730,7 @@ static gpointer query_search_folder_func(gpointer data)
 	QueryData *qdata = (QueryData *)data;
 	GSList *mlist, *cur;
 	FilterInfo fltinfo;
+	GHashTable *candidates;
 	GTimeVal tv_cur;
 
 	debug_print("query_search_folder_func start\n");
@@ -746,6 +748,9 @@ static gpointer query_search_folder_func(gpointer data)
 	debug_print("start query search: %s\n",
 		    qdata->item->path ? qdata->item->path : "");
 
+	candidates = search_index_get_candidates(qdata->item, mlist,
+						 search_window.rule);
+
 	for (cur = mlist; cur != NULL; cur = cur->next) {
 		MsgInfo *msginfo = (MsgInfo *)cur->data;
 		GSList *hlist;
@@ -767,6 +772,11 @@ static gpointer query_search_folder_func(gpointer data)
 		if (search_window.cancelled)
 			break;
 
+		if (candidates &&
+		    !g_hash_table_lookup(candidates,
+					 GUINT_TO_POINTER(msginfo->msgnum)))
+			continue;
+
 		fltinfo.flags = msginfo->flags;
 		if (search_window.requires_full_headers) {
 			gchar *file;
@@ -794,6 +804,9 @@ static gpointer query_search_folder_func(gpointer data)
 		procheader_header_list_destroy(hlist);
 	}
 
+	if (candidates)
+		g_hash_table_destroy(candidates);
+
 #if USE_THREADS
 	g_async_queue_unref(qdata->queue);
 #endif
@@ -65,6 +65,7 @@
 #endif
 
 typedef struct _SendProgressDialog	SendProgressDialog;
+typedef struct _SendSession		SendSession;
 
 struct _SendProgressDialog
 {
@@ -74,11 +75,32 @@ struct _SendProgressDialog
 	gboolean cancelled;
 };
 
+struct _SendSession
+{
+	PrefsAccount *account;
+	Session *session;
+};
+
+/* SMTP sessions kept open while flushing the queue */
+static GSList *send_session_list = NULL;
+static gboolean send_keep_sessions = FALSE;
+
 static gint send_message_local		(const gchar		*command,
 					 FILE			*fp);
 static gint send_message_smtp		(PrefsAccount		*ac_prefs,
 					 GSList			*to_list,
 					 FILE			*fp);
+static gint send_message_smtp_full	(PrefsAccount		*ac_prefs,
+					 GSList			*to_list,
+					 FILE			*fp,
+					 gboolean		 keep_alive);
+
+static Session *send_smtp_session_new	(PrefsAccount		*ac_prefs);
+static Session *send_session_take	(PrefsAccount		*ac_prefs);
+static void send_session_keep		(PrefsAccount		*ac_prefs,
+					 Session		*session);
+static void send_session_close_all	(void);
+static gboolean send_is_transient_error	(Session		*session);
 
 static gint send_recv_message		(Session		*session,
 					 const gchar		*msg,
@@ -329,8 +351,9 @@ gint send_message_queue(QueueInfo *qinfo)
 
 		if (qinfo->to_list) {
 			if (mailac)
-				val = send_message_smtp(mailac, qinfo->to_list,
-							qinfo->fp);
+				val = send_message_smtp_full
+					(mailac, qinfo->to_list, qinfo->fp,
+					 send_keep_sessions);
 			else {
 				PrefsAccount tmp_ac;
 
@@ -374,6 +397,9 @@ gint send_message_queue_all(FolderItem *queue, gboolean save_msgs,
 	mlist = folder_item_get_msg_list(queue, FALSE);
 	mlist = procmsg_sort_msg_list(mlist, SORT_BY_NUMBER, SORT_ASCENDING);
 
+	/* reuse one SMTP connection per account for the whole queue */
+	send_keep_sessions = TRUE;
+
 	for (cur = mlist; cur != NULL; cur = cur->next) {
 		gchar *file;
 		MsgInfo *msginfo = (MsgInfo *)cur->data;
@@ -385,8 +411,8 @@ gint send_message_queue_all(FolderItem *queue, gboolean save_msgs,
 
 		qinfo = send_get_queue_info(file);
 		if (!qinfo || send_message_queue(qinfo) < 0) {
-			g_warning("Sending queued message %d failed.\n",
-				  msginfo->msgnum);
+			log_warning(_("Sending queued message %d failed.\n"),
+				    msginfo->msgnum);
 			send_queue_info_free(qinfo);
 			g_free(file);
 			continue;
@@ -404,10 +430,16 @@ gint send_message_queue_all(FolderItem *queue, gboolean save_msgs,
 		send_queue_info_free(qinfo);
 		g_free(file);
 
+		log_message(_("Queued message %d has been sent.\n"),
+			    msginfo->msgnum);
+
 		folder_item_remove_msg(queue, msginfo);
 		ret++;
 	}
 
+	send_session_close_all();
+	send_keep_sessions = FALSE;
+
 	procmsg_msg_list_free(mlist);
 
 	procmsg_clear_cache(queue);
@@ -618,22 +650,93 @@ static gint send_message_local(const gchar *command, FILE *fp)
 	return 0;
 }
 
-static gint send_message_smtp(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp)
+static Session *send_session_take(PrefsAccount *ac_prefs)
+{
+	GSList *cur;
+
+	for (cur = send_session_list; cur != NULL; cur = cur->next) {
+		SendSession *ss = (SendSession *)cur->data;
+		Session *session = ss->session;
+
+		if (ss->account != ac_prefs)
+			continue;
+
+		send_session_list = g_slist_remove(send_session_list, ss);
+		g_free(ss);
+
+		if (!session_is_connected(session) ||
+		    SMTP_SESSION(session)->state != SMTP_IDLE) {
+			session_destroy(session);
+			return NULL;
+		}
+
+		return session;
+	}
+
+	return NULL;
+}
+
+static void send_session_keep(PrefsAccount *ac_prefs, Session *session)
+{
+	SendSession *ss;
+
+	session_set_recv_message_notify(session, NULL, NULL);
+	session_set_send_data_progressive_notify(session, NULL, NULL);
+	session_set_send_data_notify(session, NULL, NULL);
+	session_set_timeout(session, 0);
+
+	ss = g_new(SendSession, 1);
+	ss->account = ac_prefs;
+	ss->session = session;
+	send_session_list = g_slist_prepend(send_session_list, ss);
+}
+
+static void send_session_close_all(void)
+{
+	GSList *cur;
+
+	for (cur = send_session_list; cur != NULL; cur = cur->next) {
+		SendSession *ss = (SendSession *)cur->data;
+		Session *session = ss->session;
+
+		if (session_is_connected(session) &&
+		    SMTP_SESSION(session)->state == SMTP_IDLE) {
+			session_set_timeout(session,
+					    prefs_common.io_timeout_secs * 1000);
+			if (smtp_session_quit(session) == 0) {
+				while (session_is_connected(session))
+					gtk_main_iteration();
+			}
+		}
+		session_destroy(session);
+		g_free(ss);
+	}
+
+	g_slist_free(send_session_list);
+	send_session_list = NULL;
+	log_window_flush();
+}
+
+/* 4xx responses and lost connections may be caused by the server
+   dropping a connection which was kept idle too long */
+static gboolean send_is_transient_error(Session *session)
+{
+	SMTPSession *smtp_session = SMTP_SESSION(session);
+
+	if (smtp_session->error_val == SM_AUTHFAIL)
+		return FALSE;
+	if (smtp_session->error_msg)
+		return smtp_session->error_msg[0] == '4';
+
+	return (session->state == SESSION_EOF ||
+		session->state == SESSION_ERROR ||
+		session->state == SESSION_TIMEOUT);
+}
+
+static Session *send_smtp_session_new(PrefsAccount *ac_prefs)
 {
 	Session *session;
 	SMTPSession *smtp_session;
-	SocksInfo *socks_info = NULL;
-	FILE *out_fp;
-	gushort port;
-	SendProgressDialog *dialog;
-	gchar buf[BUFFSIZE];
-	gint ret = 0;
-
-	g_return_val_if_fail(ac_prefs != NULL, -1);
-	g_return_val_if_fail(ac_prefs->address != NULL, -1);
-	g_return_val_if_fail(ac_prefs->smtp_server != NULL, -1);
-	g_return_val_if_fail(to_list != NULL, -1);
-	g_return_val_if_fail(fp != NULL, -1);
 
 	session = smtp_session_new();
 	smtp_session = SMTP_SESSION(session);
@@ -689,15 +792,58 @@ static gint send_message_smtp(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp)
 		smtp_session->pass = NULL;
 	}
 
+	return session;
+}
+
+static gint send_message_smtp(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp)
+{
+	return send_message_smtp_full(ac_prefs, to_list, fp, FALSE);
+}
+
+static gint send_message_smtp_full(PrefsAccount *ac_prefs, GSList *to_list,
+				   FILE *fp, gboolean keep_alive)
+{
+	Session *session = NULL;
+	SMTPSession *smtp_session;
+	SocksInfo *socks_info = NULL;
+	FILE *out_fp;
+	gushort port;
+	SendProgressDialog *dialog;
+	gchar buf[BUFFSIZE];
+	gboolean reused;
+	glong fpos;
+	gint ret = 0;
+
+	g_return_val_if_fail(ac_prefs != NULL, -1);
+	g_return_val_if_fail(ac_prefs->address != NULL, -1);
+	g_return_val_if_fail(ac_prefs->smtp_server != NULL, -1);
+	g_return_val_if_fail(to_list != NULL, -1);
+	g_return_val_if_fail(fp != NULL, -1);
+
+	fpos = ftell(fp);
+
+	if (keep_alive)
+		session = send_session_take(ac_prefs);
+	reused = (session != NULL);
+
+	if (!session)
+		session = send_smtp_session_new(ac_prefs);
+	smtp_session = SMTP_SESSION(session);
+
+	smtp_session->keep_alive = keep_alive;
+
+	g_free(smtp_session->from);
 	smtp_session->from = g_strdup(ac_prefs->address);
 	smtp_session->to_list = to_list;
 	smtp_session->cur_to = to_list;
 
-	out_fp = get_outgoing_rfc2822_file(fp);
+	out_fp = get_outgoing_rfc2822_file_full(fp, FALSE);
 	if (!out_fp) {
 		session_destroy(session);
 		return -1;
 	}
+	if (smtp_session->send_data_fp)
+		fclose(smtp_session->send_data_fp);
 	smtp_session->send_data_fp = out_fp;
 	smtp_session->send_data_len = get_left_file_size(out_fp);
 	if (smtp_session->send_data_len < 0) {
@@ -715,7 +861,8 @@ static gint send_message_smtp(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp)
 	port = ac_prefs->set_smtpport ? ac_prefs->smtpport : SMTP_PORT;
 #endif
 
-	if (ac_prefs->pop_before_smtp && ac_prefs->protocol == A_POP3) {
+	if (!reused && ac_prefs->pop_before_smtp &&
+	    ac_prefs->protocol == A_POP3) {
 		if (inc_pop_before_smtp(ac_prefs) < 0) {
 			session_destroy(session);
 			return -1;
@@ -726,10 +873,17 @@ static gint send_message_smtp(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp)
 	dialog->session = session;
 
 	progress_dialog_append(dialog->dialog, NULL, ac_prefs->smtp_server,
-			       _("Connecting"), "", NULL);
+			       reused ? _("Sending") : _("Connecting"), "",
+			       NULL);
 
-	g_snprintf(buf, sizeof(buf), _("Connecting to SMTP server: %s ..."),
-		   ac_prefs->smtp_server);
+	if (reused)
+		g_snprintf(buf, sizeof(buf),
+			   _("Sending message via %s:%d..."),
+			   session->server, session->port);
+	else
+		g_snprintf(buf, sizeof(buf),
+			   _("Connecting to SMTP server: %s ..."),
+			   ac_prefs->smtp_server);
 	progress_dialog_set_label(dialog->dialog, buf);
 	log_message("%s\n", buf);
 
@@ -740,7 +894,7 @@ static gint send_message_smtp(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp)
 
 	session_set_timeout(session, prefs_common.io_timeout_secs * 1000);
 
-	if (ac_prefs->use_socks && ac_prefs->use_socks_for_send) {
+	if (!reused && ac_prefs->use_socks && ac_prefs->use_socks_for_send) {
 		socks_info = socks_info_new(ac_prefs->socks_type,
 					    ac_prefs->proxy_host,
 					    ac_prefs->proxy_port,
@@ -752,8 +906,10 @@ static gint send_message_smtp(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp)
 
 	inc_lock();
 
-	if (session_connect_full(session, ac_prefs->smtp_server, port,
-				 socks_info) < 0) {
+	if (reused)
+		smtp_session_send_next(session);
+	else if (session_connect_full(session, ac_prefs->smtp_server, port,
+				      socks_info) < 0) {
 		if (dialog->show_dialog)
 			manage_window_focus_in(dialog->dialog->window, NULL, NULL);
 		send_put_error(session);
@@ -767,11 +923,14 @@ static gint send_message_smtp(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp)
 
 	debug_print("send_message_smtp(): begin event loop\n");
 
-	while (session_is_connected(session) && dialog->cancelled == FALSE)
+	while (session_is_connected(session) &&
+	       smtp_session->state != SMTP_IDLE && dialog->cancelled == FALSE)
 		gtk_main_iteration();
 	log_window_flush();
 
-	if (SMTP_SESSION(session)->error_val == SM_AUTHFAIL) {
+	if (smtp_session->state == SMTP_IDLE && dialog->cancelled == FALSE)
+		ret = 0;
+	else if (SMTP_SESSION(session)->error_val == SM_AUTHFAIL) {
 		if (ac_prefs->smtp_userid && ac_prefs->tmp_smtp_pass) {
 			g_free(ac_prefs->tmp_smtp_pass);
 			ac_prefs->tmp_smtp_pass = NULL;
@@ -799,6 +958,22 @@ static gint send_message_smtp(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp)
 	else if (dialog->cancelled == TRUE)
 		ret = -1;
 
+	if (ret == -1 && reused && dialog->cancelled == FALSE &&
+	    send_is_transient_error(session)) {
+		/* retry once with a new connection */
+		log_message(_("Reconnecting to SMTP server: %s ...\n"),
+			    ac_prefs->smtp_server);
+		session_destroy(session);
+		send_progress_dialog_destroy(dialog);
+		inc_unlock();
+		if (fseek(fp, fpos, SEEK_SET) < 0) {
+			FILE_OP_ERROR("send_message_smtp", "fseek");
+			return -1;
+		}
+		return send_message_smtp_full(ac_prefs, to_list, fp,
+					      keep_alive);
+	}
+
 	if (ret == -1) {
 		if (dialog->show_dialog)
 			manage_window_focus_in(dialog->dialog->window, NULL, NULL);
@@ -807,7 +982,10 @@ static gint send_message_smtp(PrefsAccount *ac_prefs, GSList *to_list, FILE *fp)
 			manage_window_focus_out(dialog->dialog->window, NULL, NULL);
 	}
 
-	session_destroy(session);
+	if (ret == 0 && smtp_session->state == SMTP_IDLE)
+		send_session_keep(ac_prefs, session);
+	else
+		session_destroy(session);
 	send_progress_dialog_destroy(dialog);
 	inc_unlock();
 
@@ -856,6 +1034,7 @@ static gint send_recv_message(Session *session, const gchar *msg, gpointer data)
 		break;
 	case SMTP_DATA:
 	case SMTP_EOM:
+	case SMTP_BDAT:
 		g_snprintf(buf, sizeof(buf), _("Sending DATA..."));
 		state_str = _("Sending");
 		break;
@@ -889,7 +1068,8 @@ static gint send_send_data_progressive(Session *session, guint cur_len,
 	g_return_val_if_fail(dialog != NULL, -1);
 
 	if (SMTP_SESSION(session)->state != SMTP_SEND_DATA &&
-	    SMTP_SESSION(session)->state != SMTP_EOM)
+	    SMTP_SESSION(session)->state != SMTP_EOM &&
+	    SMTP_SESSION(session)->state != SMTP_BDAT)
 		return 0;
 
 	gdk_threads_enter();
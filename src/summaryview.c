@@ -819,6 +819,9 @@ gboolean summary_show(SummaryView *summaryview, FolderItem *item,
 	STATUSBAR_POP(summaryview->mainwin);
 
 	summaryview->all_mlist = mlist;
+	/* flags changed while scanning the folder are not tracked by
+	   MSG_FLAG_CHANGED */
+	summaryview->write_all_flags = item->mark_dirty;
 
 	/* restore temporary move/copy marks */
 	if (save_mark_mlist) {
@@ -1133,7 +1136,10 @@ void summary_show_queued_msgs(SummaryView *summaryview)
 
 	summaryview->all_mlist = g_slist_concat(summaryview->all_mlist, qlist);
 
-	item->cache_dirty = TRUE;
+	if (item->stype != F_VIRTUAL)
+		procmsg_write_journal_add_list(item, qlist);
+	else
+		item->cache_dirty = TRUE;
 	summary_selection_list_free(summaryview);
 
 	summary_status_show(summaryview);
@@ -2626,7 +2632,11 @@ static void summary_set_tree_model_from_list(SummaryView *summaryview,
 	if (summaryview->folder_item->threaded) {
 		GNode *root, *gnode;
 
-		root = procmsg_get_thread_tree(mlist);
+		if (mlist == summaryview->all_mlist)
+			root = procmsg_get_thread_tree_for_item
+				(summaryview->folder_item, mlist);
+		else
+			root = procmsg_get_thread_tree(mlist);
 
 		for (gnode = root->children; gnode != NULL;
 		     gnode = gnode->next) {
@@ -2692,18 +2702,12 @@ static void summary_set_tree_model_from_list(SummaryView *summaryview,
 	STATUSBAR_POP(summaryview->mainwin);
 }
 
-struct wcachefp
-{
-	FILE *cache_fp;
-	FILE *mark_fp;
-};
-
 gint summary_write_cache(SummaryView *summaryview)
 {
-	struct wcachefp fps;
 	FolderItem *item;
 	gchar *buf;
-	GSList *cur;
+	GSList *mlist, *cur;
+	gboolean cache_dirty;
 
 	item = summaryview->folder_item;
 	if (!item || !item->path)
@@ -2713,31 +2717,19 @@ gint summary_write_cache(SummaryView *summaryview)
 	if (!item->cache_dirty && !item->mark_dirty)
 		return 0;
 
-	if (item->cache_dirty) {
-		fps.cache_fp = procmsg_open_cache_file(item, DATA_WRITE);
-		if (fps.cache_fp == NULL)
-			return -1;
+	cache_dirty = item->cache_dirty;
+	if (cache_dirty)
 		item->mark_dirty = TRUE;
-	} else
-		fps.cache_fp = NULL;
-
-	if (item->mark_dirty && item->stype != F_VIRTUAL) {
-		fps.mark_fp = procmsg_open_mark_file(item, DATA_WRITE);
-		if (fps.mark_fp == NULL) {
-			if (fps.cache_fp)
-				fclose(fps.cache_fp);
-			return -1;
-		}
-	} else
-		fps.mark_fp = NULL;
 
-	if (item->cache_dirty) {
+	if (cache_dirty) {
 		buf = g_strdup_printf(_("Writing summary cache (%s)..."),
 				      item->path);
 		debug_print("%s", buf);
 		STATUSBAR_PUSH(summaryview->mainwin, buf);
 		gdk_flush();
 		g_free(buf);
+
+		procmsg_write_cache_list(item, summaryview->all_mlist);
 	}
 
 	for (cur = summaryview->all_mlist; cur != NULL; cur = cur->next) {
@@ -2746,38 +2738,37 @@ gint summary_write_cache(SummaryView *summaryview)
 		if (msginfo->folder && msginfo->folder->mark_queue != NULL) {
 			MSG_UNSET_PERM_FLAGS(msginfo->flags, MSG_NEW);
 		}
-		if (fps.cache_fp)
-			procmsg_write_cache(msginfo, fps.cache_fp);
-		if (fps.mark_fp)
-			procmsg_write_flags(msginfo, fps.mark_fp);
 	}
 
-	if (item->cache_queue)
-		procmsg_flush_cache_queue(item, fps.cache_fp);
-	if (item->mark_queue)
-		procmsg_flush_mark_queue(item, fps.mark_fp);
-
-	item->unmarked_num = 0;
-
-	if (fps.cache_fp)
-		fclose(fps.cache_fp);
-	if (fps.mark_fp)
-		fclose(fps.mark_fp);
+	mlist = summary_get_changed_msg_list(summaryview);
 
 	if (item->stype == F_VIRTUAL) {
-		GSList *mlist;
-
-		mlist = summary_get_changed_msg_list(summaryview);
+		if (item->mark_queue)
+			procmsg_flush_mark_queue(item, NULL);
 		if (mlist) {
 			procmsg_write_flags_for_multiple_folders(mlist);
-			g_slist_free(mlist);
 			folderview_update_all_updated(FALSE);
 		}
+	} else if (cache_dirty || item->mark_queue ||
+		   summaryview->write_all_flags) {
+		procmsg_write_flags_list(item, summaryview->all_mlist);
+	} else {
+		/* only append the changed flags to the journal */
+		procmsg_write_journal_flags_list(item, mlist);
 	}
 
+	for (cur = mlist; cur != NULL; cur = cur->next) {
+		MsgInfo *msginfo = (MsgInfo *)cur->data;
+		MSG_UNSET_TMP_FLAGS(msginfo->flags, MSG_FLAG_CHANGED);
+	}
+	g_slist_free(mlist);
+
+	item->unmarked_num = 0;
+	summaryview->write_all_flags = FALSE;
+
 	debug_print(_("done.\n"));
 
-	if (item->cache_dirty) {
+	if (cache_dirty) {
 		STATUSBAR_POP(summaryview->mainwin);
 	}
 
@@ -4024,6 +4015,17 @@ static void summary_remove_invalid_messages(SummaryView *summaryview)
 	GtkTreeIter iter, next;
 	GtkTreePath *path;
 	gboolean valid;
+	gboolean cache_dirty = item->cache_dirty;
+	GSList *removed = NULL;
+	GSList *cur;
+
+	/* the removed messages are recorded in the summary journal */
+	for (cur = summaryview->all_mlist; cur != NULL; cur = cur->next) {
+		msginfo = (MsgInfo *)cur->data;
+		if (MSG_IS_INVALID(msginfo->flags))
+			removed = g_slist_prepend
+				(removed, GUINT_TO_POINTER(msginfo->msgnum));
+	}
 
 	/* get currently displayed message */
 	if (summaryview->displayed) {
@@ -4111,6 +4113,22 @@ static void summary_remove_invalid_messages(SummaryView *summaryview)
 	if (item->cache_dirty)
 		summary_selection_list_free(summaryview);
 
+	if (removed && !cache_dirty && item->stype != F_VIRTUAL) {
+		for (cur = summaryview->all_mlist; cur != NULL;
+		     cur = cur->next) {
+			msginfo = (MsgInfo *)cur->data;
+			if (MSG_IS_INVALID(msginfo->flags))
+				break;
+		}
+		/* rewrite the whole cache if some could not be removed */
+		if (!cur) {
+			removed = g_slist_reverse(removed);
+			procmsg_write_journal_remove_list(item, removed);
+			item->cache_dirty = FALSE;
+		}
+	}
+	g_slist_free(removed);
+
 	if (summaryview->displayed &&
 	    !gtk_tree_row_reference_valid(summaryview->displayed)) {
 		/* g_print("displayed became invalid after removing. searching disp_msginfo...\n"); */
@@ -4342,7 +4360,11 @@ void summary_thread_build(SummaryView *summaryview)
 	summaryview->folder_item->threaded = TRUE;
 
 	mlist = summary_get_msg_list(summaryview);
-	root = procmsg_get_thread_tree(mlist);
+	if (summaryview->on_filter)
+		root = procmsg_get_thread_tree(mlist);
+	else
+		root = procmsg_get_thread_tree_for_item
+			(summaryview->folder_item, mlist);
 	node_table = g_hash_table_new(NULL, NULL);
 	for (node = root->children; node != NULL; node = node->next) {
 		g_hash_table_insert(node_table, node->data, node);
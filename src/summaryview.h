@@ -124,6 +124,8 @@ private:
 
 	/* all message list */
 	GSList *all_mlist;
+	/* write the flags of all messages instead of the changed ones */
+	gboolean write_all_flags;
 	/* filtered message list */
 	GSList *flt_mlist;
 
@@ -163,6 +163,8 @@ static void textview_write_body		(TextView	*textview,
 static void textview_show_html		(TextView	*textview,
 					 FILE		*fp,
 					 CodeConverter	*conv);
+static void textview_show_html_parser	(TextView	*textview,
+					 HTMLParser	*parser);
 
 static void textview_write_line		(TextView	*textview,
 					 const gchar	*str,
@@ -1210,20 +1212,52 @@ static void textview_write_body(TextView *textview, MimeInfo *mimeinfo,
 
 	conv = conv_code_converter_new(charset, NULL);
 
-	tmpfp = procmime_decode_content(NULL, fp, mimeinfo);
-	if (tmpfp) {
-		if (mimeinfo->mime_type == MIME_TEXT_HTML &&
-		    prefs_common.render_html)
-			textview_show_html(textview, tmpfp, conv);
-		else
-			while (fgets(buf, sizeof(buf), tmpfp) != NULL)
-				textview_write_line(textview, buf, conv);
-		fclose(tmpfp);
+	/* decode small parts in memory */
+	if (PROCMIME_USE_MEM_DECODE(mimeinfo)) {
+		gchar *text, *p, *next, *end;
+		gint len;
+		gchar c;
+
+		text = procmime_decode_content_str(fp, mimeinfo, &len);
+		if (text && mimeinfo->mime_type == MIME_TEXT_HTML &&
+		    prefs_common.render_html) {
+			HTMLParser *parser;
+
+			parser = html_parser_new_str(text, conv);
+			textview_show_html_parser(textview, parser);
+			html_parser_destroy(parser);
+		} else if (text) {
+			/* do not stop at NUL bytes in the body */
+			end = text + len;
+			for (p = text; p < end; p = next) {
+				if ((next = memchr(p, '\n', end - p)) != NULL)
+					next++;
+				else
+					next = end;
+				c = *next;
+				*next = '\0';
+				textview_write_line(textview, p, conv);
+				*next = c;
+			}
+		}
+		g_free(text);
 	} else {
-		textview_write_error
-			(textview,
-			 _("The body text couldn't be displayed because "
-			   "writing to temporary file failed.\n"));
+		tmpfp = procmime_decode_content(NULL, fp, mimeinfo);
+		if (tmpfp) {
+			if (mimeinfo->mime_type == MIME_TEXT_HTML &&
+			    prefs_common.render_html)
+				textview_show_html(textview, tmpfp, conv);
+			else
+				while (fgets(buf, sizeof(buf), tmpfp) != NULL)
+					textview_write_line(textview, buf,
+							    conv);
+			fclose(tmpfp);
+		} else {
+			textview_write_error
+				(textview,
+				 _("The body text couldn't be displayed because "
+				   "writing to temporary file failed.\n"));
+		}
 	}
 
 	conv_code_converter_destroy(conv);
@@ -1233,11 +1267,19 @@ static void textview_show_html(TextView *textview, FILE *fp,
 			       CodeConverter *conv)
 {
 	HTMLParser *parser;
-	const gchar *str;
 
 	parser = html_parser_new(fp, conv);
 	g_return_if_fail(parser != NULL);
 
+	textview_show_html_parser(textview, parser);
+
+	html_parser_destroy(parser);
+}
+
+static void textview_show_html_parser(TextView *textview, HTMLParser *parser)
+{
+	const gchar *str;
+
 	while ((str = html_parse(parser)) != NULL) {
 		if (parser->href != NULL)
 			textview_write_link(textview, str, parser->href, NULL);
@@ -1245,8 +1287,6 @@ static void textview_show_html(TextView *textview, FILE *fp,
 			textview_write_line(textview, str, NULL);
 	}
 	textview_write_line(textview, "\n", NULL);
-
-	html_parser_destroy(parser);
 }
 
 /* get_uri_part() - retrieves a URI starting from scanpos.